@@ -108,6 +108,23 @@ typedef struct bitmatrix {
 	int ncol;
 } BitMatrix;
 
+/*
+ * The MyersNedit struct is used by the bit-parallel edit distance engine
+ * (block-based version of Myers' algorithm) to keep track of the edit
+ * distance between a pattern (or one of its suffixes) and the substrings
+ * of the subject that end at the current position.
+ */
+typedef struct myers_nedit {
+	const BitWord *Peq;  /* 256 x Peq_nword, can be shared */
+	int Peq_nword;
+	int Poffset;  /* offset of the 1st letter used by the engine */
+	int Plength;  /* nb of letters used by the engine */
+	int nword;
+	int anchored;
+	BitWord *Pv, *Mv;  /* nword words each */
+	int score;
+} MyersNedit;
+
 typedef struct ppheadtail {
 	int is_init;
 	ByteTrTable byte2offset;
@@ -125,6 +142,28 @@ typedef struct headtail {
 } HeadTail;
 
 
+/*
+ * A PreprocessedPattern object holds a pattern plus the tables used by the
+ * "boyer-moore", "shift-or", "bndm" and "bom" algos to match it. The
+ * tables are computed
+ * once (when the object is created) and never modified after that so the
+ * same PreprocessedPattern_holder can be used by several threads. The
+ * holder of a plain XString object has no tables (i.e. NULL pointers).
+ */
+typedef struct preprocessed_pattern_holder {
+	Chars_holder P;
+	const int *VSGSshift_table;  /* 256 x P.length ("boyer-moore") */
+	int shift0;                  /* "boyer-moore" */
+	const unsigned long *pmaskmap;  /* 2 x 256 x nword ("shift-or"), the
+					   map for fixed=FALSE follows the
+					   map for fixed=TRUE */
+	const BitWord *bndm_masks;   /* 256 ("bndm") */
+	const int *bom_byte2code;    /* 256 ("bom") */
+	int bom_nletters;            /* "bom" */
+	const int *bom_trans;        /* (P.length + 1) x bom_nletters ("bom") */
+} PreprocessedPattern_holder;
+
+
 /*
  * Match storing modes.
  * np = nb of pattern sequences. ns = nb of subject sequences.
@@ -155,6 +194,11 @@ typedef struct headtail {
  *  MATCHES_AS_RANGES | The starts and ends of the matches are stored.        |
  *                    | An IntegerRanges object   | An MIndex object is       |
  *                    | is returned.              | returned.                 |
+ * -------------------|-------------------------------------------------------|
+ * MATCHES_AS_COVERAGE| Only the coverage of the subject by the matches is    |
+ *                    | stored (the matches of all the pattern/subject pairs  |
+ *                    | are added up). The runs of the coverage are returned  |
+ *                    | as a list of 2 integer vectors (values and lengths).  |
  */
 #define MATCHES_AS_NULL		0
 #define MATCHES_AS_WHICH	1
@@ -163,18 +207,78 @@ typedef struct headtail {
 #define MATCHES_AS_ENDS		4
 #define MATCHES_AS_RANGES	5
 #define MATCHES_AS_NORMALRANGES	6  // not supported yet
-#define MATCHES_AS_COVERAGE	7  // supported yet
+#define MATCHES_AS_COVERAGE	7
+
+/* A MatchSink delivers the matches to a consumer in batches of at most
+   'batch_size' matches: 'FUN' is called on each batch (the PSpair ids are
+   0-based) and the batch buffers are reused after that. So the memory used
+   to store the matches doesn't depend on the number of matches.
+   'match_shift' is added to the starts of the matches before they are put
+   in the batch. */
+typedef void (*MatchSinkFUN)(void *sink_data, const int *PSpair_ids,
+			     const int *starts, const int *widths, int nmatch);
+
+typedef struct match_sink {
+	MatchSinkFUN FUN;
+	void *sink_data;
+	int batch_size;
+	int *PSpair_ids, *starts, *widths;  /* 'batch_size' elts each */
+	int nmatch;  /* nb of matches in the current batch */
+	int match_shift;
+} MatchSink;
 
 /* The 'PSlink_ids' field contains the ids of the pattern/subject pairs that
-   are linked by at least 1 match. */
+   are linked by at least 1 match. The 'coverage' field is only used in
+   MATCHES_AS_COVERAGE mode: it's a difference array i.e. 'coverage->elts[i]'
+   is the coverage at position 'coverage_first' + i minus the coverage at
+   the previous position. It's grown on demand (in both directions) so it
+   only spans the positions from the smallest match start to the greatest
+   match end plus 1. 'coverage_shift' is the offset of the view where the
+   matches are found: the parts of the matches that are before the 1st
+   position of the subject (i.e. before position 1 - 'coverage_shift') are
+   dropped. */
 typedef struct match_buf {
 	int ms_code;
 	IntAE *PSlink_ids;
 	IntAE *match_counts;
 	IntAEAE *match_starts;  /* can be missing! (i.e. set to NULL) */
 	IntAEAE *match_widths;  /* can be missing! (i.e. set to NULL) */
+	IntAE *coverage;  /* can be missing! (i.e. set to NULL) */
+	int coverage_first;
+	int coverage_shift;
+	const int *coverage_weights;  /* 1 per PSpair, NULL means all 1 */
+	MatchSink *sink;  /* if not NULL, the matches are only counted and
+			     sent to the sink */
 } MatchBuf;
 
+/* Malloc-based buffer used by a "deferring" MatchReporter (see below) to
+   store the matches. 'PSpair_ids' has 1 elt per match. 'starts' and
+   'widths' are NULL if only the match counts are needed. */
+typedef struct deferred_matches {
+	int ms_code;
+	int *PSpair_ids;
+	int *starts;
+	int *widths;
+	size_t nelt;
+	size_t buflength;
+	int malloc_failed;
+} DeferredMatches;
+
+/* A match reporting context: the MatchBuf where the matches are stored,
+   plus the id of the pattern/subject pair they belong to and the shift to
+   add to their starts. Unlike the internal match buffer used by
+   report_match() and family, a MatchReporter is passed explicitly to the
+   matchers so several of them can be in use at the same time.
+   A "deferring" MatchReporter (i.e. with a non-NULL 'deferred_matches'
+   field) doesn't use 'match_buf' but stores the matches in
+   'deferred_matches' instead. It can be used in a worker thread. */
+typedef struct match_reporter {
+	MatchBuf match_buf;
+	int active_PSpair_id;
+	int match_shift;
+	DeferredMatches *deferred_matches;
+} MatchReporter;
+
 
 /*
  * The MatchPDictBuf struct is used for storing the matches found by the
@@ -183,10 +287,14 @@ typedef struct match_buf {
 typedef struct tbmatch_buf {
 	int is_init;
 	int tb_width;
+	const int *tb_widths;  /* NULL if the Trusted Band has a constant width */
 	const int *head_widths;
 	const int *tail_widths;
 	IntAE *PSlink_ids;
 	IntAEAE *match_ends;
+	/* used by the ACtree2 walk along subjects with IUPAC ambiguity
+	   letters, NULL until the 1st subject is walked */
+	struct frontier *frontier;
 } TBMatchBuf;
 
 typedef struct matchpdict_buf {
@@ -194,4 +302,80 @@ typedef struct matchpdict_buf {
 	MatchBuf matches;
 } MatchPDictBuf;
 
+/*
+ * The TBBatchMatches struct is used for storing the matches of the Trusted
+ * Band along a range of subjects (from S_from to S_to - 1) of a batch. Like
+ * the DeferredMatches struct, it's malloc-based so it can be filled by a
+ * worker thread. Match i is a match of the P_ids[i]-th unique pattern in
+ * subject S_ids[i], ending at ends[i].
+ */
+typedef struct tbbatch_matches {
+	int S_from, S_to;
+	int *S_ids;
+	int *P_ids;
+	int *ends;
+	size_t nelt;
+	size_t buflength;
+	int malloc_failed;
+} TBBatchMatches;
+
+/*
+ * The StripedAlignment struct is the integer version of a pairwise
+ * alignment problem as seen by the striped SIMD kernels that compute the
+ * score of the optimal alignment. Rows are the letters of the pattern and
+ * columns the letters of the subject, in the order in which
+ * pairwiseAlignment() walks them (i.e. starting from the last letter).
+ * The substitution score of row i vs column j is sub[nrow * col2key[j] + i].
+ */
+typedef struct striped_alignment {
+	int nrow;
+	int ncol;
+	int nkey;
+	const int *sub;  /* nrow x nkey */
+	const int *col2key;  /* ncol keys in [0, nkey) */
+	int gapOpening;
+	int gapExtension;
+	int endGap1;  /* end gaps are penalized in the pattern */
+	int endGap2;  /* end gaps are penalized in the subject */
+	int local;
+	int maxstep;  /* max of |sub| and gapOpening + gapExtension */
+} StripedAlignment;
+
+/*
+ * The BatchAlignment struct describes the alignments of a batch of
+ * patterns against the same subject, as seen by the inter-sequence SIMD
+ * kernels (1 pattern per lane). Rows and columns are as in the
+ * StripedAlignment struct. The substitution score of row i of pattern p vs
+ * column j is sub[(nrow * col2key[j] + i) * npattern + p]. If 'traceBuf' is
+ * not NULL, the kernels also fill the traceback matrices of the patterns:
+ * the code for row i and column j of pattern p is at
+ * sTrace[p][(i + nrow * j) * traceStride[p]] (same for dTrace and iTrace).
+ */
+typedef struct batch_alignment {
+	int npattern;
+	int nrow;  /* max of the pattern lengths */
+	const int *nrows;  /* npattern pattern lengths (> 0) */
+	int ncol;
+	int nkey;
+	const int *sub;  /* npattern x nrow x nkey */
+	const int *col2key;  /* ncol keys in [0, nkey) */
+	int gapOpening;
+	int gapExtension;
+	int endGap1;
+	int endGap2;
+	int local;
+	int maxstep;
+	char *traceBuf;  /* 3 * nrow * ncol * npattern bytes, or NULL */
+
+	/* Set by the kernels (npattern elements each) */
+	double *score;
+	char *traceStart;  /* code to start the traceback with */
+	int *startRange1;
+	int *startRange2;
+	const char **sTrace;
+	const char **dTrace;
+	const char **iTrace;
+	int *traceStride;
+} BatchAlignment;
+
 #endif
@@ -173,8 +173,40 @@ XStringSet_holder get_elt_from_XStringSetList_holder(
 
 /*
  * Match reporting facilities.
+ *
+ * The MatchReporter_*() functions operate on a match reporting context
+ * that is passed explicitly, so several of them can be in use at the same
+ * time. The other functions operate on an internal (global) context.
  */
 
+MatchReporter new_MatchReporter(const char *ms_mode, int nPSpair);
+
+void MatchReporter_set_active_PSpair(MatchReporter *reporter, int PSpair_id);
+
+void MatchReporter_set_match_shift(MatchReporter *reporter, int shift);
+
+void MatchReporter_report_match(MatchReporter *reporter, int start, int width);
+
+void MatchReporter_drop_reported_matches(MatchReporter *reporter);
+
+int MatchReporter_get_match_count(const MatchReporter *reporter);
+
+SEXP MatchReporter_reported_matches_asSEXP(const MatchReporter *reporter);
+
+/*
+ * Streaming of the matches: the matches reported to a MatchReporter with a
+ * sink are counted and passed to 'FUN' in batches of at most 'batch_size'
+ * matches instead of being stored (see the MatchSink typedef in
+ * Biostrings_defines.h). Call MatchSink_flush() once the search is done to
+ * pass the last batch to 'FUN'.
+ */
+
+MatchSink new_MatchSink(MatchSinkFUN FUN, void *sink_data, int batch_size);
+
+void MatchReporter_set_sink(MatchReporter *reporter, MatchSink *sink);
+
+void MatchSink_flush(MatchSink *sink);
+
 void init_match_reporting(const char *ms_mode, int nPSpair);
 
 void set_active_PSpair(int PSpair_id);
@@ -205,6 +237,11 @@ IRanges_holder get_elt_from_MIndex_holder(const MIndex_holder *x_holder, int i);
 
 /*
  * A BOYER-MOORE-LIKE MATCHING ALGO
+ *
+ * match_pattern_boyermoore() reports the matches to the internal context
+ * used by report_match() and family. match_pattern_boyermoore_to_reporter()
+ * reports them to 'reporter' instead (or to the internal context if
+ * 'reporter' is NULL).
  */
 
 int match_pattern_boyermoore(
@@ -214,3 +251,11 @@ int match_pattern_boyermoore(
 	int walk_backward
 );
 
+int match_pattern_boyermoore_to_reporter(
+	const Chars_holder *P,
+	const Chars_holder *S,
+	int nfirstmatches,
+	int walk_backward,
+	MatchReporter *reporter
+);
+
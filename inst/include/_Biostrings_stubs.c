@@ -108,6 +108,56 @@ DEFINE_CCALLABLE_STUB(XStringSet_holder, get_elt_from_XStringSetList_holder,
  * Stubs for callables defined in match_reporting.c
  */
 
+DEFINE_CCALLABLE_STUB(MatchReporter, new_MatchReporter,
+	(const char *ms_mode, int nPSpair),
+	(            ms_mode,     nPSpair)
+)
+
+DEFINE_NOVALUE_CCALLABLE_STUB(MatchReporter_set_active_PSpair,
+	(MatchReporter *reporter, int PSpair_id),
+	(               reporter,     PSpair_id)
+)
+
+DEFINE_NOVALUE_CCALLABLE_STUB(MatchReporter_set_match_shift,
+	(MatchReporter *reporter, int shift),
+	(               reporter,     shift)
+)
+
+DEFINE_NOVALUE_CCALLABLE_STUB(MatchReporter_report_match,
+	(MatchReporter *reporter, int start, int width),
+	(               reporter,     start,     width)
+)
+
+DEFINE_NOVALUE_CCALLABLE_STUB(MatchReporter_drop_reported_matches,
+	(MatchReporter *reporter),
+	(               reporter)
+)
+
+DEFINE_CCALLABLE_STUB(int, MatchReporter_get_match_count,
+	(const MatchReporter *reporter),
+	(                     reporter)
+)
+
+DEFINE_CCALLABLE_STUB(SEXP, MatchReporter_reported_matches_asSEXP,
+	(const MatchReporter *reporter),
+	(                     reporter)
+)
+
+DEFINE_CCALLABLE_STUB(MatchSink, new_MatchSink,
+	(MatchSinkFUN FUN, void *sink_data, int batch_size),
+	(             FUN,       sink_data,     batch_size)
+)
+
+DEFINE_NOVALUE_CCALLABLE_STUB(MatchReporter_set_sink,
+	(MatchReporter *reporter, MatchSink *sink),
+	(               reporter,            sink)
+)
+
+DEFINE_NOVALUE_CCALLABLE_STUB(MatchSink_flush,
+	(MatchSink *sink),
+	(           sink)
+)
+
 DEFINE_NOVALUE_CCALLABLE_STUB(init_match_reporting,
 	(const char *ms_mode, int nPSpair),
 	(            ms_mode,     nPSpair)
@@ -176,3 +226,8 @@ DEFINE_CCALLABLE_STUB(int, match_pattern_boyermoore,
 	(                    P,                     S,     nfirstmatches,     walk_backward)
 )
 
+DEFINE_CCALLABLE_STUB(int, match_pattern_boyermoore_to_reporter,
+	(const Chars_holder *P, const Chars_holder *S, int nfirstmatches, int walk_backward, MatchReporter *reporter),
+	(                    P,                     S,     nfirstmatches,     walk_backward,                reporter)
+)
+
@@ -64,3 +64,48 @@ SEXP _IntegerBAB_addblock(SEXP x, int block_length)
 	return block;
 }
 
+/* --- .Call ENTRY POINT ---
+ * Returns the blocks in use (list of integer vectors) and the nb of elements
+ * in the last block (the nb of elements in a block is not known by the BAB,
+ * only by the code that uses it).
+ */
+SEXP IntegerBAB_get_blocks(SEXP x)
+{
+	SEXP blocks, ans, ans_blocks;
+	int nblock, b;
+
+	blocks = _get_BAB_blocks(x);
+	nblock = *_get_BAB_nblock_ptr(x);
+	PROTECT(ans = NEW_LIST(2));
+	PROTECT(ans_blocks = NEW_LIST(nblock));
+	for (b = 0; b < nblock; b++)
+		SET_ELEMENT(ans_blocks, b, VECTOR_ELT(blocks, b));
+	SET_ELEMENT(ans, 0, ans_blocks);
+	UNPROTECT(1);
+	SET_ELEMENT(ans, 1, ScalarInteger(*_get_BAB_lastblock_nelt_ptr(x)));
+	UNPROTECT(1);
+	return ans;
+}
+
+/* --- .Call ENTRY POINT ---
+ * The reverse of IntegerBAB_get_blocks(). 'x' must be empty.
+ */
+SEXP IntegerBAB_set_blocks(SEXP x, SEXP blocks, SEXP lastblock_nelt)
+{
+	SEXP x_blocks;
+	int nblock, b;
+
+	x_blocks = _get_BAB_blocks(x);
+	nblock = LENGTH(blocks);
+	if (*_get_BAB_nblock_ptr(x) != 0)
+		error("Biostrings internal error in IntegerBAB_set_blocks(): "
+		      "'x' is not empty");
+	if (nblock > LENGTH(x_blocks))
+		error("IntegerBAB_set_blocks(): reached max buffer size");
+	for (b = 0; b < nblock; b++)
+		SET_ELEMENT(x_blocks, b, VECTOR_ELT(blocks, b));
+	*_get_BAB_nblock_ptr(x) = nblock;
+	*_get_BAB_lastblock_nelt_ptr(x) = INTEGER(lastblock_nelt)[0];
+	return R_NilValue;
+}
+
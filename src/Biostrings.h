@@ -54,6 +54,18 @@ int _get_twobit_signature_at(
 	int at_length
 );
 
+int _get_nthreads();
+
+SEXP get_nthreads();
+
+SEXP set_nthreads(SEXP n);
+
+double _get_traceback_memory_limit();
+
+SEXP get_traceback_memory_limit();
+
+SEXP set_traceback_memory_limit(SEXP limit);
+
 
 /* RoSeqs_utils.c */
 
@@ -454,6 +466,16 @@ MatchBuf _new_MatchBuf(
 	int nPSpair
 );
 
+void _MatchBuf_set_coverage_weights(
+	MatchBuf *match_buf,
+	const int *weights
+);
+
+void _MatchBuf_set_coverage_shift(
+	MatchBuf *match_buf,
+	int view_offset
+);
+
 void _MatchBuf_report_match(
 	MatchBuf *match_buf,
 	int PSpair_id,
@@ -477,6 +499,8 @@ SEXP _MatchBuf_starts_asLIST(const MatchBuf *match_buf);
 
 SEXP _MatchBuf_ends_asLIST(const MatchBuf *match_buf);
 
+SEXP _MatchBuf_coverage_asLIST(const MatchBuf *match_buf);
+
 SEXP _MatchBuf_as_Ranges(const MatchBuf *match_buf);
 
 SEXP _MatchBuf_as_SEXP(
@@ -484,6 +508,83 @@ SEXP _MatchBuf_as_SEXP(
 	SEXP env
 );
 
+MatchReporter _new_MatchReporter(
+	const char *ms_mode,
+	int nPSpair
+);
+
+void _MatchReporter_set_active_PSpair(
+	MatchReporter *reporter,
+	int PSpair_id
+);
+
+void _MatchReporter_set_match_shift(
+	MatchReporter *reporter,
+	int shift
+);
+
+void _MatchReporter_set_sink(
+	MatchReporter *reporter,
+	MatchSink *sink
+);
+
+void _MatchReporter_report_match(
+	MatchReporter *reporter,
+	int start,
+	int width
+);
+
+void _MatchReporter_drop_reported_matches(MatchReporter *reporter);
+
+int _MatchReporter_get_match_count(const MatchReporter *reporter);
+
+SEXP _MatchReporter_reported_matches_asSEXP(const MatchReporter *reporter);
+
+void _init_DeferredMatches(
+	DeferredMatches *deferred_matches,
+	int ms_code
+);
+
+void _free_DeferredMatches(DeferredMatches *deferred_matches);
+
+MatchReporter _new_deferring_MatchReporter(
+	DeferredMatches *deferred_matches
+);
+
+void _MatchReporter_report_DeferredMatches(
+	MatchReporter *reporter,
+	DeferredMatches *deferred_matches,
+	int n
+);
+
+MatchSink _new_MatchSink(
+	MatchSinkFUN FUN,
+	void *sink_data,
+	int batch_size
+);
+
+void _MatchSink_set_match_shift(
+	MatchSink *sink,
+	int shift
+);
+
+void _MatchSink_report_match(
+	MatchSink *sink,
+	int PSpair_id,
+	int start,
+	int width
+);
+
+void _MatchSink_flush(MatchSink *sink);
+
+MatchSink _new_MatchSink_from_SEXP(
+	SEXP sink,
+	SEXP batch_size,
+	SEXP seqname,
+	int seqlength,
+	SEXP names
+);
+
 void _init_match_reporting(const char *ms_mode, int nPSpair);
 
 void _set_active_PSpair(int PSpair_id);
@@ -498,7 +599,7 @@ int _get_match_count();
 
 SEXP _reported_matches_asSEXP();
 
-MatchBuf *_get_internal_match_buf();
+MatchReporter *_get_internal_match_reporter();
 
 
 /* MIndex_class.c */
@@ -596,8 +697,52 @@ SEXP XStringSet_vmatch_pattern_at(
 SEXP XStringSet_dist_hamming(SEXP x);
 
 
+/* PreprocessedPattern_class.c */
+
+PreprocessedPattern_holder _hold_Chars_as_PreprocessedPattern(
+	const Chars_holder *P
+);
+
+void _add_bom_oracle_to_PreprocessedPattern_holder(
+	PreprocessedPattern_holder *ppattern
+);
+
+PreprocessedPattern_holder _hold_PreprocessedPattern(SEXP x);
+
+SEXP build_PreprocessedPattern(SEXP pattern);
+
+
+/* match_pattern_naive.c */
+
+SEXP naive_simd_level();
+
+void _match_pattern_naive_exact(
+	const Chars_holder *P,
+	const Chars_holder *S,
+	MatchReporter *reporter
+);
+
+void _match_pattern_naive_inexact(
+	const Chars_holder *P,
+	const Chars_holder *S,
+	int max_nmis,
+	int min_nmis,
+	int fixedP,
+	int fixedS,
+	MatchReporter *reporter
+);
+
+
 /* match_pattern_boyermoore.c */
 
+int _match_pattern_boyermoore_to_reporter(
+	const Chars_holder *P,
+	const Chars_holder *S,
+	int nfirstmatches,
+	int walk_backward,
+	MatchReporter *reporter
+);
+
 int _match_pattern_boyermoore(
 	const Chars_holder *P,
 	const Chars_holder *S,
@@ -605,28 +750,141 @@ int _match_pattern_boyermoore(
 	int walk_backward
 );
 
+int _preprocess_pattern_boyermoore(
+	const Chars_holder *P,
+	int *VSGSshift_table
+);
+
+int _match_PreprocessedPattern_boyermoore(
+	const PreprocessedPattern_holder *ppattern,
+	const Chars_holder *S,
+	int nfirstmatches,
+	MatchReporter *reporter
+);
+
+
+/* match_pattern_bndm.c */
+
+void _preprocess_pattern_bndm(
+	const Chars_holder *P,
+	BitWord *B
+);
+
+void _match_pattern_bndm(
+	const Chars_holder *P,
+	const Chars_holder *S,
+	MatchReporter *reporter
+);
+
+void _match_PreprocessedPattern_bndm(
+	const PreprocessedPattern_holder *ppattern,
+	const Chars_holder *S,
+	MatchReporter *reporter
+);
+
+int _bom_nletters(
+	const Chars_holder *P,
+	int *byte2code
+);
+
+void _preprocess_pattern_bom(
+	const Chars_holder *P,
+	const int *byte2code,
+	int nletters,
+	int *trans,
+	int *supply
+);
+
+int _bom_is_thread_safe(const Chars_holder *P);
+
+void _match_pattern_bom(
+	const Chars_holder *P,
+	const Chars_holder *S,
+	MatchReporter *reporter
+);
+
+void _match_PreprocessedPattern_bom(
+	const PreprocessedPattern_holder *ppattern,
+	const Chars_holder *S,
+	MatchReporter *reporter
+);
+
 
 /* match_pattern_shiftor.c */
 
 SEXP bits_per_long();
 
+int _shiftor_is_thread_safe(
+	const Chars_holder *P,
+	int fixedP,
+	int fixedS
+);
+
 void _match_pattern_shiftor(
 	const Chars_holder *P,
 	const Chars_holder *S,
 	int max_nmis,
 	int fixedP,
-	int fixedS
+	int fixedS,
+	MatchReporter *reporter
+);
+
+int _shiftor_nword(int Plength);
+
+void _preprocess_pattern_shiftor(
+	const Chars_holder *P,
+	unsigned long *pmaskmap
+);
+
+void _match_PreprocessedPattern_shiftor(
+	const PreprocessedPattern_holder *ppattern,
+	const Chars_holder *S,
+	int max_nmis,
+	int fixedP,
+	int fixedS,
+	MatchReporter *reporter
+);
+
+
+/* match_pattern_myers.c */
+
+int _MyersNedit_nword(int Plength);
+
+void _set_MyersPeq(
+	BitWord *Peq,
+	const Chars_holder *P,
+	const BytewiseOpTable *bytewise_match_table
+);
+
+void _init_MyersNedit(
+	MyersNedit *myers,
+	const BitWord *Peq,
+	int Peq_Plength,
+	int Poffset,
+	int anchored,
+	BitWord *Pv,
+	BitWord *Mv
+);
+
+void _MyersNedit_reset(MyersNedit *myers);
+
+int _MyersNedit_add_letter(
+	MyersNedit *myers,
+	int c
 );
 
 
 /* match_pattern_indels.c */
 
+int _indels_is_thread_safe(const Chars_holder *P);
+
 void _match_pattern_indels(
 	const Chars_holder *P,
 	const Chars_holder *S,
 	int max_nmis,
 	int fixedP,
-	int fixedS
+	int fixedS,
+	MatchReporter *reporter
 );
 
 
@@ -639,7 +897,8 @@ void _match_pattern_XString(
 	SEXP min_mismatch,
 	SEXP with_indels,
 	SEXP fixed,
-	const char *algo
+	const char *algo,
+	MatchReporter *reporter
 );
 
 void _match_pattern_XStringViews(
@@ -651,7 +910,8 @@ void _match_pattern_XStringViews(
 	SEXP min_mismatch,
 	SEXP with_indels,
 	SEXP fixed,
-	const char *algo
+	const char *algo,
+	MatchReporter *reporter
 );
 
 SEXP XString_match_pattern(
@@ -662,7 +922,7 @@ SEXP XString_match_pattern(
 	SEXP with_indels,
 	SEXP fixed,
 	SEXP algorithm,
-	SEXP count_only
+	SEXP ms_mode
 );
 
 SEXP XStringViews_match_pattern(
@@ -675,7 +935,23 @@ SEXP XStringViews_match_pattern(
 	SEXP with_indels,
 	SEXP fixed,
 	SEXP algorithm,
-	SEXP count_only
+	SEXP ms_mode
+);
+
+SEXP XStringViews_stream_pattern(
+	SEXP pattern,
+	SEXP subject,
+	SEXP views_start,
+	SEXP views_width,
+	SEXP max_mismatch,
+	SEXP min_mismatch,
+	SEXP with_indels,
+	SEXP fixed,
+	SEXP algorithm,
+	SEXP sink,
+	SEXP batch_size,
+	SEXP seqname,
+	SEXP names
 );
 
 SEXP XStringSet_vmatch_pattern(
@@ -805,6 +1081,14 @@ void _BitMatrix_grow1rows(
 	const BitCol *bitcol
 );
 
+int _BitMatrix_use_simd(int on);
+
+void _BitMatrix_grow1rows_ncols(
+	BitMatrix *bitmat,
+	const BitWord * const *cols,
+	int ncol
+);
+
 
 /* PreprocessedTB_class.c */
 
@@ -822,10 +1106,14 @@ SEXP _get_PreprocessedTB_low2high(SEXP x);
 
 SEXP _get_Twobit_sign2pos_tag(SEXP x);
 
+SEXP _get_ACtreeVW_states_tag(SEXP x);
+
 SEXP _get_ACtree2_nodebuf_ptr(SEXP x);
 
 SEXP _get_ACtree2_nodeextbuf_ptr(SEXP x);
 
+SEXP _get_ACtree2_frozen_ptr(SEXP x);
+
 void _init_ppdups_buf(int length);
 
 void _report_ppdup(
@@ -841,6 +1129,7 @@ SEXP _get_ppdups_buf_asINTEGER();
 TBMatchBuf _new_TBMatchBuf(
 	int tb_length,
 	int tb_width,
+	const int *tb_widths,
 	const int *head_widths,
 	const int *tail_widths
 );
@@ -853,10 +1142,22 @@ void _TBMatchBuf_report_match(
 
 void _TBMatchBuf_flush(TBMatchBuf *buf);
 
+void _init_TBBatchMatches(TBBatchMatches *matches);
+
+void _free_TBBatchMatches(TBBatchMatches *matches);
+
+void _TBBatchMatches_add(
+	TBBatchMatches *matches,
+	int S_id,
+	int P_id,
+	int end
+);
+
 MatchPDictBuf _new_MatchPDictBuf(
 	SEXP matches_as,
 	int tb_length,
 	int tb_width,
+	const int *tb_widths,
 	const int *head_widths,
 	const int *tail_widths
 );
@@ -884,6 +1185,8 @@ HeadTail _new_HeadTail(
 	int with_ppheadtail
 );
 
+SEXP set_headtail_engine(SEXP engine);
+
 void _match_pdict_flanks_at(
 	int key0,
 	SEXP low2high,
@@ -925,6 +1228,22 @@ void _match_Twobit(
 );
 
 
+/* match_pdict_ACtreeVW.c */
+
+SEXP ACtreeVW_build(
+	SEXP tb,
+	SEXP pp_exclude,
+	SEXP base_codes
+);
+
+void _match_ACtreeVW(
+	SEXP pptb,
+	const Chars_holder *S,
+	int fixedS,
+	TBMatchBuf *tb_matches
+);
+
+
 /* BAB_class.c */
 
 SEXP IntegerBAB_new(SEXP max_nblock);
@@ -940,6 +1259,14 @@ SEXP _IntegerBAB_addblock(
 	int block_length
 );
 
+SEXP IntegerBAB_get_blocks(SEXP x);
+
+SEXP IntegerBAB_set_blocks(
+	SEXP x,
+	SEXP blocks,
+	SEXP lastblock_nelt
+);
+
 
 /* match_pdict_ACtree2.c */
 
@@ -951,8 +1278,12 @@ SEXP ACtree2_nnodes(SEXP pptb);
 
 SEXP ACtree2_print_nodes(SEXP pptb);
 
+SEXP ACtree2_nodes(SEXP pptb);
+
 SEXP ACtree2_summary(SEXP pptb);
 
+SEXP set_ACtree2_builder(SEXP builder);
+
 SEXP ACtree2_build(
 	SEXP tb,
 	SEXP pp_exclude,
@@ -965,6 +1296,10 @@ SEXP ACtree2_has_all_flinks(SEXP pptb);
 
 SEXP ACtree2_compute_all_flinks(SEXP pptb);
 
+SEXP ACtree2_is_frozen(SEXP pptb);
+
+SEXP ACtree2_freeze(SEXP pptb);
+
 void _match_tbACtree2(
 	SEXP pptb,
 	const Chars_holder *S,
@@ -972,6 +1307,16 @@ void _match_tbACtree2(
 	TBMatchBuf *tb_matches
 );
 
+void _prepare_tbACtree2_interleaved(SEXP pptb);
+
+void _match_tbACtree2_interleaved(
+	SEXP pptb,
+	const Chars_holder *S,
+	int nS,
+	TBBatchMatches *matches,
+	int nchunk
+);
+
 void _match_pdictACtree2(
 	SEXP pptb,
 	HeadTail *headtail,
@@ -984,6 +1329,21 @@ void _match_pdictACtree2(
 );
 
 
+/* PDict_io.c */
+
+SEXP write_PDict_file(
+	SEXP filepath,
+	SEXP skeleton,
+	SEXP arrays
+);
+
+void _init_mapped_integer_class(DllInfo *info);
+
+SEXP map_PDict_file(SEXP filepath);
+
+SEXP new_XInteger_from_mapped_integer(SEXP x);
+
+
 /* match_pdict.c */
 
 SEXP match_PDict3Parts_XString(
@@ -995,7 +1355,8 @@ SEXP match_PDict3Parts_XString(
 	SEXP min_mismatch,
 	SEXP fixed,
 	SEXP matches_as,
-	SEXP envir
+	SEXP envir,
+	SEXP coverage_weight
 );
 
 SEXP match_XStringSet_XString(
@@ -1021,7 +1382,8 @@ SEXP match_PDict3Parts_XStringViews(
 	SEXP min_mismatch,
 	SEXP fixed,
 	SEXP matches_as,
-	SEXP envir
+	SEXP envir,
+	SEXP coverage_weight
 );
 
 SEXP match_XStringSet_XStringViews(
@@ -1038,6 +1400,39 @@ SEXP match_XStringSet_XStringViews(
 	SEXP envir
 );
 
+SEXP stream_PDict3Parts_XStringViews(
+	SEXP pptb,
+	SEXP pdict_head,
+	SEXP pdict_tail,
+	SEXP subject,
+	SEXP views_start,
+	SEXP views_width,
+	SEXP max_mismatch,
+	SEXP min_mismatch,
+	SEXP fixed,
+	SEXP low2high,
+	SEXP sink,
+	SEXP batch_size,
+	SEXP seqname,
+	SEXP names
+);
+
+SEXP stream_XStringSet_XStringViews(
+	SEXP pattern,
+	SEXP subject,
+	SEXP views_start,
+	SEXP views_width,
+	SEXP max_mismatch,
+	SEXP min_mismatch,
+	SEXP with_indels,
+	SEXP fixed,
+	SEXP algorithm,
+	SEXP sink,
+	SEXP batch_size,
+	SEXP seqname,
+	SEXP names
+);
+
 SEXP vmatch_PDict3Parts_XStringSet(
 	SEXP pptb,
 	SEXP pdict_head,
@@ -1067,6 +1462,35 @@ SEXP vmatch_XStringSet_XStringSet(
 );
 
 
+/* match_pdict_seeds.c */
+
+SEXP match_seeds_XString(
+	SEXP seeds_pptb,
+	SEXP dict0,
+	SEXP seed_offsets,
+	SEXP subject,
+	SEXP max_mismatch,
+	SEXP min_mismatch,
+	SEXP fixed,
+	SEXP matches_as,
+	SEXP envir
+);
+
+SEXP match_seeds_XStringViews(
+	SEXP seeds_pptb,
+	SEXP dict0,
+	SEXP seed_offsets,
+	SEXP subject,
+	SEXP views_start,
+	SEXP views_width,
+	SEXP max_mismatch,
+	SEXP min_mismatch,
+	SEXP fixed,
+	SEXP matches_as,
+	SEXP envir
+);
+
+
 /* align_utils.c */
 
 SEXP PairwiseAlignments_nmatch(
@@ -1136,7 +1560,8 @@ SEXP XStringSet_align_pairwiseAlignment(
 	SEXP substitutionLookupTable,
 	SEXP fuzzyMatrix,
 	SEXP fuzzyMatrixDim,
-	SEXP fuzzyLookupTable
+	SEXP fuzzyLookupTable,
+	SEXP band
 );
 
 SEXP XStringSet_align_distance(
@@ -1155,6 +1580,21 @@ SEXP XStringSet_align_distance(
 );
 
 
+/* align_striped.c */
+
+int _striped_align_score(
+	const StripedAlignment *sa,
+	double *score
+);
+
+
+/* align_batch.c */
+
+int _batch_align_width(void);
+
+int _batch_align(const BatchAlignment *ba);
+
+
 /* align_needwunsQS.c */
 
 SEXP align_needwunsQS(
@@ -12,6 +12,49 @@
 #include <limits.h> /* for CHAR_BIT and ULONG_MAX */
 #include <stdlib.h> /* for div() */
 
+/*
+ * On x86 we compile AVX2 and AVX-512 versions of the kernel used by
+ * _BitMatrix_grow1rows_ncols() (with the 'target' function attribute so no
+ * special compiler flag is needed) and pick the best one at run time. The
+ * scalar version (1 BitWord at a time) is used everywhere else.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD_KERNELS 1
+#include <immintrin.h>
+#endif
+
+#define SIMD_NONE 0
+#define SIMD_AVX2 1
+#define SIMD_AVX512 2
+
+/* Max nb of columns of the BitMatrix passed to the SIMD kernels. */
+#define SIMD_MAX_NCOL 8
+
+static int use_simd = 1;
+
+static int simd_level(void)
+{
+	if (!use_simd)
+		return SIMD_NONE;
+#ifdef HAVE_X86_SIMD_KERNELS
+	if (__builtin_cpu_supports("avx512f"))
+		return SIMD_AVX512;
+	if (__builtin_cpu_supports("avx2"))
+		return SIMD_AVX2;
+#endif
+	return SIMD_NONE;
+}
+
+/* For benchmarking. Returns the previous setting. */
+int _BitMatrix_use_simd(int on)
+{
+	int prev;
+
+	prev = use_simd;
+	use_simd = on;
+	return prev;
+}
+
 
 #define BITMATBYROW_NCOL (sizeof(int) * CHAR_BIT)
 
@@ -264,6 +307,152 @@ void _BitMatrix_grow1rows(BitMatrix *bitmat, const BitCol *bitcol)
 
 
 
+/*****************************************************************************
+ * _BitMatrix_grow1rows_ncols()
+ * ----------------------------
+ *
+ * Same as calling _BitMatrix_grow1rows() on each column in 'cols' (from
+ * left to right) but much faster: 'bitmat' is traversed only once, by
+ * blocks of 1 BitWord (scalar kernel), 256 bits (AVX2 kernel) or 512 bits
+ * (AVX-512 kernel), and the block of each column of 'bitmat' is kept in a
+ * register while the 'ncol' columns are added to it.
+ * When used as a vertical counter (i.e. bit i in column j of 'bitmat' is
+ * set iff the counter for row i is > j), this adds the 'ncol' bits of each
+ * row to its counter, without any per-row work. The counters saturate at
+ * 'bitmat->ncol' so a block is not visited anymore once all the counters in
+ * it are saturated.
+ * 'cols[k]' must point to the 1st word of a column that has the same
+ * number of rows as 'bitmat', or be NULL for a column of ones.
+ */
+
+static void grow1rows_ncols_scalar(BitMatrix *bitmat,
+		const BitWord * const *cols, int ncol, int i1_from, int i1_to)
+{
+	BitWord *Lbitword, *top, Rbitword, ret;
+	int i1, k, j;
+
+	for (i1 = i1_from; i1 < i1_to; i1++) {
+		top = bitmat->bitword00 + (bitmat->ncol - 1) *
+					  bitmat->nword_per_col + i1;
+		for (k = 0; k < ncol && *top != ULONG_MAX; k++) {
+			Lbitword = bitmat->bitword00 + i1;
+			Rbitword = cols[k] == NULL ? ULONG_MAX : cols[k][i1];
+			for (j = 0; j < bitmat->ncol; j++) {
+				ret = *Lbitword & Rbitword; // and
+				*Lbitword |= Rbitword; // or
+				Rbitword = ret;
+				Lbitword += bitmat->nword_per_col;
+			}
+		}
+	}
+	return;
+}
+
+#ifdef HAVE_X86_SIMD_KERNELS
+
+/* Both kernels return the nb of words they processed. The remaining words
+   are processed by the scalar kernel. */
+
+__attribute__((target("avx2")))
+static int grow1rows_ncols_avx2(BitMatrix *bitmat,
+		const BitWord * const *cols, int ncol, int nword)
+{
+	const int step = sizeof(__m256i) / sizeof(BitWord);
+	__m256i ones, acc[SIMD_MAX_NCOL], R, ret;
+	BitWord *Lbitword;
+	int i1, k, j;
+
+	ones = _mm256_set1_epi32(-1);
+	for (i1 = 0; i1 + step <= nword; i1 += step) {
+		Lbitword = bitmat->bitword00 + i1;
+		for (j = 0; j < bitmat->ncol; j++)
+			acc[j] = _mm256_loadu_si256((const __m256i *)
+					(Lbitword + j * bitmat->nword_per_col));
+		for (k = 0; k < ncol; k++) {
+			/* all the counters in the block are saturated */
+			if (_mm256_testc_si256(acc[bitmat->ncol - 1], ones))
+				break;
+			R = cols[k] == NULL ? ones : _mm256_loadu_si256(
+					(const __m256i *) (cols[k] + i1));
+			for (j = 0; j < bitmat->ncol; j++) {
+				ret = _mm256_and_si256(acc[j], R);
+				acc[j] = _mm256_or_si256(acc[j], R);
+				R = ret;
+			}
+		}
+		for (j = 0; j < bitmat->ncol; j++)
+			_mm256_storeu_si256((__m256i *)
+				(Lbitword + j * bitmat->nword_per_col), acc[j]);
+	}
+	return i1;
+}
+
+__attribute__((target("avx512f")))
+static int grow1rows_ncols_avx512(BitMatrix *bitmat,
+		const BitWord * const *cols, int ncol, int nword)
+{
+	const int step = sizeof(__m512i) / sizeof(BitWord);
+	__m512i ones, acc[SIMD_MAX_NCOL], R, ret;
+	BitWord *Lbitword;
+	int i1, k, j;
+
+	ones = _mm512_set1_epi32(-1);
+	for (i1 = 0; i1 + step <= nword; i1 += step) {
+		Lbitword = bitmat->bitword00 + i1;
+		for (j = 0; j < bitmat->ncol; j++)
+			acc[j] = _mm512_loadu_si512(
+				Lbitword + j * bitmat->nword_per_col);
+		for (k = 0; k < ncol; k++) {
+			/* all the counters in the block are saturated */
+			if (_mm512_cmpneq_epi64_mask(acc[bitmat->ncol - 1],
+						     ones) == 0)
+				break;
+			R = cols[k] == NULL ? ones :
+				_mm512_loadu_si512(cols[k] + i1);
+			for (j = 0; j < bitmat->ncol; j++) {
+				ret = _mm512_and_si512(acc[j], R);
+				acc[j] = _mm512_or_si512(acc[j], R);
+				R = ret;
+			}
+		}
+		for (j = 0; j < bitmat->ncol; j++)
+			_mm512_storeu_si512(
+				Lbitword + j * bitmat->nword_per_col, acc[j]);
+	}
+	return i1;
+}
+
+#endif  /* HAVE_X86_SIMD_KERNELS */
+
+void _BitMatrix_grow1rows_ncols(BitMatrix *bitmat,
+		const BitWord * const *cols, int ncol)
+{
+	div_t q;
+	int i1;
+
+	q = div(bitmat->nrow, NBIT_PER_BITWORD);
+	if (q.rem != 0)
+		q.quot++;
+	i1 = 0;
+#ifdef HAVE_X86_SIMD_KERNELS
+	if (bitmat->ncol <= SIMD_MAX_NCOL) {
+		switch (simd_level()) {
+		    case SIMD_AVX512:
+			i1 = grow1rows_ncols_avx512(bitmat, cols, ncol,
+						    q.quot);
+			break;
+		    case SIMD_AVX2:
+			i1 = grow1rows_ncols_avx2(bitmat, cols, ncol, q.quot);
+			break;
+		}
+	}
+#endif
+	grow1rows_ncols_scalar(bitmat, cols, ncol, i1, q.quot);
+	return;
+}
+
+
+
 /*****************************************************************************
  * Testing and debugging stuff
  */
@@ -0,0 +1,390 @@
+/****************************************************************************
+ *          Saving PDict objects to a file that can be memory-mapped        *
+ ****************************************************************************/
+#include "Biostrings.h"
+#include "XVector_interface.h"
+
+#include <R_ext/Altrep.h>
+#include <stdio.h>
+#include <string.h>  /* for memcmp() and memcpy() */
+#include <stdint.h>  /* for int64_t */
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+/****************************************************************************
+ * File format.
+ *
+ * All the integers are in the native byte order of the machine that wrote
+ * the file (the 'byte_order' field is used to detect a file written on a
+ * machine with a different byte order).
+ *
+ *   header:   magic (8 bytes), version (int32), byte_order (int32),
+ *             skeleton_offset (int64), skeleton_length (int64),
+ *             narray (int32), then 'narray' x {offset (int64),
+ *             length (int64)};
+ *   arrays:   'narray' arrays of int32, each starting at an offset that is
+ *             a multiple of PDICTFILE_ALIGNMENT so it can be mapped;
+ *   skeleton: the serialized PDict object without its big buffers (see
+ *             savePDict() at the R level).
+ *
+ * The big buffers of the PDict object (the node buffers and the frozen
+ * tree of an ACtree2 object, or the lookup table of a Twobit object) are
+ * the arrays. When the file is loaded, each array is turned into an ALTREP
+ * integer vector that points to the memory where the file is mapped. The
+ * file is mapped with MAP_PRIVATE so the pages are shared by all the
+ * processes that load the same file (as long as they don't write to them).
+ */
+
+#define PDICTFILE_MAGIC "BSPDICT"
+#define PDICTFILE_VERSION 1
+#define PDICTFILE_BYTE_ORDER 0x01020304
+#define PDICTFILE_ALIGNMENT 4096
+
+typedef struct pdictfile_header {
+	char magic[8];
+	int32_t version;
+	int32_t byte_order;
+	int64_t skeleton_offset;
+	int64_t skeleton_length;
+	int32_t narray;
+	int32_t padding;
+} PDictFileHeader;
+
+typedef struct pdictfile_array {
+	int64_t offset;
+	int64_t length;  /* nb of int32 */
+} PDictFileArray;
+
+static int64_t align_offset(int64_t offset)
+{
+	int64_t rem;
+
+	rem = offset % PDICTFILE_ALIGNMENT;
+	return rem == 0 ? offset : offset + PDICTFILE_ALIGNMENT - rem;
+}
+
+static void write_bytes(FILE *file, const void *buf, size_t size,
+		const char *path)
+{
+	if (fwrite(buf, 1, size, file) != size) {
+		fclose(file);
+		error("failed to write to file '%s'", path);
+	}
+	return;
+}
+
+static void write_padding(FILE *file, int64_t from, int64_t to,
+		const char *path)
+{
+	static const char zeros[PDICTFILE_ALIGNMENT];
+
+	if (to > from)
+		write_bytes(file, zeros, (size_t) (to - from), path);
+	return;
+}
+
+/* --- .Call ENTRY POINT ---
+ * 'skeleton' must be a raw vector and 'arrays' a list of integer vectors.
+ */
+SEXP write_PDict_file(SEXP filepath, SEXP skeleton, SEXP arrays)
+{
+	const char *path;
+	FILE *file;
+	PDictFileHeader header;
+	PDictFileArray *array_descs;
+	int narray, i;
+	int64_t offset;
+	SEXP array;
+
+	path = CHAR(STRING_ELT(filepath, 0));
+	narray = LENGTH(arrays);
+	memset(&header, 0, sizeof(PDictFileHeader));
+	memcpy(header.magic, PDICTFILE_MAGIC, sizeof(PDICTFILE_MAGIC));
+	header.version = PDICTFILE_VERSION;
+	header.byte_order = PDICTFILE_BYTE_ORDER;
+	header.narray = narray;
+	array_descs = (PDictFileArray *)
+		R_alloc((long) narray + 1, sizeof(PDictFileArray));
+	offset = sizeof(PDictFileHeader) +
+		 (int64_t) narray * sizeof(PDictFileArray);
+	for (i = 0; i < narray; i++) {
+		array = VECTOR_ELT(arrays, i);
+		offset = align_offset(offset);
+		array_descs[i].offset = offset;
+		array_descs[i].length = XLENGTH(array);
+		offset += (int64_t) XLENGTH(array) * sizeof(int32_t);
+	}
+	header.skeleton_offset = offset;
+	header.skeleton_length = XLENGTH(skeleton);
+	file = fopen(path, "wb");
+	if (file == NULL)
+		error("cannot open file '%s'", path);
+	write_bytes(file, &header, sizeof(PDictFileHeader), path);
+	write_bytes(file, array_descs, sizeof(PDictFileArray) * narray, path);
+	offset = sizeof(PDictFileHeader) +
+		 (int64_t) narray * sizeof(PDictFileArray);
+	for (i = 0; i < narray; i++) {
+		array = VECTOR_ELT(arrays, i);
+		write_padding(file, offset, array_descs[i].offset, path);
+		write_bytes(file, INTEGER(array),
+			    sizeof(int32_t) * XLENGTH(array), path);
+		offset = array_descs[i].offset +
+			 (int64_t) XLENGTH(array) * sizeof(int32_t);
+	}
+	write_bytes(file, RAW(skeleton), XLENGTH(skeleton), path);
+	if (fclose(file) != 0)
+		error("failed to write to file '%s'", path);
+	return R_NilValue;
+}
+
+
+/****************************************************************************
+ * Mapping the file.
+ *
+ * On Windows, the file is read in memory instead (so the pages are not
+ * shared between processes).
+ */
+
+typedef struct pdictfile_mapping {
+	char *addr;
+	size_t size;
+} PDictFileMapping;
+
+static void unmap_PDict_file(SEXP xp)
+{
+	PDictFileMapping *mapping;
+
+	mapping = (PDictFileMapping *) R_ExternalPtrAddr(xp);
+	if (mapping == NULL)
+		return;
+#ifndef _WIN32
+	munmap(mapping->addr, mapping->size);
+#else
+	free(mapping->addr);
+#endif
+	free(mapping);
+	R_ClearExternalPtr(xp);
+	return;
+}
+
+static PDictFileMapping *map_file(const char *path)
+{
+	PDictFileMapping *mapping;
+#ifndef _WIN32
+	int fd;
+	struct stat st;
+	void *addr;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		error("cannot open file '%s'", path);
+	if (fstat(fd, &st) == -1 || st.st_size == 0) {
+		close(fd);
+		error("cannot read file '%s'", path);
+	}
+	addr = mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED)
+		error("failed to map file '%s' in memory", path);
+	mapping = (PDictFileMapping *) malloc(sizeof(PDictFileMapping));
+	if (mapping == NULL) {
+		munmap(addr, (size_t) st.st_size);
+		error("map_file(): memory allocation failed");
+	}
+	mapping->addr = (char *) addr;
+	mapping->size = (size_t) st.st_size;
+	return mapping;
+#else
+	FILE *file;
+	long size;
+
+	file = fopen(path, "rb");
+	if (file == NULL)
+		error("cannot open file '%s'", path);
+	if (fseek(file, 0L, SEEK_END) != 0 || (size = ftell(file)) <= 0) {
+		fclose(file);
+		error("cannot read file '%s'", path);
+	}
+	rewind(file);
+	mapping = (PDictFileMapping *) malloc(sizeof(PDictFileMapping));
+	if (mapping != NULL)
+		mapping->addr = (char *) malloc((size_t) size);
+	if (mapping == NULL || mapping->addr == NULL) {
+		free(mapping);
+		fclose(file);
+		error("map_file(): memory allocation failed");
+	}
+	mapping->size = (size_t) size;
+	if (fread(mapping->addr, 1, mapping->size, file) != mapping->size) {
+		free(mapping->addr);
+		free(mapping);
+		fclose(file);
+		error("cannot read file '%s'", path);
+	}
+	fclose(file);
+	return mapping;
+#endif
+}
+
+
+/****************************************************************************
+ * The "mapped_integer" ALTREP class.
+ *
+ * An integer vector that points to an array in a mapped file. 'data1' is
+ * the external pointer to the mapping (so the mapping stays alive as long
+ * as the vector) and 'data2' a double vector containing the offset (in
+ * bytes) and the length of the array.
+ * Serializing a mapped_integer vector serializes its content (like for an
+ * ordinary integer vector).
+ */
+
+static R_altrep_class_t mapped_integer_class;
+
+static R_xlen_t mapped_integer_Length(SEXP x)
+{
+	return (R_xlen_t) REAL(R_altrep_data2(x))[1];
+}
+
+static void *mapped_integer_Dataptr(SEXP x, Rboolean writeable)
+{
+	PDictFileMapping *mapping;
+
+	mapping = (PDictFileMapping *) R_ExternalPtrAddr(R_altrep_data1(x));
+	return mapping->addr + (size_t) REAL(R_altrep_data2(x))[0];
+}
+
+static const void *mapped_integer_Dataptr_or_null(SEXP x)
+{
+	return mapped_integer_Dataptr(x, FALSE);
+}
+
+static Rboolean mapped_integer_Inspect(SEXP x, int pre, int deep, int pvec,
+		void (*inspect_subtree)(SEXP, int, int, int))
+{
+	Rprintf(" mapped_integer (length=%.0f)\n",
+		REAL(R_altrep_data2(x))[1]);
+	return TRUE;
+}
+
+void _init_mapped_integer_class(DllInfo *info)
+{
+	mapped_integer_class = R_make_altinteger_class("mapped_integer",
+						       "Biostrings", info);
+	R_set_altrep_Length_method(mapped_integer_class,
+				   mapped_integer_Length);
+	R_set_altvec_Dataptr_method(mapped_integer_class,
+				    mapped_integer_Dataptr);
+	R_set_altvec_Dataptr_or_null_method(mapped_integer_class,
+					    mapped_integer_Dataptr_or_null);
+	R_set_altrep_Inspect_method(mapped_integer_class,
+				    mapped_integer_Inspect);
+	return;
+}
+
+static SEXP new_mapped_integer(SEXP mapping_xp, int64_t offset,
+		int64_t length)
+{
+	SEXP data2, ans;
+
+	PROTECT(data2 = NEW_NUMERIC(2));
+	REAL(data2)[0] = (double) offset;
+	REAL(data2)[1] = (double) length;
+	ans = R_new_altrep(mapped_integer_class, mapping_xp, data2);
+	UNPROTECT(1);
+	return ans;
+}
+
+/* Returns 1 if the 'length' bytes starting at 'offset' are between 'from'
+   and 'to' (excluded). Doesn't overflow on corrupted values. */
+static int is_within(int64_t offset, int64_t length, int64_t from,
+		int64_t to)
+{
+	return offset >= from && offset <= to &&
+	       length >= 0 && length <= to - offset;
+}
+
+/* --- .Call ENTRY POINT ---
+ * Returns a list of 2 elements: the skeleton (raw vector) and the arrays
+ * (list of mapped_integer vectors).
+ * All the offsets and lengths found in the file are checked before they are
+ * used so a corrupted file cannot cause a read outside the mapping.
+ */
+SEXP map_PDict_file(SEXP filepath)
+{
+	const char *path;
+	PDictFileMapping *mapping;
+	PDictFileHeader header;
+	const PDictFileArray *array_descs;
+	int i;
+	int64_t header_size;
+	SEXP mapping_xp, ans, skeleton, arrays, array;
+
+	path = CHAR(STRING_ELT(filepath, 0));
+	mapping = map_file(path);
+	PROTECT(mapping_xp = R_MakeExternalPtr(mapping, R_NilValue,
+					       R_NilValue));
+	R_RegisterCFinalizerEx(mapping_xp, unmap_PDict_file, TRUE);
+	if (mapping->size < sizeof(PDictFileHeader))
+		error("'%s' is not a PDict file", path);
+	memcpy(&header, mapping->addr, sizeof(PDictFileHeader));
+	if (memcmp(header.magic, PDICTFILE_MAGIC,
+		   sizeof(PDICTFILE_MAGIC)) != 0)
+		error("'%s' is not a PDict file", path);
+	if (header.version != PDICTFILE_VERSION)
+		error("PDict file '%s' has an unsupported version (%d)",
+		      path, header.version);
+	if (header.byte_order != PDICTFILE_BYTE_ORDER)
+		error("PDict file '%s' was written on a machine with "
+		      "a different byte order", path);
+	if (header.narray < 0
+	 || header.narray > (mapping->size - sizeof(PDictFileHeader)) /
+			    sizeof(PDictFileArray))
+		error("PDict file '%s' is truncated or corrupted", path);
+	header_size = sizeof(PDictFileHeader) +
+		      (int64_t) header.narray * sizeof(PDictFileArray);
+	if (!is_within(header.skeleton_offset, header.skeleton_length,
+		       header_size, (int64_t) mapping->size))
+		error("PDict file '%s' is truncated or corrupted", path);
+	array_descs = (const PDictFileArray *)
+		      (mapping->addr + sizeof(PDictFileHeader));
+	PROTECT(ans = NEW_LIST(2));
+	PROTECT(skeleton = NEW_RAW(header.skeleton_length));
+	memcpy(RAW(skeleton), mapping->addr + header.skeleton_offset,
+	       header.skeleton_length);
+	SET_ELEMENT(ans, 0, skeleton);
+	UNPROTECT(1);
+	PROTECT(arrays = NEW_LIST(header.narray));
+	for (i = 0; i < header.narray; i++) {
+		if (array_descs[i].offset % PDICTFILE_ALIGNMENT != 0
+		 || array_descs[i].length < 0
+		 || array_descs[i].length > INT64_MAX / sizeof(int32_t)
+		 || !is_within(array_descs[i].offset,
+			       array_descs[i].length * sizeof(int32_t),
+			       header_size, header.skeleton_offset))
+			error("PDict file '%s' is truncated or corrupted",
+			      path);
+		PROTECT(array = new_mapped_integer(mapping_xp,
+					array_descs[i].offset,
+					array_descs[i].length));
+		SET_ELEMENT(arrays, i, array);
+		UNPROTECT(1);
+	}
+	SET_ELEMENT(ans, 1, arrays);
+	UNPROTECT(3);
+	return ans;
+}
+
+/* --- .Call ENTRY POINT ---
+ * Used for the lookup table of a Twobit object.
+ */
+SEXP new_XInteger_from_mapped_integer(SEXP x)
+{
+	return new_XInteger_from_tag("XInteger", x);
+}
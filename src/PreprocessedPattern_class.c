@@ -0,0 +1,312 @@
+/****************************************************************************
+ *            Basic manipulation of PreprocessedPattern objects             *
+ ****************************************************************************/
+#include "Biostrings.h"
+#include "XVector_interface.h"
+#include "S4Vectors_interface.h"
+
+
+/****************************************************************************
+ * C-level slot getters for PreprocessedPattern objects.
+ *
+ * Be careful that these functions do NOT duplicate the returned slot.
+ * Thus they cannot be made .Call() entry points!
+ */
+
+static SEXP
+	pattern_symbol = NULL,
+	VSGSshift_symbol = NULL,
+	shift0_symbol = NULL,
+	pmaskmap_symbol = NULL,
+	bndm_masks_symbol = NULL,
+	bom_byte2code_symbol = NULL,
+	bom_trans_symbol = NULL,
+	word_layout_symbol = NULL;
+
+static SEXP get_PreprocessedPattern_pattern(SEXP x)
+{
+	INIT_STATIC_SYMBOL(pattern)
+	return GET_SLOT(x, pattern_symbol);
+}
+
+static SEXP get_PreprocessedPattern_VSGSshift(SEXP x)
+{
+	INIT_STATIC_SYMBOL(VSGSshift)
+	return GET_SLOT(x, VSGSshift_symbol);
+}
+
+static SEXP get_PreprocessedPattern_shift0(SEXP x)
+{
+	INIT_STATIC_SYMBOL(shift0)
+	return GET_SLOT(x, shift0_symbol);
+}
+
+static SEXP get_PreprocessedPattern_pmaskmap(SEXP x)
+{
+	INIT_STATIC_SYMBOL(pmaskmap)
+	return GET_SLOT(x, pmaskmap_symbol);
+}
+
+static SEXP get_PreprocessedPattern_bndm_masks(SEXP x)
+{
+	INIT_STATIC_SYMBOL(bndm_masks)
+	return GET_SLOT(x, bndm_masks_symbol);
+}
+
+static SEXP get_PreprocessedPattern_bom_byte2code(SEXP x)
+{
+	INIT_STATIC_SYMBOL(bom_byte2code)
+	return GET_SLOT(x, bom_byte2code_symbol);
+}
+
+static SEXP get_PreprocessedPattern_bom_trans(SEXP x)
+{
+	INIT_STATIC_SYMBOL(bom_trans)
+	return GET_SLOT(x, bom_trans_symbol);
+}
+
+/* Returns R_NilValue if 'x' has no "word_layout" slot. */
+static SEXP get_PreprocessedPattern_word_layout(SEXP x)
+{
+	INIT_STATIC_SYMBOL(word_layout)
+	if (!R_has_slot(x, word_layout_symbol))
+		return R_NilValue;
+	return GET_SLOT(x, word_layout_symbol);
+}
+
+
+/****************************************************************************
+ * Word layout.
+ *
+ * The "shift-or" and "bndm" tables are arrays of native words (unsigned
+ * long) stored in raw vectors so their content depends on the size and
+ * byte order of an unsigned long. The layout of the platform where the
+ * tables were built is stored in the "word_layout" slot. When a
+ * PreprocessedPattern object is used on a platform with another layout
+ * (e.g. after saveRDS() and readRDS()), these 2 tables are rebuilt.
+ */
+
+static void get_native_word_layout(int *layout)
+{
+	unsigned long one = 1UL;
+
+	layout[0] = (int) sizeof(unsigned long);
+	layout[1] = *((const unsigned char *) &one);  /* 1 = little endian */
+	return;
+}
+
+static SEXP new_word_layout()
+{
+	SEXP ans;
+
+	PROTECT(ans = NEW_INTEGER(2));
+	get_native_word_layout(INTEGER(ans));
+	UNPROTECT(1);
+	return ans;
+}
+
+static int has_native_word_layout(SEXP x)
+{
+	SEXP word_layout;
+	int layout[2];
+
+	word_layout = get_PreprocessedPattern_word_layout(x);
+	if (!IS_INTEGER(word_layout) || LENGTH(word_layout) != 2)
+		return 0;
+	get_native_word_layout(layout);
+	return INTEGER(word_layout)[0] == layout[0] &&
+	       INTEGER(word_layout)[1] == layout[1];
+}
+
+
+/****************************************************************************
+ * C-level abstract getters.
+ */
+
+/* A PreprocessedPattern_holder with no tables. */
+PreprocessedPattern_holder _hold_Chars_as_PreprocessedPattern(
+		const Chars_holder *P)
+{
+	PreprocessedPattern_holder ppattern;
+
+	ppattern.P = *P;
+	ppattern.VSGSshift_table = NULL;
+	ppattern.shift0 = 0;
+	ppattern.pmaskmap = NULL;
+	ppattern.bndm_masks = NULL;
+	ppattern.bom_byte2code = NULL;
+	ppattern.bom_nletters = 0;
+	ppattern.bom_trans = NULL;
+	return ppattern;
+}
+
+/*
+ * Adds the "bom" oracle to a PreprocessedPattern_holder that doesn't have
+ * it yet (i.e. the holder of a plain XString object) so it can be reused
+ * across subjects and by worker threads. Uses R_alloc() so must be called
+ * from the main thread.
+ */
+void _add_bom_oracle_to_PreprocessedPattern_holder(
+		PreprocessedPattern_holder *ppattern)
+{
+	const Chars_holder *P;
+	int *byte2code, nletters, *trans, *supply;
+
+	if (ppattern->bom_trans != NULL)
+		return;
+	P = &(ppattern->P);
+	byte2code = (int *) R_alloc(256, sizeof(int));
+	nletters = _bom_nletters(P, byte2code);
+	trans = (int *) R_alloc((long) (P->length + 1) * nletters,
+				sizeof(int));
+	supply = (int *) R_alloc((long) P->length + 1, sizeof(int));
+	_preprocess_pattern_bom(P, byte2code, nletters, trans, supply);
+	ppattern->bom_byte2code = byte2code;
+	ppattern->bom_nletters = nletters;
+	ppattern->bom_trans = trans;
+	return;
+}
+
+/*
+ * 'x' must be a PreprocessedPattern or an XString object. Uses R_alloc()
+ * (see "Word layout" above) so must be called from the main thread.
+ */
+PreprocessedPattern_holder _hold_PreprocessedPattern(SEXP x)
+{
+	PreprocessedPattern_holder ppattern;
+	Chars_holder P;
+	SEXP VSGSshift, pmaskmap, bndm_masks, bom_byte2code, bom_trans;
+	unsigned long *rebuilt_pmaskmap;
+	BitWord *rebuilt_bndm_masks;
+
+	if (strcmp(get_classname(x), "PreprocessedPattern") != 0) {
+		P = hold_XRaw(x);
+		return _hold_Chars_as_PreprocessedPattern(&P);
+	}
+	P = hold_XRaw(get_PreprocessedPattern_pattern(x));
+	ppattern = _hold_Chars_as_PreprocessedPattern(&P);
+	VSGSshift = get_PreprocessedPattern_VSGSshift(x);
+	if (LENGTH(VSGSshift) != 256 * P.length)
+		error("Biostrings internal error in "
+		      "_hold_PreprocessedPattern(): invalid 'x@VSGSshift'");
+	ppattern.VSGSshift_table = INTEGER(VSGSshift);
+	ppattern.shift0 = INTEGER(get_PreprocessedPattern_shift0(x))[0];
+	if (has_native_word_layout(x)) {
+		pmaskmap = get_PreprocessedPattern_pmaskmap(x);
+		if (LENGTH(pmaskmap) != 512 * _shiftor_nword(P.length) *
+					sizeof(unsigned long))
+			error("Biostrings internal error in "
+			      "_hold_PreprocessedPattern(): "
+			      "invalid 'x@pmaskmap'");
+		ppattern.pmaskmap = (const unsigned long *) RAW(pmaskmap);
+		bndm_masks = get_PreprocessedPattern_bndm_masks(x);
+		if (LENGTH(bndm_masks) != 256 * sizeof(BitWord))
+			error("Biostrings internal error in "
+			      "_hold_PreprocessedPattern(): "
+			      "invalid 'x@bndm_masks'");
+		ppattern.bndm_masks = (const BitWord *) RAW(bndm_masks);
+	} else {
+		/* Tables built on a platform with another word layout. */
+		rebuilt_pmaskmap = (unsigned long *)
+			R_alloc((long) 512 * _shiftor_nword(P.length),
+				sizeof(unsigned long));
+		_preprocess_pattern_shiftor(&P, rebuilt_pmaskmap);
+		ppattern.pmaskmap = rebuilt_pmaskmap;
+		rebuilt_bndm_masks = (BitWord *) R_alloc(256, sizeof(BitWord));
+		_preprocess_pattern_bndm(&P, rebuilt_bndm_masks);
+		ppattern.bndm_masks = rebuilt_bndm_masks;
+	}
+	bom_byte2code = get_PreprocessedPattern_bom_byte2code(x);
+	bom_trans = get_PreprocessedPattern_bom_trans(x);
+	if (LENGTH(bom_byte2code) != 256
+	 || LENGTH(bom_trans) % (P.length + 1) != 0)
+		error("Biostrings internal error in "
+		      "_hold_PreprocessedPattern(): invalid 'x@bom_byte2code' "
+		      "or 'x@bom_trans'");
+	ppattern.bom_byte2code = INTEGER(bom_byte2code);
+	ppattern.bom_nletters = LENGTH(bom_trans) / (P.length + 1);
+	ppattern.bom_trans = INTEGER(bom_trans);
+	return ppattern;
+}
+
+
+/****************************************************************************
+ * .Call entry point for preprocessing
+ * -----------------------------------
+ *
+ * Arguments:
+ *   pattern: an XString object.
+ *
+ * Returns an R list with the following elements:
+ *   - VSGSshift: integer vector of length 256 x length(pattern);
+ *   - shift0: single integer;
+ *   - pmaskmap: raw vector;
+ *   - bndm_masks: raw vector (256 BitWords);
+ *   - bom_byte2code: integer vector of length 256;
+ *   - bom_trans: integer vector of length
+ *     (length(pattern) + 1) x nb of distinct letters in 'pattern';
+ *   - word_layout: integer vector of length 2 (see "Word layout" above).
+ */
+
+/* --- .Call ENTRY POINT --- */
+SEXP build_PreprocessedPattern(SEXP pattern)
+{
+	Chars_holder P;
+	SEXP ans, ans_names, ans_elt, byte2code;
+	int shift0, nletters, *supply;
+
+	P = hold_XRaw(pattern);
+	PROTECT(ans = NEW_LIST(7));
+
+	/* set the names */
+	PROTECT(ans_names = NEW_CHARACTER(7));
+	SET_STRING_ELT(ans_names, 0, mkChar("VSGSshift"));
+	SET_STRING_ELT(ans_names, 1, mkChar("shift0"));
+	SET_STRING_ELT(ans_names, 2, mkChar("pmaskmap"));
+	SET_STRING_ELT(ans_names, 3, mkChar("bndm_masks"));
+	SET_STRING_ELT(ans_names, 4, mkChar("bom_byte2code"));
+	SET_STRING_ELT(ans_names, 5, mkChar("bom_trans"));
+	SET_STRING_ELT(ans_names, 6, mkChar("word_layout"));
+	SET_NAMES(ans, ans_names);
+	UNPROTECT(1);
+
+	/* set the "VSGSshift" and "shift0" elements */
+	PROTECT(ans_elt = NEW_INTEGER(256 * P.length));
+	shift0 = _preprocess_pattern_boyermoore(&P, INTEGER(ans_elt));
+	SET_ELEMENT(ans, 0, ans_elt);
+	UNPROTECT(1);
+	SET_ELEMENT(ans, 1, ScalarInteger(shift0));
+
+	/* set the "pmaskmap" element */
+	PROTECT(ans_elt = NEW_RAW(512 * _shiftor_nword(P.length) *
+				  sizeof(unsigned long)));
+	_preprocess_pattern_shiftor(&P, (unsigned long *) RAW(ans_elt));
+	SET_ELEMENT(ans, 2, ans_elt);
+	UNPROTECT(1);
+
+	/* set the "bndm_masks" element */
+	PROTECT(ans_elt = NEW_RAW(256 * sizeof(BitWord)));
+	_preprocess_pattern_bndm(&P, (BitWord *) RAW(ans_elt));
+	SET_ELEMENT(ans, 3, ans_elt);
+	UNPROTECT(1);
+
+	/* set the "bom_byte2code" and "bom_trans" elements */
+	PROTECT(byte2code = NEW_INTEGER(256));
+	nletters = _bom_nletters(&P, INTEGER(byte2code));
+	PROTECT(ans_elt = NEW_INTEGER((P.length + 1) * nletters));
+	supply = (int *) R_alloc((long) P.length + 1, sizeof(int));
+	_preprocess_pattern_bom(&P, INTEGER(byte2code), nletters,
+				INTEGER(ans_elt), supply);
+	SET_ELEMENT(ans, 4, byte2code);
+	SET_ELEMENT(ans, 5, ans_elt);
+	UNPROTECT(2);
+
+	/* set the "word_layout" element */
+	PROTECT(ans_elt = new_word_layout());
+	SET_ELEMENT(ans, 6, ans_elt);
+	UNPROTECT(1);
+
+	UNPROTECT(1);
+	return ans;
+}
+
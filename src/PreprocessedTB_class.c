@@ -81,6 +81,28 @@ SEXP _get_Twobit_sign2pos_tag(SEXP x)
 }
 
 
+/****************************************************************************
+ * C-level slot getters for ACtreeVW objects.
+ *
+ * Be careful that these functions do NOT duplicate the returned slot.
+ * Thus they cannot be made .Call() entry points!
+ */
+
+static SEXP states_symbol = NULL;
+
+static SEXP get_ACtreeVW_states(SEXP x)
+{
+	INIT_STATIC_SYMBOL(states)
+	return GET_SLOT(x, states_symbol);
+}
+
+/* Not a strict "slot getter" but very much like. */
+SEXP _get_ACtreeVW_states_tag(SEXP x)
+{
+	return get_XVector_tag(get_ACtreeVW_states(x));
+}
+
+
 /****************************************************************************
  * C-level slot getters for ACtree2 objects.
  *
@@ -90,7 +112,8 @@ SEXP _get_Twobit_sign2pos_tag(SEXP x)
 
 static SEXP
 	nodebuf_ptr_symbol = NULL,
-	nodeextbuf_ptr_symbol = NULL;
+	nodeextbuf_ptr_symbol = NULL,
+	frozen_ptr_symbol = NULL;
 
 SEXP _get_ACtree2_nodebuf_ptr(SEXP x)
 {
@@ -104,6 +127,16 @@ SEXP _get_ACtree2_nodeextbuf_ptr(SEXP x)
 	return GET_SLOT(x, nodeextbuf_ptr_symbol);
 }
 
+/* Returns R_NilValue if 'x' was serialized before the "frozen_ptr" slot
+   was added to the ACtree2 class. */
+SEXP _get_ACtree2_frozen_ptr(SEXP x)
+{
+	INIT_STATIC_SYMBOL(frozen_ptr)
+	if (!R_has_slot(x, frozen_ptr_symbol))
+		return R_NilValue;
+	return GET_SLOT(x, frozen_ptr_symbol);
+}
+
 
 /****************************************************************************
  * Buffer of duplicates.
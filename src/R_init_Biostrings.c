@@ -26,6 +26,12 @@ static const R_CMethodDef cMethods[] = {
 
 static const R_CallMethodDef callMethods[] = {
 
+/* utils.c */
+	CALLMETHOD_DEF(get_nthreads, 0),
+	CALLMETHOD_DEF(set_nthreads, 1),
+	CALLMETHOD_DEF(get_traceback_memory_limit, 0),
+	CALLMETHOD_DEF(set_traceback_memory_limit, 1),
+
 /* XString_class.c */
 	CALLMETHOD_DEF(init_DNAlkups, 2),
 	CALLMETHOD_DEF(init_RNAlkups, 2),
@@ -89,12 +95,19 @@ static const R_CallMethodDef callMethods[] = {
 	CALLMETHOD_DEF(XStringSet_vmatch_pattern_at, 10),
 	CALLMETHOD_DEF(XStringSet_dist_hamming, 1),
 
+/* PreprocessedPattern_class.c */
+	CALLMETHOD_DEF(build_PreprocessedPattern, 1),
+
+/* match_pattern_naive.c */
+	CALLMETHOD_DEF(naive_simd_level, 0),
+
 /* match_pattern_shiftor.c */
 	CALLMETHOD_DEF(bits_per_long, 0),
 
 /* match_pattern.c */
 	CALLMETHOD_DEF(XString_match_pattern, 8),
 	CALLMETHOD_DEF(XStringViews_match_pattern, 10),
+	CALLMETHOD_DEF(XStringViews_stream_pattern, 13),
 	CALLMETHOD_DEF(XStringSet_vmatch_pattern, 8),
 
 /* match_PWM.c */
@@ -106,30 +119,53 @@ static const R_CallMethodDef callMethods[] = {
 	CALLMETHOD_DEF(find_palindromes, 5),
 	CALLMETHOD_DEF(palindrome_arm_length, 3),
 
+/* match_pdict_utils.c */
+	CALLMETHOD_DEF(set_headtail_engine, 1),
+
 /* match_pdict_Twobit.c */
 	CALLMETHOD_DEF(build_Twobit, 3),
 
+/* match_pdict_ACtreeVW.c */
+	CALLMETHOD_DEF(ACtreeVW_build, 3),
+
 /* BAB_class.c */
 	CALLMETHOD_DEF(IntegerBAB_new, 1),
+	CALLMETHOD_DEF(IntegerBAB_get_blocks, 1),
+	CALLMETHOD_DEF(IntegerBAB_set_blocks, 3),
 
 /* match_pdict_ACtree2.c */
 	CALLMETHOD_DEF(ACtree2_nodebuf_max_nblock, 0),
 	CALLMETHOD_DEF(ACtree2_nodeextbuf_max_nblock, 0),
 	CALLMETHOD_DEF(ACtree2_nnodes, 1),
 	CALLMETHOD_DEF(ACtree2_print_nodes, 1),
+	CALLMETHOD_DEF(ACtree2_nodes, 1),
 	CALLMETHOD_DEF(ACtree2_summary, 1),
+	CALLMETHOD_DEF(set_ACtree2_builder, 1),
 	CALLMETHOD_DEF(ACtree2_build, 5),
 	CALLMETHOD_DEF(ACtree2_has_all_flinks, 1),
 	CALLMETHOD_DEF(ACtree2_compute_all_flinks, 1),
+	CALLMETHOD_DEF(ACtree2_is_frozen, 1),
+	CALLMETHOD_DEF(ACtree2_freeze, 1),
+
+/* PDict_io.c */
+	CALLMETHOD_DEF(write_PDict_file, 3),
+	CALLMETHOD_DEF(map_PDict_file, 1),
+	CALLMETHOD_DEF(new_XInteger_from_mapped_integer, 1),
 
 /* match_pdict.c */
-	CALLMETHOD_DEF(match_PDict3Parts_XString, 9),
+	CALLMETHOD_DEF(match_PDict3Parts_XString, 10),
 	CALLMETHOD_DEF(match_XStringSet_XString, 9),
-	CALLMETHOD_DEF(match_PDict3Parts_XStringViews, 11),
+	CALLMETHOD_DEF(match_PDict3Parts_XStringViews, 12),
 	CALLMETHOD_DEF(match_XStringSet_XStringViews, 11),
+	CALLMETHOD_DEF(stream_PDict3Parts_XStringViews, 14),
+	CALLMETHOD_DEF(stream_XStringSet_XStringViews, 13),
 	CALLMETHOD_DEF(vmatch_PDict3Parts_XStringSet, 11),
 	CALLMETHOD_DEF(vmatch_XStringSet_XStringSet, 11),
 
+/* match_pdict_seeds.c */
+	CALLMETHOD_DEF(match_seeds_XString, 9),
+	CALLMETHOD_DEF(match_seeds_XStringViews, 11),
+
 /* align_utils.c */
 	CALLMETHOD_DEF(PairwiseAlignments_nmatch, 4),
 	CALLMETHOD_DEF(AlignedXStringSet_nchar, 1),
@@ -142,7 +178,7 @@ static const R_CallMethodDef callMethods[] = {
 	CALLMETHOD_DEF(lcsuffix, 6),
 
 /* align_pairwiseAlignment.c */
-	CALLMETHOD_DEF(XStringSet_align_pairwiseAlignment, 14),
+	CALLMETHOD_DEF(XStringSet_align_pairwiseAlignment, 15),
 	CALLMETHOD_DEF(XStringSet_align_distance, 12),
 
 /* align_needwunsQS.c */
@@ -165,6 +201,7 @@ void R_init_Biostrings(DllInfo *info)
 	_init_bytewise_match_tables();
 	R_registerRoutines(info, cMethods, NULL, NULL, NULL);
 	R_registerRoutines(info, NULL, callMethods, NULL, NULL);
+	_init_mapped_integer_class(info);
 
 /* XString_class.c */
 	REGISTER_CCALLABLE(_DNAencode);
@@ -186,6 +223,16 @@ void R_init_Biostrings(DllInfo *info)
 	REGISTER_CCALLABLE(_get_elt_from_XStringSetList_holder);
 
 /* match_reporting.c */
+	REGISTER_CCALLABLE(_new_MatchReporter);
+	REGISTER_CCALLABLE(_MatchReporter_set_active_PSpair);
+	REGISTER_CCALLABLE(_MatchReporter_set_match_shift);
+	REGISTER_CCALLABLE(_MatchReporter_report_match);
+	REGISTER_CCALLABLE(_MatchReporter_drop_reported_matches);
+	REGISTER_CCALLABLE(_MatchReporter_get_match_count);
+	REGISTER_CCALLABLE(_MatchReporter_reported_matches_asSEXP);
+	REGISTER_CCALLABLE(_new_MatchSink);
+	REGISTER_CCALLABLE(_MatchReporter_set_sink);
+	REGISTER_CCALLABLE(_MatchSink_flush);
 	REGISTER_CCALLABLE(_init_match_reporting);
 	REGISTER_CCALLABLE(_set_active_PSpair);
 	REGISTER_CCALLABLE(_set_match_shift);
@@ -202,6 +249,7 @@ void R_init_Biostrings(DllInfo *info)
 
 /* match_pattern_boyermoore.c */
 	REGISTER_CCALLABLE(_match_pattern_boyermoore);
+	REGISTER_CCALLABLE(_match_pattern_boyermoore_to_reporter);
 
 	return;
 }
@@ -0,0 +1,422 @@
+/****************************************************************************
+ *         INTER-SEQUENCE SIMD KERNELS FOR MANY-PATTERNS PAIRWISE ALIGNMENT *
+ ****************************************************************************/
+#include "Biostrings.h"
+
+#include <stdlib.h>  /* for malloc() and free() */
+#include <string.h>  /* for memset() and memcpy() */
+
+/*
+ * These kernels align a batch of patterns against the same subject, one
+ * pattern per lane of the vectors (Rognes, BMC Bioinformatics 2011), so
+ * there is no dependency between the lanes at all. This is the layout of
+ * choice for many short patterns, and since each lane walks the DP matrix
+ * exactly like the scalar code, the kernels can also produce the
+ * traceback matrices of the full alignments.
+ *
+ * Like the striped kernels (see align_striped.c), they work on integers
+ * with no saturating arithmetic and give up (return 0) when the scores get
+ * too big for the lanes. The widest lanes are tried first: 32 x 16-bit
+ * lanes with AVX-512BW, 16 with AVX2 and 8 with SSE2, then half as many
+ * 32-bit lanes.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD_KERNELS 1
+#include <immintrin.h>
+#endif
+
+#define SIMD_NONE 0
+#define SIMD_SSE2 1
+#define SIMD_AVX2 2
+#define SIMD_AVX512 3
+
+/* 16-bit lanes. The row and column numbers must also fit in a lane. */
+#define SCORE_LIMIT16 8192
+#define SCORE_NEG16 (-24576)
+#define MAX_MAXSTEP16 512
+#define MAX_NROW16 32766
+
+/* 32-bit lanes */
+#define SCORE_LIMIT32 8388608
+#define SCORE_NEG32 (-536870912)
+#define MAX_MAXSTEP32 262144
+
+static int simd_level(void)
+{
+#ifdef HAVE_X86_SIMD_KERNELS
+	if (__builtin_cpu_supports("avx512bw"))
+		return SIMD_AVX512;
+	if (__builtin_cpu_supports("avx2"))
+		return SIMD_AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return SIMD_SSE2;
+#endif
+	return SIMD_NONE;
+}
+
+#ifdef HAVE_X86_SIMD_KERNELS
+
+/* SSE2 has no 32-bit max/min */
+__attribute__((target("sse2")))
+static inline __m128i sse2_max_epi32(__m128i a, __m128i b)
+{
+	__m128i m = _mm_cmpgt_epi32(a, b);
+	return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i sse2_min_epi32(__m128i a, __m128i b)
+{
+	__m128i m = _mm_cmpgt_epi32(a, b);
+	return _mm_or_si128(_mm_and_si128(m, b), _mm_andnot_si128(m, a));
+}
+
+__attribute__((target("sse2")))
+static inline void sse2_store4(char *p, __m128i v)
+{
+	int x = _mm_cvtsi128_si32(v);
+	memcpy(p, &x, sizeof(int));
+}
+
+#define VEC_T __m128i
+#define VMASK_T __m128i
+#define VLOAD(p) _mm_load_si128(p)
+#define VSTORE(p, v) _mm_store_si128((p), (v))
+#define VBLEND(m, a, b) \
+	_mm_or_si128(_mm_and_si128((m), (a)), _mm_andnot_si128((m), (b)))
+#define VMASK_ANDNOT(m1, m2) _mm_andnot_si128((m1), (m2))
+#define VANY(m) _mm_movemask_epi8(m)
+#define TARGET "sse2"
+
+#define KERNEL batch_align_sse2_16
+#define LANE_T short
+#define NLANES 8
+#define VSET1(x) _mm_set1_epi16(x)
+#define VADD _mm_add_epi16
+#define VSUB _mm_sub_epi16
+#define VMAX _mm_max_epi16
+#define VMIN _mm_min_epi16
+#define VCMPGT _mm_cmpgt_epi16
+#define VCMPEQ _mm_cmpeq_epi16
+#define VSTORE_CODES(p, v) \
+	_mm_storel_epi64((__m128i *) (p), _mm_packus_epi16((v), (v)))
+#define SCORE_LIMIT SCORE_LIMIT16
+#define SCORE_NEG SCORE_NEG16
+#include "align_batch_kernel.h"
+#undef KERNEL
+#undef LANE_T
+#undef NLANES
+#undef VSET1
+#undef VADD
+#undef VSUB
+#undef VMAX
+#undef VMIN
+#undef VCMPGT
+#undef VCMPEQ
+#undef VSTORE_CODES
+#undef SCORE_LIMIT
+#undef SCORE_NEG
+
+#define KERNEL batch_align_sse2_32
+#define LANE_T int
+#define NLANES 4
+#define VSET1(x) _mm_set1_epi32(x)
+#define VADD _mm_add_epi32
+#define VSUB _mm_sub_epi32
+#define VMAX sse2_max_epi32
+#define VMIN sse2_min_epi32
+#define VCMPGT _mm_cmpgt_epi32
+#define VCMPEQ _mm_cmpeq_epi32
+#define VSTORE_CODES(p, v) \
+	sse2_store4((p), _mm_packus_epi16(_mm_packs_epi32((v), (v)), \
+					  _mm_setzero_si128()))
+#define SCORE_LIMIT SCORE_LIMIT32
+#define SCORE_NEG SCORE_NEG32
+#include "align_batch_kernel.h"
+#undef KERNEL
+#undef LANE_T
+#undef NLANES
+#undef VSET1
+#undef VADD
+#undef VSUB
+#undef VMAX
+#undef VMIN
+#undef VCMPGT
+#undef VCMPEQ
+#undef VSTORE_CODES
+#undef SCORE_LIMIT
+#undef SCORE_NEG
+
+#undef VEC_T
+#undef VMASK_T
+#undef VLOAD
+#undef VSTORE
+#undef VBLEND
+#undef VMASK_ANDNOT
+#undef VANY
+#undef TARGET
+
+#define VEC_T __m256i
+#define VMASK_T __m256i
+#define VLOAD(p) _mm256_load_si256(p)
+#define VSTORE(p, v) _mm256_store_si256((p), (v))
+#define VBLEND(m, a, b) _mm256_blendv_epi8((b), (a), (m))
+#define VMASK_ANDNOT(m1, m2) _mm256_andnot_si256((m1), (m2))
+#define VANY(m) _mm256_movemask_epi8(m)
+#define TARGET "avx2"
+
+#define KERNEL batch_align_avx2_16
+#define LANE_T short
+#define NLANES 16
+#define VSET1(x) _mm256_set1_epi16(x)
+#define VADD _mm256_add_epi16
+#define VSUB _mm256_sub_epi16
+#define VMAX _mm256_max_epi16
+#define VMIN _mm256_min_epi16
+#define VCMPGT _mm256_cmpgt_epi16
+#define VCMPEQ _mm256_cmpeq_epi16
+#define VSTORE_CODES(p, v) \
+	_mm_storeu_si128((__m128i *) (p), \
+		_mm_packus_epi16(_mm256_castsi256_si128(v), \
+				 _mm256_extracti128_si256((v), 1)))
+#define SCORE_LIMIT SCORE_LIMIT16
+#define SCORE_NEG SCORE_NEG16
+#include "align_batch_kernel.h"
+#undef KERNEL
+#undef LANE_T
+#undef NLANES
+#undef VSET1
+#undef VADD
+#undef VSUB
+#undef VMAX
+#undef VMIN
+#undef VCMPGT
+#undef VCMPEQ
+#undef VSTORE_CODES
+#undef SCORE_LIMIT
+#undef SCORE_NEG
+
+#define KERNEL batch_align_avx2_32
+#define LANE_T int
+#define NLANES 8
+#define VSET1(x) _mm256_set1_epi32(x)
+#define VADD _mm256_add_epi32
+#define VSUB _mm256_sub_epi32
+#define VMAX _mm256_max_epi32
+#define VMIN _mm256_min_epi32
+#define VCMPGT _mm256_cmpgt_epi32
+#define VCMPEQ _mm256_cmpeq_epi32
+#define VSTORE_CODES(p, v) \
+	_mm_storel_epi64((__m128i *) (p), \
+		_mm_packus_epi16(_mm_packs_epi32(_mm256_castsi256_si128(v), \
+				 _mm256_extracti128_si256((v), 1)), \
+				 _mm_setzero_si128()))
+#define SCORE_LIMIT SCORE_LIMIT32
+#define SCORE_NEG SCORE_NEG32
+#include "align_batch_kernel.h"
+#undef KERNEL
+#undef LANE_T
+#undef NLANES
+#undef VSET1
+#undef VADD
+#undef VSUB
+#undef VMAX
+#undef VMIN
+#undef VCMPGT
+#undef VCMPEQ
+#undef VSTORE_CODES
+#undef SCORE_LIMIT
+#undef SCORE_NEG
+
+#undef VEC_T
+#undef VMASK_T
+#undef VLOAD
+#undef VSTORE
+#undef VBLEND
+#undef VMASK_ANDNOT
+#undef VANY
+#undef TARGET
+
+#define VEC_T __m512i
+#define VLOAD(p) _mm512_load_si512(p)
+#define VSTORE(p, v) _mm512_store_si512((p), (v))
+#define VMASK_ANDNOT(m1, m2) (~(m1) & (m2))
+#define VANY(m) ((m) != 0)
+#define TARGET "avx512f,avx512bw"
+
+#define KERNEL batch_align_avx512_16
+#define VMASK_T __mmask32
+#define LANE_T short
+#define NLANES 32
+#define VSET1(x) _mm512_set1_epi16(x)
+#define VADD _mm512_add_epi16
+#define VSUB _mm512_sub_epi16
+#define VMAX _mm512_max_epi16
+#define VMIN _mm512_min_epi16
+#define VCMPGT _mm512_cmpgt_epi16_mask
+#define VCMPEQ _mm512_cmpeq_epi16_mask
+#define VBLEND(m, a, b) _mm512_mask_blend_epi16((m), (b), (a))
+#define VSTORE_CODES(p, v) \
+	_mm256_storeu_si256((__m256i *) (p), _mm512_cvtepi16_epi8(v))
+#define SCORE_LIMIT SCORE_LIMIT16
+#define SCORE_NEG SCORE_NEG16
+#include "align_batch_kernel.h"
+#undef KERNEL
+#undef VMASK_T
+#undef LANE_T
+#undef NLANES
+#undef VSET1
+#undef VADD
+#undef VSUB
+#undef VMAX
+#undef VMIN
+#undef VCMPGT
+#undef VCMPEQ
+#undef VBLEND
+#undef VSTORE_CODES
+#undef SCORE_LIMIT
+#undef SCORE_NEG
+
+#define KERNEL batch_align_avx512_32
+#define VMASK_T __mmask16
+#define LANE_T int
+#define NLANES 16
+#define VSET1(x) _mm512_set1_epi32(x)
+#define VADD _mm512_add_epi32
+#define VSUB _mm512_sub_epi32
+#define VMAX _mm512_max_epi32
+#define VMIN _mm512_min_epi32
+#define VCMPGT _mm512_cmpgt_epi32_mask
+#define VCMPEQ _mm512_cmpeq_epi32_mask
+#define VBLEND(m, a, b) _mm512_mask_blend_epi32((m), (b), (a))
+#define VSTORE_CODES(p, v) \
+	_mm_storeu_si128((__m128i *) (p), _mm512_cvtepi32_epi8(v))
+#define SCORE_LIMIT SCORE_LIMIT32
+#define SCORE_NEG SCORE_NEG32
+#include "align_batch_kernel.h"
+#undef KERNEL
+#undef VMASK_T
+#undef LANE_T
+#undef NLANES
+#undef VSET1
+#undef VADD
+#undef VSUB
+#undef VMAX
+#undef VMIN
+#undef VCMPGT
+#undef VCMPEQ
+#undef VBLEND
+#undef VSTORE_CODES
+#undef SCORE_LIMIT
+#undef SCORE_NEG
+
+#undef VEC_T
+#undef VLOAD
+#undef VSTORE
+#undef VMASK_ANDNOT
+#undef VANY
+#undef TARGET
+
+typedef int (*BatchKernel)(const BatchAlignment *ba, int first, int nlane,
+			   void *ws, char *traceBuf);
+
+/*
+ * Runs 'kernel' on the patterns of the batch, 'nlanes' at a time, with a
+ * 64-byte aligned workspace. Returns 0 as soon as the kernel fails on a
+ * group of patterns.
+ */
+static int run_batch_kernel(BatchKernel kernel, const BatchAlignment *ba,
+		int nlanes, size_t lane_size)
+{
+	size_t nvec, ntrace;
+	char *buf, *traceBuf;
+	void *ws;
+	int first, nlane, ok;
+
+	/* the profile + S, D, I (2 columns each) */
+	nvec = (size_t) ba->nkey * ba->nrow + 6 * ((size_t) ba->nrow + 1);
+	buf = (char *) malloc(nvec * nlanes * lane_size + ba->nrow + 1 + 64);
+	if (buf == NULL)
+		return 0;
+	ws = buf + (64 - ((size_t) buf & 63));
+	ntrace = 3 * (size_t) ba->nrow * ba->ncol;
+	ok = 1;
+	for (first = 0; ok && first < ba->npattern; first += nlanes) {
+		nlane = ba->npattern - first;
+		if (nlane > nlanes)
+			nlane = nlanes;
+		traceBuf = ba->traceBuf == NULL ? NULL :
+			   ba->traceBuf + ntrace * first;
+		ok = kernel(ba, first, nlane, ws, traceBuf);
+	}
+	free(buf);
+	return ok;
+}
+
+#endif  /* HAVE_X86_SIMD_KERNELS */
+
+/*
+ * The max nb of patterns in a batch, or 0 if the inter-sequence kernels are
+ * not available.
+ */
+int _batch_align_width(void)
+{
+	switch (simd_level()) {
+	    case SIMD_AVX512: return 32;
+	    case SIMD_AVX2: return 16;
+	    case SIMD_SSE2: return 8;
+	}
+	return 0;
+}
+
+/*
+ * Returns 1 if the kernels could align all the patterns of the batch, 0 if
+ * the caller must align them with the floating point DP. Like
+ * _striped_align_score(), never raises an error.
+ */
+int _batch_align(const BatchAlignment *ba)
+{
+	int level;
+
+	level = simd_level();
+	if (level == SIMD_NONE || ba->npattern < 1
+	 || ba->npattern > _batch_align_width()
+	 || ba->nrow < 1 || ba->ncol < 1)
+		return 0;
+#ifdef HAVE_X86_SIMD_KERNELS
+	if (ba->maxstep <= MAX_MAXSTEP16
+	 && ba->nrow <= MAX_NROW16 && ba->ncol <= MAX_NROW16) {
+		switch (level) {
+		    case SIMD_AVX512:
+			if (run_batch_kernel(batch_align_avx512_16, ba,
+					     32, sizeof(short)))
+				return 1;
+			break;
+		    case SIMD_AVX2:
+			if (run_batch_kernel(batch_align_avx2_16, ba,
+					     16, sizeof(short)))
+				return 1;
+			break;
+		    default:
+			if (run_batch_kernel(batch_align_sse2_16, ba,
+					     8, sizeof(short)))
+				return 1;
+		}
+	}
+	if (ba->maxstep <= MAX_MAXSTEP32) {
+		switch (level) {
+		    case SIMD_AVX512:
+			return run_batch_kernel(batch_align_avx512_32, ba,
+						16, sizeof(int));
+		    case SIMD_AVX2:
+			return run_batch_kernel(batch_align_avx2_32, ba,
+						8, sizeof(int));
+		    default:
+			return run_batch_kernel(batch_align_sse2_32, ba,
+						4, sizeof(int));
+		}
+	}
+#endif
+	return 0;
+}
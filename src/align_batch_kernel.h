@@ -0,0 +1,294 @@
+/*
+ * Template for the inter-sequence kernels of align_batch.c. It is included
+ * once per instruction set and lane width with the following macros
+ * defined:
+ *   KERNEL        name of the function
+ *   TARGET        its 'target' function attribute (e.g. "avx2")
+ *   LANE_T        type of a lane (short or int)
+ *   NLANES        nb of lanes per vector
+ *   VEC_T         the vector type
+ *   VMASK_T       the type of a comparison result
+ *   VSET1(x)      all the lanes set to x
+ *   VADD, VSUB, VMAX, VMIN
+ *                 lane by lane operations
+ *   VCMPGT, VCMPEQ
+ *                 lane by lane comparisons (return a VMASK_T)
+ *   VBLEND(m, a, b)
+ *                 a where m is set, b elsewhere
+ *   VMASK_ANDNOT(m1, m2)
+ *                 m2 and not m1
+ *   VANY(m)       nonzero if any lane of m is set
+ *   VLOAD, VSTORE aligned load and store
+ *   VSTORE_CODES(p, v)
+ *                 stores the NLANES lanes of v (all < 128) as bytes at p
+ *   SCORE_LIMIT   see align_striped.c
+ *   SCORE_NEG
+ *
+ * The recurrence and the traceback codes are exactly those of the full
+ * alignment branch of pairwiseAlignment() (see align_pairwiseAlignment.c),
+ * including the tie breaking rules, so the traceback gives the same
+ * alignments. Lane l aligns pattern 'first + l'. The rows beyond the end of
+ * a pattern are computed like the others (with a substitution score of 0)
+ * but never used.
+ *
+ * The body is inlined twice in KERNEL() so the score-only version doesn't
+ * compute the traceback codes at all.
+ */
+
+#define BATCH_CAT_(a, b) a ## b
+#define BATCH_CAT(a, b) BATCH_CAT_(a, b)
+#define KERNEL_BODY BATCH_CAT(KERNEL, _body)
+
+__attribute__((always_inline, target(TARGET)))
+static inline int KERNEL_BODY(const BatchAlignment *ba, int first, int nlane,
+			      void *ws, char *traceBuf, const int withTrace)
+{
+	const int nrow = ba->nrow, ncol = ba->ncol, go = ba->gapOpening,
+		  ge = ba->gapExtension, local = ba->local,
+		  noEndGap1 = !ba->endGap1, noEndGap2 = !ba->endGap2;
+	int key, i, j, l, p, n1, lastCol;
+	size_t plane, offset;
+	char *rowEnds, *sTrace, *dTrace, *iTrace;
+	VEC_T *prof, *vP, *prevS, *prevD, *prevI, *currS, *currD, *currI, *tmp;
+	VEC_T vS, vD, vI, vPS, vPD, vPI, vT, vRow, vCol, vN1, vN1Plus1,
+	      vBest, vBestRow, vBestCol, vFinS, vFinD, vFinI, vMin, vMax,
+	      vCodeS, vCodeD, vCodeI, vCodeT, vZero, vNeg, vGo, vGe,
+	      vEndGapGe, vLimit, vMinusLimit, vS_, vD_, vI_;
+	VMASK_T m;
+	LANE_T lanes[NLANES] __attribute__((aligned(64))),
+	       lanes2[NLANES] __attribute__((aligned(64))),
+	       lanes3[NLANES] __attribute__((aligned(64)));
+
+	prof = (VEC_T *) ws;
+	prevS = prof + (size_t) ba->nkey * nrow;
+	prevD = prevS + nrow + 1;
+	prevI = prevD + nrow + 1;
+	currS = prevI + nrow + 1;
+	currD = currS + nrow + 1;
+	currI = currD + nrow + 1;
+	rowEnds = (char *) (currI + nrow + 1);
+
+	/* The profile: the substitution scores of row i of the patterns vs
+	   each key of the subject */
+	for (key = 0, vP = prof; key < ba->nkey; key++) {
+		for (i = 0; i < nrow; i++, vP++) {
+			for (l = 0; l < NLANES; l++) {
+				p = first + l;
+				lanes[l] = l < nlane && i < ba->nrows[p] ?
+				    ba->sub[((size_t) key * nrow + i) *
+					    ba->npattern + p] : 0;
+			}
+			VSTORE(vP, VLOAD((VEC_T *) lanes));
+		}
+	}
+	memset(rowEnds, 0, nrow + 1);
+	for (l = 0; l < NLANES; l++) {
+		n1 = l < nlane ? ba->nrows[first + l] : 0;
+		lanes[l] = n1;
+		rowEnds[n1] = 1;
+	}
+	vN1 = VLOAD((VEC_T *) lanes);
+	vN1Plus1 = VADD(vN1, VSET1(1));
+
+	/* Column 0 */
+	if (ba->endGap1 && go + (double) nrow * ge > SCORE_LIMIT)
+		return 0;
+	vNeg = VSET1(SCORE_NEG);
+	VSTORE(prevS, VSET1(0));
+	VSTORE(prevD, VSET1(ba->endGap2 ? - go : 0));
+	for (i = 0; i <= nrow; i++) {
+		if (i > 0) {
+			VSTORE(prevS + i, vNeg);
+			VSTORE(prevD + i, vNeg);
+		}
+		VSTORE(prevI + i, VSET1(ba->endGap1 ? - go - i * ge : 0));
+	}
+
+	vZero = VSET1(0);
+	vGo = VSET1(go);
+	vGe = VSET1(ge);
+	vEndGapGe = VSET1(ba->endGap2 ? ge : 0);
+	vLimit = VSET1(SCORE_LIMIT);
+	vMinusLimit = VSET1(- SCORE_LIMIT);
+	vCodeS = VSET1('S');
+	vCodeD = VSET1('D');
+	vCodeI = VSET1('I');
+	vCodeT = VSET1('T');
+	vMin = vZero;
+	vMax = vZero;
+	vBest = VSET1(-1);
+	vBestRow = vZero;
+	vBestCol = vZero;
+	vFinS = vFinD = vFinI = vZero;
+	sTrace = dTrace = iTrace = NULL;
+	if (traceBuf != NULL) {
+		plane = (size_t) nrow * ncol * NLANES;
+		sTrace = traceBuf;
+		dTrace = sTrace + plane;
+		iTrace = dTrace + plane;
+	}
+	for (j = 1; j <= ncol; j++) {
+		if (ba->endGap2 && go + (double) j * ge > SCORE_LIMIT)
+			return 0;
+		lastCol = j == ncol;
+		vP = prof + (size_t) ba->col2key[j - 1] * nrow;
+		vCol = VSET1(j);
+		VSTORE(currS, vNeg);
+		VSTORE(currD, VSUB(VLOAD(prevD), vEndGapGe));
+		VSTORE(currI, vNeg);
+		for (i = 1; i <= nrow; i++) {
+			/* (0) substitution */
+			vPS = VLOAD(prevS + i - 1);
+			vPD = VLOAD(prevD + i - 1);
+			vPI = VLOAD(prevI + i - 1);
+			vT = VMAX(vPD, vPI);
+			vS = VADD(VMAX(vPS, vT), VLOAD(vP + i - 1));
+			if (withTrace)
+				vS_ = VBLEND(VCMPGT(vT, vPS),
+					VBLEND(VCMPGT(vPI, vPD), vCodeI, vCodeD),
+					vCodeS);
+			/* (1) deletion */
+			vPS = VLOAD(prevS + i);
+			vPD = VLOAD(prevD + i);
+			vPI = VLOAD(prevI + i);
+			vT = VSUB(VMAX(vPS, vPI), vGo);
+			vD = VSUB(VMAX(vPD, vT), vGe);
+			if (withTrace)
+				vD_ = VBLEND(VCMPGT(vPD, vT), vCodeD,
+					VBLEND(VCMPGT(vPI, vPS), vCodeI, vCodeS));
+			/* (2) insertion */
+			vPS = VLOAD(currS + i - 1);
+			vPD = VLOAD(currD + i - 1);
+			vPI = VLOAD(currI + i - 1);
+			vT = VSUB(VMAX(vPS, vPD), vGo);
+			vI = VSUB(VMAX(vPI, vT), vGe);
+			if (withTrace)
+				vI_ = VBLEND(VCMPGT(vPI, vT), vCodeI,
+					VBLEND(VCMPGT(vPD, vPS), vCodeD, vCodeS));
+			vRow = VSET1(i);
+			if (local) {
+				if (withTrace) {
+					vS_ = VBLEND(VCMPGT(vS, vZero), vS_, vCodeT);
+					vD_ = VBLEND(VCMPGT(vD, vZero), vD_, vCodeT);
+					vI_ = VBLEND(VCMPGT(vI, vZero), vI_, vCodeT);
+				}
+				vS = VMAX(vS, vZero);
+				vD = VMAX(vD, vZero);
+				vI = VMAX(vI, vZero);
+				m = VMASK_ANDNOT(VCMPGT(vBest, vS),
+						 VCMPGT(vN1Plus1, vRow));
+				vBest = VBLEND(m, vS, vBest);
+				if (withTrace) {
+					vBestRow = VBLEND(m, vRow, vBestRow);
+					vBestCol = VBLEND(m, vCol, vBestCol);
+				}
+			}
+			/* No end gap penalty in the subject: the deletions in
+			   the last row of each pattern are free */
+			if (noEndGap2 && rowEnds[i]) {
+				m = VCMPEQ(vN1, vRow);
+				vPS = VLOAD(prevS + i);
+				vPD = VLOAD(prevD + i);
+				vPI = VLOAD(prevI + i);
+				vT = VMAX(vPS, vPI);
+				vD = VBLEND(m, VMAX(vPD, vT), vD);
+				if (withTrace)
+					vD_ = VBLEND(m, VBLEND(VCMPGT(vT, vPD),
+						VBLEND(VCMPGT(vPI, vPS),
+						       vCodeI, vCodeS),
+						vCodeD), vD_);
+			}
+			/* No end gap penalty in the pattern: the insertions in
+			   the last column are free */
+			if (noEndGap1 && lastCol) {
+				vPS = VLOAD(currS + i - 1);
+				vPD = VLOAD(currD + i - 1);
+				vPI = VLOAD(currI + i - 1);
+				vT = VMAX(vPS, vPD);
+				vI = VMAX(vT, vPI);
+				if (withTrace)
+					vI_ = VBLEND(VCMPGT(vT, vPI),
+						VBLEND(VCMPGT(vPD, vPS),
+						       vCodeD, vCodeS),
+						vCodeI);
+			}
+			VSTORE(currS + i, vS);
+			VSTORE(currD + i, vD);
+			VSTORE(currI + i, vI);
+			vMax = VMAX(vMax, VMAX(VMAX(vS, vD), vI));
+			vMin = VMIN(vMin, VMIN(VMIN(vS, vD), vI));
+			if (withTrace) {
+				offset = ((size_t) (i - 1) + (size_t) nrow * (j - 1))
+					 * NLANES;
+				VSTORE_CODES(sTrace + offset, vS_);
+				VSTORE_CODES(dTrace + offset, vD_);
+				VSTORE_CODES(iTrace + offset, vI_);
+			}
+			if (lastCol && !local && rowEnds[i]) {
+				m = VCMPEQ(vN1, vRow);
+				vFinS = VBLEND(m, vS, vFinS);
+				vFinD = VBLEND(m, vD, vFinD);
+				vFinI = VBLEND(m, vI, vFinI);
+			}
+		}
+		tmp = prevS; prevS = currS; currS = tmp;
+		tmp = prevD; prevD = currD; currD = tmp;
+		tmp = prevI; prevI = currI; currI = tmp;
+		if ((j % 16 == 0 || lastCol)
+		 && (VANY(VCMPGT(vMax, vLimit)) ||
+		     VANY(VCMPGT(vMinusLimit, vMin))))
+			return 0;
+	}
+
+	if (local) {
+		VSTORE((VEC_T *) lanes, vBest);
+		VSTORE((VEC_T *) lanes2, vBestRow);
+		VSTORE((VEC_T *) lanes3, vBestCol);
+		for (l = 0; l < nlane; l++) {
+			p = first + l;
+			ba->score[p] = (double) lanes[l];
+			ba->traceStart[p] = lanes[l] == 0 ? 'T' : 'S';
+			ba->startRange1[p] = ba->nrows[p] - lanes2[l] + 1;
+			ba->startRange2[p] = ncol - lanes3[l] + 1;
+		}
+	} else {
+		VSTORE((VEC_T *) lanes, vFinS);
+		VSTORE((VEC_T *) lanes2, vFinD);
+		VSTORE((VEC_T *) lanes3, vFinI);
+		for (l = 0; l < nlane; l++) {
+			p = first + l;
+			if (lanes[l] >= lanes2[l] && lanes[l] >= lanes3[l]) {
+				ba->traceStart[p] = 'S';
+				ba->score[p] = (double) lanes[l];
+			} else if (lanes2[l] >= lanes3[l]) {
+				ba->traceStart[p] = 'D';
+				ba->score[p] = (double) lanes2[l];
+			} else {
+				ba->traceStart[p] = 'I';
+				ba->score[p] = (double) lanes3[l];
+			}
+			ba->startRange1[p] = ba->startRange2[p] = 1;
+		}
+	}
+	if (withTrace) {
+		for (l = 0; l < nlane; l++) {
+			p = first + l;
+			ba->sTrace[p] = sTrace + l;
+			ba->dTrace[p] = dTrace + l;
+			ba->iTrace[p] = iTrace + l;
+			ba->traceStride[p] = NLANES;
+		}
+	}
+	return 1;
+}
+
+__attribute__((target(TARGET)))
+static int KERNEL(const BatchAlignment *ba, int first, int nlane, void *ws,
+		  char *traceBuf)
+{
+	if (traceBuf != NULL)
+		return KERNEL_BODY(ba, first, nlane, ws, traceBuf, 1);
+	return KERNEL_BODY(ba, first, nlane, ws, NULL, 0);
+}
+
+#undef KERNEL_BODY
@@ -11,7 +11,6 @@
 
 #define POSITIVE_INFINITY R_PosInf
 #define NEGATIVE_INFINITY R_NegInf
-#define MAX_BUF_SIZE      1048576
 
 #define       GLOBAL_ALIGNMENT 1
 #define        LOCAL_ALIGNMENT 2
@@ -24,11 +23,16 @@
 #define INSERTION    'I'
 #define TERMINATION  'T'
 
+#define NO_BAND       (-2)
+#define ADAPTIVE_BAND (-1)
+
 #define CURR_MATRIX(i, j) (currMatrix[i + nCharString1Plus1 * j])
 #define PREV_MATRIX(i, j) (prevMatrix[i + nCharString1Plus1 * j])
 #define S_TRACE_MATRIX(i, j) (sTraceMatrix[i + nCharString1 * j])
 #define D_TRACE_MATRIX(i, j) (dTraceMatrix[i + nCharString1 * j])
 #define I_TRACE_MATRIX(i, j) (iTraceMatrix[i + nCharString1 * j])
+#define TRACE_MATRIX(traceMatrix, i, j) \
+	(traceMatrix[((long) i + (long) traceNrow * j) * traceStride])
 #define FUZZY_MATRIX(i, j) (fuzzyMatrix[i + fuzzyMatrixDim[0] * j])
 #define SUBSTITUTION_ARRAY(i, j, k) (substitutionArray[i + substitutionArrayDim[0] * (j + substitutionArrayDim[1] * k)])
 
@@ -98,6 +102,52 @@ struct AlignBuffer {
 	char *sTraceMatrix;
 	char *iTraceMatrix;
 	char *dTraceMatrix;
+
+	/* Only used by the striped SIMD kernels (see align_striped.c) when
+	 * all the scores are integers (useStriped = 1). */
+	int useStriped;
+	int maxStep;
+	int *stripedSub;         /* the substitution scores of the pattern
+	                          * letters vs each key used by the subject */
+	int *stripedColKeys;     /* 1 per subject letter */
+	int *stripedKeys;        /* the keys used by the subject */
+	int *stripedKeyIndex;    /* 1 per possible key, -1 if not used */
+	int *stripedPatternFuzzy;
+	int *stripedPatternElement;
+
+	/* The traceback matrices hold 'traceCapacity' cells and can grow up
+	 * to 'traceLimit' cells (see reserve_trace_AlignBuffer()). They are
+	 * grown with malloc() in the worker threads (mallocTrace = 1) and
+	 * must then be freed if traceMalloced = 1. The bigger alignments are
+	 * traced back in linear space (see linear_pairwiseAlignment()) with
+	 * the following buffers, which are only allocated if needed
+	 * (linearSpace = 1). */
+	int traceCapacity;
+	int traceLimit;
+	int mallocTrace;
+	int traceMalloced;
+	int linearSpace;
+	int *rowElement;         /* 1 per pattern letter (row of the DP) */
+	int *rowFuzzy;
+	int *colElement;         /* 1 per subject letter (column of the DP) */
+	int *colFuzzy;
+	long long int *currOrigin;  /* the cell where the traceback from */
+	long long int *prevOrigin;  /* each cell of currMatrix/prevMatrix stops */
+	char *lastRowTrace;      /* the traceback codes of the last row */
+	char *lastColTrace;      /* and of the last column */
+	double *cc;              /* the Myers-Miller vectors */
+	double *dd;
+	double *rr;
+	double *ss;
+	char *path;
+	char *pathTrace;
+
+	/* The band of the global and overlap alignments (see
+	 * banded_pairwiseAlignment()), NO_BAND for the full DP. The letters
+	 * are encoded in rowElement, rowFuzzy, colElement and colFuzzy. */
+	int band;
+	char *currTouch;         /* whether the traceback from each cell of */
+	char *prevTouch;         /* currMatrix/prevMatrix meets the band edges */
 };
 void function2(struct AlignBuffer *);
 
@@ -121,17 +171,27 @@ struct IndelBuffer {
 };
 void function4(struct IndelBuffer *);
 
-/* Traceback through the score matrices */
-static void traceback(const struct AlignBuffer *alignBufferPtr,
+/*
+ * Traceback through the score matrices. The code for row i and column j is
+ * at (i + traceNrow * j) * traceStride in each traceback matrix. If
+ * 'pathTrace' is not NULL, the traceback matrices are not used and the
+ * codes are read in sequence from 'pathTrace' instead.
+ */
+#define NEXT_TRACE(traceMatrix) \
+	(pathTrace != NULL ? pathTrace[k] : TRACE_MATRIX(traceMatrix, i, j))
+
+static void traceback(const char *sTraceMatrix,
+		      const char *iTraceMatrix,
+		      const char *dTraceMatrix,
+		      const int traceNrow,
+		      const int traceStride,
+		      const char *pathTrace,
 		      char currTraceMatrix,
 		      struct AlignInfo *align1InfoPtr,
 		      struct AlignInfo *align2InfoPtr)
 {
-	int i, j;
-	char prevTraceMatrix = '?';
-	const char *sTraceMatrix = alignBufferPtr->sTraceMatrix;
-	const char *iTraceMatrix = alignBufferPtr->iTraceMatrix;
-	const char *dTraceMatrix = alignBufferPtr->dTraceMatrix;
+	int i, j, k;
+	char prevTraceMatrix = '?', nextTraceMatrix;
 	const int nCharString1 = align1InfoPtr->string.length;
 	const int nCharString2 = align2InfoPtr->string.length;
 	const int nCharString1Minus1 = nCharString1 - 1;
@@ -144,10 +204,12 @@ static void traceback(const struct AlignBuffer *alignBufferPtr,
 
 	i = nCharString1 - align1InfoPtr->startRange;
 	j = nCharString2 - align2InfoPtr->startRange;
+	k = 0;
 	while (currTraceMatrix != TERMINATION && i >= 0 && j >= 0) {
 		switch (currTraceMatrix) {
 		case INSERTION:
-			if (I_TRACE_MATRIX(i, j) != TERMINATION) {
+			nextTraceMatrix = NEXT_TRACE(iTraceMatrix);
+			if (nextTraceMatrix != TERMINATION) {
 				if (j == nCharString2Minus1) {
 					align1InfoPtr->startRange++;
 				} else {
@@ -160,11 +222,12 @@ static void traceback(const struct AlignBuffer *alignBufferPtr,
 				}
 			}
 			prevTraceMatrix = currTraceMatrix;
-			currTraceMatrix = I_TRACE_MATRIX(i, j);
+			currTraceMatrix = nextTraceMatrix;
 			i--;
 			break;
 		case DELETION:
-			if (D_TRACE_MATRIX(i, j) != TERMINATION) {
+			nextTraceMatrix = NEXT_TRACE(dTraceMatrix);
+			if (nextTraceMatrix != TERMINATION) {
 				if (i == nCharString1Minus1) {
 					align2InfoPtr->startRange++;
 				} else {
@@ -177,12 +240,12 @@ static void traceback(const struct AlignBuffer *alignBufferPtr,
 				}
 			}
 			prevTraceMatrix = currTraceMatrix;
-			currTraceMatrix = D_TRACE_MATRIX(i, j);
+			currTraceMatrix = nextTraceMatrix;
 			j--;
 			break;
 	    	case SUBSTITUTION:
 			prevTraceMatrix = currTraceMatrix;
-			currTraceMatrix = S_TRACE_MATRIX(i, j);
+			currTraceMatrix = NEXT_TRACE(sTraceMatrix);
 			if (currTraceMatrix != TERMINATION) {
 				align1InfoPtr->widthRange++;
 				align2InfoPtr->widthRange++;
@@ -201,6 +264,7 @@ static void traceback(const struct AlignBuffer *alignBufferPtr,
 			error("unknown traceback code %d", currTraceMatrix);
 			break;
 		}
+		k++;
 	}
 
 	const int offset1 = align1InfoPtr->startRange - 1;
@@ -216,15 +280,554 @@ static void traceback(const struct AlignBuffer *alignBufferPtr,
 	return;
 }
 
-/* Returns the score of the optimal pairwise alignment */
-static double pairwiseAlignment(
+#define MAX_STRIPED_MAXSTEP 262144
+#define MAX_STRIPED_SUB_SIZE 16777216
+
+/*
+ * Returns the max of the absolute values of the substitution scores and of
+ * gapOpening + gapExtension if they are all integers (small enough for the
+ * SIMD kernels), -1 otherwise.
+ */
+static int get_integer_maxStep(
+		const float gapOpening,
+		const float gapExtension,
+		const double *substitutionArray,
+		const int substitutionArrayLength)
+{
+	int i;
+	double x, maxStep;
+
+	if (!R_FINITE(gapOpening) || !R_FINITE(gapExtension)
+	 || gapOpening < 0 || gapExtension < 0
+	 || gapOpening != (int) gapOpening
+	 || gapExtension != (int) gapExtension)
+		return -1;
+	maxStep = gapOpening + gapExtension;
+	for (i = 0; i < substitutionArrayLength; i++) {
+		x = substitutionArray[i];
+		if (!R_FINITE(x) || fabs(x) > MAX_STRIPED_MAXSTEP
+		 || x != (int) x)
+			return -1;
+		maxStep = MAX(maxStep, fabs(x));
+	}
+	if (maxStep > MAX_STRIPED_MAXSTEP)
+		return -1;
+	return (int) maxStep;
+}
+
+/*
+ * The score-only alignments go to the striped SIMD kernels when the
+ * substitution scores and the gap penalties are integers (this is the case
+ * e.g. for nucleotideSubstitutionMatrix(), the BLOSUM and PAM matrices,
+ * and stringDist(method="levenshtein")). A subject letter is mapped to a
+ * key made of its fuzzy and substitution indices, and the substitution
+ * scores of all the pattern letters are computed once per key used by the
+ * subject.
+ */
+static void init_striped_AlignBuffer(
+		struct AlignBuffer *alignBufferPtr,
+		const int nCharString1,
+		const int nCharString2,
+		const float gapOpening,
+		const float gapExtension,
+		const double *substitutionArray,
+		const int substitutionArrayLength,
+		const int *substitutionArrayDim,
+		const int *fuzzyMatrixDim)
+{
+	int i, nKey, maxKey, maxStep;
+
+	alignBufferPtr->useStriped = 0;
+	maxStep = get_integer_maxStep(gapOpening, gapExtension,
+				      substitutionArray, substitutionArrayLength);
+	if (maxStep < 0)
+		return;
+	nKey = substitutionArrayDim[1] * fuzzyMatrixDim[1];
+	maxKey = MIN(nKey, nCharString2);
+	if ((double) nCharString1 * maxKey > MAX_STRIPED_SUB_SIZE)
+		return;
+	alignBufferPtr->useStriped = 1;
+	alignBufferPtr->maxStep = maxStep;
+	alignBufferPtr->stripedSub =
+		(int *) R_alloc((long) nCharString1 * maxKey, sizeof(int));
+	alignBufferPtr->stripedColKeys =
+		(int *) R_alloc((long) nCharString2, sizeof(int));
+	alignBufferPtr->stripedKeys = (int *) R_alloc((long) maxKey, sizeof(int));
+	alignBufferPtr->stripedKeyIndex = (int *) R_alloc((long) nKey, sizeof(int));
+	for (i = 0; i < nKey; i++)
+		alignBufferPtr->stripedKeyIndex[i] = -1;
+	alignBufferPtr->stripedPatternFuzzy =
+		(int *) R_alloc((long) nCharString1, sizeof(int));
+	alignBufferPtr->stripedPatternElement =
+		(int *) R_alloc((long) nCharString1, sizeof(int));
+	return;
+}
+
+/*
+ * Returns 1 and sets '*score' if the striped kernels could compute the
+ * score, 0 otherwise. The letters are looked up in the same order as in
+ * the scoreOnly branch of pairwiseAlignment() so the same error is raised
+ * for an invalid letter.
+ */
+static int striped_pairwiseAlignment(
+		const struct AlignInfo *align1InfoPtr,
+		const struct AlignInfo *align2InfoPtr,
+		const int localAlignment,
+		const float gapOpening,
+		const float gapExtension,
+		const Chars_holder *sequence1,
+		const Chars_holder *sequence2,
+		const int scalar1,
+		const int scalar2,
+		const double *substitutionArray,
+		const int *substitutionArrayDim,
+		const int *substitutionLookupTable,
+		const int substitutionLookupTableLength,
+		const int *fuzzyMatrix,
+		const int *fuzzyMatrixDim,
+		const int *fuzzyLookupTable,
+		const int fuzzyLookupTableLength,
+		struct AlignBuffer *alignBufferPtr,
+		double *score)
+{
+	int i, j, iElt, jElt, key, nKeyUsed, lookupValue = 0, ok;
+	int stringElt2, element2, *sub;
+	StripedAlignment sa;
+	const int nCharString1 = align1InfoPtr->string.length;
+	const int nCharString2 = align2InfoPtr->string.length;
+	int *patternFuzzy = alignBufferPtr->stripedPatternFuzzy;
+	int *patternElement = alignBufferPtr->stripedPatternElement;
+	int *colKeys = alignBufferPtr->stripedColKeys;
+	int *keys = alignBufferPtr->stripedKeys;
+	int *keyIndex = alignBufferPtr->stripedKeyIndex;
+
+	/* Step 1:  Encode the subject and the pattern */
+	nKeyUsed = 0;
+	for (j = 0, jElt = nCharString2 - 1; j < nCharString2; j++, jElt--) {
+		SET_LOOKUP_VALUE(fuzzyLookupTable, fuzzyLookupTableLength, align2InfoPtr->string.ptr[jElt]);
+		stringElt2 = lookupValue;
+		SET_LOOKUP_VALUE(substitutionLookupTable, substitutionLookupTableLength, sequence2->ptr[scalar2 ? 0 : jElt]);
+		key = lookupValue + substitutionArrayDim[1] * stringElt2;
+		if (keyIndex[key] == -1) {
+			keyIndex[key] = nKeyUsed;
+			keys[nKeyUsed++] = key;
+		}
+		colKeys[j] = keyIndex[key];
+		if (j > 0)
+			continue;
+		for (i = 0, iElt = nCharString1 - 1; i < nCharString1; i++, iElt--) {
+			SET_LOOKUP_VALUE(fuzzyLookupTable, fuzzyLookupTableLength, align1InfoPtr->string.ptr[iElt]);
+			patternFuzzy[i] = lookupValue;
+			SET_LOOKUP_VALUE(substitutionLookupTable, substitutionLookupTableLength, sequence1->ptr[scalar1 ? 0 : iElt]);
+			patternElement[i] = lookupValue;
+		}
+	}
+	for (key = 0; key < nKeyUsed; key++)
+		keyIndex[keys[key]] = -1;
+
+	/* Step 2:  Get the substitution scores for each key */
+	for (key = 0, sub = alignBufferPtr->stripedSub; key < nKeyUsed; key++) {
+		element2 = keys[key] % substitutionArrayDim[1];
+		stringElt2 = keys[key] / substitutionArrayDim[1];
+		for (i = 0; i < nCharString1; i++, sub++)
+			*sub = (int) SUBSTITUTION_ARRAY(patternElement[i], element2,
+				FUZZY_MATRIX(patternFuzzy[i], stringElt2));
+	}
+
+	/* Step 3:  Run the kernels */
+	sa.nrow = nCharString1;
+	sa.ncol = nCharString2;
+	sa.nkey = nKeyUsed;
+	sa.sub = alignBufferPtr->stripedSub;
+	sa.col2key = colKeys;
+	sa.gapOpening = (int) gapOpening;
+	sa.gapExtension = (int) gapExtension;
+	sa.endGap1 = align1InfoPtr->endGap;
+	sa.endGap2 = align2InfoPtr->endGap;
+	sa.local = localAlignment;
+	sa.maxstep = alignBufferPtr->maxStep;
+	ok = _striped_align_score(&sa, score);
+	return ok;
+}
+
+/*
+ * The alignments with more cells than the traceback matrices can hold are
+ * traced back in linear space with the divide-and-conquer algorithm of
+ * Myers and Miller (Optimal alignments in linear space, CABIOS 1988), the
+ * affine gap version of Hirschberg's algorithm.
+ *
+ * A first pass runs the DP of pairwiseAlignment() with 2 columns only,
+ * and carries for each cell and state the cell where the traceback from
+ * it would stop. This gives the score (computed exactly as in the
+ * quadratic mode) and the 2 ends of the optimal path. Myers-Miller then
+ * finds an optimal path between these 2 cells, and traceback() replays it
+ * to get the ranges, the mismatches and the indels. When there are
+ * several optimal alignments, the one returned can differ from the one
+ * returned by the quadratic mode.
+ */
+
+#define ORIGIN_CELL(i, j) ((long long int) (i) + (long long int) nCharString1Plus1 * (j))
+#define CURR_ORIGIN(i, j) (currOrigin[i + nCharString1Plus1 * j])
+#define PREV_ORIGIN(i, j) (prevOrigin[i + nCharString1Plus1 * j])
+
+/*
+ * Returns the nb of cells of the traceback matrices for alignments of up to
+ * 'nCharProduct' cells, within the limit set by setTracebackMemoryLimit().
+ */
+static int get_traceCapacity(const double nCharProduct)
+{
+	double traceCapacity;
+
+	traceCapacity = MIN(nCharProduct, _get_traceback_memory_limit() / 3.0);
+	traceCapacity = MIN(traceCapacity, (double) INT_MAX);
+	return (int) MAX(traceCapacity, 0.0);
+}
+
+/*
+ * Allocates the traceback matrices for up to 'nTraceCell' cells and, if
+ * some alignments of up to 'nCharProduct' cells don't fit in them, the
+ * linear-space buffers. With the adaptive band, the matrices can later
+ * grow up to the size of the biggest alignment allowed by the limit.
+ * Must be called after init_band_AlignBuffer().
+ */
+static void init_trace_AlignBuffer(struct AlignBuffer *alignBufferPtr,
+		const int nCharString1,
+		const int nCharString2,
+		const double nCharProduct,
+		const double nTraceCell)
+{
+	struct AlignBuffer *ab = alignBufferPtr;
+	const int traceCapacity = get_traceCapacity(nTraceCell);
+
+	ab->traceCapacity = traceCapacity;
+	ab->traceLimit = ab->band == ADAPTIVE_BAND ?
+			 MAX(get_traceCapacity(nCharProduct), traceCapacity) :
+			 traceCapacity;
+	ab->mallocTrace = 0;
+	ab->traceMalloced = 0;
+	ab->sTraceMatrix = (char *) R_alloc((long) traceCapacity, sizeof(char));
+	ab->iTraceMatrix = (char *) R_alloc((long) traceCapacity, sizeof(char));
+	ab->dTraceMatrix = (char *) R_alloc((long) traceCapacity, sizeof(char));
+	ab->linearSpace = nCharProduct > traceCapacity;
+	if (!ab->linearSpace)
+		return;
+	if (ab->band == NO_BAND) {
+		ab->rowElement = (int *) R_alloc((long) nCharString1 + 1, sizeof(int));
+		ab->rowFuzzy = (int *) R_alloc((long) nCharString1 + 1, sizeof(int));
+		ab->colElement = (int *) R_alloc((long) nCharString2 + 1, sizeof(int));
+		ab->colFuzzy = (int *) R_alloc((long) nCharString2 + 1, sizeof(int));
+	}
+	ab->currOrigin = (long long int *) R_alloc((long) 3 * (nCharString1 + 1), sizeof(long long int));
+	ab->prevOrigin = (long long int *) R_alloc((long) 3 * (nCharString1 + 1), sizeof(long long int));
+	ab->lastRowTrace = (char *) R_alloc((long) nCharString2 + 1, sizeof(char));
+	ab->lastColTrace = (char *) R_alloc((long) nCharString1 + 1, sizeof(char));
+	ab->cc = (double *) R_alloc((long) nCharString2 + 1, sizeof(double));
+	ab->dd = (double *) R_alloc((long) nCharString2 + 1, sizeof(double));
+	ab->rr = (double *) R_alloc((long) nCharString2 + 1, sizeof(double));
+	ab->ss = (double *) R_alloc((long) nCharString2 + 1, sizeof(double));
+	ab->path = (char *) R_alloc((long) nCharString1 + nCharString2 + 2, sizeof(char));
+	ab->pathTrace = (char *) R_alloc((long) nCharString1 + nCharString2 + 2, sizeof(char));
+	return;
+}
+
+static void free_trace_AlignBuffer(struct AlignBuffer *alignBufferPtr)
+{
+	if (!alignBufferPtr->traceMalloced)
+		return;
+	free(alignBufferPtr->sTraceMatrix);
+	free(alignBufferPtr->iTraceMatrix);
+	free(alignBufferPtr->dTraceMatrix);
+	alignBufferPtr->traceMalloced = 0;
+	return;
+}
+
+/*
+ * Makes sure the traceback matrices can hold 'nCell' cells, growing them
+ * (at least twice) if 'nCell' is within 'traceLimit'. Returns 0 if they
+ * can't, i.e. if 'nCell' exceeds the limit or if malloc() failed.
+ */
+static int reserve_trace_AlignBuffer(struct AlignBuffer *alignBufferPtr,
+		const double nCell)
+{
+	struct AlignBuffer *ab = alignBufferPtr;
+	int traceCapacity;
+	char *sTraceMatrix, *iTraceMatrix, *dTraceMatrix;
+
+	if (nCell <= ab->traceCapacity)
+		return 1;
+	if (nCell > ab->traceLimit)
+		return 0;
+	traceCapacity = (int) MIN(MAX(nCell, 2.0 * ab->traceCapacity),
+				  (double) ab->traceLimit);
+	if (ab->mallocTrace) {
+		sTraceMatrix = (char *) malloc((size_t) traceCapacity);
+		iTraceMatrix = (char *) malloc((size_t) traceCapacity);
+		dTraceMatrix = (char *) malloc((size_t) traceCapacity);
+		if (sTraceMatrix == NULL || iTraceMatrix == NULL
+		 || dTraceMatrix == NULL) {
+			free(sTraceMatrix);
+			free(iTraceMatrix);
+			free(dTraceMatrix);
+			return 0;
+		}
+		free_trace_AlignBuffer(ab);
+		ab->traceMalloced = 1;
+	} else {
+		sTraceMatrix = (char *) R_alloc((long) traceCapacity, sizeof(char));
+		iTraceMatrix = (char *) R_alloc((long) traceCapacity, sizeof(char));
+		dTraceMatrix = (char *) R_alloc((long) traceCapacity, sizeof(char));
+	}
+	ab->sTraceMatrix = sTraceMatrix;
+	ab->iTraceMatrix = iTraceMatrix;
+	ab->dTraceMatrix = dTraceMatrix;
+	ab->traceCapacity = traceCapacity;
+	return 1;
+}
+
+/*
+ * Encodes the letters of the subject (columns of the DP) and of the pattern
+ * (rows) in the order used by pairwiseAlignment() so the same error is
+ * raised for an invalid letter.
+ */
+static void encode_letters(
+		const struct AlignInfo *align1InfoPtr,
+		const struct AlignInfo *align2InfoPtr,
+		const Chars_holder *sequence1,
+		const Chars_holder *sequence2,
+		const int scalar1,
+		const int scalar2,
+		const int *substitutionLookupTable,
+		const int substitutionLookupTableLength,
+		const int *fuzzyLookupTable,
+		const int fuzzyLookupTableLength,
+		int *rowElement,
+		int *rowFuzzy,
+		int *colElement,
+		int *colFuzzy)
+{
+	int i, j, iElt, jElt, lookupValue = 0;
+	const int nCharString1 = align1InfoPtr->string.length;
+	const int nCharString2 = align2InfoPtr->string.length;
+
+	for (j = 1, jElt = nCharString2 - 1; j <= nCharString2; j++, jElt--) {
+		SET_LOOKUP_VALUE(fuzzyLookupTable, fuzzyLookupTableLength, align2InfoPtr->string.ptr[jElt]);
+		colFuzzy[j] = lookupValue;
+		SET_LOOKUP_VALUE(substitutionLookupTable, substitutionLookupTableLength, sequence2->ptr[scalar2 ? 0 : jElt]);
+		colElement[j] = lookupValue;
+		if (j > 1)
+			continue;
+		for (i = 1, iElt = nCharString1 - 1; i <= nCharString1; i++, iElt--) {
+			SET_LOOKUP_VALUE(fuzzyLookupTable, fuzzyLookupTableLength, align1InfoPtr->string.ptr[iElt]);
+			rowFuzzy[i] = lookupValue;
+			SET_LOOKUP_VALUE(substitutionLookupTable, substitutionLookupTableLength, sequence1->ptr[scalar1 ? 0 : iElt]);
+			rowElement[i] = lookupValue;
+		}
+	}
+	return;
+}
+
+/* The state of the Myers-Miller recursion */
+struct MyersMiller {
+	const int *rowElement;
+	const int *rowFuzzy;
+	const int *colElement;
+	const int *colFuzzy;
+	const double *substitutionArray;
+	const int *substitutionArrayDim;
+	const int *fuzzyMatrix;
+	const int *fuzzyMatrixDim;
+	double gapOpening;
+	double gapExtension;
+	double *cc, *dd, *rr, *ss;
+	char *path;
+	int pathLength;
+};
+
+/* The cost of aligning row i with column j (the opposite of the score) */
+static double MyersMiller_cost(const struct MyersMiller *mm,
+			       const int i, const int j)
+{
+	const double *substitutionArray = mm->substitutionArray;
+	const int *substitutionArrayDim = mm->substitutionArrayDim;
+	const int *fuzzyMatrix = mm->fuzzyMatrix;
+	const int *fuzzyMatrixDim = mm->fuzzyMatrixDim;
+
+	return - (double) (float) SUBSTITUTION_ARRAY(mm->rowElement[i],
+			mm->colElement[j],
+			FUZZY_MATRIX(mm->rowFuzzy[i], mm->colFuzzy[j]));
+}
+
+static double MyersMiller_gap(const struct MyersMiller *mm, const int k)
+{
+	return k <= 0 ? 0.0 : mm->gapOpening + k * mm->gapExtension;
+}
+
+static void MyersMiller_emit(struct MyersMiller *mm, const char op, int k)
+{
+	for ( ; k > 0; k--)
+		mm->path[mm->pathLength++] = op;
+	return;
+}
+
+/*
+ * Appends to mm->path an optimal path from cell (i0, j0) to cell
+ * (i0 + M, j0 + N) of the DP matrix. A gap in the rows (INSERTION) costs
+ * 'tb' (or 'te') instead of the gap opening when it starts at the first
+ * row (or ends at the last row).
+ */
+static void MyersMiller_diff(struct MyersMiller *mm,
+		const int i0, const int j0, const int M, const int N,
+		const double tb, const double te)
+{
+	int i, j, midi, midj, type;
+	double c, d, e, s, t, midc;
+	double *CC = mm->cc, *DD = mm->dd, *RR = mm->rr, *SS = mm->ss;
+	const double g = mm->gapOpening, h = mm->gapExtension;
+
+	if (N <= 0) {
+		MyersMiller_emit(mm, INSERTION, M);
+		return;
+	}
+	if (M <= 1) {
+		if (M <= 0) {
+			MyersMiller_emit(mm, DELETION, N);
+			return;
+		}
+		midc = MIN(tb, te) + h + MyersMiller_gap(mm, N);
+		midj = 0;
+		for (j = 1; j <= N; j++) {
+			c = MyersMiller_gap(mm, j - 1)
+			    + MyersMiller_cost(mm, i0 + 1, j0 + j)
+			    + MyersMiller_gap(mm, N - j);
+			if (c < midc) {
+				midc = c;
+				midj = j;
+			}
+		}
+		if (midj == 0) {
+			if (tb <= te) {
+				MyersMiller_emit(mm, INSERTION, 1);
+				MyersMiller_emit(mm, DELETION, N);
+			} else {
+				MyersMiller_emit(mm, DELETION, N);
+				MyersMiller_emit(mm, INSERTION, 1);
+			}
+		} else {
+			MyersMiller_emit(mm, DELETION, midj - 1);
+			MyersMiller_emit(mm, SUBSTITUTION, 1);
+			MyersMiller_emit(mm, DELETION, N - midj);
+		}
+		return;
+	}
+
+	/* Forward pass down to the middle row */
+	midi = M / 2;
+	CC[0] = 0.0;
+	t = g;
+	for (j = 1; j <= N; j++) {
+		CC[j] = t = t + h;
+		DD[j] = t + g;
+	}
+	t = tb;
+	for (i = 1; i <= midi; i++) {
+		s = CC[0];
+		CC[0] = c = t = t + h;
+		e = t + g;
+		for (j = 1; j <= N; j++) {
+			if ((c = c + g + h) < (e = e + h))
+				e = c;
+			if ((c = CC[j] + g + h) < (d = DD[j] + h))
+				d = c;
+			c = s + MyersMiller_cost(mm, i0 + i, j0 + j);
+			if (e < c)
+				c = e;
+			if (d < c)
+				c = d;
+			s = CC[j];
+			CC[j] = c;
+			DD[j] = d;
+		}
+	}
+	DD[0] = CC[0];
+
+	/* Reverse pass up to the middle row */
+	RR[N] = 0.0;
+	t = g;
+	for (j = N - 1; j >= 0; j--) {
+		RR[j] = t = t + h;
+		SS[j] = t + g;
+	}
+	t = te;
+	for (i = M - 1; i >= midi; i--) {
+		s = RR[N];
+		RR[N] = c = t = t + h;
+		e = t + g;
+		for (j = N - 1; j >= 0; j--) {
+			if ((c = c + g + h) < (e = e + h))
+				e = c;
+			if ((c = RR[j] + g + h) < (d = SS[j] + h))
+				d = c;
+			c = s + MyersMiller_cost(mm, i0 + i + 1, j0 + j + 1);
+			if (e < c)
+				c = e;
+			if (d < c)
+				c = d;
+			s = RR[j];
+			RR[j] = c;
+			SS[j] = d;
+		}
+	}
+	SS[N] = RR[N];
+
+	/* Where the optimal path crosses the middle row: through a cell
+	 * (type 1) or through a gap that spans it (type 2) */
+	midc = CC[0] + RR[0];
+	midj = 0;
+	type = 1;
+	for (j = 0; j <= N; j++) {
+		c = CC[j] + RR[j];
+		if (c < midc || (c == midc && CC[j] != DD[j] && RR[j] == SS[j])) {
+			midc = c;
+			midj = j;
+		}
+	}
+	for (j = N; j >= 0; j--) {
+		c = DD[j] + SS[j] - g;
+		if (c < midc) {
+			midc = c;
+			midj = j;
+			type = 2;
+		}
+	}
+
+	if (type == 1) {
+		MyersMiller_diff(mm, i0, j0, midi, midj, tb, g);
+		MyersMiller_diff(mm, i0 + midi, j0 + midj,
+				 M - midi, N - midj, g, te);
+	} else {
+		MyersMiller_diff(mm, i0, j0, midi - 1, midj, tb, 0.0);
+		MyersMiller_emit(mm, INSERTION, 2);
+		MyersMiller_diff(mm, i0 + midi + 1, j0 + midj,
+				 M - midi - 1, N - midj, 0.0, te);
+	}
+	return;
+}
+
+/*
+ * Same as the full (not scoreOnly) branch of pairwiseAlignment(), but in
+ * linear space. 'align1InfoPtr' and 'align2InfoPtr' must have been
+ * prepared by pairwiseAlignment().
+ */
+static double linear_pairwiseAlignment(
 		struct AlignInfo *align1InfoPtr,
 		struct AlignInfo *align2InfoPtr,
 		const int localAlignment,
-		const int scoreOnly,
 		const float gapOpening,
 		const float gapExtension,
-		const int useQuality,
+		const Chars_holder *sequence1,
+		const Chars_holder *sequence2,
+		const int scalar1,
+		const int scalar2,
 		const double *substitutionArray,
 		const int *substitutionArrayDim,
 		const int *substitutionLookupTable,
@@ -235,41 +838,356 @@ static double pairwiseAlignment(
 		const int fuzzyLookupTableLength,
 		struct AlignBuffer *alignBufferPtr)
 {
-	int i, j, iMinus1, jMinus1;
-
-	/* Step 1:  Get information on input XString objects */
+	int i, j, iMinus1, iElt, jElt, iEnd, jEnd, nFree;
+	int i0, j0, k, nop;
+	long long int origin, bestOrigin = 0;
+	char currTraceMatrix, freeTraceMatrix;
+	float *tempMatrix, substitutionValue;
+	long long int *tempOrigin;
+	double maxScore = NEGATIVE_INFINITY;
+	struct MyersMiller mm;
 	const int nCharString1 = align1InfoPtr->string.length;
 	const int nCharString2 = align2InfoPtr->string.length;
 	const int nCharString1Plus1 = nCharString1 + 1;
-	const int nCharString1Minus1 = nCharString1 - 1;
-	const int nCharString2Minus1 = nCharString2 - 1;
+	const int noEndGap1 = !align1InfoPtr->endGap;
+	const int noEndGap2 = !align2InfoPtr->endGap;
+	const float gapOpeningPlusExtension = gapOpening + gapExtension;
+	const float endGapAddend = (align2InfoPtr->endGap ? - gapExtension : 0.0);
+	float *currMatrix = alignBufferPtr->currMatrix;
+	float *prevMatrix = alignBufferPtr->prevMatrix;
+	long long int *currOrigin = alignBufferPtr->currOrigin;
+	long long int *prevOrigin = alignBufferPtr->prevOrigin;
+	int *rowElement = alignBufferPtr->rowElement;
+	int *rowFuzzy = alignBufferPtr->rowFuzzy;
+	int *colElement = alignBufferPtr->colElement;
+	int *colFuzzy = alignBufferPtr->colFuzzy;
+	char *lastRowTrace = alignBufferPtr->lastRowTrace;
+	char *lastColTrace = alignBufferPtr->lastColTrace;
+
+	/* Step 1:  Encode the subject and the pattern */
+	encode_letters(align1InfoPtr, align2InfoPtr, sequence1, sequence2,
+		       scalar1, scalar2,
+		       substitutionLookupTable, substitutionLookupTableLength,
+		       fuzzyLookupTable, fuzzyLookupTableLength,
+		       rowElement, rowFuzzy, colElement, colFuzzy);
+
+	/* Step 2:  Run the DP of pairwiseAlignment() with the origins of the
+	 *          cells instead of the traceback values. The cells of row 0
+	 *          and column 0 are their own origins. */
+	for (i = 0; i <= nCharString1; i++)
+		for (k = 0; k < 3; k++)
+			CURR_ORIGIN(i, k) = ORIGIN_CELL(i, 0);
+	for (j = 1, jElt = nCharString2 - 1; j <= nCharString2; j++, jElt--) {
+		tempMatrix = prevMatrix;
+		prevMatrix = currMatrix;
+		currMatrix = tempMatrix;
+		tempOrigin = prevOrigin;
+		prevOrigin = currOrigin;
+		currOrigin = tempOrigin;
+
+		CURR_MATRIX(0, 0) = NEGATIVE_INFINITY;
+		CURR_MATRIX(0, 1) = PREV_MATRIX(0, 1) + endGapAddend;
+		CURR_MATRIX(0, 2) = NEGATIVE_INFINITY;
+		for (k = 0; k < 3; k++)
+			CURR_ORIGIN(0, k) = ORIGIN_CELL(0, j);
+
+		for (i = 1, iMinus1 = 0, iElt = nCharString1 - 1; i <= nCharString1; i++, iMinus1++, iElt--) {
+			substitutionValue = (float) SUBSTITUTION_ARRAY(rowElement[i], colElement[j],
+					FUZZY_MATRIX(rowFuzzy[i], colFuzzy[j]));
+			if (PREV_MATRIX(iMinus1, 0) >= MAX(PREV_MATRIX(iMinus1, 1), PREV_MATRIX(iMinus1, 2))) {
+				CURR_ORIGIN(i, 0) = PREV_ORIGIN(iMinus1, 0);
+				CURR_MATRIX(i, 0) = PREV_MATRIX(iMinus1, 0) + substitutionValue;
+			} else if (PREV_MATRIX(iMinus1, 1) >= PREV_MATRIX(iMinus1, 2)) {
+				CURR_ORIGIN(i, 0) = PREV_ORIGIN(iMinus1, 1);
+				CURR_MATRIX(i, 0) = PREV_MATRIX(iMinus1, 1) + substitutionValue;
+			} else {
+				CURR_ORIGIN(i, 0) = PREV_ORIGIN(iMinus1, 2);
+				CURR_MATRIX(i, 0) = PREV_MATRIX(iMinus1, 2) + substitutionValue;
+			}
+			if (PREV_MATRIX(i, 1) > (MAX(PREV_MATRIX(i, 0), PREV_MATRIX(i, 2)) - gapOpening)) {
+				CURR_ORIGIN(i, 1) = PREV_ORIGIN(i, 1);
+				CURR_MATRIX(i, 1) = PREV_MATRIX(i, 1) - gapExtension;
+			} else if (PREV_MATRIX(i, 0) >= PREV_MATRIX(i, 2)) {
+				CURR_ORIGIN(i, 1) = PREV_ORIGIN(i, 0);
+				CURR_MATRIX(i, 1) = PREV_MATRIX(i, 0) - gapOpeningPlusExtension;
+			} else {
+				CURR_ORIGIN(i, 1) = PREV_ORIGIN(i, 2);
+				CURR_MATRIX(i, 1) = PREV_MATRIX(i, 2) - gapOpeningPlusExtension;
+			}
+			if (CURR_MATRIX(iMinus1, 2) > (MAX(CURR_MATRIX(iMinus1, 0), CURR_MATRIX(iMinus1, 1)) - gapOpening)) {
+				CURR_ORIGIN(i, 2) = CURR_ORIGIN(iMinus1, 2);
+				CURR_MATRIX(i, 2) = CURR_MATRIX(iMinus1, 2) - gapExtension;
+			} else if (CURR_MATRIX(iMinus1, 0) >= CURR_MATRIX(iMinus1, 1)) {
+				CURR_ORIGIN(i, 2) = CURR_ORIGIN(iMinus1, 0);
+				CURR_MATRIX(i, 2) = CURR_MATRIX(iMinus1, 0) - gapOpeningPlusExtension;
+			} else {
+				CURR_ORIGIN(i, 2) = CURR_ORIGIN(iMinus1, 1);
+				CURR_MATRIX(i, 2) = CURR_MATRIX(iMinus1, 1) - gapOpeningPlusExtension;
+			}
+			if (localAlignment) {
+				for (k = 0; k < 3; k++) {
+					CURR_MATRIX(i, k) = MAX(0.0, CURR_MATRIX(i, k));
+					if (CURR_MATRIX(i, k) == 0.0)
+						CURR_ORIGIN(i, k) = ORIGIN_CELL(i, j);
+				}
+				if (CURR_MATRIX(i, 0) >= maxScore) {
+					align1InfoPtr->startRange = iElt + 1;
+					align2InfoPtr->startRange = jElt + 1;
+					maxScore = CURR_MATRIX(i, 0);
+					bestOrigin = CURR_ORIGIN(i, 0);
+				}
+			}
+		}
 
-	align1InfoPtr->startRange = -1;
-	align2InfoPtr->startRange = -1;
-	align1InfoPtr->widthRange = 0;
-	align2InfoPtr->widthRange = 0;
-	if (nCharString1 < 1 || nCharString2 < 1) {
-		double zeroCharScore;
-		if (nCharString1 >= 1 && align1InfoPtr->endGap)
-			zeroCharScore = - gapOpening - nCharString1 * gapExtension;
-		else if (nCharString2 >= 1 && align2InfoPtr->endGap)
-			zeroCharScore = - gapOpening - nCharString2 * gapExtension;
-		else
-			zeroCharScore = 0.0;
-		align1InfoPtr->lengthMismatch = 0;
-		align2InfoPtr->lengthMismatch = 0;
-		align1InfoPtr->lengthIndel = 0;
-		align2InfoPtr->lengthIndel = 0;
-		return zeroCharScore;
+		/* The free end gaps don't change the local alignments */
+		if (localAlignment)
+			continue;
+		if (noEndGap2) {
+			if (PREV_MATRIX(nCharString1, 1) >= MAX(PREV_MATRIX(nCharString1, 0), PREV_MATRIX(nCharString1, 2))) {
+				lastRowTrace[j] = DELETION;
+				CURR_ORIGIN(nCharString1, 1) = PREV_ORIGIN(nCharString1, 1);
+				CURR_MATRIX(nCharString1, 1) = PREV_MATRIX(nCharString1, 1);
+			} else if (PREV_MATRIX(nCharString1, 0) >= PREV_MATRIX(nCharString1, 2)) {
+				lastRowTrace[j] = SUBSTITUTION;
+				CURR_ORIGIN(nCharString1, 1) = PREV_ORIGIN(nCharString1, 0);
+				CURR_MATRIX(nCharString1, 1) = PREV_MATRIX(nCharString1, 0);
+			} else {
+				lastRowTrace[j] = INSERTION;
+				CURR_ORIGIN(nCharString1, 1) = PREV_ORIGIN(nCharString1, 2);
+				CURR_MATRIX(nCharString1, 1) = PREV_MATRIX(nCharString1, 2);
+			}
+		}
+		if (noEndGap1 && j == nCharString2) {
+			for (i = 1, iMinus1 = 0; i <= nCharString1; i++, iMinus1++) {
+				if (CURR_MATRIX(iMinus1, 2) >= MAX(CURR_MATRIX(iMinus1, 0), CURR_MATRIX(iMinus1, 1))) {
+					lastColTrace[i] = INSERTION;
+					CURR_ORIGIN(i, 2) = CURR_ORIGIN(iMinus1, 2);
+					CURR_MATRIX(i, 2) = CURR_MATRIX(iMinus1, 2);
+				} else if (CURR_MATRIX(iMinus1, 0) >= CURR_MATRIX(iMinus1, 1)) {
+					lastColTrace[i] = SUBSTITUTION;
+					CURR_ORIGIN(i, 2) = CURR_ORIGIN(iMinus1, 0);
+					CURR_MATRIX(i, 2) = CURR_MATRIX(iMinus1, 0);
+				} else {
+					lastColTrace[i] = DELETION;
+					CURR_ORIGIN(i, 2) = CURR_ORIGIN(iMinus1, 1);
+					CURR_MATRIX(i, 2) = CURR_MATRIX(iMinus1, 1);
+				}
+			}
+		}
 	}
 
-	/* Step 2:  Create objects for scores values */
-	/* Rows of currMatrix and prevMatrix = (0) substitution, (1) deletion, and (2) insertion */
-	float *currMatrix = alignBufferPtr->currMatrix;
-	float *prevMatrix = alignBufferPtr->prevMatrix;
+	/* Step 3:  Get the ends of the optimal path. The free end gaps at the
+	 *          end of the path are not part of the Myers-Miller problem,
+	 *          and the local alignments start and end with a
+	 *          substitution. */
+	nFree = 0;
+	freeTraceMatrix = DELETION;
+	if (localAlignment) {
+		if (maxScore == 0.0) {
+			traceback(NULL, NULL, NULL, 0, 0, NULL, TERMINATION,
+				  align1InfoPtr, align2InfoPtr);
+			return maxScore;
+		}
+		origin = bestOrigin + ORIGIN_CELL(1, 1);
+		iEnd = nCharString1 - align1InfoPtr->startRange + 1;
+		jEnd = nCharString2 - align2InfoPtr->startRange + 1;
+	} else {
+		align1InfoPtr->startRange = 1;
+		align2InfoPtr->startRange = 1;
+		if (CURR_MATRIX(nCharString1, 0) >=
+				MAX(CURR_MATRIX(nCharString1, 1), CURR_MATRIX(nCharString1, 2))) {
+			currTraceMatrix = SUBSTITUTION;
+			maxScore = CURR_MATRIX(nCharString1, 0);
+			origin = CURR_ORIGIN(nCharString1, 0);
+		} else if (CURR_MATRIX(nCharString1, 1) >= CURR_MATRIX(nCharString1, 2)) {
+			currTraceMatrix = DELETION;
+			maxScore = CURR_MATRIX(nCharString1, 1);
+			origin = CURR_ORIGIN(nCharString1, 1);
+		} else {
+			currTraceMatrix = INSERTION;
+			maxScore = CURR_MATRIX(nCharString1, 2);
+			origin = CURR_ORIGIN(nCharString1, 2);
+		}
+		iEnd = nCharString1;
+		jEnd = nCharString2;
+		if (noEndGap2 && currTraceMatrix == DELETION) {
+			while (currTraceMatrix == DELETION && jEnd > 0) {
+				currTraceMatrix = lastRowTrace[jEnd];
+				jEnd--;
+				nFree++;
+			}
+		} else if (noEndGap1 && currTraceMatrix == INSERTION) {
+			freeTraceMatrix = INSERTION;
+			while (currTraceMatrix == INSERTION && iEnd > 0) {
+				currTraceMatrix = lastColTrace[iEnd];
+				iEnd--;
+				nFree++;
+			}
+		}
+	}
+	i0 = origin % nCharString1Plus1;
+	j0 = origin / nCharString1Plus1;
+
+	/* Step 4:  Find the optimal path with Myers-Miller */
+	mm.rowElement = rowElement;
+	mm.rowFuzzy = rowFuzzy;
+	mm.colElement = colElement;
+	mm.colFuzzy = colFuzzy;
+	mm.substitutionArray = substitutionArray;
+	mm.substitutionArrayDim = substitutionArrayDim;
+	mm.fuzzyMatrix = fuzzyMatrix;
+	mm.fuzzyMatrixDim = fuzzyMatrixDim;
+	mm.gapOpening = gapOpening;
+	mm.gapExtension = gapExtension;
+	mm.cc = alignBufferPtr->cc;
+	mm.dd = alignBufferPtr->dd;
+	mm.rr = alignBufferPtr->rr;
+	mm.ss = alignBufferPtr->ss;
+	mm.path = alignBufferPtr->path;
+	mm.pathLength = 0;
+	if (localAlignment) {
+		/* (i0, j0) is the first substitution */
+		MyersMiller_emit(&mm, SUBSTITUTION, 1);
+		if (iEnd > i0) {
+			MyersMiller_diff(&mm, i0, j0, iEnd - i0 - 1, jEnd - j0 - 1,
+					 gapOpening, gapOpening);
+			MyersMiller_emit(&mm, SUBSTITUTION, 1);
+		}
+	} else {
+		MyersMiller_diff(&mm, i0, j0, iEnd - i0, jEnd - j0,
+				 gapOpening, gapOpening);
+		MyersMiller_emit(&mm, freeTraceMatrix, nFree);
+	}
+
+	/* Step 5:  Replay the path (backward) through traceback() */
+	nop = mm.pathLength;
+	for (k = 0; k < nop - 1; k++)
+		alignBufferPtr->pathTrace[k] = mm.path[nop - 2 - k];
+	alignBufferPtr->pathTrace[MAX(nop - 1, 0)] = SUBSTITUTION;
+	alignBufferPtr->pathTrace[MAX(nop, 1)] = TERMINATION;
+	traceback(NULL, NULL, NULL, 0, 0, alignBufferPtr->pathTrace,
+		  nop > 0 ? mm.path[nop - 1] : TERMINATION,
+		  align1InfoPtr, align2InfoPtr);
+	return maxScore;
+}
+
+/*
+ * Banded alignment (global and overlap alignments only): the optimal path
+ * is searched among the cells (i, j) of the DP with lo <= j - i <= hi,
+ * where lo = min(0, n2 - n1) - band and hi = max(0, n2 - n1) + band, so
+ * the time is proportional to n2 * band instead of n1 * n2. The band is the
+ * same for the reversed strings the DP runs on. The cells out of the band
+ * are -Inf and the DP is otherwise the one of the full (not scoreOnly)
+ * branch of pairwiseAlignment().
+ *
+ * Only the rows of the band are stored in the traceback matrices: the code
+ * of cell (i, j) (0-based) is at i - j + hi + (hi - lo + 1) * j, i.e. at
+ * i + (hi - lo) * j from 'hi', so traceback() can be used as is.
+ *
+ * With band = ADAPTIVE_BAND, the band starts at ADAPTIVE_BAND_START and is
+ * doubled until the optimal path doesn't touch its edges (the ones that
+ * are not beyond the edges of the DP matrix). Like the origins in
+ * linear_pairwiseAlignment(), each cell carries whether the traceback
+ * from it touches an edge.
+ */
+
+#define ADAPTIVE_BAND_START 16
+
+#define CURR_TOUCH(i, j) (currTouch[i + nCharString1Plus1 * j])
+#define PREV_TOUCH(i, j) (prevTouch[i + nCharString1Plus1 * j])
+#define BAND_TRACE(traceMatrix, i, j) \
+	(traceMatrix[(long) i + (long) traceNrow * j])
+#define BAND_EDGE(i, j) \
+	((edgeLo && (j) - (i) == lo) || (edgeHi && (j) - (i) == hi))
+
+/* The diagonals of the band, clipped to the DP matrix */
+static void get_band_diagonals(const int nCharString1,
+		const int nCharString2,
+		const int band,
+		int *lo,
+		int *hi)
+{
+	*lo = (int) MAX((double) MIN(0, nCharString2 - nCharString1) - band,
+			(double) - nCharString1);
+	*hi = (int) MIN((double) MAX(0, nCharString2 - nCharString1) + band,
+			(double) nCharString2);
+	return;
+}
+
+/*
+ * Returns the nb of cells of the traceback matrices needed by an alignment
+ * of 'nCharString1' x 'nCharString2' with 'band'. For the adaptive band,
+ * this is what its first band needs: the matrices grow with the band.
+ */
+static double get_band_nTraceCell(const int nCharString1,
+		const int nCharString2,
+		const int band)
+{
+	int lo, hi;
+
+	if (band == NO_BAND)
+		return (double) nCharString1 * nCharString2;
+	get_band_diagonals(nCharString1, nCharString2,
+			   band == ADAPTIVE_BAND ? ADAPTIVE_BAND_START : band,
+			   &lo, &hi);
+	return (double) MIN(hi - lo + 1, nCharString1) * nCharString2;
+}
+
+/* Must be called before init_trace_AlignBuffer() */
+static void init_band_AlignBuffer(struct AlignBuffer *alignBufferPtr,
+		const int nCharString1,
+		const int nCharString2,
+		const int band)
+{
+	struct AlignBuffer *ab = alignBufferPtr;
+
+	ab->band = band;
+	if (band == NO_BAND)
+		return;
+	ab->rowElement = (int *) R_alloc((long) nCharString1 + 1, sizeof(int));
+	ab->rowFuzzy = (int *) R_alloc((long) nCharString1 + 1, sizeof(int));
+	ab->colElement = (int *) R_alloc((long) nCharString2 + 1, sizeof(int));
+	ab->colFuzzy = (int *) R_alloc((long) nCharString2 + 1, sizeof(int));
+	ab->currTouch = (char *) R_alloc((long) 3 * (nCharString1 + 1), sizeof(char));
+	ab->prevTouch = (char *) R_alloc((long) 3 * (nCharString1 + 1), sizeof(char));
+	return;
+}
+
+/*
+ * Returns 1 if the banded traceback of some alignments of 'nCharString1' x
+ * 'nCharString2' with the fixed 'band' exceeds the limit set by
+ * setTracebackMemoryLimit() while the band doesn't cover the DP matrix.
+ */
+static int band_exceeds_traceLimit(const int nCharString1,
+		const int nCharString2,
+		const int band)
+{
+	int lo, hi;
+	double nTraceCell;
+
+	if (band < 0)
+		return 0;
+	get_band_diagonals(nCharString1, nCharString2, band, &lo, &hi);
+	if (lo == - nCharString1 && hi == nCharString2)
+		return 0;
+	nTraceCell = get_band_nTraceCell(nCharString1, nCharString2, band);
+	return nTraceCell > get_traceCapacity(nTraceCell);
+}
+
+/* Sets column 0 of the DP (the first column of currMatrix) */
+static void init_first_column(float *currMatrix,
+		const struct AlignInfo *align1InfoPtr,
+		const struct AlignInfo *align2InfoPtr,
+		const float gapOpening,
+		const float gapExtension)
+{
+	int i;
+	const int nCharString1 = align1InfoPtr->string.length;
+	const int nCharString1Plus1 = nCharString1 + 1;
+
 	CURR_MATRIX(0, 0) = 0.0;
 	CURR_MATRIX(0, 1) = (align2InfoPtr->endGap ? - gapOpening : 0.0);
-	for (i = 1, iMinus1 = 0; i <= nCharString1; i++, iMinus1++) {
+	for (i = 1; i <= nCharString1; i++) {
 		CURR_MATRIX(i, 0) = NEGATIVE_INFINITY;
 		CURR_MATRIX(i, 1) = NEGATIVE_INFINITY;
 	}
@@ -280,28 +1198,359 @@ static double pairwiseAlignment(
 		for (i = 0; i <= nCharString1; i++)
 			CURR_MATRIX(i, 2) = 0.0;
 	}
+	return;
+}
 
-	/* Step 3:  Perform main alignment operations */
-	Chars_holder sequence1, sequence2;
-	int scalar1, scalar2;
-	if (useQuality) {
-		sequence1 = align1InfoPtr->quality;
-		sequence2 = align2InfoPtr->quality;
-		scalar1 = (align1InfoPtr->quality.length == 1);
-		scalar2 = (align2InfoPtr->quality.length == 1);
-	} else {
-		sequence1 = align1InfoPtr->string;
-		sequence2 = align2InfoPtr->string;
-		scalar1 = (nCharString1 == 1);
-		scalar2 = (nCharString2 == 1);
-	}
-	int lookupValue = 0, element1, element2, stringElt1, stringElt2, fuzzy, iElt, jElt;
-	const int noEndGap1 = !align1InfoPtr->endGap;
-	const int noEndGap2 = !align2InfoPtr->endGap;
-	const float gapOpeningPlusExtension = gapOpening + gapExtension;
-	const float endGapAddend = (align2InfoPtr->endGap ? - gapExtension : 0.0);
-	float *tempMatrix, substitutionValue;
+/*
+ * Returns 1 and sets '*score' if the alignment was done in the band, 0 if
+ * the band covers the whole DP matrix or if the traceback of the adaptive
+ * band doesn't fit in the traceback matrices, even after they have grown
+ * up to 'traceLimit' (the caller then does the full DP, in linear space
+ * if it doesn't fit either). The traceback of a fixed band always fits:
+ * XStringSet_align_pairwiseAlignment() raises an error otherwise.
+ * 'align1InfoPtr' and 'align2InfoPtr' must have been prepared by
+ * pairwiseAlignment().
+ */
+static int banded_pairwiseAlignment(
+		struct AlignInfo *align1InfoPtr,
+		struct AlignInfo *align2InfoPtr,
+		const int scoreOnly,
+		const float gapOpening,
+		const float gapExtension,
+		const Chars_holder *sequence1,
+		const Chars_holder *sequence2,
+		const int scalar1,
+		const int scalar2,
+		const double *substitutionArray,
+		const int *substitutionArrayDim,
+		const int *substitutionLookupTable,
+		const int substitutionLookupTableLength,
+		const int *fuzzyMatrix,
+		const int *fuzzyMatrixDim,
+		const int *fuzzyLookupTable,
+		const int fuzzyLookupTableLength,
+		struct AlignBuffer *alignBufferPtr,
+		double *score)
+{
+	int i, j, iMinus1, jMinus1, k, band, lo, hi, edgeLo, edgeHi, edge;
+	int iLow, iHigh, traceNrow = 0, from;
+	char sCode, dCode, iCode, currTraceMatrix, *tempTouch;
+	char *sTraceMatrix = NULL, *iTraceMatrix = NULL, *dTraceMatrix = NULL;
+	float *tempMatrix, substitutionValue;
+	const int nCharString1 = align1InfoPtr->string.length;
+	const int nCharString2 = align2InfoPtr->string.length;
+	const int nCharString1Plus1 = nCharString1 + 1;
+	const int noEndGap1 = !align1InfoPtr->endGap;
+	const int noEndGap2 = !align2InfoPtr->endGap;
+	const float gapOpeningPlusExtension = gapOpening + gapExtension;
+	const float endGapAddend = (align2InfoPtr->endGap ? - gapExtension : 0.0);
+	float *currMatrix = alignBufferPtr->currMatrix;
+	float *prevMatrix = alignBufferPtr->prevMatrix;
+	char *currTouch = alignBufferPtr->currTouch;
+	char *prevTouch = alignBufferPtr->prevTouch;
+	int *rowElement = alignBufferPtr->rowElement;
+	int *rowFuzzy = alignBufferPtr->rowFuzzy;
+	int *colElement = alignBufferPtr->colElement;
+	int *colFuzzy = alignBufferPtr->colFuzzy;
+
+	/* Step 1:  Encode the subject and the pattern */
+	encode_letters(align1InfoPtr, align2InfoPtr, sequence1, sequence2,
+		       scalar1, scalar2,
+		       substitutionLookupTable, substitutionLookupTableLength,
+		       fuzzyLookupTable, fuzzyLookupTableLength,
+		       rowElement, rowFuzzy, colElement, colFuzzy);
+
+	band = alignBufferPtr->band == ADAPTIVE_BAND ?
+	       ADAPTIVE_BAND_START : alignBufferPtr->band;
+	while (1) {
+		/* Step 2:  Get the band and the layout of its traceback */
+		get_band_diagonals(nCharString1, nCharString2, band, &lo, &hi);
+		edgeLo = lo > - nCharString1;
+		edgeHi = hi < nCharString2;
+		if ((!edgeLo && !edgeHi)
+		 || (!scoreOnly && !reserve_trace_AlignBuffer(alignBufferPtr,
+				(double) MIN(hi - lo + 1, nCharString1) * nCharString2))) {
+			/* The previous bands overwrote column 0 */
+			init_first_column(alignBufferPtr->currMatrix,
+					  align1InfoPtr, align2InfoPtr,
+					  gapOpening, gapExtension);
+			return 0;
+		}
+		if (!scoreOnly) {
+			sTraceMatrix = alignBufferPtr->sTraceMatrix;
+			iTraceMatrix = alignBufferPtr->iTraceMatrix;
+			dTraceMatrix = alignBufferPtr->dTraceMatrix;
+			if (hi - lo + 1 < nCharString1) {
+				traceNrow = hi - lo;
+				sTraceMatrix += hi;
+				iTraceMatrix += hi;
+				dTraceMatrix += hi;
+			} else {
+				traceNrow = nCharString1;
+			}
+		}
+
+		/* Step 3:  Column 0 */
+		for (i = 0; i <= nCharString1; i++) {
+			CURR_MATRIX(i, 0) = NEGATIVE_INFINITY;
+			CURR_MATRIX(i, 1) = NEGATIVE_INFINITY;
+			if (- i < lo)
+				CURR_MATRIX(i, 2) = NEGATIVE_INFINITY;
+			else if (align1InfoPtr->endGap)
+				CURR_MATRIX(i, 2) = - gapOpening - i * gapExtension;
+			else
+				CURR_MATRIX(i, 2) = 0.0;
+			edge = BAND_EDGE(i, 0);
+			for (k = 0; k < 3; k++)
+				CURR_TOUCH(i, k) = edge;
+		}
+		CURR_MATRIX(0, 0) = 0.0;
+		CURR_MATRIX(0, 1) = (align2InfoPtr->endGap ? - gapOpening : 0.0);
+
+		/* Step 4:  Run the DP on the rows iLow to iHigh of each column.
+		 *          Row iLow - 1 of this column and row iHigh + 1 of the
+		 *          previous one are out of the band. */
+		for (j = 1, jMinus1 = 0; j <= nCharString2; j++, jMinus1++) {
+			tempMatrix = prevMatrix;
+			prevMatrix = currMatrix;
+			currMatrix = tempMatrix;
+			tempTouch = prevTouch;
+			prevTouch = currTouch;
+			currTouch = tempTouch;
+			iLow = MAX(1, j - hi);
+			iHigh = MIN(nCharString1, j - lo);
+
+			CURR_MATRIX(0, 0) = NEGATIVE_INFINITY;
+			if (j <= hi)
+				CURR_MATRIX(0, 1) = PREV_MATRIX(0, 1) + endGapAddend;
+			else
+				CURR_MATRIX(0, 1) = NEGATIVE_INFINITY;
+			CURR_MATRIX(0, 2) = NEGATIVE_INFINITY;
+			edge = PREV_TOUCH(0, 1) || BAND_EDGE(0, j);
+			for (k = 0; k < 3; k++)
+				CURR_TOUCH(0, k) = edge;
+			if (iLow > 1) {
+				for (k = 0; k < 3; k++)
+					CURR_MATRIX(iLow - 1, k) = NEGATIVE_INFINITY;
+			}
+
+			for (i = iLow, iMinus1 = iLow - 1; i <= iHigh; i++, iMinus1++) {
+				substitutionValue = (float) SUBSTITUTION_ARRAY(rowElement[i], colElement[j],
+						FUZZY_MATRIX(rowFuzzy[i], colFuzzy[j]));
+				edge = BAND_EDGE(i, j);
+				if (PREV_MATRIX(iMinus1, 0) >= MAX(PREV_MATRIX(iMinus1, 1), PREV_MATRIX(iMinus1, 2))) {
+					sCode = SUBSTITUTION;
+					from = 0;
+				} else if (PREV_MATRIX(iMinus1, 1) >= PREV_MATRIX(iMinus1, 2)) {
+					sCode = DELETION;
+					from = 1;
+				} else {
+					sCode = INSERTION;
+					from = 2;
+				}
+				CURR_MATRIX(i, 0) = PREV_MATRIX(iMinus1, from) + substitutionValue;
+				CURR_TOUCH(i, 0) = PREV_TOUCH(iMinus1, from) || edge;
+				if (PREV_MATRIX(i, 1) > (MAX(PREV_MATRIX(i, 0), PREV_MATRIX(i, 2)) - gapOpening)) {
+					dCode = DELETION;
+					CURR_MATRIX(i, 1) = PREV_MATRIX(i, 1) - gapExtension;
+					CURR_TOUCH(i, 1) = PREV_TOUCH(i, 1) || edge;
+				} else {
+					if (PREV_MATRIX(i, 0) >= PREV_MATRIX(i, 2)) {
+						dCode = SUBSTITUTION;
+						from = 0;
+					} else {
+						dCode = INSERTION;
+						from = 2;
+					}
+					CURR_MATRIX(i, 1) = PREV_MATRIX(i, from) - gapOpeningPlusExtension;
+					CURR_TOUCH(i, 1) = PREV_TOUCH(i, from) || edge;
+				}
+				if (CURR_MATRIX(iMinus1, 2) > (MAX(CURR_MATRIX(iMinus1, 0), CURR_MATRIX(iMinus1, 1)) - gapOpening)) {
+					iCode = INSERTION;
+					CURR_MATRIX(i, 2) = CURR_MATRIX(iMinus1, 2) - gapExtension;
+					CURR_TOUCH(i, 2) = CURR_TOUCH(iMinus1, 2) || edge;
+				} else {
+					if (CURR_MATRIX(iMinus1, 0) >= CURR_MATRIX(iMinus1, 1)) {
+						iCode = SUBSTITUTION;
+						from = 0;
+					} else {
+						iCode = DELETION;
+						from = 1;
+					}
+					CURR_MATRIX(i, 2) = CURR_MATRIX(iMinus1, from) - gapOpeningPlusExtension;
+					CURR_TOUCH(i, 2) = CURR_TOUCH(iMinus1, from) || edge;
+				}
+				if (!scoreOnly) {
+					BAND_TRACE(sTraceMatrix, iMinus1, jMinus1) = sCode;
+					BAND_TRACE(dTraceMatrix, iMinus1, jMinus1) = dCode;
+					BAND_TRACE(iTraceMatrix, iMinus1, jMinus1) = iCode;
+				}
+			}
+			if (iHigh < nCharString1) {
+				for (k = 0; k < 3; k++)
+					CURR_MATRIX(iHigh + 1, k) = NEGATIVE_INFINITY;
+			}
+
+			if (noEndGap2 && iHigh == nCharString1) {
+				if (PREV_MATRIX(nCharString1, 1) >= MAX(PREV_MATRIX(nCharString1, 0), PREV_MATRIX(nCharString1, 2))) {
+					dCode = DELETION;
+					from = 1;
+				} else if (PREV_MATRIX(nCharString1, 0) >= PREV_MATRIX(nCharString1, 2)) {
+					dCode = SUBSTITUTION;
+					from = 0;
+				} else {
+					dCode = INSERTION;
+					from = 2;
+				}
+				CURR_MATRIX(nCharString1, 1) = PREV_MATRIX(nCharString1, from);
+				CURR_TOUCH(nCharString1, 1) = PREV_TOUCH(nCharString1, from) || BAND_EDGE(nCharString1, j);
+				if (!scoreOnly)
+					BAND_TRACE(dTraceMatrix, nCharString1 - 1, jMinus1) = dCode;
+			}
+			if (noEndGap1 && j == nCharString2) {
+				for (i = iLow, iMinus1 = iLow - 1; i <= nCharString1; i++, iMinus1++) {
+					if (CURR_MATRIX(iMinus1, 2) >= MAX(CURR_MATRIX(iMinus1, 0), CURR_MATRIX(iMinus1, 1))) {
+						iCode = INSERTION;
+						from = 2;
+					} else if (CURR_MATRIX(iMinus1, 0) >= CURR_MATRIX(iMinus1, 1)) {
+						iCode = SUBSTITUTION;
+						from = 0;
+					} else {
+						iCode = DELETION;
+						from = 1;
+					}
+					CURR_MATRIX(i, 2) = CURR_MATRIX(iMinus1, from);
+					CURR_TOUCH(i, 2) = CURR_TOUCH(iMinus1, from) || BAND_EDGE(i, j);
+					if (!scoreOnly)
+						BAND_TRACE(iTraceMatrix, iMinus1, jMinus1) = iCode;
+				}
+			}
+		}
+
+		/* Step 5:  Get the optimal score and check the edges */
+		if (CURR_MATRIX(nCharString1, 0) >=
+				MAX(CURR_MATRIX(nCharString1, 1), CURR_MATRIX(nCharString1, 2))) {
+			currTraceMatrix = SUBSTITUTION;
+			from = 0;
+		} else if (CURR_MATRIX(nCharString1, 1) >= CURR_MATRIX(nCharString1, 2)) {
+			currTraceMatrix = DELETION;
+			from = 1;
+		} else {
+			currTraceMatrix = INSERTION;
+			from = 2;
+		}
+		if (alignBufferPtr->band != ADAPTIVE_BAND || !CURR_TOUCH(nCharString1, from))
+			break;
+		band = band > INT_MAX / 2 ? INT_MAX : 2 * band;
+	}
+	*score = CURR_MATRIX(nCharString1, from);
+
+	/* Step 6:  Traceback through the band */
+	if (!scoreOnly) {
+		align1InfoPtr->startRange = 1;
+		align2InfoPtr->startRange = 1;
+		traceback(sTraceMatrix, iTraceMatrix, dTraceMatrix,
+			  traceNrow, 1, NULL, currTraceMatrix,
+			  align1InfoPtr, align2InfoPtr);
+	}
+	return 1;
+}
+
+/* Returns the score of the optimal pairwise alignment */
+static double pairwiseAlignment(
+		struct AlignInfo *align1InfoPtr,
+		struct AlignInfo *align2InfoPtr,
+		const int localAlignment,
+		const int scoreOnly,
+		const float gapOpening,
+		const float gapExtension,
+		const int useQuality,
+		const double *substitutionArray,
+		const int *substitutionArrayDim,
+		const int *substitutionLookupTable,
+		const int substitutionLookupTableLength,
+		const int *fuzzyMatrix,
+		const int *fuzzyMatrixDim,
+		const int *fuzzyLookupTable,
+		const int fuzzyLookupTableLength,
+		struct AlignBuffer *alignBufferPtr)
+{
+	int i, j, iMinus1, jMinus1;
+
+	/* Step 1:  Get information on input XString objects */
+	const int nCharString1 = align1InfoPtr->string.length;
+	const int nCharString2 = align2InfoPtr->string.length;
+	const int nCharString1Plus1 = nCharString1 + 1;
+	const int nCharString1Minus1 = nCharString1 - 1;
+	const int nCharString2Minus1 = nCharString2 - 1;
+
+	align1InfoPtr->startRange = -1;
+	align2InfoPtr->startRange = -1;
+	align1InfoPtr->widthRange = 0;
+	align2InfoPtr->widthRange = 0;
+	if (nCharString1 < 1 || nCharString2 < 1) {
+		double zeroCharScore;
+		if (nCharString1 >= 1 && align1InfoPtr->endGap)
+			zeroCharScore = - gapOpening - nCharString1 * gapExtension;
+		else if (nCharString2 >= 1 && align2InfoPtr->endGap)
+			zeroCharScore = - gapOpening - nCharString2 * gapExtension;
+		else
+			zeroCharScore = 0.0;
+		align1InfoPtr->lengthMismatch = 0;
+		align2InfoPtr->lengthMismatch = 0;
+		align1InfoPtr->lengthIndel = 0;
+		align2InfoPtr->lengthIndel = 0;
+		return zeroCharScore;
+	}
+
+	/* Step 2:  Create objects for scores values */
+	/* Rows of currMatrix and prevMatrix = (0) substitution, (1) deletion, and (2) insertion */
+	float *currMatrix = alignBufferPtr->currMatrix;
+	float *prevMatrix = alignBufferPtr->prevMatrix;
+	init_first_column(currMatrix, align1InfoPtr, align2InfoPtr,
+			  gapOpening, gapExtension);
+
+	/* Step 3:  Perform main alignment operations */
+	Chars_holder sequence1, sequence2;
+	int scalar1, scalar2;
+	if (useQuality) {
+		sequence1 = align1InfoPtr->quality;
+		sequence2 = align2InfoPtr->quality;
+		scalar1 = (align1InfoPtr->quality.length == 1);
+		scalar2 = (align2InfoPtr->quality.length == 1);
+	} else {
+		sequence1 = align1InfoPtr->string;
+		sequence2 = align2InfoPtr->string;
+		scalar1 = (nCharString1 == 1);
+		scalar2 = (nCharString2 == 1);
+	}
+	int lookupValue = 0, element1, element2, stringElt1, stringElt2, fuzzy, iElt, jElt;
+	const int noEndGap1 = !align1InfoPtr->endGap;
+	const int noEndGap2 = !align2InfoPtr->endGap;
+	const float gapOpeningPlusExtension = gapOpening + gapExtension;
+	const float endGapAddend = (align2InfoPtr->endGap ? - gapExtension : 0.0);
+	float *tempMatrix, substitutionValue;
 	double maxScore = NEGATIVE_INFINITY;
+	if (scoreOnly && alignBufferPtr->band != NO_BAND
+	 && banded_pairwiseAlignment(align1InfoPtr, align2InfoPtr,
+			scoreOnly, gapOpening, gapExtension,
+			&sequence1, &sequence2, scalar1, scalar2,
+			substitutionArray, substitutionArrayDim,
+			substitutionLookupTable, substitutionLookupTableLength,
+			fuzzyMatrix, fuzzyMatrixDim,
+			fuzzyLookupTable, fuzzyLookupTableLength,
+			alignBufferPtr, &maxScore))
+		return maxScore;
+	if (scoreOnly && alignBufferPtr->useStriped
+	 && striped_pairwiseAlignment(align1InfoPtr, align2InfoPtr,
+			localAlignment, gapOpening, gapExtension,
+			&sequence1, &sequence2, scalar1, scalar2,
+			substitutionArray, substitutionArrayDim,
+			substitutionLookupTable, substitutionLookupTableLength,
+			fuzzyMatrix, fuzzyMatrixDim,
+			fuzzyLookupTable, fuzzyLookupTableLength,
+			alignBufferPtr, &maxScore))
+		return maxScore;
 	if (scoreOnly) {
 		/* Simplified calculations when only need the alignment score */
 		for (j = 1, jElt = nCharString2Minus1; j <= nCharString2; j++, jElt--) {
@@ -378,10 +1627,9 @@ static double pairwiseAlignment(
 				    CURR_MATRIX(nCharString1, 2)));
 		}
 	} else {
-		/* Step 3a:  Create objects for traceback values */
-		char *sTraceMatrix = alignBufferPtr->sTraceMatrix;
-		char *iTraceMatrix = alignBufferPtr->iTraceMatrix;
-		char *dTraceMatrix = alignBufferPtr->dTraceMatrix;
+		/* Step 3a:  Create objects for traceback values (set once the
+		 *           traceback matrices have grown to the alignment) */
+		char *sTraceMatrix, *iTraceMatrix, *dTraceMatrix;
 
 		/* Step 3b:  Prepare the alignment info object for alignment */
 		const int alignmentBufferSize = nCharString1Plus1;
@@ -397,6 +1645,29 @@ static double pairwiseAlignment(
 		memset(align2InfoPtr->startIndel, 0, alignmentBufferSize * sizeof(int));
 		memset(align1InfoPtr->widthIndel, 0, alignmentBufferSize * sizeof(int));
 		memset(align2InfoPtr->widthIndel, 0, alignmentBufferSize * sizeof(int));
+		if (alignBufferPtr->band != NO_BAND
+		 && banded_pairwiseAlignment(align1InfoPtr, align2InfoPtr,
+				scoreOnly, gapOpening, gapExtension,
+				&sequence1, &sequence2, scalar1, scalar2,
+				substitutionArray, substitutionArrayDim,
+				substitutionLookupTable, substitutionLookupTableLength,
+				fuzzyMatrix, fuzzyMatrixDim,
+				fuzzyLookupTable, fuzzyLookupTableLength,
+				alignBufferPtr, &maxScore))
+			return maxScore;
+		if (!reserve_trace_AlignBuffer(alignBufferPtr,
+				(double) nCharString1 * nCharString2))
+			return linear_pairwiseAlignment(align1InfoPtr, align2InfoPtr,
+					localAlignment, gapOpening, gapExtension,
+					&sequence1, &sequence2, scalar1, scalar2,
+					substitutionArray, substitutionArrayDim,
+					substitutionLookupTable, substitutionLookupTableLength,
+					fuzzyMatrix, fuzzyMatrixDim,
+					fuzzyLookupTable, fuzzyLookupTableLength,
+					alignBufferPtr);
+		sTraceMatrix = alignBufferPtr->sTraceMatrix;
+		iTraceMatrix = alignBufferPtr->iTraceMatrix;
+		dTraceMatrix = alignBufferPtr->dTraceMatrix;
 		for (j = 1, jMinus1 = 0, jElt = nCharString2Minus1; j <= nCharString2; j++, jMinus1++, jElt--) {
 			tempMatrix = prevMatrix;
 			prevMatrix = currMatrix;
@@ -567,13 +1838,1182 @@ static double pairwiseAlignment(
 		}
 
 		/* Step 4:  Traceback through the score matrices */
-		traceback(alignBufferPtr, currTraceMatrix,
+		traceback(sTraceMatrix, iTraceMatrix, dTraceMatrix,
+			  nCharString1, 1, NULL, currTraceMatrix,
 			  align1InfoPtr, align2InfoPtr);
 	}
 
 	return (double) maxScore;
 }
 
+#define BATCH_MAX_NROW 1024
+#define BATCH_WINDOW_NBATCH 64
+#define BATCH_MAX_TRACE_SIZE 67108864
+
+/*
+ * When many patterns are aligned against a single subject with integer
+ * scores, they are aligned in batches by the inter-sequence SIMD kernels
+ * (see align_batch.c). The patterns are taken in windows of consecutive
+ * patterns and sorted by length within each window so that the patterns
+ * of a batch have similar lengths. For the full alignments, the traceback
+ * matrices of all the batches of a window are kept until the alignments
+ * are reported, in the original order of the patterns.
+ */
+struct BatchBuffer {
+	int width;          /* max nb of patterns per batch, 0 if not used */
+	int maxNrow;        /* the longer patterns are aligned one at a time */
+	int windowSize;
+	int checkInterrupt; /* 0 in the worker threads */
+
+	/* The alignment problem */
+	const XStringSet_holder *pattern_holder;
+	const XStringSet_holder *patternQuality_holder;
+	int quality1Increment;
+	int useQuality;
+	int nCharString2;
+	int localAlignment;
+	int endGap1;
+	int endGap2;
+	int gapOpening;
+	int gapExtension;
+	int maxStep;
+	const double *substitutionArray;
+	const int *substitutionArrayDim;
+	const int *substitutionLookupTable;
+	int substitutionLookupTableLength;
+	const int *fuzzyMatrix;
+	const int *fuzzyMatrixDim;
+	const int *fuzzyLookupTable;
+	int fuzzyLookupTableLength;
+
+	/* The subject */
+	int nKeyUsed;
+	int *colKeys;
+	int *keyElement;
+	int *keyStringElt;
+
+	/* The current window. The results are stored by position in
+	 * 'order'. */
+	int windowStart;
+	int windowEnd;
+	int *lengthCounts;
+	int *order;         /* window offsets sorted by pattern length */
+	int *rank;          /* position in 'order', -1 if not aligned */
+	int *batchNrow;
+	char *traceBuf;
+	int *sub;
+	int *nrows;
+	double *score;
+	char *traceStart;
+	int *startRange1;
+	int *startRange2;
+	const char **sTrace;
+	const char **dTrace;
+	const char **iTrace;
+	int *traceStride;
+};
+
+static void init_BatchBuffer(
+		struct BatchBuffer *batchBufferPtr,
+		const XStringSet_holder *pattern_holder,
+		const XStringSet_holder *patternQuality_holder,
+		const int quality1Increment,
+		const int numberOfStrings,
+		const int nCharString1,
+		const struct AlignInfo *align2InfoPtr,
+		const int endGap1,
+		const int localAlignment,
+		const int scoreOnly,
+		const float gapOpening,
+		const float gapExtension,
+		const int useQuality,
+		const double *substitutionArray,
+		const int substitutionArrayLength,
+		const int *substitutionArrayDim,
+		const int *substitutionLookupTable,
+		const int substitutionLookupTableLength,
+		const int *fuzzyMatrix,
+		const int *fuzzyMatrixDim,
+		const int *fuzzyLookupTable,
+		const int fuzzyLookupTableLength,
+		const double maxTraceSize)
+{
+	int i, j, jElt, key, nKey, maxKey, *keyIndex, width, nbatch,
+	    lookupValue = 0, stringElt2, scalar2;
+	double traceSizePerRow;
+	const int nCharString2 = align2InfoPtr->string.length;
+	Chars_holder sequence2;
+	struct BatchBuffer *bb = batchBufferPtr;
+
+	bb->width = 0;
+	bb->windowStart = bb->windowEnd = 0;
+	if (numberOfStrings < 2 || nCharString1 < 1 || nCharString2 < 1)
+		return;
+	width = _batch_align_width();
+	bb->maxStep = get_integer_maxStep(gapOpening, gapExtension,
+				substitutionArray, substitutionArrayLength);
+	if (width == 0 || bb->maxStep < 0)
+		return;
+	/* With narrow vectors, the striped kernels are as fast at computing
+	   the scores one pattern at a time */
+	if (scoreOnly && width < 16)
+		return;
+	bb->maxNrow = MIN(nCharString1, BATCH_MAX_NROW);
+	nbatch = BATCH_WINDOW_NBATCH;
+	if (!scoreOnly) {
+		traceSizePerRow = 3.0 * nCharString2 * width;
+		if (traceSizePerRow * bb->maxNrow > maxTraceSize)
+			bb->maxNrow = maxTraceSize / traceSizePerRow;
+		if (bb->maxNrow < 1)
+			return;
+		nbatch = MIN(nbatch, (int) (maxTraceSize /
+				(traceSizePerRow * bb->maxNrow)));
+	}
+
+	/* Encode the subject */
+	nKey = substitutionArrayDim[1] * fuzzyMatrixDim[1];
+	maxKey = MIN(nKey, nCharString2);
+	keyIndex = (int *) R_alloc((long) nKey, sizeof(int));
+	for (key = 0; key < nKey; key++)
+		keyIndex[key] = -1;
+	bb->colKeys = (int *) R_alloc((long) nCharString2, sizeof(int));
+	bb->keyElement = (int *) R_alloc((long) maxKey, sizeof(int));
+	bb->keyStringElt = (int *) R_alloc((long) maxKey, sizeof(int));
+	if (useQuality) {
+		sequence2 = align2InfoPtr->quality;
+		scalar2 = (align2InfoPtr->quality.length == 1);
+	} else {
+		sequence2 = align2InfoPtr->string;
+		scalar2 = (nCharString2 == 1);
+	}
+	bb->nKeyUsed = 0;
+	for (j = 0, jElt = nCharString2 - 1; j < nCharString2; j++, jElt--) {
+		SET_LOOKUP_VALUE(fuzzyLookupTable, fuzzyLookupTableLength, align2InfoPtr->string.ptr[jElt]);
+		stringElt2 = lookupValue;
+		SET_LOOKUP_VALUE(substitutionLookupTable, substitutionLookupTableLength, sequence2.ptr[scalar2 ? 0 : jElt]);
+		key = lookupValue + substitutionArrayDim[1] * stringElt2;
+		if (keyIndex[key] == -1) {
+			keyIndex[key] = bb->nKeyUsed;
+			bb->keyElement[bb->nKeyUsed] = lookupValue;
+			bb->keyStringElt[bb->nKeyUsed] = stringElt2;
+			bb->nKeyUsed++;
+		}
+		bb->colKeys[j] = keyIndex[key];
+	}
+	if ((double) bb->nKeyUsed * bb->maxNrow * width > MAX_STRIPED_SUB_SIZE)
+		bb->maxNrow = MAX_STRIPED_SUB_SIZE / (bb->nKeyUsed * width);
+	if (bb->maxNrow < 1)
+		return;
+
+	bb->pattern_holder = pattern_holder;
+	bb->patternQuality_holder = patternQuality_holder;
+	bb->quality1Increment = quality1Increment;
+	bb->useQuality = useQuality;
+	bb->nCharString2 = nCharString2;
+	bb->localAlignment = localAlignment;
+	bb->endGap1 = endGap1;
+	bb->endGap2 = align2InfoPtr->endGap;
+	bb->gapOpening = (int) gapOpening;
+	bb->gapExtension = (int) gapExtension;
+	bb->substitutionArray = substitutionArray;
+	bb->substitutionArrayDim = substitutionArrayDim;
+	bb->substitutionLookupTable = substitutionLookupTable;
+	bb->substitutionLookupTableLength = substitutionLookupTableLength;
+	bb->fuzzyMatrix = fuzzyMatrix;
+	bb->fuzzyMatrixDim = fuzzyMatrixDim;
+	bb->fuzzyLookupTable = fuzzyLookupTable;
+	bb->fuzzyLookupTableLength = fuzzyLookupTableLength;
+
+	bb->windowSize = nbatch * width;
+	bb->checkInterrupt = 1;
+	i = bb->windowSize;
+	bb->lengthCounts = (int *) R_alloc((long) bb->maxNrow + 2, sizeof(int));
+	bb->order = (int *) R_alloc((long) i, sizeof(int));
+	bb->rank = (int *) R_alloc((long) i, sizeof(int));
+	bb->batchNrow = (int *) R_alloc((long) nbatch, sizeof(int));
+	bb->traceBuf = scoreOnly ? NULL :
+		(char *) R_alloc((long) nbatch * 3 * bb->maxNrow * nCharString2
+				 * width, sizeof(char));
+	bb->sub = (int *) R_alloc((long) bb->nKeyUsed * bb->maxNrow * width,
+				  sizeof(int));
+	bb->nrows = (int *) R_alloc((long) i, sizeof(int));
+	bb->score = (double *) R_alloc((long) i, sizeof(double));
+	bb->traceStart = (char *) R_alloc((long) i, sizeof(char));
+	bb->startRange1 = (int *) R_alloc((long) i, sizeof(int));
+	bb->startRange2 = (int *) R_alloc((long) i, sizeof(int));
+	bb->sTrace = (const char **) R_alloc((long) i, sizeof(char *));
+	bb->dTrace = (const char **) R_alloc((long) i, sizeof(char *));
+	bb->iTrace = (const char **) R_alloc((long) i, sizeof(char *));
+	bb->traceStride = (int *) R_alloc((long) i, sizeof(int));
+	bb->width = width;
+	return;
+}
+
+/*
+ * Aligns the patterns of the window starting at pattern 'windowStart'. The
+ * window stops at pattern 'end' (excluded) at the latest.
+ */
+static void run_batch_window(struct BatchBuffer *batchBufferPtr,
+			     const int windowStart,
+			     const int end)
+{
+	int i, k, n, b, p, first, nrow, len, iElt, scalar1, key,
+	    lookupValue = 0, element1, stringElt1, *counts;
+	Chars_holder string1, sequence1;
+	BatchAlignment ba;
+	struct BatchBuffer *bb = batchBufferPtr;
+	const double *substitutionArray = bb->substitutionArray;
+	const int *substitutionArrayDim = bb->substitutionArrayDim;
+	const int *fuzzyMatrix = bb->fuzzyMatrix;
+	const int *fuzzyMatrixDim = bb->fuzzyMatrixDim;
+
+	bb->windowStart = windowStart;
+	bb->windowEnd = MIN(windowStart + bb->windowSize, end);
+	n = bb->windowEnd - windowStart;
+
+	/* Sort the patterns by length (counting sort) */
+	counts = bb->lengthCounts;
+	memset(counts, 0, (bb->maxNrow + 2) * sizeof(int));
+	for (k = 0; k < n; k++) {
+		len = _get_elt_from_XStringSet_holder(bb->pattern_holder,
+						      windowStart + k).length;
+		bb->rank[k] = len >= 1 && len <= bb->maxNrow ? len : -1;
+		if (bb->rank[k] != -1)
+			counts[len + 1]++;
+	}
+	for (len = 1; len <= bb->maxNrow; len++)
+		counts[len + 1] += counts[len];
+	for (k = 0; k < n; k++) {
+		if (bb->rank[k] == -1)
+			continue;
+		p = counts[bb->rank[k]]++;
+		bb->order[p] = k;
+		bb->rank[k] = p;
+	}
+	n = counts[bb->maxNrow];
+
+	ba.ncol = bb->nCharString2;
+	ba.nkey = bb->nKeyUsed;
+	ba.sub = bb->sub;
+	ba.col2key = bb->colKeys;
+	ba.gapOpening = bb->gapOpening;
+	ba.gapExtension = bb->gapExtension;
+	ba.endGap1 = bb->endGap1;
+	ba.endGap2 = bb->endGap2;
+	ba.local = bb->localAlignment;
+	ba.maxstep = bb->maxStep;
+	for (b = 0, first = 0; first < n; b++, first += bb->width) {
+		if (bb->checkInterrupt)
+			R_CheckUserInterrupt();
+		ba.npattern = MIN(bb->width, n - first);
+		if (ba.npattern < 2) {
+			bb->rank[bb->order[first]] = -1;
+			continue;
+		}
+		i = windowStart + bb->order[first + ba.npattern - 1];
+		nrow = _get_elt_from_XStringSet_holder(bb->pattern_holder, i).length;
+		for (p = 0; p < ba.npattern; p++) {
+			i = windowStart + bb->order[first + p];
+			string1 = _get_elt_from_XStringSet_holder(bb->pattern_holder, i);
+			if (bb->useQuality) {
+				sequence1 = _get_elt_from_XStringSet_holder(bb->patternQuality_holder,
+						i * bb->quality1Increment);
+				scalar1 = (sequence1.length == 1);
+			} else {
+				sequence1 = string1;
+				scalar1 = (string1.length == 1);
+			}
+			bb->nrows[first + p] = string1.length;
+			for (k = 0, iElt = string1.length - 1; k < string1.length; k++, iElt--) {
+				SET_LOOKUP_VALUE(bb->fuzzyLookupTable, bb->fuzzyLookupTableLength, string1.ptr[iElt]);
+				stringElt1 = lookupValue;
+				SET_LOOKUP_VALUE(bb->substitutionLookupTable, bb->substitutionLookupTableLength, sequence1.ptr[scalar1 ? 0 : iElt]);
+				element1 = lookupValue;
+				for (key = 0; key < bb->nKeyUsed; key++)
+					bb->sub[((long) key * nrow + k) * ba.npattern + p] =
+						(int) SUBSTITUTION_ARRAY(element1, bb->keyElement[key],
+							FUZZY_MATRIX(stringElt1, bb->keyStringElt[key]));
+			}
+		}
+		ba.nrow = nrow;
+		ba.nrows = bb->nrows + first;
+		ba.traceBuf = bb->traceBuf == NULL ? NULL : bb->traceBuf +
+			(long) b * 3 * bb->maxNrow * bb->nCharString2 * bb->width;
+		ba.score = bb->score + first;
+		ba.traceStart = bb->traceStart + first;
+		ba.startRange1 = bb->startRange1 + first;
+		ba.startRange2 = bb->startRange2 + first;
+		ba.sTrace = bb->sTrace + first;
+		ba.dTrace = bb->dTrace + first;
+		ba.iTrace = bb->iTrace + first;
+		ba.traceStride = bb->traceStride + first;
+		bb->batchNrow[b] = nrow;
+		if (!_batch_align(&ba)) {
+			for (p = 0; p < ba.npattern; p++)
+				bb->rank[bb->order[first + p]] = -1;
+		}
+	}
+	return;
+}
+
+/*
+ * Like pairwiseAlignment() but for a pattern of the current window that
+ * was aligned by run_batch_window().
+ */
+static double pairwiseAlignment_from_batch(
+		const struct BatchBuffer *batchBufferPtr,
+		const int k,
+		struct AlignInfo *align1InfoPtr,
+		struct AlignInfo *align2InfoPtr,
+		const int scoreOnly)
+{
+	const struct BatchBuffer *bb = batchBufferPtr;
+	const int p = bb->rank[k];
+	const int alignmentBufferSize = align1InfoPtr->string.length + 1;
+
+	align1InfoPtr->startRange = -1;
+	align2InfoPtr->startRange = -1;
+	align1InfoPtr->widthRange = 0;
+	align2InfoPtr->widthRange = 0;
+	if (scoreOnly)
+		return bb->score[p];
+
+	align1InfoPtr->lengthMismatch = 0;
+	align2InfoPtr->lengthMismatch = 0;
+	align1InfoPtr->lengthIndel = 0;
+	align2InfoPtr->lengthIndel = 0;
+
+	memset(align1InfoPtr->mismatch,   0, alignmentBufferSize * sizeof(int));
+	memset(align2InfoPtr->mismatch,   0, alignmentBufferSize * sizeof(int));
+	memset(align1InfoPtr->startIndel, 0, alignmentBufferSize * sizeof(int));
+	memset(align2InfoPtr->startIndel, 0, alignmentBufferSize * sizeof(int));
+	memset(align1InfoPtr->widthIndel, 0, alignmentBufferSize * sizeof(int));
+	memset(align2InfoPtr->widthIndel, 0, alignmentBufferSize * sizeof(int));
+	align1InfoPtr->startRange = bb->startRange1[p];
+	align2InfoPtr->startRange = bb->startRange2[p];
+	traceback(bb->sTrace[p], bb->iTrace[p], bb->dTrace[p],
+		  bb->batchNrow[p / bb->width], bb->traceStride[p],
+		  NULL, bb->traceStart[p], align1InfoPtr, align2InfoPtr);
+	return bb->score[p];
+}
+
+/*
+ * Multi-threaded mode (see setBiostringsThreads()). The patterns (or the
+ * pairs of strings for stringDist()) are split in 1 chunk per thread and
+ * each thread aligns its chunk with its own buffers. The chunks are
+ * balanced by number of cells of the DP matrices. The scores, ranges and
+ * nb of mismatches/indels of each alignment are written in pre-sized
+ * slots of the output, and the mismatches and indels are stored in
+ * malloc-based buffers (1 per chunk) that are concatenated in chunk order
+ * by the main thread. So the result doesn't depend on the number of
+ * threads.
+ *
+ * Nothing in a worker thread can use the R API: pairwiseAlignment() only
+ * raises an error for a letter that is not in the lookup tables so all the
+ * letters are checked in the main thread first and 1 worker run by the main
+ * thread is used if one of them is not valid (to raise the same error as
+ * before). The chunks are aligned in rounds of about ROUND_NCELL cells per
+ * worker and the main thread checks for user interrupts between 2 rounds.
+ */
+
+#define PARALLEL_MAX_TRACE_SIZE 1073741824.0
+#define ROUND_NCELL 67108864.0
+
+/* The parameters of pairwiseAlignment() that are the same for all the
+ * alignments */
+struct AlignParams {
+	int localAlignment;
+	int scoreOnly;
+	float gapOpening;
+	float gapExtension;
+	int useQuality;
+	const double *substitutionArray;
+	int substitutionArrayLength;
+	const int *substitutionArrayDim;
+	const int *substitutionLookupTable;
+	int substitutionLookupTableLength;
+	const int *fuzzyMatrix;
+	const int *fuzzyMatrixDim;
+	const int *fuzzyLookupTable;
+	int fuzzyLookupTableLength;
+	int band;
+};
+
+/* The buffers owned by a worker thread */
+struct AlignWorker {
+	struct AlignInfo align1Info;
+	struct AlignInfo align2Info;
+	struct AlignBuffer alignBuffer;
+	struct BatchBuffer batchBuffer;
+	struct MismatchBuffer mismatchBuffer;
+	struct IndelBuffer indel1Buffer;
+	struct IndelBuffer indel2Buffer;
+	int mallocFailed;
+
+	/* 1 if the worker is run by the main thread: its buffers are then
+	 * grown with R_alloc() and it checks for user interrupts */
+	int inMainThread;
+
+	/* The chunk: alignments 'from' to 'to' (excluded). For stringDist(),
+	 * these are offsets in the lower triangle of the distance matrix and
+	 * the first pair of the chunk is (firstI, firstJ). A round aligns
+	 * 'from' to 'end' (excluded) and then moves 'from' (and 'firstI',
+	 * 'firstJ') to 'end'. */
+	long from;
+	long to;
+	long end;
+	int firstI;
+	int firstJ;
+};
+
+/* The output slots of XStringSet_align_pairwiseAlignment(). The 'Ends'
+ * slots hold the nb of mismatches/indels of each alignment until the main
+ * thread turns them into cumulated sums. */
+struct AlignSlots {
+	double *score;
+	int *align1RangeStart;
+	int *align1RangeWidth;
+	int *align1MismatchEnds;
+	int *align1IndelEnds;
+	int *align2RangeStart;
+	int *align2RangeWidth;
+	int *align2MismatchEnds;
+	int *align2IndelEnds;
+};
+
+static void init_AlignParams(struct AlignParams *alignParamsPtr,
+		const int localAlignment,
+		const int scoreOnly,
+		const float gapOpening,
+		const float gapExtension,
+		const int useQuality,
+		SEXP substitutionArray,
+		SEXP substitutionArrayDim,
+		SEXP substitutionLookupTable,
+		SEXP fuzzyMatrix,
+		SEXP fuzzyMatrixDim,
+		SEXP fuzzyLookupTable,
+		const int band)
+{
+	alignParamsPtr->localAlignment = localAlignment;
+	alignParamsPtr->scoreOnly = scoreOnly;
+	alignParamsPtr->gapOpening = gapOpening;
+	alignParamsPtr->gapExtension = gapExtension;
+	alignParamsPtr->useQuality = useQuality;
+	alignParamsPtr->substitutionArray = REAL(substitutionArray);
+	alignParamsPtr->substitutionArrayLength = LENGTH(substitutionArray);
+	alignParamsPtr->substitutionArrayDim = INTEGER(substitutionArrayDim);
+	alignParamsPtr->substitutionLookupTable = INTEGER(substitutionLookupTable);
+	alignParamsPtr->substitutionLookupTableLength = LENGTH(substitutionLookupTable);
+	alignParamsPtr->fuzzyMatrix = INTEGER(fuzzyMatrix);
+	alignParamsPtr->fuzzyMatrixDim = INTEGER(fuzzyMatrixDim);
+	alignParamsPtr->fuzzyLookupTable = INTEGER(fuzzyLookupTable);
+	alignParamsPtr->fuzzyLookupTableLength = LENGTH(fuzzyLookupTable);
+	alignParamsPtr->band = band;
+	return;
+}
+
+/*
+ * Returns 1 if all the letters of 'string' and of 'sequence' (its quality,
+ * or 'string' itself) that pairwiseAlignment() looks up are in the lookup
+ * tables, 0 otherwise.
+ */
+static int letters_are_in_lookup_tables(
+		const Chars_holder *string,
+		const Chars_holder *sequence,
+		const struct AlignParams *alignParamsPtr)
+{
+	int i, k;
+	unsigned char lookupKey;
+	const struct AlignParams *ap = alignParamsPtr;
+
+	for (i = 0; i < string->length; i++) {
+		lookupKey = (unsigned char) string->ptr[i];
+		if (lookupKey >= ap->fuzzyLookupTableLength
+		 || ap->fuzzyLookupTable[lookupKey] == NA_INTEGER)
+			return 0;
+		k = sequence->length == 1 ? 0 : i;
+		if (k >= sequence->length)
+			return 0;
+		lookupKey = (unsigned char) sequence->ptr[k];
+		if (lookupKey >= ap->substitutionLookupTableLength
+		 || ap->substitutionLookupTable[lookupKey] == NA_INTEGER)
+			return 0;
+	}
+	return 1;
+}
+
+static int XStringSet_letters_are_in_lookup_tables(
+		const XStringSet_holder *string_holder,
+		const XStringSet_holder *quality_holder,
+		const int qualityIncrement,
+		const int length,
+		const struct AlignParams *alignParamsPtr)
+{
+	int i;
+	Chars_holder string, quality;
+
+	for (i = 0; i < length; i++) {
+		string = _get_elt_from_XStringSet_holder(string_holder, i);
+		if (alignParamsPtr->useQuality)
+			quality = _get_elt_from_XStringSet_holder(quality_holder,
+						i * qualityIncrement);
+		else
+			quality = string;
+		if (!letters_are_in_lookup_tables(&string, &quality,
+						  alignParamsPtr))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Returns the nb of worker threads to use for 'nalign' alignments with
+ * traceback matrices of up to 'nTraceCell' cells. Each worker needs its
+ * own traceback matrices so fewer threads are used for the bigger
+ * alignments.
+ */
+static int get_nworker(const int nalign, const int scoreOnly,
+		       const double nTraceCell)
+{
+	int nworker;
+	double traceSize;
+
+	nworker = _get_nthreads();
+	if (nworker > nalign)
+		nworker = MAX(nalign, 1);
+	if (!scoreOnly && nworker > 1) {
+		traceSize = 3.0 * get_traceCapacity(nTraceCell);
+		if (nworker * traceSize > PARALLEL_MAX_TRACE_SIZE)
+			nworker = MAX(1, (int) (PARALLEL_MAX_TRACE_SIZE / traceSize));
+	}
+	return nworker;
+}
+
+static void init_AlignWorker(struct AlignWorker *alignWorkerPtr,
+		const struct AlignParams *alignParamsPtr,
+		const int nCharString1,
+		const int nCharString2,
+		const double nCharProduct,
+		const double nTraceCell)
+{
+	struct AlignWorker *w = alignWorkerPtr;
+	const struct AlignParams *ap = alignParamsPtr;
+	const int alignmentBufferSize = nCharString1 + 1;
+
+	w->alignBuffer.currMatrix = (float *) R_alloc((long) 3 * alignmentBufferSize, sizeof(float));
+	w->alignBuffer.prevMatrix = (float *) R_alloc((long) 3 * alignmentBufferSize, sizeof(float));
+	w->alignBuffer.useStriped = 0;
+	w->batchBuffer.width = 0;
+	init_band_AlignBuffer(&w->alignBuffer, nCharString1, nCharString2,
+			      ap->band);
+	if (ap->scoreOnly) {
+		init_striped_AlignBuffer(&w->alignBuffer, nCharString1, nCharString2,
+				ap->gapOpening, ap->gapExtension,
+				ap->substitutionArray, ap->substitutionArrayLength,
+				ap->substitutionArrayDim, ap->fuzzyMatrixDim);
+	} else {
+		w->align1Info.mismatch   = (int *) R_alloc((long) alignmentBufferSize, sizeof(int));
+		w->align2Info.mismatch   = (int *) R_alloc((long) alignmentBufferSize, sizeof(int));
+		w->align1Info.startIndel = (int *) R_alloc((long) alignmentBufferSize, sizeof(int));
+		w->align2Info.startIndel = (int *) R_alloc((long) alignmentBufferSize, sizeof(int));
+		w->align1Info.widthIndel = (int *) R_alloc((long) alignmentBufferSize, sizeof(int));
+		w->align2Info.widthIndel = (int *) R_alloc((long) alignmentBufferSize, sizeof(int));
+		init_trace_AlignBuffer(&w->alignBuffer, nCharString1, nCharString2,
+				       nCharProduct, nTraceCell);
+	}
+	memset(&w->mismatchBuffer, 0, sizeof(struct MismatchBuffer));
+	memset(&w->indel1Buffer, 0, sizeof(struct IndelBuffer));
+	memset(&w->indel2Buffer, 0, sizeof(struct IndelBuffer));
+	w->mallocFailed = 0;
+	w->inMainThread = 0;
+	return;
+}
+
+static void free_AlignWorkers(struct AlignWorker *workers, const int nworker)
+{
+	int k;
+
+	for (k = 0; k < nworker; k++) {
+		if (workers[k].inMainThread)
+			continue;
+		free(workers[k].mismatchBuffer.pattern);
+		free(workers[k].mismatchBuffer.subject);
+		free(workers[k].indel1Buffer.start);
+		free(workers[k].indel1Buffer.width);
+		free(workers[k].indel2Buffer.start);
+		free(workers[k].indel2Buffer.width);
+		free_trace_AlignBuffer(&workers[k].alignBuffer);
+	}
+	return;
+}
+
+/*
+ * Grows 'buf' (holding 'usedSpace' ints) so it can hold at least 'needed'
+ * ints, with realloc() if 'useMalloc' is 1 or R_alloc() otherwise.
+ */
+static int grow_int_buffer(int **buf, const int needed, const int usedSpace,
+			   const int useMalloc)
+{
+	int *tmp;
+
+	if (!useMalloc) {
+		tmp = (int *) R_alloc((long) needed, sizeof(int));
+		if (usedSpace > 0)
+			memcpy(tmp, *buf, usedSpace * sizeof(int));
+		*buf = tmp;
+		return 1;
+	}
+	tmp = (int *) realloc(*buf, (size_t) needed * sizeof(int));
+	if (tmp == NULL)
+		return 0;
+	*buf = tmp;
+	return 1;
+}
+
+/* Returns 0 if realloc() failed */
+static int append_to_MismatchBuffer(struct MismatchBuffer *mismatchBufferPtr,
+		const struct AlignInfo *align1InfoPtr,
+		const struct AlignInfo *align2InfoPtr,
+		const int useMalloc)
+{
+	struct MismatchBuffer *buf = mismatchBufferPtr;
+	const int n = align1InfoPtr->lengthMismatch;
+	int totalSpace;
+
+	if (n == 0)
+		return 1;
+	if (buf->usedSpace + n > buf->totalSpace) {
+		totalSpace = MAX(2 * buf->totalSpace, buf->usedSpace + n);
+		if (!grow_int_buffer(&buf->pattern, totalSpace, buf->usedSpace, useMalloc)
+		 || !grow_int_buffer(&buf->subject, totalSpace, buf->usedSpace, useMalloc))
+			return 0;
+		buf->totalSpace = totalSpace;
+	}
+	memcpy(buf->pattern + buf->usedSpace, align1InfoPtr->mismatch, n * sizeof(int));
+	memcpy(buf->subject + buf->usedSpace, align2InfoPtr->mismatch, n * sizeof(int));
+	buf->usedSpace += n;
+	return 1;
+}
+
+/* Returns 0 if realloc() failed */
+static int append_to_IndelBuffer(struct IndelBuffer *indelBufferPtr,
+		const struct AlignInfo *alignInfoPtr,
+		const int useMalloc)
+{
+	struct IndelBuffer *buf = indelBufferPtr;
+	const int n = alignInfoPtr->lengthIndel;
+	int totalSpace;
+
+	if (n == 0)
+		return 1;
+	if (buf->usedSpace + n > buf->totalSpace) {
+		totalSpace = MAX(2 * buf->totalSpace, buf->usedSpace + n);
+		if (!grow_int_buffer(&buf->start, totalSpace, buf->usedSpace, useMalloc)
+		 || !grow_int_buffer(&buf->width, totalSpace, buf->usedSpace, useMalloc))
+			return 0;
+		buf->totalSpace = totalSpace;
+	}
+	memcpy(buf->start + buf->usedSpace, alignInfoPtr->startIndel, n * sizeof(int));
+	memcpy(buf->width + buf->usedSpace, alignInfoPtr->widthIndel, n * sizeof(int));
+	buf->usedSpace += n;
+	return 1;
+}
+
+static double pairwiseAlignment_with_params(
+		struct AlignInfo *align1InfoPtr,
+		struct AlignInfo *align2InfoPtr,
+		const struct AlignParams *alignParamsPtr,
+		struct AlignBuffer *alignBufferPtr)
+{
+	const struct AlignParams *ap = alignParamsPtr;
+
+	return pairwiseAlignment(align1InfoPtr, align2InfoPtr,
+			ap->localAlignment, ap->scoreOnly,
+			ap->gapOpening, ap->gapExtension, ap->useQuality,
+			ap->substitutionArray, ap->substitutionArrayDim,
+			ap->substitutionLookupTable,
+			ap->substitutionLookupTableLength,
+			ap->fuzzyMatrix, ap->fuzzyMatrixDim,
+			ap->fuzzyLookupTable, ap->fuzzyLookupTableLength,
+			alignBufferPtr);
+}
+
+/*
+ * Splits the 'n' alignments in 'nworker' chunks of consecutive alignments
+ * with about the same total cost.
+ */
+static void split_alignments(struct AlignWorker *workers, const int nworker,
+			     const double *cost, const int n)
+{
+	int i, k;
+	double total, acc;
+
+	for (i = 0, total = 0.0; i < n; i++)
+		total += cost[i];
+	workers[0].from = 0;
+	for (i = 0, k = 1, acc = 0.0; i < n && k < nworker; i++) {
+		acc += cost[i];
+		while (k < nworker && acc >= total * k / nworker) {
+			workers[k - 1].to = workers[k].from = i + 1;
+			k++;
+		}
+	}
+	for ( ; k < nworker; k++)
+		workers[k - 1].to = workers[k].from = n;
+	workers[nworker - 1].to = n;
+	return;
+}
+
+/*
+ * Sets the end of the next round of each worker so it aligns about
+ * ROUND_NCELL cells (and at least 1 alignment) of its chunk. Returns 0 if
+ * all the chunks are done.
+ */
+static int set_round_ends(struct AlignWorker *workers, const int nworker,
+			  const double *cost)
+{
+	int k, more;
+	long i;
+	double acc;
+
+	for (k = 0, more = 0; k < nworker; k++) {
+		for (i = workers[k].from, acc = 0.0;
+		     i < workers[k].to && acc < ROUND_NCELL; i++)
+			acc += cost[i];
+		workers[k].end = i;
+		more = more || i > workers[k].from;
+	}
+	return more;
+}
+
+static void check_interrupt_fun(void *data)
+{
+	R_CheckUserInterrupt();
+}
+
+/*
+ * Called by the main thread between 2 rounds. R_CheckUserInterrupt() would
+ * jump out of the .Call without freeing the malloc-based buffers of the
+ * workers so it is called with R_ToplevelExec().
+ */
+static void check_AlignWorkers_interrupt(struct AlignWorker *workers,
+					 const int nworker)
+{
+	if (R_ToplevelExec(check_interrupt_fun, NULL))
+		return;
+	free_AlignWorkers(workers, nworker);
+	error("interrupted by the user");
+}
+
+/*
+ * Aligns the patterns of the current round of worker 'w' (run by a worker
+ * thread or by the main thread).
+ */
+static void align_chunk(struct AlignWorker *w,
+		const struct AlignParams *alignParamsPtr,
+		const XStringSet_holder *pattern_holder,
+		const XStringSet_holder *patternQuality_holder,
+		const int quality1Increment,
+		const XStringSet_holder *subject_holder,
+		const XStringSet_holder *subjectQuality_holder,
+		const int quality2Increment,
+		const int multipleSubjects,
+		const struct AlignSlots *slots)
+{
+	int i;
+	double score;
+	const int useQuality = alignParamsPtr->useQuality;
+	const int scoreOnly = alignParamsPtr->scoreOnly;
+	const int from = (int) w->from, to = (int) w->end;
+	const int useMalloc = !w->inMainThread;
+	struct AlignInfo *align1InfoPtr = &w->align1Info;
+	struct AlignInfo *align2InfoPtr = &w->align2Info;
+	struct BatchBuffer *bb = &w->batchBuffer;
+
+	bb->windowStart = bb->windowEnd = from;
+	for (i = from; i < to; i++) {
+		if (w->inMainThread)
+			R_CheckUserInterrupt();
+		align1InfoPtr->string = _get_elt_from_XStringSet_holder(pattern_holder, i);
+		if (useQuality)
+			align1InfoPtr->quality = _get_elt_from_XStringSet_holder(patternQuality_holder,
+							i * quality1Increment);
+		if (multipleSubjects) {
+			align2InfoPtr->string = _get_elt_from_XStringSet_holder(subject_holder, i);
+			if (useQuality)
+				align2InfoPtr->quality = _get_elt_from_XStringSet_holder(subjectQuality_holder,
+								i * quality2Increment);
+		}
+		if (bb->width != 0 && i == bb->windowEnd)
+			run_batch_window(bb, i, to);
+		if (bb->width != 0 && bb->rank[i - bb->windowStart] != -1)
+			score = pairwiseAlignment_from_batch(bb, i - bb->windowStart,
+					align1InfoPtr, align2InfoPtr, scoreOnly);
+		else
+			score = pairwiseAlignment_with_params(align1InfoPtr, align2InfoPtr,
+					alignParamsPtr, &w->alignBuffer);
+		slots->score[i] = score;
+		if (scoreOnly)
+			continue;
+		slots->align1RangeStart[i] = align1InfoPtr->startRange;
+		slots->align1RangeWidth[i] = align1InfoPtr->widthRange;
+		slots->align1MismatchEnds[i] = align1InfoPtr->lengthMismatch;
+		slots->align1IndelEnds[i] = align1InfoPtr->lengthIndel;
+		slots->align2RangeStart[i] = align2InfoPtr->startRange;
+		slots->align2RangeWidth[i] = align2InfoPtr->widthRange;
+		slots->align2MismatchEnds[i] = align2InfoPtr->lengthMismatch;
+		slots->align2IndelEnds[i] = align2InfoPtr->lengthIndel;
+		if (w->mallocFailed)
+			continue;
+		if (!append_to_MismatchBuffer(&w->mismatchBuffer, align1InfoPtr,
+					      align2InfoPtr, useMalloc)
+		 || !append_to_IndelBuffer(&w->indel1Buffer, align1InfoPtr, useMalloc)
+		 || !append_to_IndelBuffer(&w->indel2Buffer, align2InfoPtr, useMalloc))
+			w->mallocFailed = 1;
+	}
+	w->from = to;
+	return;
+}
+
+/* Copies the 'n' ints of 'src' at offset 'usedSpace' of 'dest' */
+static void append_ints(int *dest, const int usedSpace,
+			const int *src, const int n)
+{
+	if (n > 0)
+		memcpy(dest + usedSpace, src, n * sizeof(int));
+	return;
+}
+
+/* Turns the nb of mismatches/indels per alignment into cumulated sums */
+static void cumsum_ends(int *ends, const int n)
+{
+	int i;
+
+	for (i = 1; i < n; i++)
+		ends[i] += ends[i - 1];
+	return;
+}
+
+/*
+ * Aligns all the patterns with 'nworker' worker threads, or in the main
+ * thread if 'nworker' is 1. When 'scoreOnly' is FALSE, fills
+ * 'mismatchBuffer', 'indel1Buffer' and 'indel2Buffer' with the mismatches
+ * and indels of all the alignments.
+ */
+static void align_patterns(
+		const int nworker,
+		const struct AlignParams *alignParamsPtr,
+		const XStringSet_holder *pattern_holder,
+		const XStringSet_holder *patternQuality_holder,
+		const int quality1Increment,
+		const XStringSet_holder *subject_holder,
+		const XStringSet_holder *subjectQuality_holder,
+		const int quality2Increment,
+		const int multipleSubjects,
+		const int numberOfStrings,
+		const struct AlignInfo *align2InfoPtr,
+		const int endGap1,
+		const int nCharString1,
+		const int nCharString2,
+		const double nCharProduct,
+		const double nTraceCell,
+		const struct AlignSlots *slots,
+		struct MismatchBuffer *mismatchBufferPtr,
+		struct IndelBuffer *indel1BufferPtr,
+		struct IndelBuffer *indel2BufferPtr)
+{
+	struct AlignWorker *workers;
+	struct AlignBuffer *ab;
+	const struct AlignParams *ap = alignParamsPtr;
+	double *cost;
+	int i, k, mallocFailed, nchar2;
+
+	workers = (struct AlignWorker *) R_alloc((long) nworker, sizeof(struct AlignWorker));
+	for (k = 0; k < nworker; k++) {
+		init_AlignWorker(workers + k, ap, nCharString1, nCharString2,
+				 nCharProduct, nTraceCell);
+		workers[k].inMainThread = nworker == 1;
+		ab = &workers[k].alignBuffer;
+		if (!ap->scoreOnly && nworker > 1) {
+			/* The traceback matrices of the adaptive band grow
+			 * in the worker threads, within the share of each
+			 * worker of PARALLEL_MAX_TRACE_SIZE */
+			ab->mallocTrace = 1;
+			ab->traceLimit = MAX(ab->traceCapacity,
+				MIN(ab->traceLimit,
+				    (int) (PARALLEL_MAX_TRACE_SIZE / (3.0 * nworker))));
+		}
+		workers[k].align1Info.endGap = endGap1;
+		workers[k].align2Info.string = align2InfoPtr->string;
+		if (ap->useQuality)
+			workers[k].align2Info.quality = align2InfoPtr->quality;
+		workers[k].align2Info.endGap = align2InfoPtr->endGap;
+	}
+	cost = (double *) R_alloc((long) numberOfStrings, sizeof(double));
+	for (i = 0; i < numberOfStrings; i++) {
+		nchar2 = multipleSubjects ?
+			_get_elt_from_XStringSet_holder(subject_holder, i).length :
+			nCharString2;
+		cost[i] = (_get_elt_from_XStringSet_holder(pattern_holder, i).length + 1.0) *
+			  (nchar2 + 1.0);
+	}
+	split_alignments(workers, nworker, cost, numberOfStrings);
+	if (!multipleSubjects && ap->band == NO_BAND) {
+		for (k = 0; k < nworker; k++) {
+			init_BatchBuffer(&workers[k].batchBuffer, pattern_holder,
+				patternQuality_holder, quality1Increment,
+				numberOfStrings, nCharString1, align2InfoPtr,
+				endGap1, ap->localAlignment, ap->scoreOnly,
+				ap->gapOpening, ap->gapExtension, ap->useQuality,
+				ap->substitutionArray, ap->substitutionArrayLength,
+				ap->substitutionArrayDim,
+				ap->substitutionLookupTable,
+				ap->substitutionLookupTableLength,
+				ap->fuzzyMatrix, ap->fuzzyMatrixDim,
+				ap->fuzzyLookupTable, ap->fuzzyLookupTableLength,
+				MIN(BATCH_MAX_TRACE_SIZE,
+				    _get_traceback_memory_limit()) / nworker);
+			workers[k].batchBuffer.checkInterrupt = nworker == 1;
+		}
+	}
+
+	if (nworker == 1) {
+		workers[0].end = workers[0].to;
+		align_chunk(workers, ap,
+			    pattern_holder, patternQuality_holder, quality1Increment,
+			    subject_holder, subjectQuality_holder, quality2Increment,
+			    multipleSubjects, slots);
+	} else {
+		while (set_round_ends(workers, nworker, cost)) {
+#ifdef _OPENMP
+			#pragma omp parallel for num_threads(nworker) schedule(static, 1)
+#endif
+			for (k = 0; k < nworker; k++)
+				align_chunk(workers + k, ap,
+					    pattern_holder, patternQuality_holder,
+					    quality1Increment,
+					    subject_holder, subjectQuality_holder,
+					    quality2Increment,
+					    multipleSubjects, slots);
+			check_AlignWorkers_interrupt(workers, nworker);
+		}
+	}
+
+	if (ap->scoreOnly)
+		return;
+	mallocFailed = 0;
+	mismatchBufferPtr->usedSpace = 0;
+	indel1BufferPtr->usedSpace = 0;
+	indel2BufferPtr->usedSpace = 0;
+	for (k = 0; k < nworker; k++) {
+		mallocFailed = mallocFailed || workers[k].mallocFailed;
+		mismatchBufferPtr->usedSpace += workers[k].mismatchBuffer.usedSpace;
+		indel1BufferPtr->usedSpace += workers[k].indel1Buffer.usedSpace;
+		indel2BufferPtr->usedSpace += workers[k].indel2Buffer.usedSpace;
+	}
+	if (mallocFailed) {
+		free_AlignWorkers(workers, nworker);
+		error("failed to allocate memory for the alignments");
+	}
+	mismatchBufferPtr->pattern = (int *) R_alloc((long) mismatchBufferPtr->usedSpace, sizeof(int));
+	mismatchBufferPtr->subject = (int *) R_alloc((long) mismatchBufferPtr->usedSpace, sizeof(int));
+	indel1BufferPtr->start = (int *) R_alloc((long) indel1BufferPtr->usedSpace, sizeof(int));
+	indel1BufferPtr->width = (int *) R_alloc((long) indel1BufferPtr->usedSpace, sizeof(int));
+	indel2BufferPtr->start = (int *) R_alloc((long) indel2BufferPtr->usedSpace, sizeof(int));
+	indel2BufferPtr->width = (int *) R_alloc((long) indel2BufferPtr->usedSpace, sizeof(int));
+	mismatchBufferPtr->totalSpace = mismatchBufferPtr->usedSpace;
+	indel1BufferPtr->totalSpace = indel1BufferPtr->usedSpace;
+	indel2BufferPtr->totalSpace = indel2BufferPtr->usedSpace;
+	mismatchBufferPtr->usedSpace = 0;
+	indel1BufferPtr->usedSpace = 0;
+	indel2BufferPtr->usedSpace = 0;
+	for (k = 0; k < nworker; k++) {
+		append_ints(mismatchBufferPtr->pattern, mismatchBufferPtr->usedSpace,
+			    workers[k].mismatchBuffer.pattern,
+			    workers[k].mismatchBuffer.usedSpace);
+		append_ints(mismatchBufferPtr->subject, mismatchBufferPtr->usedSpace,
+			    workers[k].mismatchBuffer.subject,
+			    workers[k].mismatchBuffer.usedSpace);
+		mismatchBufferPtr->usedSpace += workers[k].mismatchBuffer.usedSpace;
+		append_ints(indel1BufferPtr->start, indel1BufferPtr->usedSpace,
+			    workers[k].indel1Buffer.start,
+			    workers[k].indel1Buffer.usedSpace);
+		append_ints(indel1BufferPtr->width, indel1BufferPtr->usedSpace,
+			    workers[k].indel1Buffer.width,
+			    workers[k].indel1Buffer.usedSpace);
+		indel1BufferPtr->usedSpace += workers[k].indel1Buffer.usedSpace;
+		append_ints(indel2BufferPtr->start, indel2BufferPtr->usedSpace,
+			    workers[k].indel2Buffer.start,
+			    workers[k].indel2Buffer.usedSpace);
+		append_ints(indel2BufferPtr->width, indel2BufferPtr->usedSpace,
+			    workers[k].indel2Buffer.width,
+			    workers[k].indel2Buffer.usedSpace);
+		indel2BufferPtr->usedSpace += workers[k].indel2Buffer.usedSpace;
+	}
+	free_AlignWorkers(workers, nworker);
+	cumsum_ends(slots->align1MismatchEnds, numberOfStrings);
+	cumsum_ends(slots->align1IndelEnds, numberOfStrings);
+	cumsum_ends(slots->align2MismatchEnds, numberOfStrings);
+	cumsum_ends(slots->align2IndelEnds, numberOfStrings);
+	return;
+}
+
+/*
+ * Splits the pairs of the lower triangle of the distance matrix of 'n'
+ * strings of lengths 'nchar' in 'nworker' tiles of consecutive pairs with
+ * about the same total cost.
+ */
+static void split_pairs(struct AlignWorker *workers, const int nworker,
+			const int *nchar, const int n)
+{
+	int i, j, k;
+	long npair;
+	double *suffix, total, acc, rowCost;
+
+	/* suffix[i] is the total length (+1 per string) of strings i to n-1 */
+	suffix = (double *) R_alloc((long) n + 1, sizeof(double));
+	suffix[n] = 0.0;
+	for (i = n - 1; i >= 0; i--)
+		suffix[i] = suffix[i + 1] + nchar[i] + 1.0;
+	for (i = 0, total = 0.0; i < n - 1; i++)
+		total += (nchar[i] + 1.0) * suffix[i + 1];
+	workers[0].from = 0;
+	workers[0].firstI = 0;
+	workers[0].firstJ = 1;
+	for (i = 0, k = 1, acc = 0.0, npair = 0; i < n - 1 && k < nworker; i++) {
+		rowCost = (nchar[i] + 1.0) * suffix[i + 1];
+		if (acc + rowCost < total * k / nworker) {
+			acc += rowCost;
+			npair += n - 1 - i;
+			continue;
+		}
+		for (j = i + 1; j < n; j++) {
+			acc += (nchar[i] + 1.0) * (nchar[j] + 1.0);
+			npair++;
+			while (k < nworker && acc >= total * k / nworker) {
+				workers[k - 1].to = workers[k].from = npair;
+				workers[k].firstI = j + 1 < n ? i : i + 1;
+				workers[k].firstJ = j + 1 < n ? j + 1 : i + 2;
+				k++;
+			}
+		}
+	}
+	npair = (long) n * (n - 1) / 2;
+	for ( ; k < nworker; k++) {
+		workers[k - 1].to = workers[k].from = npair;
+		workers[k].firstI = workers[k].firstJ = 0;
+	}
+	workers[nworker - 1].to = npair;
+	return;
+}
+
+/*
+ * Aligns the pairs of the current round of the tile of worker 'w' (run by a
+ * worker thread)
+ */
+static void align_pair_chunk(struct AlignWorker *w,
+		const struct AlignParams *alignParamsPtr,
+		const XStringSet_holder *string_holder,
+		const XStringSet_holder *stringQuality_holder,
+		const int qualityIncrement,
+		const int numberOfStrings,
+		double *score)
+{
+	int i, j;
+	long k;
+	const int useQuality = alignParamsPtr->useQuality;
+	struct AlignInfo *align1InfoPtr = &w->align1Info;
+	struct AlignInfo *align2InfoPtr = &w->align2Info;
+
+	for (k = w->from, i = w->firstI, j = w->firstJ; k < w->end; k++) {
+		align1InfoPtr->string = _get_elt_from_XStringSet_holder(string_holder, i);
+		align2InfoPtr->string = _get_elt_from_XStringSet_holder(string_holder, j);
+		if (useQuality) {
+			align1InfoPtr->quality = _get_elt_from_XStringSet_holder(stringQuality_holder,
+							i * qualityIncrement);
+			align2InfoPtr->quality = _get_elt_from_XStringSet_holder(stringQuality_holder,
+							j * qualityIncrement);
+		}
+		score[k] = pairwiseAlignment_with_params(align1InfoPtr, align2InfoPtr,
+				alignParamsPtr, &w->alignBuffer);
+		if (++j == numberOfStrings) {
+			i++;
+			j = i + 1;
+		}
+	}
+	w->from = k;
+	w->firstI = i;
+	w->firstJ = j;
+	return;
+}
+
+/* Like set_round_ends() for the tiles of pairs of split_pairs() */
+static int set_pair_round_ends(struct AlignWorker *workers, const int nworker,
+			       const int *nchar, const int n)
+{
+	int i, j, k, more;
+	long p;
+	double acc;
+
+	for (k = 0, more = 0; k < nworker; k++) {
+		for (p = workers[k].from, i = workers[k].firstI,
+		     j = workers[k].firstJ, acc = 0.0;
+		     p < workers[k].to && acc < ROUND_NCELL; p++) {
+			acc += (nchar[i] + 1.0) * (nchar[j] + 1.0);
+			if (++j == n) {
+				i++;
+				j = i + 1;
+			}
+		}
+		workers[k].end = p;
+		more = more || p > workers[k].from;
+	}
+	return more;
+}
+
+/* Computes the lower triangle of the distance matrix with 'nworker'
+ * worker threads */
+static void align_pairs_in_parallel(
+		const int nworker,
+		const struct AlignParams *alignParamsPtr,
+		const XStringSet_holder *string_holder,
+		const XStringSet_holder *stringQuality_holder,
+		const int qualityIncrement,
+		const int numberOfStrings,
+		const int endGap,
+		const int nCharString,
+		double *score)
+{
+	struct AlignWorker *workers;
+	int i, k, *nchar;
+
+	workers = (struct AlignWorker *) R_alloc((long) nworker, sizeof(struct AlignWorker));
+	for (k = 0; k < nworker; k++) {
+		init_AlignWorker(workers + k, alignParamsPtr,
+				 nCharString, nCharString, 0, 0);
+		workers[k].align1Info.endGap = endGap;
+		workers[k].align2Info.endGap = endGap;
+	}
+	nchar = (int *) R_alloc((long) numberOfStrings, sizeof(int));
+	for (i = 0; i < numberOfStrings; i++)
+		nchar[i] = _get_elt_from_XStringSet_holder(string_holder, i).length;
+	split_pairs(workers, nworker, nchar, numberOfStrings);
+
+	while (set_pair_round_ends(workers, nworker, nchar, numberOfStrings)) {
+#ifdef _OPENMP
+		#pragma omp parallel for num_threads(nworker) schedule(static, 1)
+#endif
+		for (k = 0; k < nworker; k++)
+			align_pair_chunk(workers + k, alignParamsPtr,
+					 string_holder, stringQuality_holder,
+					 qualityIncrement, numberOfStrings, score);
+		check_AlignWorkers_interrupt(workers, nworker);
+	}
+	free_AlignWorkers(workers, nworker);
+	return;
+}
+
 /*
  * INPUTS
  * 'pattern':                XStringSet or QualityScaledXStringSet object for patterns
@@ -611,6 +3051,9 @@ static double pairwiseAlignment(
  * 'fuzzyLookupTable':         lookup table for translating XString bytes to
  *                             fuzzy indices
  *                             (integer vector)
+ * 'band':                     band of the global and overlap alignments
+ *                             (single integer; NA for no band, -1 for an
+ *                             adaptive band)
  *
  * OUTPUT
  * If scoreOnly = TRUE, returns either a vector of scores
@@ -632,11 +3075,14 @@ SEXP XStringSet_align_pairwiseAlignment(
 		SEXP substitutionLookupTable,
 		SEXP fuzzyMatrix,
 		SEXP fuzzyMatrixDim,
-		SEXP fuzzyLookupTable)
+		SEXP fuzzyLookupTable,
+		SEXP band)
 {
 	const int scoreOnlyValue = LOGICAL(scoreOnly)[0];
 	const int useQualityValue = LOGICAL(useQuality)[0];
 	const int localAlignment = (INTEGER(typeCode)[0] == LOCAL_ALIGNMENT);
+	const int bandValue =
+		(INTEGER(band)[0] == NA_INTEGER ? NO_BAND : INTEGER(band)[0]);
 	float gapOpeningValue = REAL(gapOpening)[0];
 	float gapExtensionValue = REAL(gapExtension)[0];
 	if (gapOpeningValue == POSITIVE_INFINITY || gapExtensionValue == POSITIVE_INFINITY) {
@@ -677,104 +3123,71 @@ SEXP XStringSet_align_pairwiseAlignment(
 
 	SEXP output;
 
-	int i, quality1Element = 0, quality2Element = 0;
+	int i;
 	const int quality1Increment = ((lengthOfPatternQualitySet < numberOfStrings) ? 0 : 1);
 	const int quality2Increment = ((lengthOfSubjectQualitySet < numberOfStrings) ? 0 : 1);
 
-	/* Create the alignment buffer object */
-	struct AlignBuffer alignBuffer;
-	int nCharString1 = 0, nCharString2 = 0, nCharProduct = 0;
-	reset_ovflow_flag();
+	/* Get the dimensions of the alignment buffers */
+	int nCharString1 = 0, nCharString2 = 0;
+	double nCharProduct = 0.0, nTraceCell = 0.0;
+	int bandExceedsLimit = 0;
 	if (multipleSubjects) {
 		for (i = 0; i < numberOfStrings; i++) {
 			int nchar1 = _get_elt_from_XStringSet_holder(&pattern_holder, i).length;
 			int nchar2 = _get_elt_from_XStringSet_holder(&subject_holder, i).length;
 			nCharString1 = MAX(nCharString1, nchar1);
 			nCharString2 = MAX(nCharString2, nchar2);
-			nCharProduct = MAX(nCharProduct,
-					   safe_int_mult(nchar1, nchar2));
+			nCharProduct = MAX(nCharProduct, (double) nchar1 * nchar2);
+			nTraceCell = MAX(nTraceCell, get_band_nTraceCell(nchar1, nchar2, bandValue));
+			bandExceedsLimit = bandExceedsLimit ||
+				band_exceeds_traceLimit(nchar1, nchar2, bandValue);
 		}
 	} else {
 		for (i = 0; i < numberOfStrings; i++) {
-			nCharString1 = MAX(nCharString1, _get_elt_from_XStringSet_holder(&pattern_holder, i).length);
+			int nchar1 = _get_elt_from_XStringSet_holder(&pattern_holder, i).length;
+			nCharString1 = MAX(nCharString1, nchar1);
+			nTraceCell = MAX(nTraceCell, get_band_nTraceCell(nchar1, align2Info.string.length, bandValue));
+			bandExceedsLimit = bandExceedsLimit ||
+				band_exceeds_traceLimit(nchar1, align2Info.string.length, bandValue);
 		}
 		nCharString2 = align2Info.string.length;
-		nCharProduct = safe_int_mult(nCharString1, nCharString2);
+		nCharProduct = (double) nCharString1 * nCharString2;
 	}
-	if (get_ovflow_flag())
-		error("max(nchar(pattern) * nchar(subject)) is too big "
-		      "(must be <= %d)", INT_MAX);
-	const int alignmentBufferSize = nCharString1 + 1;
-	alignBuffer.currMatrix = (float *) R_alloc((long) 3 * alignmentBufferSize, sizeof(float));
-	alignBuffer.prevMatrix = (float *) R_alloc((long) 3 * alignmentBufferSize, sizeof(float));
+	if (!scoreOnlyValue && bandExceedsLimit)
+		error("the banded traceback of some alignments needs more "
+		      "memory than the limit set by setTracebackMemoryLimit()");
+
+	/* Use the worker threads (see setBiostringsThreads()) if all the
+	 * letters are valid, 1 worker run by the main thread otherwise */
+	struct AlignParams alignParams;
+	struct AlignSlots slots;
+	init_AlignParams(&alignParams, localAlignment, scoreOnlyValue,
+			gapOpeningValue, gapExtensionValue, useQualityValue,
+			substitutionArray, substitutionArrayDim,
+			substitutionLookupTable, fuzzyMatrix, fuzzyMatrixDim,
+			fuzzyLookupTable, bandValue);
+	int nworker = get_nworker(numberOfStrings, scoreOnlyValue, nTraceCell);
+	if (nworker > 1
+	 && !(XStringSet_letters_are_in_lookup_tables(&pattern_holder,
+			&patternQuality_holder, quality1Increment,
+			numberOfStrings, &alignParams)
+	   && XStringSet_letters_are_in_lookup_tables(&subject_holder,
+			&subjectQuality_holder, quality2Increment,
+			multipleSubjects ? numberOfStrings : 1, &alignParams)))
+		nworker = 1;
 
 	struct MismatchBuffer mismatchBuffer;
 	struct IndelBuffer indel1Buffer;
 	struct IndelBuffer indel2Buffer;
-	int mismatchBufferSize = 0, indelBufferSize = 0;
-	if (!scoreOnlyValue) {
-		align1Info.mismatch   = (int *) R_alloc((long) alignmentBufferSize, sizeof(int));
-		align2Info.mismatch   = (int *) R_alloc((long) alignmentBufferSize, sizeof(int));
-		align1Info.startIndel = (int *) R_alloc((long) alignmentBufferSize, sizeof(int));
-		align2Info.startIndel = (int *) R_alloc((long) alignmentBufferSize, sizeof(int));
-		align1Info.widthIndel = (int *) R_alloc((long) alignmentBufferSize, sizeof(int));
-		align2Info.widthIndel = (int *) R_alloc((long) alignmentBufferSize, sizeof(int));
-		alignBuffer.sTraceMatrix = (char *) R_alloc((long) nCharProduct, sizeof(char));
-		alignBuffer.iTraceMatrix = (char *) R_alloc((long) nCharProduct, sizeof(char));
-		alignBuffer.dTraceMatrix = (char *) R_alloc((long) nCharProduct, sizeof(char));
-
-		mismatchBufferSize = MIN(MAX_BUF_SIZE, alignmentBufferSize + numberOfStrings * (alignmentBufferSize/4));
-		mismatchBuffer.pattern = (int *) R_alloc((long) mismatchBufferSize, sizeof(int));
-		mismatchBuffer.subject = (int *) R_alloc((long) mismatchBufferSize, sizeof(int));
-		mismatchBuffer.usedSpace = 0;
-		mismatchBuffer.totalSpace = mismatchBufferSize;
-
-		indelBufferSize = MIN(MAX_BUF_SIZE, alignmentBufferSize + numberOfStrings * (alignmentBufferSize/12));
-		indel1Buffer.start = (int *) R_alloc((long) indelBufferSize, sizeof(int));
-		indel1Buffer.width = (int *) R_alloc((long) indelBufferSize, sizeof(int));
-		indel1Buffer.usedSpace = 0;
-		indel1Buffer.totalSpace = indelBufferSize;
-		indel2Buffer.start = (int *) R_alloc((long) indelBufferSize, sizeof(int));
-		indel2Buffer.width = (int *) R_alloc((long) indelBufferSize, sizeof(int));
-		indel2Buffer.usedSpace = 0;
-		indel2Buffer.totalSpace = indelBufferSize;
-	}
-
-	double *score;
 	if (scoreOnlyValue) {
 		PROTECT(output = NEW_NUMERIC(numberOfStrings));
-		for (i = 0, score = REAL(output); i < numberOfStrings; i++, score++) {
-	        R_CheckUserInterrupt();
-			align1Info.string = _get_elt_from_XStringSet_holder(&pattern_holder, i);
-			if (useQualityValue) {
-				align1Info.quality = _get_elt_from_XStringSet_holder(&patternQuality_holder, quality1Element);
-				quality1Element += quality1Increment;
-			}
-			if (multipleSubjects) {
-				align2Info.string = _get_elt_from_XStringSet_holder(&subject_holder, i);
-				if (useQualityValue) {
-					align2Info.quality = _get_elt_from_XStringSet_holder(&subjectQuality_holder, quality2Element);
-					quality2Element += quality2Increment;
-				}
-			}
-			*score = pairwiseAlignment(
-					&align1Info,
-					&align2Info,
-					localAlignment,
-					scoreOnlyValue,
-					gapOpeningValue,
-					gapExtensionValue,
-					useQualityValue,
-					REAL(substitutionArray),
-					INTEGER(substitutionArrayDim),
-					INTEGER(substitutionLookupTable),
-					LENGTH(substitutionLookupTable),
-					INTEGER(fuzzyMatrix),
-					INTEGER(fuzzyMatrixDim),
-					INTEGER(fuzzyLookupTable),
-					LENGTH(fuzzyLookupTable),
-					&alignBuffer);
-		}
+		slots.score = REAL(output);
+		align_patterns(nworker, &alignParams,
+			&pattern_holder, &patternQuality_holder, quality1Increment,
+			&subject_holder, &subjectQuality_holder, quality2Increment,
+			multipleSubjects, numberOfStrings, &align2Info,
+			align1Info.endGap, nCharString1, nCharString2,
+			nCharProduct, nTraceCell, &slots, NULL, NULL, NULL);
 		UNPROTECT(1);
 	} else {
 		SEXP alignedPattern;
@@ -811,128 +3224,22 @@ SEXP XStringSet_align_pairwiseAlignment(
 
 		PROTECT(alignedScore = NEW_NUMERIC(numberOfStrings));
 
-		int align1MismatchPrevEnd = 0, align1IndelPrevEnd = 0;
-		int align2MismatchPrevEnd = 0, align2IndelPrevEnd = 0;
-		int *tempIntPtr;
-		int *align1RangeStart, *align1RangeWidth, *align1MismatchEnds, *align1IndelEnds;
-		int *align2RangeStart, *align2RangeWidth, *align2MismatchEnds, *align2IndelEnds;
-		for (i = 0, score = REAL(alignedScore),
-				align1RangeStart = INTEGER(alignedPatternRangeStart),
-				align1RangeWidth = INTEGER(alignedPatternRangeWidth),
-				align1MismatchEnds = INTEGER(alignedPatternMismatchEnds),
-				align1IndelEnds = INTEGER(alignedPatternIndelEnds),
-				align2RangeStart = INTEGER(alignedSubjectRangeStart),
-				align2RangeWidth = INTEGER(alignedSubjectRangeWidth),
-				align2MismatchEnds = INTEGER(alignedSubjectMismatchEnds),
-				align2IndelEnds = INTEGER(alignedSubjectIndelEnds);
-		        i < numberOfStrings; i++, score++,
-				align1RangeStart++, align1RangeWidth++, align1MismatchEnds++, align1IndelEnds++,
-				align2RangeStart++, align2RangeWidth++, align2MismatchEnds++, align2IndelEnds++) {
-	        R_CheckUserInterrupt();
-			align1Info.string = _get_elt_from_XStringSet_holder(&pattern_holder, i);
-			if (useQualityValue) {
-				align1Info.quality = _get_elt_from_XStringSet_holder(&patternQuality_holder, quality1Element);
-				quality1Element += quality1Increment;
-			}
-			if (multipleSubjects) {
-				align2Info.string = _get_elt_from_XStringSet_holder(&subject_holder, i);
-				if (useQualityValue) {
-					align2Info.quality = _get_elt_from_XStringSet_holder(&subjectQuality_holder, quality2Element);
-					quality2Element += quality2Increment;
-				}
-			}
-			*score = pairwiseAlignment(
-					&align1Info,
-					&align2Info,
-					localAlignment,
-					scoreOnlyValue,
-					gapOpeningValue,
-					gapExtensionValue,
-					useQualityValue,
-					REAL(substitutionArray),
-					INTEGER(substitutionArrayDim),
-					INTEGER(substitutionLookupTable),
-					LENGTH(substitutionLookupTable),
-					INTEGER(fuzzyMatrix),
-					INTEGER(fuzzyMatrixDim),
-					INTEGER(fuzzyLookupTable),
-					LENGTH(fuzzyLookupTable),
-					&alignBuffer);
-			*align1MismatchEnds = align1Info.lengthMismatch + align1MismatchPrevEnd;
-			*align2MismatchEnds = align2Info.lengthMismatch + align2MismatchPrevEnd;
-			if (align1Info.lengthMismatch > 0) {
-				if ((mismatchBuffer.usedSpace + align1Info.lengthMismatch) > mismatchBuffer.totalSpace) {
-					mismatchBuffer.totalSpace =
-						mismatchBuffer.totalSpace +
-							MIN(MAX_BUF_SIZE,
-							    alignmentBufferSize + (numberOfStrings - (i+1)) * (alignmentBufferSize/4));
-					tempIntPtr = (int *) R_alloc((long) mismatchBuffer.totalSpace, sizeof(int));
-					memcpy(tempIntPtr, mismatchBuffer.pattern, mismatchBuffer.usedSpace * sizeof(int));
-					mismatchBuffer.pattern = tempIntPtr;
-					tempIntPtr = (int *) R_alloc((long) mismatchBuffer.totalSpace, sizeof(int));
-					memcpy(tempIntPtr, mismatchBuffer.subject, mismatchBuffer.usedSpace * sizeof(int));
-					mismatchBuffer.subject = tempIntPtr;
-				}
-
-				memcpy(&mismatchBuffer.pattern[mismatchBuffer.usedSpace], align1Info.mismatch,
-					   align1Info.lengthMismatch * sizeof(int));
-
-				memcpy(&mismatchBuffer.subject[mismatchBuffer.usedSpace], align2Info.mismatch,
-					   align1Info.lengthMismatch * sizeof(int));
-				mismatchBuffer.usedSpace = mismatchBuffer.usedSpace + align1Info.lengthMismatch;
-			}
-
-			*align1RangeStart = align1Info.startRange;
-			*align1RangeWidth = align1Info.widthRange;
-			*align1IndelEnds = align1Info.lengthIndel + align1IndelPrevEnd;
-			if (align1Info.lengthIndel > 0) {
-				if ((indel1Buffer.usedSpace + align1Info.lengthIndel) > indel1Buffer.totalSpace) {
-					indel1Buffer.totalSpace =
-						indel1Buffer.totalSpace +
-							MIN(MAX_BUF_SIZE,
-							    alignmentBufferSize + (numberOfStrings - (i+1)) * (alignmentBufferSize/12));
-					tempIntPtr = (int *) R_alloc((long) indel1Buffer.totalSpace, sizeof(int));
-					memcpy(tempIntPtr, indel1Buffer.start, indel1Buffer.usedSpace * sizeof(int));
-					indel1Buffer.start = tempIntPtr;
-					tempIntPtr = (int *) R_alloc((long) indel1Buffer.totalSpace, sizeof(int));
-					memcpy(tempIntPtr, indel1Buffer.width, indel1Buffer.usedSpace * sizeof(int));
-					indel1Buffer.width = tempIntPtr;
-				}
-				memcpy(&indel1Buffer.start[indel1Buffer.usedSpace], align1Info.startIndel,
-					   align1Info.lengthIndel * sizeof(int));
-				memcpy(&indel1Buffer.width[indel1Buffer.usedSpace], align1Info.widthIndel,
-					   align1Info.lengthIndel * sizeof(int));
-				indel1Buffer.usedSpace = indel1Buffer.usedSpace + align1Info.lengthIndel;
-			}
-
-			*align2RangeStart = align2Info.startRange;
-			*align2RangeWidth = align2Info.widthRange;
-			*align2IndelEnds = align2Info.lengthIndel + align2IndelPrevEnd;
-			if (align2Info.lengthIndel > 0) {
-				if ((indel2Buffer.usedSpace + align2Info.lengthIndel) > indel2Buffer.totalSpace) {
-					indel2Buffer.totalSpace =
-						indel2Buffer.totalSpace +
-							MIN(MAX_BUF_SIZE,
-							    alignmentBufferSize + (numberOfStrings - (i+1)) * (alignmentBufferSize/12));
-					tempIntPtr = (int *) R_alloc((long) indel2Buffer.totalSpace, sizeof(int));
-					memcpy(tempIntPtr, indel2Buffer.start, indel2Buffer.usedSpace * sizeof(int));
-					indel2Buffer.start = tempIntPtr;
-					tempIntPtr = (int *) R_alloc((long) indel2Buffer.totalSpace, sizeof(int));
-					memcpy(tempIntPtr, indel2Buffer.width, indel2Buffer.usedSpace * sizeof(int));
-					indel2Buffer.width = tempIntPtr;
-				}
-				memcpy(&indel2Buffer.start[indel2Buffer.usedSpace], align2Info.startIndel,
-					   align2Info.lengthIndel * sizeof(int));
-				memcpy(&indel2Buffer.width[indel2Buffer.usedSpace], align2Info.widthIndel,
-					   align2Info.lengthIndel * sizeof(int));
-				indel2Buffer.usedSpace = indel2Buffer.usedSpace + align2Info.lengthIndel;
-			}
-
-			align1MismatchPrevEnd = *align1MismatchEnds;
-			align2MismatchPrevEnd = *align2MismatchEnds;
-			align1IndelPrevEnd = *align1IndelEnds;
-			align2IndelPrevEnd = *align2IndelEnds;
-		}
+		slots.score = REAL(alignedScore);
+		slots.align1RangeStart = INTEGER(alignedPatternRangeStart);
+		slots.align1RangeWidth = INTEGER(alignedPatternRangeWidth);
+		slots.align1MismatchEnds = INTEGER(alignedPatternMismatchEnds);
+		slots.align1IndelEnds = INTEGER(alignedPatternIndelEnds);
+		slots.align2RangeStart = INTEGER(alignedSubjectRangeStart);
+		slots.align2RangeWidth = INTEGER(alignedSubjectRangeWidth);
+		slots.align2MismatchEnds = INTEGER(alignedSubjectMismatchEnds);
+		slots.align2IndelEnds = INTEGER(alignedSubjectIndelEnds);
+		align_patterns(nworker, &alignParams,
+			&pattern_holder, &patternQuality_holder, quality1Increment,
+			&subject_holder, &subjectQuality_holder, quality2Increment,
+			multipleSubjects, numberOfStrings, &align2Info,
+			align1Info.endGap, nCharString1, nCharString2,
+			nCharProduct, nTraceCell,
+			&slots, &mismatchBuffer, &indel1Buffer, &indel2Buffer);
 
 		/* Create the output object */
 		if (multipleSubjects) {
@@ -1128,11 +3435,38 @@ SEXP XStringSet_align_distance(
 	int alignmentBufferSize = nCharString + 1;
 	alignBuffer.currMatrix = (float *) R_alloc((long) 3 * alignmentBufferSize, sizeof(float));
 	alignBuffer.prevMatrix = (float *) R_alloc((long) 3 * alignmentBufferSize, sizeof(float));
+	alignBuffer.band = NO_BAND;
+
+	/* Use the worker threads (see setBiostringsThreads()) if all the
+	 * letters are valid */
+	struct AlignParams alignParams;
+	init_AlignParams(&alignParams, localAlignment, scoreOnlyValue,
+			gapOpeningValue, gapExtensionValue, useQualityValue,
+			substitutionArray, substitutionArrayDim,
+			substitutionLookupTable, fuzzyMatrix, fuzzyMatrixDim,
+			fuzzyLookupTable, NO_BAND);
+	int nworker = get_nworker(numberOfStrings * (numberOfStrings - 1) / 2,
+				  scoreOnlyValue, 0);
+	if (nworker > 1
+	 && !XStringSet_letters_are_in_lookup_tables(&string_holder,
+			&stringQuality_holder, qualityIncrement,
+			numberOfStrings, &alignParams))
+		nworker = 1;
+	if (nworker == 1)
+		init_striped_AlignBuffer(&alignBuffer, nCharString, nCharString,
+				gapOpeningValue, gapExtensionValue,
+				REAL(substitutionArray), LENGTH(substitutionArray),
+				INTEGER(substitutionArrayDim), INTEGER(fuzzyMatrixDim));
 
 	double *score;
 	PROTECT(output = NEW_NUMERIC((numberOfStrings * (numberOfStrings - 1)) / 2));
 	score = REAL(output);
-	if (!useQualityValue) {
+	if (nworker > 1) {
+		align_pairs_in_parallel(nworker, &alignParams,
+				&string_holder, &stringQuality_holder,
+				qualityIncrement, numberOfStrings,
+				align1Info.endGap, nCharString, score);
+	} else if (!useQualityValue) {
 		for (i = 0; i < numberOfStrings; i++) {
 	        R_CheckUserInterrupt();
 			align1Info.string = _get_elt_from_XStringSet_holder(&string_holder, i);
@@ -0,0 +1,272 @@
+/****************************************************************************
+ *            STRIPED SIMD KERNELS FOR SCORE-ONLY PAIRWISE ALIGNMENT        *
+ ****************************************************************************/
+#include "Biostrings.h"
+
+#include <stdlib.h>  /* for malloc() and free() */
+
+/*
+ * These kernels compute the score of the optimal alignment with Farrar's
+ * striped method (Farrar, Bioinformatics 2007): the rows (pattern letters)
+ * are distributed across the lanes of the vectors so that the lanes never
+ * depend on each other within a segment, and the insertions that cross
+ * segment boundaries are fixed up by the "lazy F" loop. They implement the
+ * same recurrence as the scoreOnly branch of pairwiseAlignment() (see
+ * align_pairwiseAlignment.c) but on integers, so the result is the same as
+ * long as the scores stay small enough to be exact in single precision.
+ *
+ * The kernels use no saturating arithmetic. Instead, the H values are
+ * checked to be within [-SCORE_LIMIT, SCORE_LIMIT] every 16 columns and the
+ * kernel gives up (returns 0) if they are not. Since a value can't move by
+ * more than 'maxstep' from one column to the next, this guarantees that
+ * no lane ever wraps around, and that the -Inf cells of the DP (stored as
+ * SCORE_NEG) never win against a real value. The caller then tries the
+ * next wider kernel, and ultimately falls back to the floating point DP.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD_KERNELS 1
+#include <immintrin.h>
+#endif
+
+#define SIMD_NONE 0
+#define SIMD_SSE2 1
+#define SIMD_AVX2 2
+
+/* 16-bit lanes */
+#define SCORE_LIMIT16 8192
+#define SCORE_NEG16 (-24576)
+#define MAX_MAXSTEP16 512
+
+/* 32-bit lanes (2^23 keeps all the intermediate values exact in single
+   precision) */
+#define SCORE_LIMIT32 8388608
+#define SCORE_NEG32 (-536870912)
+#define MAX_MAXSTEP32 262144
+
+static int simd_level(void)
+{
+#ifdef HAVE_X86_SIMD_KERNELS
+	if (__builtin_cpu_supports("avx2"))
+		return SIMD_AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return SIMD_SSE2;
+#endif
+	return SIMD_NONE;
+}
+
+#ifdef HAVE_X86_SIMD_KERNELS
+
+/* SSE2 has no 32-bit max/min */
+__attribute__((target("sse2")))
+static inline __m128i sse2_max_epi32(__m128i a, __m128i b)
+{
+	__m128i m = _mm_cmpgt_epi32(a, b);
+	return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i sse2_min_epi32(__m128i a, __m128i b)
+{
+	__m128i m = _mm_cmpgt_epi32(a, b);
+	return _mm_or_si128(_mm_and_si128(m, b), _mm_andnot_si128(m, a));
+}
+
+/* Shifts the whole 256-bit vector up by 'n' bytes (zero fill) */
+#define MM256_SLLI_SI256(v, n) \
+	_mm256_alignr_epi8((v), _mm256_permute2x128_si256((v), (v), 0x08), \
+			   16 - (n))
+
+#define VEC_T __m128i
+#define VLOAD(p) _mm_load_si128(p)
+#define VSTORE(p, v) _mm_store_si128((p), (v))
+#define VANY(m) _mm_movemask_epi8(m)
+#define TARGET "sse2"
+
+#define KERNEL striped_score_sse2_16
+#define LANE_T short
+#define NLANES 8
+#define VSET1(x) _mm_set1_epi16(x)
+#define VADD _mm_add_epi16
+#define VSUB _mm_sub_epi16
+#define VMAX _mm_max_epi16
+#define VMIN _mm_min_epi16
+#define VCMPGT _mm_cmpgt_epi16
+#define VSHIFT(v, x) _mm_insert_epi16(_mm_slli_si128((v), 2), (x), 0)
+#define SCORE_LIMIT SCORE_LIMIT16
+#define SCORE_NEG SCORE_NEG16
+#include "align_striped_kernel.h"
+#undef KERNEL
+#undef LANE_T
+#undef NLANES
+#undef VSET1
+#undef VADD
+#undef VSUB
+#undef VMAX
+#undef VMIN
+#undef VCMPGT
+#undef VSHIFT
+#undef SCORE_LIMIT
+#undef SCORE_NEG
+
+#define KERNEL striped_score_sse2_32
+#define LANE_T int
+#define NLANES 4
+#define VSET1(x) _mm_set1_epi32(x)
+#define VADD _mm_add_epi32
+#define VSUB _mm_sub_epi32
+#define VMAX sse2_max_epi32
+#define VMIN sse2_min_epi32
+#define VCMPGT _mm_cmpgt_epi32
+#define VSHIFT(v, x) \
+	_mm_or_si128(_mm_slli_si128((v), 4), _mm_cvtsi32_si128(x))
+#define SCORE_LIMIT SCORE_LIMIT32
+#define SCORE_NEG SCORE_NEG32
+#include "align_striped_kernel.h"
+#undef KERNEL
+#undef LANE_T
+#undef NLANES
+#undef VSET1
+#undef VADD
+#undef VSUB
+#undef VMAX
+#undef VMIN
+#undef VCMPGT
+#undef VSHIFT
+#undef SCORE_LIMIT
+#undef SCORE_NEG
+
+#undef VEC_T
+#undef VLOAD
+#undef VSTORE
+#undef VANY
+#undef TARGET
+
+#define VEC_T __m256i
+#define VLOAD(p) _mm256_load_si256(p)
+#define VSTORE(p, v) _mm256_store_si256((p), (v))
+#define VANY(m) _mm256_movemask_epi8(m)
+#define TARGET "avx2"
+
+#define KERNEL striped_score_avx2_16
+#define LANE_T short
+#define NLANES 16
+#define VSET1(x) _mm256_set1_epi16(x)
+#define VADD _mm256_add_epi16
+#define VSUB _mm256_sub_epi16
+#define VMAX _mm256_max_epi16
+#define VMIN _mm256_min_epi16
+#define VCMPGT _mm256_cmpgt_epi16
+#define VSHIFT(v, x) \
+	_mm256_insert_epi16(MM256_SLLI_SI256((v), 2), (x), 0)
+#define SCORE_LIMIT SCORE_LIMIT16
+#define SCORE_NEG SCORE_NEG16
+#include "align_striped_kernel.h"
+#undef KERNEL
+#undef LANE_T
+#undef NLANES
+#undef VSET1
+#undef VADD
+#undef VSUB
+#undef VMAX
+#undef VMIN
+#undef VCMPGT
+#undef VSHIFT
+#undef SCORE_LIMIT
+#undef SCORE_NEG
+
+#define KERNEL striped_score_avx2_32
+#define LANE_T int
+#define NLANES 8
+#define VSET1(x) _mm256_set1_epi32(x)
+#define VADD _mm256_add_epi32
+#define VSUB _mm256_sub_epi32
+#define VMAX _mm256_max_epi32
+#define VMIN _mm256_min_epi32
+#define VCMPGT _mm256_cmpgt_epi32
+#define VSHIFT(v, x) \
+	_mm256_insert_epi32(MM256_SLLI_SI256((v), 4), (x), 0)
+#define SCORE_LIMIT SCORE_LIMIT32
+#define SCORE_NEG SCORE_NEG32
+#include "align_striped_kernel.h"
+#undef KERNEL
+#undef LANE_T
+#undef NLANES
+#undef VSET1
+#undef VADD
+#undef VSUB
+#undef VMAX
+#undef VMIN
+#undef VCMPGT
+#undef VSHIFT
+#undef SCORE_LIMIT
+#undef SCORE_NEG
+
+#undef VEC_T
+#undef VLOAD
+#undef VSTORE
+#undef VANY
+#undef TARGET
+
+typedef int (*StripedKernel)(const StripedAlignment *sa, void *ws,
+			     double *score);
+
+/* Calls 'kernel' with a 64-byte aligned workspace */
+static int run_striped_kernel(StripedKernel kernel,
+		const StripedAlignment *sa, int nlanes, size_t lane_size,
+		double *score)
+{
+	size_t segLen, nvec;
+	char *buf;
+	void *ws;
+	int ok;
+
+	segLen = (sa->nrow + nlanes - 1) / nlanes;
+	/* the query profile + H (2 columns) + E + S */
+	nvec = ((size_t) sa->nkey + 4) * segLen;
+	buf = (char *) malloc(nvec * nlanes * lane_size + 64);
+	if (buf == NULL)
+		return 0;
+	ws = buf + (64 - ((size_t) buf & 63));
+	ok = kernel(sa, ws, score);
+	free(buf);
+	return ok;
+}
+
+#endif  /* HAVE_X86_SIMD_KERNELS */
+
+/*
+ * Returns 1 and sets '*score' if one of the kernels could compute the
+ * score, 0 if the caller must use the floating point DP (no SIMD support,
+ * scores too big, or memory allocation failure). Never raises an error so
+ * it's safe to call from a worker thread.
+ */
+int _striped_align_score(const StripedAlignment *sa, double *score)
+{
+	int level;
+
+	if (sa->nrow < 1 || sa->ncol < 1)
+		return 0;
+	level = simd_level();
+	if (level == SIMD_NONE)
+		return 0;
+#ifdef HAVE_X86_SIMD_KERNELS
+	if (sa->maxstep <= MAX_MAXSTEP16) {
+		if (level == SIMD_AVX2 ?
+		    run_striped_kernel(striped_score_avx2_16, sa,
+				       16, sizeof(short), score) :
+		    run_striped_kernel(striped_score_sse2_16, sa,
+				       8, sizeof(short), score))
+			return 1;
+	}
+	if (sa->maxstep <= MAX_MAXSTEP32) {
+		if (level == SIMD_AVX2 ?
+		    run_striped_kernel(striped_score_avx2_32, sa,
+				       8, sizeof(int), score) :
+		    run_striped_kernel(striped_score_sse2_32, sa,
+				       4, sizeof(int), score))
+			return 1;
+	}
+#endif
+	return 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * Template for the striped kernels of align_striped.c. It is included once
+ * per instruction set and lane width with the following macros defined:
+ *   KERNEL        name of the function
+ *   TARGET        its 'target' function attribute (e.g. "avx2")
+ *   LANE_T        type of a lane (short or int)
+ *   NLANES        nb of lanes per vector
+ *   VEC_T         the vector type
+ *   VSET1(x)      all the lanes set to x
+ *   VADD, VSUB, VMAX, VMIN, VCMPGT
+ *                 lane by lane operations
+ *   VLOAD, VSTORE aligned load and store
+ *   VSHIFT(v, x)  shifts the lanes of v up by 1 and puts x in lane 0
+ *   VANY(m)       nonzero if any lane of comparison result m is set
+ *   SCORE_LIMIT   see align_striped.c
+ *   SCORE_NEG
+ */
+
+__attribute__((target(TARGET)))
+static int KERNEL(const StripedAlignment *sa, void *ws, double *score)
+{
+	const int n1 = sa->nrow, n2 = sa->ncol, go = sa->gapOpening,
+		  ge = sa->gapExtension, goe = go + ge;
+	int segLen, key, i, j, k, l, h0, d0, lastK, lastL, ans, best;
+	VEC_T *prof, *pvHLoad, *pvHStore, *pvE, *pvS, *vP, *tmp;
+	VEC_T vH, vHp, vS, vD, vF, vMin, vMax, vMaxS,
+	      vZero, vNeg, vGoe, vGe, vLimit, vMinusLimit;
+	LANE_T *lanes, lastH, prevLastH;
+
+	segLen = (n1 + NLANES - 1) / NLANES;
+	prof = (VEC_T *) ws;
+	pvHLoad = prof + (size_t) sa->nkey * segLen;
+	pvHStore = pvHLoad + segLen;
+	pvE = pvHStore + segLen;
+	pvS = pvE + segLen;
+
+	/* The query profile. Row i is in lane i / segLen of vector
+	   i % segLen. The padding rows get 0. */
+	for (key = 0; key < sa->nkey; key++) {
+		lanes = (LANE_T *) (prof + (size_t) key * segLen);
+		for (k = 0; k < segLen; k++) {
+			for (l = 0; l < NLANES; l++) {
+				i = l * segLen + k;
+				lanes[k * NLANES + l] = i < n1 ?
+					sa->sub[(size_t) n1 * key + i] : 0;
+			}
+		}
+	}
+
+	/* Column 0: only insertions (in the pattern) are possible */
+	for (k = 0; k < segLen; k++) {
+		lanes = (LANE_T *) (pvHLoad + k);
+		for (l = 0; l < NLANES; l++) {
+			i = l * segLen + k + 1;
+			if (sa->endGap1 && go + (double) i * ge > SCORE_LIMIT)
+				return 0;
+			lanes[l] = sa->endGap1 ? - go - i * ge : 0;
+		}
+		VSTORE(pvE + k, VSET1(SCORE_NEG));
+	}
+
+	vZero = VSET1(0);
+	vNeg = VSET1(SCORE_NEG);
+	vGoe = VSET1(goe);
+	vGe = VSET1(ge);
+	vLimit = VSET1(SCORE_LIMIT);
+	vMinusLimit = VSET1(- SCORE_LIMIT);
+	vMin = vZero;
+	vMax = vZero;
+	vMaxS = vZero;
+	lastK = (n1 - 1) % segLen;
+	lastL = (n1 - 1) / segLen;
+	lastH = prevLastH = ((LANE_T *) (pvHLoad + lastK))[lastL];
+	for (j = 1; j <= n2; j++) {
+		/* H in row 0 of the previous column and D in row 0 of this
+		   column */
+		if (sa->endGap2 && go + (double) j * ge > SCORE_LIMIT)
+			return 0;
+		h0 = j == 1 || !sa->endGap2 ? 0 : - go - (j - 1) * ge;
+		d0 = sa->endGap2 ? - go - j * ge : 0;
+		vP = prof + (size_t) sa->col2key[j - 1] * segLen;
+		vF = VSHIFT(vNeg, d0 - goe);
+		vH = VSHIFT(VLOAD(pvHLoad + segLen - 1), h0);
+		for (k = 0; k < segLen; k++) {
+			vS = VADD(vH, VLOAD(vP + k));
+			if (sa->local) {
+				vS = VMAX(vS, vZero);
+				vMaxS = VMAX(vMaxS, vS);
+			}
+			VSTORE(pvS + k, vS);
+			vHp = VLOAD(pvHLoad + k);
+			vD = VMAX(VSUB(vHp, vGoe), VSUB(VLOAD(pvE + k), vGe));
+			VSTORE(pvE + k, vD);
+			vH = VMAX(VMAX(vS, vD), vF);
+			VSTORE(pvHStore + k, vH);
+			vMin = VMIN(vMin, vH);
+			vMax = VMAX(vMax, vH);
+			vF = VMAX(VSUB(vH, vGoe), VSUB(vF, vGe));
+			vH = vHp;
+		}
+		/* Lazy F loop: propagate the insertions across the segments */
+		vF = VSHIFT(vF, SCORE_NEG);
+		k = 0;
+		while (1) {
+			vH = VLOAD(pvHStore + k);
+			if (!VANY(VCMPGT(vF, VSUB(vH, vGoe))))
+				break;
+			vH = VMAX(vH, vF);
+			VSTORE(pvHStore + k, vH);
+			vMax = VMAX(vMax, vH);
+			vF = VMAX(VSUB(vF, vGe), vNeg);
+			if (++k == segLen) {
+				k = 0;
+				vF = VSHIFT(vF, SCORE_NEG);
+			}
+		}
+		tmp = pvHLoad;
+		pvHLoad = pvHStore;
+		pvHStore = tmp;
+		if ((j % 16 == 0 || j == n2)
+		 && (VANY(VCMPGT(vMax, vLimit)) ||
+		     VANY(VCMPGT(vMinusLimit, vMin))))
+			return 0;
+		prevLastH = lastH;
+		if (((LANE_T *) (pvHLoad + lastK))[lastL] > lastH)
+			lastH = ((LANE_T *) (pvHLoad + lastK))[lastL];
+	}
+
+	if (sa->local) {
+		lanes = (LANE_T *) &vMaxS;
+		for (l = 1, best = lanes[0]; l < NLANES; l++)
+			if (lanes[l] > best)
+				best = lanes[l];
+		*score = (double) best;
+		return 1;
+	}
+	if (sa->endGap1) {
+		/* with no end gap penalty in the subject, the best score in
+		   the last row is carried over to the next columns */
+		*score = (double) (sa->endGap2 ?
+			((LANE_T *) (pvHLoad + lastK))[lastL] : lastH);
+		return 1;
+	}
+	/* No end gap penalty in the pattern: the insertions in the last
+	   column are free */
+	best = sa->endGap2 ? - go - n2 * ge : 0;
+	for (i = 0; i < n1 - 1; i++) {
+		k = i % segLen;
+		l = i / segLen;
+		if (((LANE_T *) (pvS + k))[l] > best)
+			best = ((LANE_T *) (pvS + k))[l];
+		if (((LANE_T *) (pvE + k))[l] > best)
+			best = ((LANE_T *) (pvE + k))[l];
+	}
+	ans = ((LANE_T *) (pvS + lastK))[lastL];
+	if (best > ans)
+		ans = best;
+	d0 = sa->endGap2 ? ((LANE_T *) (pvE + lastK))[lastL] : prevLastH;
+	if (d0 > ans)
+		ans = d0;
+	*score = (double) ans;
+	return 1;
+}
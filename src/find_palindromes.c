@@ -20,7 +20,7 @@ static int is_match(char c1, char c2, const int *lkup, int lkup_len)
 
 static void get_find_palindromes_at(const char *x, int x_len,
 	int i1, int i2, int max_loop_len1, int min_arm_len, int max_nmis,
-	const int *lkup, int lkup_len)
+	const int *lkup, int lkup_len, MatchReporter *reporter)
 {
 	int arm_len, valid_indices;
 	char c1, c2;
@@ -39,7 +39,8 @@ static void get_find_palindromes_at(const char *x, int x_len,
 			}
 		}
 		if (arm_len >= min_arm_len)
-			_report_match(i1 + 2, i2 - i1 - 1);
+			_MatchReporter_report_match(reporter,
+						    i1 + 2, i2 - i1 - 1);
 		arm_len = 0;
 	next:
 		i1--;
@@ -71,6 +72,7 @@ SEXP find_palindromes(SEXP x, SEXP min_armlength, SEXP max_looplength,
 	Chars_holder x_holder;
 	int x_len, min_arm_len, max_loop_len1, max_nmis, lkup_len, n;
 	const int *lkup;
+	MatchReporter reporter;
 
 	x_holder = hold_XRaw(x);
 	x_len = x_holder.length;
@@ -84,18 +86,18 @@ SEXP find_palindromes(SEXP x, SEXP min_armlength, SEXP max_looplength,
 		lkup = INTEGER(L2R_lkup);
 		lkup_len = LENGTH(L2R_lkup);
 	}
-	_init_match_reporting("MATCHES_AS_RANGES", 1);
+	reporter = _new_MatchReporter("MATCHES_AS_RANGES", 1);
 	for (n = 0; n < x_len; n++) {
 		/* Find palindromes centered on n. */
 		get_find_palindromes_at(x_holder.ptr, x_len, n - 1, n + 1,
 					max_loop_len1, min_arm_len, max_nmis,
-					lkup, lkup_len);
+					lkup, lkup_len, &reporter);
 		/* Find palindromes centered on n + 0.5. */
 		get_find_palindromes_at(x_holder.ptr, x_len, n, n + 1,
 					max_loop_len1, min_arm_len, max_nmis,
-					lkup, lkup_len);
+					lkup, lkup_len, &reporter);
 	}
-	return _reported_matches_asSEXP();
+	return _MatchReporter_reported_matches_asSEXP(&reporter);
 }
 
 /* --- .Call ENTRY POINT --- */
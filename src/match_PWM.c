@@ -46,7 +46,7 @@ static double compute_pwm_score(const double *pwm, int pwm_ncol,
 }
 
 static void _match_PWM_XString(const double *pwm, int pwm_ncol,
-		const Chars_holder *S, double minscore)
+		const Chars_holder *S, double minscore, MatchReporter *reporter)
 {
 	int n1, n2;
 	double score;
@@ -54,7 +54,7 @@ static void _match_PWM_XString(const double *pwm, int pwm_ncol,
 	for (n1 = 0, n2 = pwm_ncol; n2 <= S->length; n1++, n2++) {
 		score = compute_pwm_score(pwm, pwm_ncol, S->ptr, S->length, n1);
 		if (score >= minscore)
-			_report_match(n1 + 1, pwm_ncol);
+			_MatchReporter_report_match(reporter, n1 + 1, pwm_ncol);
 	}
 	return;
 }
@@ -115,6 +115,7 @@ SEXP XString_match_PWM(SEXP pwm, SEXP subject,
 	Chars_holder S;
 	int pwm_ncol, is_count_only;
 	double minscore;
+	MatchReporter reporter;
 
 	if (INTEGER(GET_DIM(pwm))[0] != 4)
 		error("'pwm' must have 4 rows");
@@ -124,10 +125,10 @@ SEXP XString_match_PWM(SEXP pwm, SEXP subject,
 	is_count_only = LOGICAL(count_only)[0];
 	_init_byte2offset_with_INTEGER(&byte2offset, base_codes, 1);
 	no_warning_yet = 1;
-	_init_match_reporting(is_count_only ?
+	reporter = _new_MatchReporter(is_count_only ?
 		"MATCHES_AS_COUNTS" : "MATCHES_AS_RANGES", 1);
-	_match_PWM_XString(REAL(pwm), pwm_ncol, &S, minscore);
-	return _reported_matches_asSEXP();
+	_match_PWM_XString(REAL(pwm), pwm_ncol, &S, minscore, &reporter);
+	return _MatchReporter_reported_matches_asSEXP(&reporter);
 }
 
 /*
@@ -149,6 +150,7 @@ SEXP XStringViews_match_PWM(SEXP pwm,
 	int pwm_ncol, is_count_only;
 	int nviews, v, *start_p, *width_p, view_offset;
 	double minscore;
+	MatchReporter reporter;
 
 	if (INTEGER(GET_DIM(pwm))[0] != 4)
 		error("'pwm' must have 4 rows");
@@ -158,7 +160,7 @@ SEXP XStringViews_match_PWM(SEXP pwm,
 	is_count_only = LOGICAL(count_only)[0];
 	_init_byte2offset_with_INTEGER(&byte2offset, base_codes, 1);
 	no_warning_yet = 1;
-	_init_match_reporting(is_count_only ?
+	reporter = _new_MatchReporter(is_count_only ?
 		"MATCHES_AS_COUNTS" : "MATCHES_AS_RANGES", 1);
 	nviews = LENGTH(views_start);
 	for (v = 0,
@@ -172,9 +174,10 @@ SEXP XStringViews_match_PWM(SEXP pwm,
 			error("'subject' has \"out of limits\" views");
 		S_view.ptr = S.ptr + view_offset;
 		S_view.length = *width_p;
-		_set_match_shift(view_offset);
-		_match_PWM_XString(REAL(pwm), pwm_ncol, &S_view, minscore);
+		_MatchReporter_set_match_shift(&reporter, view_offset);
+		_match_PWM_XString(REAL(pwm), pwm_ncol, &S_view, minscore,
+				   &reporter);
 	}
-	return _reported_matches_asSEXP();
+	return _MatchReporter_reported_matches_asSEXP(&reporter);
 }
 
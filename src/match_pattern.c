@@ -6,117 +6,115 @@
 #include "XVector_interface.h"
 #include "IRanges_interface.h"
 
+#include <stdlib.h>  /* for malloc(), free() */
 
-/****************************************************************************
- * A memcmp-based implementation of the "naive" method for exact matching.
- *
- * Here is how the "naive" (aka "memcmp", aka "blunt") method for finding
- * exact matches is described in Dan Gusfield book "Algorithms on strings,
- * trees, and sequences" (slightly modified):
- *   The naive method aligns the left end of P (the pattern) with the left
- *   end of S (the subject) and then compares the characters of P and S left
- *   to right until either two unequal characters are found or until P is
- *   exhausted, in which case an occurrence of P is reported. In either case,
- *   P is then shifted one place to the right, and the comparisons are
- *   restarted from the left end of P. This process repeats until the right
- *   end of P shifts past the right end of S.
- *
- * Why implement this inefficient "naive" method?
- * - For QC: we can validate other more sophisticated matching algo by
- *   comparing their results to those obtains with the "naive" method.
- * - To use as a reference when comparing performance.
- */
-
-static void match_naive_exact(const Chars_holder *P, const Chars_holder *S)
-{
-	const char *p, *s;
-	int plen, slen, start, n2;
-
-	if (P->length <= 0)
-		error("empty pattern");
-	p = P->ptr;
-	plen = P->length;
-	s = S->ptr;
-	slen = S->length;
-	for (start = 1, n2 = plen; n2 <= slen; start++, n2++, s++) {
-		if (memcmp(p, s, plen) == 0)
-			_report_match(start, P->length);
-	}
-	return;
-}
-
-
-/****************************************************************************
- * An implementation of the "naive" method for inexact matching.
- */
-
-static void match_naive_inexact(const Chars_holder *P, const Chars_holder *S,
-		int max_nmis, int min_nmis, int fixedP, int fixedS)
-{
-	int Pshift, // position of pattern left-most char relative to the subject
-	    n2, // 1 + position of pattern right-most char relative to the subject
-	    min_Pshift, max_n2, nmis;
-	const BytewiseOpTable *bytewise_match_table;
-
-	if (P->length <= 0)
-		error("empty pattern");
-	bytewise_match_table = _select_bytewise_match_table(fixedP, fixedS);
-	min_Pshift = P->length <= max_nmis ? 1 - P->length : -max_nmis;
-	max_n2 = S->length - min_Pshift;
-	for (Pshift = min_Pshift, n2 = min_Pshift + P->length;
-	     n2 <= max_n2;
-	     Pshift++, n2++)
-	{
-		nmis = _nmismatch_at_Pshift(P, S, Pshift, max_nmis,
-					    bytewise_match_table);
-		if (nmis <= max_nmis && nmis >= min_nmis)
-			_report_match(Pshift + 1, P->length);
-	}
-	return;
-}
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 
 /****************************************************************************
  * _match_pattern_XString() and _match_pattern_XStringViews()
  */
 
-void _match_pattern_XString(const Chars_holder *P, const Chars_holder *S,
-		SEXP max_mismatch, SEXP min_mismatch,
-		SEXP with_indels, SEXP fixed,
-		const char *algo)
+/*
+ * The "boyer-moore", "shift-or", "bndm" and "bom" algos use the tables
+ * stored in 'ppattern' if any (i.e. if 'ppattern' is the holder of a
+ * PreprocessedPattern object).
+ */
+static void match_pattern(const PreprocessedPattern_holder *ppattern,
+		const Chars_holder *S,
+		int max_nmis, int min_nmis, int fixedP, int fixedS,
+		const char *algo, MatchReporter *reporter)
 {
-	int max_nmis, min_nmis, fixedP, fixedS;
+	const Chars_holder *P;
 
-	max_nmis = INTEGER(max_mismatch)[0];
-	min_nmis = INTEGER(min_mismatch)[0];
+	P = &(ppattern->P);
 	if (max_nmis < P->length - S->length
 	 || min_nmis > P->length)
 		return;
-	fixedP = LOGICAL(fixed)[0];
-	fixedS = LOGICAL(fixed)[1];
 	if (P->length <= max_nmis || strcmp(algo, "naive-inexact") == 0)
-		match_naive_inexact(P, S, max_nmis, min_nmis, fixedP, fixedS);
+		_match_pattern_naive_inexact(P, S, max_nmis, min_nmis,
+					     fixedP, fixedS, reporter);
 	else if (strcmp(algo, "naive-exact") == 0)
-		match_naive_exact(P, S);
-	else if (strcmp(algo, "boyer-moore") == 0)
-		_match_pattern_boyermoore(P, S, -1, 0);
-	else if (strcmp(algo, "shift-or") == 0)
-		_match_pattern_shiftor(P, S, max_nmis, fixedP, fixedS);
-	else if (strcmp(algo, "indels") == 0)
-		_match_pattern_indels(P, S, max_nmis, fixedP, fixedS);
+		_match_pattern_naive_exact(P, S, reporter);
+	else if (strcmp(algo, "boyer-moore") == 0) {
+		if (ppattern->VSGSshift_table != NULL)
+			_match_PreprocessedPattern_boyermoore(ppattern, S,
+							      -1, reporter);
+		else
+			_match_pattern_boyermoore_to_reporter(P, S, -1, 0,
+					reporter);
+	} else if (strcmp(algo, "shift-or") == 0) {
+		if (ppattern->pmaskmap != NULL)
+			_match_PreprocessedPattern_shiftor(ppattern, S,
+					max_nmis, fixedP, fixedS, reporter);
+		else
+			_match_pattern_shiftor(P, S, max_nmis, fixedP, fixedS,
+					       reporter);
+	} else if (strcmp(algo, "bndm") == 0) {
+		if (ppattern->bndm_masks != NULL)
+			_match_PreprocessedPattern_bndm(ppattern, S, reporter);
+		else
+			_match_pattern_bndm(P, S, reporter);
+	} else if (strcmp(algo, "bom") == 0) {
+		if (ppattern->bom_trans != NULL)
+			_match_PreprocessedPattern_bom(ppattern, S, reporter);
+		else
+			_match_pattern_bom(P, S, reporter);
+	} else if (strcmp(algo, "indels") == 0)
+		_match_pattern_indels(P, S, max_nmis, fixedP, fixedS,
+				      reporter);
 	else
 		error("\"%s\": unknown algorithm", algo);
 	return;
 }
 
-void _match_pattern_XStringViews(const Chars_holder *P,
+/*
+ * Returns 1 if match_pattern() can be called in a worker thread i.e. if it
+ * won't call any function of the R API for 'ppattern' and 'algo'. The
+ * "boyer-moore" algo is only safe on a preprocessed pattern (otherwise it
+ * uses static buffers).
+ */
+static int match_pattern_is_thread_safe(
+		const PreprocessedPattern_holder *ppattern,
+		int max_nmis, int fixedP, int fixedS, const char *algo)
+{
+	const Chars_holder *P;
+
+	P = &(ppattern->P);
+	if (P->length <= 0)
+		return 0;
+	if (P->length <= max_nmis
+	 || strcmp(algo, "naive-inexact") == 0
+	 || strcmp(algo, "naive-exact") == 0
+	 || strcmp(algo, "bndm") == 0)
+		return 1;
+	if (strcmp(algo, "boyer-moore") == 0)
+		return ppattern->VSGSshift_table != NULL;
+	if (strcmp(algo, "bom") == 0)
+		return ppattern->bom_trans != NULL || _bom_is_thread_safe(P);
+	if (strcmp(algo, "shift-or") == 0)
+		return _shiftor_is_thread_safe(P, fixedP, fixedS);
+	if (strcmp(algo, "indels") == 0)
+		return _indels_is_thread_safe(P);
+	return 0;
+}
+
+static void match_pattern_views(const PreprocessedPattern_holder *ppattern,
 		const Chars_holder *S, SEXP views_start, SEXP views_width,
 		SEXP max_mismatch, SEXP min_mismatch,
 		SEXP with_indels, SEXP fixed,
-		const char *algo)
+		const char *algo, MatchReporter *reporter)
 {
 	Chars_holder S_view;
-	int nviews, v, *view_start, *view_width, view_offset;
+	int nviews, v, *view_start, *view_width, view_offset, max_nmis,
+	    min_nmis, fixedP, fixedS;
+
+	max_nmis = INTEGER(max_mismatch)[0];
+	min_nmis = INTEGER(min_mismatch)[0];
+	fixedP = LOGICAL(fixed)[0];
+	fixedS = LOGICAL(fixed)[1];
 
 	nviews = LENGTH(views_start);
 	for (v = 0,
@@ -130,26 +128,57 @@ void _match_pattern_XStringViews(const Chars_holder *P,
 			error("'subject' has \"out of limits\" views");
 		S_view.ptr = S->ptr + view_offset;
 		S_view.length = *view_width;
-		_set_match_shift(view_offset);
-		_match_pattern_XString(P, &S_view,
-			max_mismatch, min_mismatch, with_indels, fixed,
-			algo);
+		_MatchReporter_set_match_shift(reporter, view_offset);
+		match_pattern(ppattern, &S_view, max_nmis, min_nmis,
+			      fixedP, fixedS, algo, reporter);
 	}
 	return;
 }
 
+void _match_pattern_XString(const Chars_holder *P, const Chars_holder *S,
+		SEXP max_mismatch, SEXP min_mismatch,
+		SEXP with_indels, SEXP fixed,
+		const char *algo, MatchReporter *reporter)
+{
+	PreprocessedPattern_holder ppattern;
+
+	ppattern = _hold_Chars_as_PreprocessedPattern(P);
+	match_pattern(&ppattern, S,
+		INTEGER(max_mismatch)[0], INTEGER(min_mismatch)[0],
+		LOGICAL(fixed)[0], LOGICAL(fixed)[1],
+		algo, reporter);
+	return;
+}
+
+void _match_pattern_XStringViews(const Chars_holder *P,
+		const Chars_holder *S, SEXP views_start, SEXP views_width,
+		SEXP max_mismatch, SEXP min_mismatch,
+		SEXP with_indels, SEXP fixed,
+		const char *algo, MatchReporter *reporter)
+{
+	PreprocessedPattern_holder ppattern;
+
+	ppattern = _hold_Chars_as_PreprocessedPattern(P);
+	match_pattern_views(&ppattern, S, views_start, views_width,
+		max_mismatch, min_mismatch, with_indels, fixed,
+		algo, reporter);
+	return;
+}
+
 
 /****************************************************************************
  * --- .Call ENTRY POINTS ---
  *
  * Arguments:
- *   pattern, subject: XString objects;
+ *   pattern: XString or PreprocessedPattern object;
+ *   subject: XString object;
  *   max_mismatch: (single integer) the max number of mismatching letters;
  *   min_mismatch: (single integer) the min number of mismatching letters;
  *   with_indels: single logical;
  *   fixed: logical vector of length 2;
  *   algorithm: single string;
- *   count_only: single logical.
+ *   ms_mode: "MATCHES_AS_COUNTS", "MATCHES_AS_RANGES" or
+ *     "MATCHES_AS_COVERAGE".
  *
  * If with_indels is FALSE: all matches have the length of the pattern.
  * Otherwise, matches are of variable length (>= length(pattern) - max_mismatch
@@ -160,22 +189,22 @@ void _match_pattern_XStringViews(const Chars_holder *P,
 SEXP XString_match_pattern(SEXP pattern, SEXP subject,
 		SEXP max_mismatch, SEXP min_mismatch,
 		SEXP with_indels, SEXP fixed,
-		SEXP algorithm, SEXP count_only)
+		SEXP algorithm, SEXP ms_mode)
 {
-	Chars_holder P, S;
+	PreprocessedPattern_holder ppattern;
+	Chars_holder S;
 	const char *algo;
-	int is_count_only;
+	MatchReporter reporter;
 
-	P = hold_XRaw(pattern);
+	ppattern = _hold_PreprocessedPattern(pattern);
 	S = hold_XRaw(subject);
 	algo = CHAR(STRING_ELT(algorithm, 0));
-	is_count_only = LOGICAL(count_only)[0];
-	_init_match_reporting(is_count_only ?
-		"MATCHES_AS_COUNTS" : "MATCHES_AS_RANGES", 1);
-	_match_pattern_XString(&P, &S,
-		max_mismatch, min_mismatch, with_indels, fixed,
-		algo);
-	return _reported_matches_asSEXP();
+	reporter = _new_MatchReporter(CHAR(STRING_ELT(ms_mode, 0)), 1);
+	match_pattern(&ppattern, &S,
+		INTEGER(max_mismatch)[0], INTEGER(min_mismatch)[0],
+		LOGICAL(fixed)[0], LOGICAL(fixed)[1],
+		algo, &reporter);
+	return _MatchReporter_reported_matches_asSEXP(&reporter);
 }
 
 /* --- .Call ENTRY POINT ---
@@ -187,51 +216,155 @@ SEXP XStringViews_match_pattern(SEXP pattern,
 		SEXP subject, SEXP views_start, SEXP views_width,
 		SEXP max_mismatch, SEXP min_mismatch,
 		SEXP with_indels, SEXP fixed,
-		SEXP algorithm, SEXP count_only)
+		SEXP algorithm, SEXP ms_mode)
+{
+	PreprocessedPattern_holder ppattern;
+	Chars_holder S;
+	const char *algo;
+	MatchReporter reporter;
+
+	ppattern = _hold_PreprocessedPattern(pattern);
+	S = hold_XRaw(subject);
+	algo = CHAR(STRING_ELT(algorithm, 0));
+	reporter = _new_MatchReporter(CHAR(STRING_ELT(ms_mode, 0)), 1);
+	match_pattern_views(&ppattern,
+		&S, views_start, views_width,
+		max_mismatch, min_mismatch, with_indels, fixed,
+		algo, &reporter);
+	return _MatchReporter_reported_matches_asSEXP(&reporter);
+}
+
+/* --- .Call ENTRY POINT ---
+ * Arguments are the same as for XStringViews_match_pattern() except that
+ * 'ms_mode' is replaced by:
+ *   sink, batch_size, seqname, names: see _new_MatchSink_from_SEXP().
+ * The matches are sent to the sink in batches. Returns the number of
+ * matches.
+ */
+SEXP XStringViews_stream_pattern(SEXP pattern,
+		SEXP subject, SEXP views_start, SEXP views_width,
+		SEXP max_mismatch, SEXP min_mismatch,
+		SEXP with_indels, SEXP fixed,
+		SEXP algorithm, SEXP sink, SEXP batch_size,
+		SEXP seqname, SEXP names)
 {
-	Chars_holder P, S;
+	PreprocessedPattern_holder ppattern;
+	Chars_holder S;
 	const char *algo;
-	int is_count_only;
+	MatchReporter reporter;
+	MatchSink match_sink;
 
-	P = hold_XRaw(pattern);
+	ppattern = _hold_PreprocessedPattern(pattern);
 	S = hold_XRaw(subject);
 	algo = CHAR(STRING_ELT(algorithm, 0));
-	is_count_only = LOGICAL(count_only)[0];
-	_init_match_reporting(is_count_only ?
-		"MATCHES_AS_COUNTS" : "MATCHES_AS_RANGES", 1);
-	_match_pattern_XStringViews(&P,
+	reporter = _new_MatchReporter("MATCHES_AS_COUNTS", 1);
+	match_sink = _new_MatchSink_from_SEXP(sink, batch_size,
+					      seqname, S.length, names);
+	_MatchReporter_set_sink(&reporter, &match_sink);
+	match_pattern_views(&ppattern,
 		&S, views_start, views_width,
 		max_mismatch, min_mismatch, with_indels, fixed,
-		algo);
-	return _reported_matches_asSEXP();
+		algo, &reporter);
+	_MatchSink_flush(&match_sink);
+	return _MatchReporter_reported_matches_asSEXP(&reporter);
+}
+
+/*
+ * Splits the subjects into 'nchunk' contiguous chunks and walks the chunks
+ * in parallel. Each chunk reports its matches to its own deferring
+ * MatchReporter. The deferred matches are then reported to 'reporter' in
+ * chunk order so the result is the same as with a serial walk.
+ */
+static void vmatch_pattern_in_parallel(
+		const PreprocessedPattern_holder *ppattern,
+		const XStringSet_holder *S, int S_length,
+		int max_nmis, int min_nmis, int fixedP, int fixedS,
+		const char *algo, int nchunk, MatchReporter *reporter)
+{
+	DeferredMatches *chunk_matches;
+	int c;
+
+	chunk_matches = (DeferredMatches *)
+			R_alloc(nchunk, sizeof(DeferredMatches));
+	for (c = 0; c < nchunk; c++)
+		_init_DeferredMatches(chunk_matches + c,
+				      reporter->match_buf.ms_code);
+#ifdef _OPENMP
+	#pragma omp parallel for num_threads(_get_nthreads()) \
+		schedule(dynamic, 1)
+#endif
+	for (c = 0; c < nchunk; c++) {
+		MatchReporter chunk_reporter;
+		Chars_holder S_elt;
+		int from, to, j;
+
+		from = (int) ((double) S_length * c / nchunk);
+		to = (int) ((double) S_length * (c + 1) / nchunk);
+		chunk_reporter = _new_deferring_MatchReporter(chunk_matches + c);
+		for (j = from; j < to; j++) {
+			S_elt = _get_elt_from_XStringSet_holder(S, j);
+			_MatchReporter_set_active_PSpair(&chunk_reporter, j);
+			match_pattern(ppattern, &S_elt, max_nmis, min_nmis,
+				      fixedP, fixedS, algo, &chunk_reporter);
+		}
+	}
+	/* Frees all the chunk buffers before reporting the first match */
+	_MatchReporter_report_DeferredMatches(reporter, chunk_matches, nchunk);
+	return;
 }
 
 /* --- .Call ENTRY POINT ---
  * Arguments are the same as for XString_match_pattern() except for:
  *   subject: XStringSet object.
+ * The subjects are walked in parallel if more than 1 thread is allowed
+ * (see setBiostringsThreads()) and the algorithm is thread-safe for
+ * 'pattern'. Note that "boyer-moore" is only thread-safe if 'pattern' is
+ * a PreprocessedPattern object.
  */
 SEXP XStringSet_vmatch_pattern(SEXP pattern, SEXP subject,
 		SEXP max_mismatch, SEXP min_mismatch,
 		SEXP with_indels, SEXP fixed,
 		SEXP algorithm, SEXP ms_mode)
 {
-	Chars_holder P, S_elt;
+	PreprocessedPattern_holder ppattern;
+	Chars_holder S_elt;
 	XStringSet_holder S;
-	int S_length, j;
+	int S_length, max_nmis, min_nmis, fixedP, fixedS, nthreads, j;
 	const char *algo;
+	MatchReporter reporter;
 
-	P = hold_XRaw(pattern);
+	ppattern = _hold_PreprocessedPattern(pattern);
 	S = _hold_XStringSet(subject);
 	S_length = _get_XStringSet_length(subject);
+	max_nmis = INTEGER(max_mismatch)[0];
+	min_nmis = INTEGER(min_mismatch)[0];
+	fixedP = LOGICAL(fixed)[0];
+	fixedS = LOGICAL(fixed)[1];
 	algo = CHAR(STRING_ELT(algorithm, 0));
-	_init_match_reporting(CHAR(STRING_ELT(ms_mode, 0)), S_length);
-	for (j = 0; j < S_length; j++) {
-		S_elt = _get_elt_from_XStringSet_holder(&S, j);
-		_set_active_PSpair(j);
-		_match_pattern_XString(&P, &S_elt,
-			max_mismatch, min_mismatch, with_indels, fixed,
-			algo);
+	reporter = _new_MatchReporter(CHAR(STRING_ELT(ms_mode, 0)), S_length);
+	/* Build the oracle once for all the subjects. This also makes "bom"
+	   thread-safe for any pattern. */
+	if (strcmp(algo, "bom") == 0 && ppattern.P.length > 0)
+		_add_bom_oracle_to_PreprocessedPattern_holder(&ppattern);
+	nthreads = _get_nthreads();
+	if (nthreads > 1 && S_length > 1
+	 && match_pattern_is_thread_safe(&ppattern, max_nmis,
+					 fixedP, fixedS, algo))
+	{
+		/* Use more chunks than threads to balance the load when the
+		   subjects have very different lengths. */
+		vmatch_pattern_in_parallel(&ppattern, &S, S_length,
+			max_nmis, min_nmis, fixedP, fixedS, algo,
+			S_length < 8 * nthreads ? S_length : 8 * nthreads,
+			&reporter);
+	} else {
+		for (j = 0; j < S_length; j++) {
+			S_elt = _get_elt_from_XStringSet_holder(&S, j);
+			_MatchReporter_set_active_PSpair(&reporter, j);
+			match_pattern(&ppattern, &S_elt, max_nmis, min_nmis,
+				      fixedP, fixedS, algo, &reporter);
+		}
 	}
-	return _MatchBuf_as_SEXP(_get_internal_match_buf(), R_NilValue);
+	return _MatchBuf_as_SEXP(&(reporter.match_buf), R_NilValue);
 }
 
@@ -0,0 +1,260 @@
+/****************************************************************************
+ *       THE BNDM AND BACKWARD ORACLE MATCHING ALGOS FOR EXACT MATCHING     *
+ ****************************************************************************/
+#include "Biostrings.h"
+
+
+/****************************************************************************
+ * References:
+ *   - G. Navarro and M. Raffinot, "A bit-parallel approach to suffix
+ *     automata: fast extended string matching", CPM 1998 (BNDM).
+ *   - C. Allauzen, M. Crochemore and M. Raffinot, "Factor oracle: a new
+ *     structure for pattern matching", SOFSEM 1999 (BOM).
+ *   - http://www-igm.univ-mlv.fr/~lecroq/string/index.html
+ *
+ * Both algos read the current window of the subject backward and shift it
+ * as soon as the letters read are not a factor of the pattern. On a small
+ * alphabet (e.g. DNA) this gives much longer shifts than the
+ * Boyer-Moore-like algo which only looks at the rightmost letters.
+ */
+
+
+/****************************************************************************
+ * BNDM (Backward Nondeterministic DAWG Matching).
+ *
+ * The nondeterministic suffix automaton of the pattern is simulated with a
+ * single BitWord so, for patterns longer than NBIT_PER_BITWORD letters, it
+ * is built on the first NBIT_PER_BITWORD letters only and the rest of the
+ * pattern is compared with memcmp(). The automaton is represented by a table
+ * of 256 bitmasks (1 per byte value).
+ * None of the functions below calls the R API (except error() on an empty
+ * pattern) so they can be used in a worker thread.
+ */
+
+/* 'B' must have room for 256 bitmasks (1 per byte value). */
+void _preprocess_pattern_bndm(const Chars_holder *P, BitWord *B)
+{
+	BitWord high_bit;
+	int w, i;
+
+	w = P->length < NBIT_PER_BITWORD ? P->length : NBIT_PER_BITWORD;
+	high_bit = (BitWord) 1 << (w - 1);
+	memset(B, 0, sizeof(BitWord) * 256);
+	for (i = 0; i < w; i++)
+		B[(unsigned char) P->ptr[i]] |= high_bit >> i;
+	return;
+}
+
+static void bndm(const Chars_holder *P, const BitWord *B,
+		const Chars_holder *S, MatchReporter *reporter)
+{
+	BitWord D, mask, high_bit;
+	int w, pos, j, last;
+	const char *s;
+
+	w = P->length < NBIT_PER_BITWORD ? P->length : NBIT_PER_BITWORD;
+	high_bit = (BitWord) 1 << (w - 1);
+	mask = high_bit | (high_bit - 1);
+	for (pos = 0; pos <= S->length - P->length; pos += last) {
+		s = S->ptr + pos;
+		j = w - 1;
+		last = w;
+		D = mask;
+		while (1) {
+			D &= B[(unsigned char) s[j]];
+			if (D == 0)
+				break;
+			if (D & high_bit) {
+				/* s[j..w-1] is a prefix of P */
+				if (j == 0) {
+					if (w == P->length
+					 || memcmp(P->ptr + w, s + w,
+						   P->length - w) == 0)
+						_MatchReporter_report_match(
+							reporter, pos + 1,
+							P->length);
+				} else {
+					last = j;
+				}
+			}
+			if (j == 0)
+				break;
+			j--;
+			D = (D << 1) & mask;
+		}
+	}
+	return;
+}
+
+void _match_pattern_bndm(const Chars_holder *P, const Chars_holder *S,
+		MatchReporter *reporter)
+{
+	BitWord B[256];
+
+	if (P->length <= 0)
+		error("empty pattern");
+	_preprocess_pattern_bndm(P, B);
+	bndm(P, B, S, reporter);
+	return;
+}
+
+/* Uses the bitmasks stored in 'ppattern'. */
+void _match_PreprocessedPattern_bndm(
+		const PreprocessedPattern_holder *ppattern,
+		const Chars_holder *S, MatchReporter *reporter)
+{
+	bndm(&(ppattern->P), ppattern->bndm_masks, S, reporter);
+	return;
+}
+
+
+/****************************************************************************
+ * BOM (Backward Oracle Matching).
+ *
+ * The factor oracle of the reversed pattern recognizes at least all the
+ * factors of the reversed pattern so a window is verified with memcmp()
+ * when all its letters could be read. The transitions are stored in a
+ * (nP + 1) x nletters table where nletters is the number of distinct
+ * letters in the pattern. The 'byte2code' table maps each byte value to
+ * its column in the transition table (or to NO_LETTER if the letter is not
+ * in the pattern).
+ */
+
+#define NO_LETTER -1
+#define NO_STATE -1
+
+/*
+ * The transition table and the supply function of the oracle are on the
+ * stack for patterns with at most MAX_STACK_NTRANS of them. Longer patterns
+ * need R_alloc() so are not thread-safe (unless they are preprocessed).
+ */
+#define MAX_STACK_NTRANS 8192
+
+/* Fills 'byte2code' (256 ints) and returns the number of distinct letters
+   in 'P'. Doesn't call any function of the R API. */
+int _bom_nletters(const Chars_holder *P, int *byte2code)
+{
+	int nletters, i, k;
+
+	for (i = 0; i < 256; i++)
+		byte2code[i] = NO_LETTER;
+	nletters = 0;
+	for (i = 0; i < P->length; i++) {
+		k = (unsigned char) P->ptr[i];
+		if (byte2code[k] == NO_LETTER)
+			byte2code[k] = nletters++;
+	}
+	return nletters;
+}
+
+/* 'trans' must have room for (P->length + 1) x nletters ints and 'supply'
+   for P->length + 1 ints. Doesn't call any function of the R API. */
+void _preprocess_pattern_bom(const Chars_holder *P, const int *byte2code,
+		int nletters, int *trans, int *supply)
+{
+	int m, i, k, code;
+
+	m = P->length;
+	for (i = 0; i < (m + 1) * nletters; i++)
+		trans[i] = NO_STATE;
+	/* Build the oracle of the reversed pattern: state i is reached after
+	   reading its first i letters (i.e. the last i letters of P,
+	   backward). */
+	supply[0] = NO_STATE;
+	for (i = 1; i <= m; i++) {
+		code = byte2code[(unsigned char) P->ptr[m - i]];
+		trans[(i - 1) * nletters + code] = i;
+		k = supply[i - 1];
+		while (k != NO_STATE
+		    && trans[k * nletters + code] == NO_STATE) {
+			trans[k * nletters + code] = i;
+			k = supply[k];
+		}
+		supply[i] = k == NO_STATE ? 0 : trans[k * nletters + code];
+	}
+	return;
+}
+
+/* Doesn't call any function of the R API. */
+static void bom(const Chars_holder *P, const int *byte2code, int nletters,
+		const int *trans, const Chars_holder *S,
+		MatchReporter *reporter)
+{
+	int m, pos, j, state, code;
+	const char *s;
+
+	m = P->length;
+	for (pos = 0; pos <= S->length - m; pos += j + 1) {
+		s = S->ptr + pos;
+		state = 0;
+		j = m;
+		while (j > 0 && state != NO_STATE) {
+			code = byte2code[(unsigned char) s[j - 1]];
+			state = code == NO_LETTER ? NO_STATE :
+				trans[state * nletters + code];
+			j--;
+		}
+		/* If the window was read entirely then 'j' is 0 and we
+		   shift by 1. Otherwise s[j..m-1] is not a factor of P and
+		   we shift past s[j]. */
+		if (state != NO_STATE && memcmp(P->ptr, s, m) == 0)
+			_MatchReporter_report_match(reporter, pos + 1, m);
+	}
+	return;
+}
+
+int _bom_is_thread_safe(const Chars_holder *P)
+{
+	int byte2code[256];
+
+	return P->length > 0 &&
+	       (P->length + 1) * (_bom_nletters(P, byte2code) + 1) <=
+	       MAX_STACK_NTRANS;
+}
+
+/*
+ * Doesn't call the R API (except for error() on an empty pattern and
+ * R_alloc() for long patterns, see _bom_is_thread_safe() above) so can be
+ * used in a worker thread.
+ */
+void _match_pattern_bom(const Chars_holder *P, const Chars_holder *S,
+		MatchReporter *reporter)
+{
+	int byte2code[256], trans0[MAX_STACK_NTRANS], nletters, ntrans,
+	    *trans;
+	const void *vmax;
+
+	if (P->length <= 0)
+		error("empty pattern");
+	if (P->length > S->length)
+		return;
+	nletters = _bom_nletters(P, byte2code);
+	/* The transition table is followed by the supply function. */
+	ntrans = (P->length + 1) * (nletters + 1);
+	vmax = NULL;
+	if (ntrans <= MAX_STACK_NTRANS) {
+		trans = trans0;
+	} else {
+		/* Released before we return so calling this function for
+		   many subjects doesn't accumulate memory. */
+		vmax = vmaxget();
+		trans = (int *) R_alloc((long) ntrans, sizeof(int));
+	}
+	_preprocess_pattern_bom(P, byte2code, nletters, trans,
+				trans + (P->length + 1) * nletters);
+	bom(P, byte2code, nletters, trans, S, reporter);
+	if (vmax != NULL)
+		vmaxset(vmax);
+	return;
+}
+
+/* Uses the oracle stored in 'ppattern'. Doesn't call any function of the
+   R API. */
+void _match_PreprocessedPattern_bom(
+		const PreprocessedPattern_holder *ppattern,
+		const Chars_holder *S, MatchReporter *reporter)
+{
+	bom(&(ppattern->P), ppattern->bom_byte2code, ppattern->bom_nletters,
+	    ppattern->bom_trans, S, reporter);
+	return;
+}
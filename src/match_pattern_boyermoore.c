@@ -25,6 +25,10 @@
  * memory (i.e. memory that is not reclaimed by R at the end of the .Call()
  * call). Hence the use of malloc()/free() instead of Salloc() for memory
  * allocation.
+ * The matching functions (get_VSGSshift(), get_MWshift() and boyermoore())
+ * take a pointer to a PPP struct so they can also be used with a pattern
+ * that was preprocessed once for all by _preprocess_pattern_boyermoore()
+ * (see below).
  * Members of 'ppP' are:
  *   buflength: the size of the buffer pointed by the 'seq' member, which, in
  *              the current implemenation, is also the length of the longest
@@ -38,15 +42,18 @@
  *   VSGSshift_table: see "The Very Strong Good Suffix shifts" section below;
  *   MWshift_table: see "The Matching Window shifts" section below.
  */
-static struct {
+typedef struct ppp {
 	int buflength;
-	char *seq;
+	const char *seq;
 	int seqlength;
 	int LCP;
 	int j0, shift0;
 	int *VSGSshift_table;
 	int *MWshift_table;
-} ppP = {0, NULL, 0, -1, 0, 0, NULL, NULL};
+} PPP;
+
+static char *ppP_seqbuf = NULL;
+static PPP ppP = {0, NULL, 0, -1, 0, 0, NULL, NULL};
 
 /* The 'LCP' member:
  *     -1: init_ppP_seq() changed the value of ppP.buflength.
@@ -69,11 +76,11 @@ static void init_ppP_seq(const Chars_holder *P, int walk_backward)
 	if (P->length > ppP.buflength) {
 		/* We need to extend the size of 'ppP'. In that case, we
 		   don't need to compute the LCP and we set it to -1. */
-		if (ppP.seq != NULL)
-			free(ppP.seq);
+		if (ppP_seqbuf != NULL)
+			free(ppP_seqbuf);
 		ppP.buflength = 0;
-		ppP.seq = (char *) malloc(P->length * sizeof(char));
-		if (ppP.seq == NULL)
+		ppP.seq = ppP_seqbuf = (char *) malloc(P->length * sizeof(char));
+		if (ppP_seqbuf == NULL)
 			error("can't allocate memory for ppP.seq");
 		ppP.buflength = P->length;
 		LCP = -1;
@@ -87,7 +94,7 @@ static void init_ppP_seq(const Chars_holder *P, int walk_backward)
 		if (LCP != -1 && j1 < ppP.seqlength && c == ppP.seq[j1])
 			LCP++;
 		else
-			ppP.seq[j1] = c;
+			ppP_seqbuf[j1] = c;
 	}
 	ppP.seqlength = P->length;
 	ppP.LCP = LCP;
@@ -164,38 +171,38 @@ static void init_ppP_j0shift0()
  * The "x" region is defined by 0 <= j < ppP.seqlength
  */
 
-#define VSGS_SHIFT(c, j) (ppP.VSGSshift_table[ppP.buflength * ((unsigned char) (c)) + (j)])
+#define VSGS_SHIFT(pp, c, j) ((pp)->VSGSshift_table[(pp)->buflength * ((unsigned char) (c)) + (j)])
 
-static int get_VSGSshift(char c, int j)
+static int get_VSGSshift(PPP *pp, char c, int j)
 {
 	int shift, k, k1, k2, length;
 	const char *tmp;
 
-	if (j < ppP.j0)
-		return ppP.shift0;
-	shift = VSGS_SHIFT(c, j);
+	if (j < pp->j0)
+		return pp->shift0;
+	shift = VSGS_SHIFT(pp, c, j);
 	if (shift != 0)
 		return shift;
-	for (shift = 1; shift < ppP.seqlength; shift++) {
+	for (shift = 1; shift < pp->seqlength; shift++) {
 		if (shift <= j) {
 			k = j - shift;
-			if (ppP.seq[k] != c)
+			if (pp->seq[k] != c)
 				continue;
 			k1 = k + 1;
 		} else {
 			k1 = 0;
 		}
-		k2 = ppP.seqlength - shift;
+		k2 = pp->seqlength - shift;
 		if (k1 == k2)
 			break;
 		length = k2 - k1;
-		tmp = ppP.seq + k1;
+		tmp = pp->seq + k1;
 		if (memcmp(tmp, tmp + shift, length) == 0)
 			break;
 	}
-	/* shift is ppP.seqlength when the "for" loop is not interrupted by "break" */
+	/* shift is pp->seqlength when the "for" loop is not interrupted by "break" */
 	/*Rprintf("VSGSshift(c=%c, j=%d) = %d\n", c, j, shift);*/
-	return VSGS_SHIFT(c, j) = shift;
+	return VSGS_SHIFT(pp, c, j) = shift;
 }
 
 static void init_ppP_VSGSshift_table()
@@ -216,7 +223,7 @@ static void init_ppP_VSGSshift_table()
 	for (u = 0; u < 256; u++) {
 		for (j = 0; j < ppP.seqlength; j++) {
 			c = (char) u;
-			VSGS_SHIFT(c, j) = 0;
+			VSGS_SHIFT(&ppP, c, j) = 0;
 		}
 	}
 }
@@ -299,26 +306,26 @@ static void init_ppP_VSGSshift_table()
  * The "x" region is defined by 0 <= j1 < j2 <= ppP.seqlength
  */
 
-#define MWSHIFT(j1, j2) (ppP.MWshift_table[ppP.buflength * (j1) + (j2) - 1])
+#define MWSHIFT(pp, j1, j2) ((pp)->MWshift_table[(pp)->buflength * (j1) + (j2) - 1])
 
-static int get_MWshift(int j1, int j2)
+static int get_MWshift(PPP *pp, int j1, int j2)
 {
 	int shift, k1, k2, length;
 	const char *tmp;
 
-	shift = MWSHIFT(j1, j2);
+	shift = MWSHIFT(pp, j1, j2);
 	if (shift != 0)
 		return shift;
 	for (shift = 1; shift < j2; shift++) {
 		if (shift < j1) k1 = j1 - shift; else k1 = 0;
 		k2 = j2 - shift;
 		length = k2 - k1;
-		tmp = ppP.seq + k1;
+		tmp = pp->seq + k1;
 		if (memcmp(tmp, tmp + shift, length) == 0)
 			break;
 	}
 	/* shift is j2 when the "for" loop is not interrupted by "break" */
-	return MWSHIFT(j1, j2) = shift;
+	return MWSHIFT(pp, j1, j2) = shift;
 }
 
 static void init_ppP_MWshift_table()
@@ -339,7 +346,7 @@ static void init_ppP_MWshift_table()
 		j2 = ppP.LCP + 1;
 	for ( ; j2 <= ppP.seqlength; j2++) {
 		for (j1 = 0; j1 < j2; j1++) {
-			MWSHIFT(j1, j2) = 0;
+			MWSHIFT(&ppP, j1, j2) = 0;
 		}
 	}
 }
@@ -376,38 +383,38 @@ static void init_ppP_MWshift_table()
 	} \
 }
 
-/* Return 1-based end of last match or -1 if no match */
-int _match_pattern_boyermoore(const Chars_holder *P, const Chars_holder *S,
-		int nfirstmatches, int walk_backward)
+/*
+ * Return 1-based end of last match or -1 if no match.
+ * Doesn't call any function of the R API (so can be used in a worker
+ * thread) if all the shifts in 'pp' are precomputed, which is the case when
+ * 'pp' was set by set_PPP_from_PreprocessedPattern().
+ */
+static int boyermoore(PPP *pp, const Chars_holder *S,
+		int nfirstmatches, int walk_backward, MatchReporter *reporter)
 {
-	int nmatches, last_match_end, n, i1, i2, j1, j2, shift, shift1,
-	    i, j, match_start;
-	char ppP_rmc, c; /* ppP_rmc is 'ppP.seq' right-most char */
+	int nmatches, last_match_end, use_MWshift, n, i1, i2, j1, j2,
+	    shift, shift1, i, j, match_start;
+	char ppP_rmc, c; /* ppP_rmc is 'pp->seq' right-most char */
 
-	if (P->length <= 0)
-		error("empty pattern");
 	nmatches = 0;
 	last_match_end = -1;
-	init_ppP_seq(P, walk_backward);
-	init_ppP_j0shift0();
-	init_ppP_VSGSshift_table();
-	if (ppP.seqlength <= MWSHIFT_NPMAX)
-		init_ppP_MWshift_table();
-	n = ppP.seqlength - 1;
-	ppP_rmc = ppP.seq[n];
+	use_MWshift = pp->seqlength <= MWSHIFT_NPMAX &&
+		      pp->MWshift_table != NULL;
+	n = pp->seqlength - 1;
+	ppP_rmc = pp->seq[n];
 	j2 = 0;
 	while (n < S->length) {
 		if (j2 == 0) {
 			/* No Matching Window yet, we need to find one */
 			c = GET_S_LETTER(S, n, walk_backward);
 			if (c != ppP_rmc) {
-				shift = get_VSGSshift(c, ppP.seqlength - 1);
+				shift = get_VSGSshift(pp, c, pp->seqlength - 1);
 				n += shift;
 				continue;
 			}
 			i1 = n;
 			i2 = i1 + 1;
-			j2 = ppP.seqlength;
+			j2 = pp->seqlength;
 			j1 = j2 - 1;
 			/* Now we have a Matching Window (1-letter suffix) */
 		}
@@ -415,46 +422,47 @@ int _match_pattern_boyermoore(const Chars_holder *P, const Chars_holder *S,
 		if (j1 > 0) {
 			/* ... to the left */
 			for (i = i1-1, j = j1-1; j >= 0; i--, j--)
-				if ((c = GET_S_LETTER(S, i, walk_backward)) != ppP.seq[j])
+				if ((c = GET_S_LETTER(S, i, walk_backward)) != pp->seq[j])
 					break;
 			i1 = i + 1;
 			j1 = j + 1;
 		}
-		if (j2 < ppP.seqlength) {
+		if (j2 < pp->seqlength) {
 			/* ... to the right */
-			for ( ; j2 < ppP.seqlength; i2++, j2++)
-				if (GET_S_LETTER(S, i2, walk_backward) != ppP.seq[j2])
+			for ( ; j2 < pp->seqlength; i2++, j2++)
+				if (GET_S_LETTER(S, i2, walk_backward) != pp->seq[j2])
 					break;
 		}
-		if (j2 == ppP.seqlength) { /* the Matching Window is a suffix */
+		if (j2 == pp->seqlength) { /* the Matching Window is a suffix */
 			if (j1 == 0) {
 				/* we have a full match! */
 				if (walk_backward) {
 					last_match_end = S->length - i1;
-					match_start = last_match_end - ppP.seqlength + 1;
+					match_start = last_match_end - pp->seqlength + 1;
 				} else {
 					match_start = i1 + 1;
-					last_match_end = i1 + ppP.seqlength;
+					last_match_end = i1 + pp->seqlength;
 				}
-				_report_match(match_start, ppP.seqlength);
+				_MatchReporter_report_match(reporter,
+						match_start, pp->seqlength);
 				nmatches++;
 				if (nfirstmatches >= 0 && nmatches >= nfirstmatches)
 					break;
-				shift = ppP.shift0;
+				shift = pp->shift0;
 			} else {
-				shift = get_VSGSshift(c, j1 - 1);
+				shift = get_VSGSshift(pp, c, j1 - 1);
 			}
 		} else {
-			shift = get_MWshift(j1, j2);
+			shift = get_MWshift(pp, j1, j2);
 			c = GET_S_LETTER(S, n, walk_backward);
 			if (c != ppP_rmc) {
-				shift1 = get_VSGSshift(c, ppP.seqlength - 1);
+				shift1 = get_VSGSshift(pp, c, pp->seqlength - 1);
 				if (shift1 > shift)
 					shift = shift1;
 			}
 		}
 		n += shift;
-		if (ppP.seqlength <= MWSHIFT_NPMAX) {
+		if (use_MWshift) {
 			ADJUST_MW(i1, j1, shift)
 			ADJUST_MW(i2, j2, shift)
 		} else {
@@ -464,3 +472,139 @@ int _match_pattern_boyermoore(const Chars_holder *P, const Chars_holder *S,
 	return last_match_end;
 }
 
+
+/*
+ * The matches are reported to the internal MatchReporter instance if
+ * 'reporter' is NULL.
+ */
+int _match_pattern_boyermoore_to_reporter(const Chars_holder *P,
+		const Chars_holder *S, int nfirstmatches, int walk_backward,
+		MatchReporter *reporter)
+{
+	if (P->length <= 0)
+		error("empty pattern");
+	if (reporter == NULL)
+		reporter = _get_internal_match_reporter();
+	init_ppP_seq(P, walk_backward);
+	init_ppP_j0shift0();
+	init_ppP_VSGSshift_table();
+	if (ppP.seqlength <= MWSHIFT_NPMAX)
+		init_ppP_MWshift_table();
+	return boyermoore(&ppP, S, nfirstmatches, walk_backward, reporter);
+}
+
+/* Reports to the internal MatchReporter instance. */
+int _match_pattern_boyermoore(const Chars_holder *P, const Chars_holder *S,
+		int nfirstmatches, int walk_backward)
+{
+	return _match_pattern_boyermoore_to_reporter(P, S, nfirstmatches,
+			walk_backward, NULL);
+}
+
+
+/****************************************************************************
+ * Preprocessing a pattern once for all
+ * ====================================
+ *
+ * _preprocess_pattern_boyermoore() fills the full 256 x P->length
+ * VSGSshift table of 'P' (no walking backward) upfront instead of
+ * delaying the evaluation of its values until they are needed. It uses
+ * the suffix lengths of 'P' (see Charras & Lecroq, "Handbook of exact string
+ * matching algorithms") to do this in O(256 x P->length) time:
+ *   - For 1 <= shift < nP, let m be the length of the longest common suffix
+ *     of P(0, nP-shift) and P. If m < nP - shift, then 'shift' is a
+ *     candidate for VSGSshift(c, j) with j = nP-1-m and c = P[j-shift]
+ *     (P[j] is the first letter that doesn't match when P is shifted).
+ *   - If m = nP - shift, then P(0, nP-shift) is a suffix of P and 'shift' is
+ *     a candidate for VSGSshift(c, j) for any c and any j < shift.
+ *   - VSGSshift(c, j) is the smallest candidate (or nP if there is none).
+ * Only the values of VSGSshift(c, j) for c != P[j] are relevant (they are
+ * the only ones used by boyermoore()). Note that they are all non-zero so
+ * get_VSGSshift() will never try to modify the table.
+ * Returns shift0 (which is VSGSshift(c, 0) for c != P[0]).
+ */
+
+int _preprocess_pattern_boyermoore(const Chars_holder *P,
+		int *VSGSshift_table)
+{
+	int nP, *suff, f, g, i, j, u, shift, m;
+
+	nP = P->length;
+	if (nP <= 0)
+		error("empty pattern");
+	if (nP > 20000)
+		error("pattern is too long");
+	suff = (int *) R_alloc((long) nP, sizeof(int));
+	suff[nP - 1] = nP;
+	f = g = nP - 1;
+	for (i = nP - 2; i >= 0; i--) {
+		if (i > g && suff[i + nP - 1 - f] < i - g) {
+			suff[i] = suff[i + nP - 1 - f];
+		} else {
+			if (i < g)
+				g = i;
+			f = i;
+			while (g >= 0 && P->ptr[g] == P->ptr[g + nP - 1 - f])
+				g--;
+			suff[i] = f - g;
+		}
+	}
+	/* Shifts for which P(0, nP-shift) is a suffix of P. */
+	for (shift = 1, j = 0; shift < nP; shift++) {
+		if (suff[nP - 1 - shift] != nP - shift)
+			continue;
+		for ( ; j < shift; j++)
+			for (u = 0; u < 256; u++)
+				VSGSshift_table[nP * u + j] = shift;
+	}
+	for ( ; j < nP; j++)
+		for (u = 0; u < 256; u++)
+			VSGSshift_table[nP * u + j] = nP;
+	/* Shifts for which the first mismatching letter is in P. Walking the
+	   shifts backward ensures that the smallest candidate wins. */
+	for (shift = nP - 1; shift >= 1; shift--) {
+		m = suff[nP - 1 - shift];
+		if (m >= nP - shift)
+			continue;
+		j = nP - 1 - m;
+		u = (unsigned char) P->ptr[j - shift];
+		if (shift < VSGSshift_table[nP * u + j])
+			VSGSshift_table[nP * u + j] = shift;
+	}
+	/* The VSGSshift table is filled so shift0 is VSGSshift(c, 0) for any
+	   c != P[0]. */
+	u = ((unsigned char) P->ptr[0]) ^ 1;
+	return VSGSshift_table[u * nP];
+}
+
+/* Doesn't call any function of the R API. */
+static void set_PPP_from_PreprocessedPattern(PPP *pp,
+		const PreprocessedPattern_holder *ppattern)
+{
+	pp->buflength = pp->seqlength = ppattern->P.length;
+	pp->seq = ppattern->P.ptr;
+	pp->LCP = -1;
+	pp->j0 = 0;  /* get_VSGSshift() won't use its j0/shift0 shortcut */
+	pp->shift0 = ppattern->shift0;
+	/* get_VSGSshift() won't modify the table (see above). */
+	pp->VSGSshift_table = (int *) ppattern->VSGSshift_table;
+	pp->MWshift_table = NULL;
+	return;
+}
+
+/*
+ * Like _match_pattern_boyermoore() but for a pattern that was preprocessed
+ * with _preprocess_pattern_boyermoore() (no walking backward).
+ * Doesn't call any function of the R API so can be used in a worker thread.
+ */
+int _match_PreprocessedPattern_boyermoore(
+		const PreprocessedPattern_holder *ppattern,
+		const Chars_holder *S, int nfirstmatches,
+		MatchReporter *reporter)
+{
+	PPP pp;
+
+	set_PPP_from_PreprocessedPattern(&pp, ppattern);
+	return boyermoore(&pp, S, nfirstmatches, 0, reporter);
+}
+
@@ -15,7 +15,8 @@ static void test_match_pattern_indels(const char *p, const char *s,
 	P.length = strlen(P.ptr);
 	S.ptr = s;
 	S.length = strlen(S.ptr);
-	_match_pattern_indels(&P, &S, max_nmis, 1, 1);
+	_match_pattern_indels(&P, &S, max_nmis, 1, 1,
+			      _get_internal_match_reporter());
 	return;
 }
 
@@ -31,45 +32,156 @@ static void test_match_pattern_indels(const char *p, const char *s,
  * hold it until it is replaced by a better one or until it's guaranteed to be 
  * a best local match (then it's reported as a match).
  */
-static int provisory_match_start, provisory_match_end, provisory_match_width,
-	   provisory_match_nedit;
+typedef struct provisory_match {
+	int start, end, width, nedit;  /* nedit is -1 if no provisory match */
+} ProvisoryMatch;
 
-static void report_provisory_match(int start, int width, int nedit)
+static void report_provisory_match(ProvisoryMatch *provisory_match,
+		int start, int width, int nedit, MatchReporter *reporter)
 {
 	int end;
 
 	end = start + width - 1;
-	if (provisory_match_nedit != -1) {
+	if (provisory_match->nedit != -1) {
 		// Given how we walk on S, 'start' is always guaranteed to be >
-		// 'provisory_match_start'.
-		if (end > provisory_match_end)
-			_report_match(provisory_match_start, provisory_match_width);
-		else if (nedit > provisory_match_nedit)
+		// 'provisory_match->start'.
+		if (end > provisory_match->end)
+			_MatchReporter_report_match(reporter,
+						    provisory_match->start,
+						    provisory_match->width);
+		else if (nedit > provisory_match->nedit)
 			return;
 	}
-	provisory_match_start = start;
-	provisory_match_end = end;
-	provisory_match_width = width;
-	provisory_match_nedit = nedit;
+	provisory_match->start = start;
+	provisory_match->end = end;
+	provisory_match->width = width;
+	provisory_match->nedit = nedit;
 	return;
 }
 
-static ByteTrTable byte2offset;
+/*
+ * A best local match S' starting at position j0 in S has a length between
+ * nP - max_nmis and nP + max_nmis, and the edit distance between P and S'
+ * is <= max_nmis. So if the (non-anchored) bit-parallel engine 'myers'
+ * didn't find any substring of S with an edit distance <= max_nmis ending
+ * between j0 + nP - max_nmis - 1 and j0 + nP + max_nmis - 1, then no match
+ * can start at j0 and we don't need to call nedit_for_Ploffset().
+ * 'Myers_end' is the position of the last letter added to 'myers' and
+ * 'last_ok_end' the last position where the edit distance was
+ * <= max_nmis (both are -1 initially).
+ */
+static int can_start_at(int j0, const Chars_holder *P, const Chars_holder *S,
+		int max_nmis, MyersNedit *myers,
+		int *Myers_end, int *last_ok_end)
+{
+	int max_end;
+
+	max_end = j0 + P->length + max_nmis - 1;
+	if (max_end >= S->length)
+		max_end = S->length - 1;
+	while (*Myers_end < max_end) {
+		(*Myers_end)++;
+		if (_MyersNedit_add_letter(myers,
+				(unsigned char) S->ptr[*Myers_end]) <= max_nmis)
+			*last_ok_end = *Myers_end;
+	}
+	return *last_ok_end >= j0 + P->length - max_nmis - 1;
+}
+
+/*
+ * Bit-parallel version of _nedit_for_Ploffset() (see lowlevel_matching.c).
+ * 'myers' must be an anchored engine. Returns the smallest edit distance
+ * between the letters used by 'myers' (P1) and the substrings S' of S
+ * starting at 'Ploffset' with a width <= nP1 + min(max_nedit, nP1), and
+ * the width of the shortest S' for which this distance is reached. Like
+ * _nedit_for_Ploffset(), the letters beyond the end of S are considered
+ * to be mismatches. The result is the same as with _nedit_for_Ploffset()
+ * when it's <= 'max_nedit' (otherwise the caller discards it anyway).
+ */
+static int nedit_for_Ploffset(MyersNedit *myers, const Chars_holder *S,
+		int Ploffset, int max_nedit, int *min_width)
+{
+	int nP1, max_width, min_nedit, width, Si, nedit;
+
+	nP1 = myers->Plength;
+	*min_width = 0;
+	if (nP1 == 0)
+		return 0;
+	if (max_nedit > nP1)
+		max_nedit = nP1;
+	max_width = nP1 + max_nedit;
+	_MyersNedit_reset(myers);
+	min_nedit = nP1;  /* nedit for a width of 0 */
+	/* The edit distance for width 'width' is >= width - nP1 so we can
+	   stop as soon as this is >= min_nedit. */
+	for (width = 1, Si = Ploffset;
+	     width <= max_width && width - nP1 < min_nedit;
+	     width++, Si++)
+	{
+		nedit = _MyersNedit_add_letter(myers,
+				Si < S->length ? (unsigned char) S->ptr[Si] : -1);
+		if (nedit < min_nedit) {
+			min_nedit = nedit;
+			*min_width = width;
+		}
+	}
+	return min_nedit;
+}
+
+/*
+ * The "pattern match vectors" of the Myers engines are on the stack for
+ * patterns with at most MAX_STACK_NWORD x NBIT_PER_BITWORD letters.
+ * Longer patterns need R_alloc() so are not thread-safe.
+ */
+#define MAX_STACK_NWORD 4
+
+int _indels_is_thread_safe(const Chars_holder *P)
+{
+	return P->length > 0 && _MyersNedit_nword(P->length) <= MAX_STACK_NWORD;
+}
 
+/*
+ * Doesn't use any static buffer and doesn't call the R API (except for
+ * error() on an empty pattern and R_alloc() for long patterns, see
+ * _indels_is_thread_safe() above) so can be used in a worker thread.
+ */
 void _match_pattern_indels(const Chars_holder *P, const Chars_holder *S,
-		int max_nmis, int fixedP, int fixedS)
+		int max_nmis, int fixedP, int fixedS, MatchReporter *reporter)
 {
-	int i0, j0, max_nmis1, nedit1, width1;
+	int i0, j0, max_nmis1, nedit1, width1, Myers_end, last_ok_end,
+	    nword;
 	char c0;
 	const BytewiseOpTable *bytewise_match_table;
+	ByteTrTable byte2offset;
+	ProvisoryMatch provisory_match;
 	Chars_holder P1;
+	MyersNedit myers, myers1;
+	BitWord Peq0[256 * MAX_STACK_NWORD], state0[4 * MAX_STACK_NWORD],
+		*Peq, *state;
+	const void *vmax;
 
 	if (P->length <= 0)
 		error("empty pattern");
 	bytewise_match_table = _select_bytewise_match_table(fixedP, fixedS);
 	_init_byte2offset_with_Chars_holder(&byte2offset, P,
 					     bytewise_match_table);
-	provisory_match_nedit = -1; // means no provisory match yet
+	nword = _MyersNedit_nword(P->length);
+	vmax = NULL;
+	if (nword <= MAX_STACK_NWORD) {
+		Peq = Peq0;
+		state = state0;
+	} else {
+		/* Released before we return so calling this function for
+		   many subjects doesn't accumulate memory. */
+		vmax = vmaxget();
+		Peq = (BitWord *) R_alloc(256L * nword, sizeof(BitWord));
+		state = (BitWord *) R_alloc(4L * nword, sizeof(BitWord));
+	}
+	_set_MyersPeq(Peq, P, bytewise_match_table);
+	_init_MyersNedit(&myers, Peq, P->length, 0, 0,
+			 state, state + nword);
+	Myers_end = last_ok_end = -1;
+	provisory_match.nedit = -1; // means no provisory match yet
 	j0 = 0;
 	while (j0 < S->length) {
 		while (1) {
@@ -79,6 +191,11 @@ void _match_pattern_indels(const Chars_holder *P, const Chars_holder *S,
 			j0++;
 			if (j0 >= S->length) goto done;
 		}
+		if (!can_start_at(j0, P, S, max_nmis, &myers,
+				  &Myers_end, &last_ok_end)) {
+			j0++;
+			continue;
+		}
 		P1.ptr = P->ptr + i0 + 1;
 		P1.length = P->length - i0 - 1;
 		max_nmis1 = max_nmis - i0;
@@ -89,19 +206,29 @@ void _match_pattern_indels(const Chars_holder *P, const Chars_holder *S,
 							bytewise_match_table);
 				width1 = P1.length;
 			} else {
-				nedit1 = _nedit_for_Ploffset(&P1, S, j0 + 1,
-							max_nmis1, 1, &width1,
-							bytewise_match_table);
+				/* The rows of 'myers1' are the letters of
+				   P1. */
+				_init_MyersNedit(&myers1, Peq, P->length,
+						 i0 + 1, 1, state + 2 * nword,
+						 state + 3 * nword);
+				nedit1 = nedit_for_Ploffset(&myers1, S, j0 + 1,
+							max_nmis1, &width1);
 			}
 			if (nedit1 <= max_nmis1) {
-				report_provisory_match(j0 + 1, width1 + 1, nedit1 + i0);
+				report_provisory_match(&provisory_match,
+					j0 + 1, width1 + 1, nedit1 + i0,
+					reporter);
 			}
 		}
 		j0++;
 	}
 	done:
-	if (provisory_match_nedit != -1)
-		_report_match(provisory_match_start, provisory_match_width);
+	if (provisory_match.nedit != -1)
+		_MatchReporter_report_match(reporter,
+					    provisory_match.start,
+					    provisory_match.width);
+	if (vmax != NULL)
+		vmaxset(vmax);
 	return;
 }
 
@@ -0,0 +1,168 @@
+/****************************************************************************
+ *             A BIT-PARALLEL EDIT DISTANCE ENGINE (MYERS 1999)             *
+ ****************************************************************************/
+#include "Biostrings.h"
+
+
+/****************************************************************************
+ * References:
+ *   - G. Myers, "A fast bit-vector algorithm for approximate string matching
+ *     based on dynamic programming", Journal of the ACM 46(3), 1999.
+ *   - H. Hyyro, "A bit-vector algorithm for computing Levenshtein and
+ *     Damerau edit distances", Nordic Journal of Computing 10, 2003.
+ *
+ * The columns of the dynamic programming matrix D (one column per letter in
+ * the subject, one row per letter in the pattern) are encoded as vertical
+ * deltas: bit i of 'Pv' (resp. 'Mv') is set iff D[i+1][j] - D[i][j] is +1
+ * (resp. -1). If the engine is not "anchored", the first row of D is all
+ * zeros (a match can start anywhere in the subject) and D[nP][j] is the
+ * smallest edit distance between the pattern and the substrings of the
+ * subject that end at position j. If it's "anchored", the first row of D
+ * is 0, 1, 2, ... and D[nP][j] is the edit distance between the pattern
+ * and the subject.
+ * Patterns longer than NBIT_PER_BITWORD letters use 'nword' words per
+ * column. The horizontal delta at the bottom of a block is passed as
+ * the 'hin' delta of the next block (see Myers' paper, section 4.2).
+ * Note that the bits of the last word that are beyond the last letter of
+ * the pattern don't affect the other bits (the carries and the shifts only
+ * propagate toward the most significant bits).
+ *
+ * The "pattern match vectors" (Peq) are computed once for the full pattern
+ * and can be shared (read-only) by several engines. An engine can use a
+ * suffix of the pattern (the rows of D are the letters of the pattern that
+ * start at offset 'Poffset'), in which case the pattern match vectors are
+ * shifted on the fly. None of the functions below call the R API or
+ * allocate memory.
+ */
+
+#define HIGH_BIT ((BitWord) 1 << (NBIT_PER_BITWORD - 1))
+
+int _MyersNedit_nword(int Plength)
+{
+	return (Plength + NBIT_PER_BITWORD - 1) / NBIT_PER_BITWORD;
+}
+
+/*
+ * 'Peq' must have room for 256 x _MyersNedit_nword(P->length) words.
+ */
+void _set_MyersPeq(BitWord *Peq, const Chars_holder *P,
+		const BytewiseOpTable *bytewise_match_table)
+{
+	int nword, i, u;
+	BitWord *Peq_u;
+
+	nword = _MyersNedit_nword(P->length);
+	for (u = 0; u < 256; u++) {
+		Peq_u = Peq + u * nword;
+		memset(Peq_u, 0, nword * sizeof(BitWord));
+		for (i = 0; i < P->length; i++) {
+			if (bytewise_match_table->xy2val[(unsigned char)
+							 P->ptr[i]][u])
+				Peq_u[i / NBIT_PER_BITWORD] |=
+					(BitWord) 1 << (i % NBIT_PER_BITWORD);
+		}
+	}
+	return;
+}
+
+/*
+ * 'Peq' was set by _set_MyersPeq() for a pattern of length 'Peq_Plength'.
+ * The engine uses the letters of this pattern that start at offset
+ * 'Poffset'. 'Pv' and 'Mv' must have room for
+ * _MyersNedit_nword(Peq_Plength - Poffset) words each.
+ */
+void _init_MyersNedit(MyersNedit *myers,
+		const BitWord *Peq, int Peq_Plength, int Poffset,
+		int anchored, BitWord *Pv, BitWord *Mv)
+{
+	myers->Peq = Peq;
+	myers->Peq_nword = _MyersNedit_nword(Peq_Plength);
+	myers->Poffset = Poffset;
+	myers->Plength = Peq_Plength - Poffset;
+	myers->nword = _MyersNedit_nword(myers->Plength);
+	myers->anchored = anchored;
+	myers->Pv = Pv;
+	myers->Mv = Mv;
+	_MyersNedit_reset(myers);
+	return;
+}
+
+/* Puts 'myers' back in the state it was before any letter was added. */
+void _MyersNedit_reset(MyersNedit *myers)
+{
+	int k;
+
+	for (k = 0; k < myers->nword; k++) {
+		myers->Pv[k] = ~((BitWord) 0);
+		myers->Mv[k] = 0;
+	}
+	myers->score = myers->Plength;
+	return;
+}
+
+/* Word 'k' of the match vector of byte 'u' for the letters used by
+   'myers'. */
+static BitWord get_Eq(const MyersNedit *myers, int u, int k)
+{
+	const BitWord *Peq_u;
+	int q, r;
+	BitWord Eq;
+
+	Peq_u = myers->Peq + u * myers->Peq_nword;
+	q = myers->Poffset / NBIT_PER_BITWORD + k;
+	r = myers->Poffset % NBIT_PER_BITWORD;
+	Eq = Peq_u[q] >> r;
+	if (r != 0 && q + 1 < myers->Peq_nword)
+		Eq |= Peq_u[q + 1] << (NBIT_PER_BITWORD - r);
+	return Eq;
+}
+
+/*
+ * Adds byte 'c' to the subject and returns D[nP][j] for the new column j
+ * (see above). 'c' can be -1 for a position that doesn't match any letter
+ * of the pattern (e.g. beyond the end of the subject).
+ */
+int _MyersNedit_add_letter(MyersNedit *myers, int c)
+{
+	BitWord Pv, Mv, Eq, Xv, Xh, Ph, Mh, hin_is_neg, last_bit;
+	int nword, k, hin, hout;
+
+	nword = myers->nword;
+	hin = myers->anchored ? 1 : 0;
+	for (k = 0; k < nword; k++) {
+		Pv = myers->Pv[k];
+		Mv = myers->Mv[k];
+		Eq = c < 0 ? 0 : get_Eq(myers, c, k);
+		hin_is_neg = hin < 0 ? 1 : 0;
+		Xv = Eq | Mv;
+		Eq |= hin_is_neg;
+		Xh = (((Eq & Pv) + Pv) ^ Pv) | Eq;
+		Ph = Mv | ~(Xh | Pv);
+		Mh = Pv & Xh;
+		if (k == nword - 1) {
+			/* The score is in the row of the last letter of the
+			   pattern, not necessarily at the bottom of the
+			   block. */
+			last_bit = (BitWord) 1 <<
+				   ((myers->Plength - 1) % NBIT_PER_BITWORD);
+			if (Ph & last_bit)
+				myers->score++;
+			else if (Mh & last_bit)
+				myers->score--;
+			hout = 0;
+		} else {
+			hout = (Ph & HIGH_BIT) ? 1 : ((Mh & HIGH_BIT) ? -1 : 0);
+		}
+		Ph <<= 1;
+		Mh <<= 1;
+		if (hin < 0)
+			Mh |= 1;
+		else if (hin > 0)
+			Ph |= 1;
+		myers->Pv[k] = Mh | ~(Xv | Ph);
+		myers->Mv[k] = Ph & Xv;
+		hin = hout;
+	}
+	return myers->score;
+}
+
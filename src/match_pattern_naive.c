@@ -0,0 +1,346 @@
+/****************************************************************************
+ *            THE "NAIVE" METHODS FOR EXACT AND INEXACT MATCHING            *
+ ****************************************************************************/
+#include "Biostrings.h"
+
+/*
+ * On x86 we compile SSE2 and AVX2 versions of the naive kernels (with the
+ * 'target' function attribute so no special compiler flag is needed) and
+ * pick the best one at run time. The scalar versions are used everywhere
+ * else.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD_KERNELS 1
+#include <immintrin.h>
+#endif
+
+#define SIMD_NONE 0
+#define SIMD_SSE2 1
+#define SIMD_AVX2 2
+
+static int simd_level(void)
+{
+#ifdef HAVE_X86_SIMD_KERNELS
+	if (__builtin_cpu_supports("avx2"))
+		return SIMD_AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return SIMD_SSE2;
+#endif
+	return SIMD_NONE;
+}
+
+/* --- .Call ENTRY POINT ---
+ * Returns the SIMD level used by the naive kernels (0 if they are not
+ * available on this platform). Used by the "auto" algorithm selection.
+ */
+SEXP naive_simd_level()
+{
+	return ScalarInteger(simd_level());
+}
+
+
+/****************************************************************************
+ * A memcmp-based implementation of the "naive" method for exact matching.
+ *
+ * Here is how the "naive" (aka "memcmp", aka "blunt") method for finding
+ * exact matches is described in Dan Gusfield book "Algorithms on strings,
+ * trees, and sequences" (slightly modified):
+ *   The naive method aligns the left end of P (the pattern) with the left
+ *   end of S (the subject) and then compares the characters of P and S left
+ *   to right until either two unequal characters are found or until P is
+ *   exhausted, in which case an occurrence of P is reported. In either case,
+ *   P is then shifted one place to the right, and the comparisons are
+ *   restarted from the left end of P. This process repeats until the right
+ *   end of P shifts past the right end of S.
+ *
+ * Why implement this inefficient "naive" method?
+ * - For QC: we can validate other more sophisticated matching algo by
+ *   comparing their results to those obtains with the "naive" method.
+ * - To use as a reference when comparing performance.
+ * - With SIMD instructions, it's the fastest method for short patterns
+ *   (the other methods cannot skip much in that case).
+ *
+ * The SIMD kernels compare the first (resp. last) letter of P with 16 or
+ * 32 consecutive letters of S at once and only call memcmp() on the
+ * shifts where both letters match. Each kernel returns the number of
+ * shifts it processed (a multiple of the vector width) and the remaining
+ * shifts are processed by the scalar code.
+ */
+
+#ifdef HAVE_X86_SIMD_KERNELS
+
+#define REPORT_MATCHES_IN_MASK(mask, i0, P, S, reporter) \
+{ \
+	int j; \
+	while ((mask) != 0) { \
+		j = (i0) + __builtin_ctz(mask); \
+		if ((P)->length <= 2 || \
+		    memcmp((P)->ptr + 1, (S)->ptr + j + 1, \
+			   (P)->length - 2) == 0) \
+			_MatchReporter_report_match((reporter), j + 1, \
+						    (P)->length); \
+		(mask) &= (mask) - 1; \
+	} \
+}
+
+__attribute__((target("sse2")))
+static int naive_exact_sse2(const Chars_holder *P, const Chars_holder *S,
+		MatchReporter *reporter)
+{
+	int nshift, i;
+	const char *s;
+	__m128i first, last, b0, b1;
+	unsigned int mask;
+
+	nshift = S->length - P->length + 1;
+	first = _mm_set1_epi8(P->ptr[0]);
+	last = _mm_set1_epi8(P->ptr[P->length - 1]);
+	for (i = 0, s = S->ptr; i + 16 <= nshift; i += 16, s += 16) {
+		b0 = _mm_loadu_si128((const __m128i *) s);
+		b1 = _mm_loadu_si128((const __m128i *) (s + P->length - 1));
+		mask = (unsigned int) _mm_movemask_epi8(
+			_mm_and_si128(_mm_cmpeq_epi8(first, b0),
+				      _mm_cmpeq_epi8(last, b1)));
+		REPORT_MATCHES_IN_MASK(mask, i, P, S, reporter)
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+static int naive_exact_avx2(const Chars_holder *P, const Chars_holder *S,
+		MatchReporter *reporter)
+{
+	int nshift, i;
+	const char *s;
+	__m256i first, last, b0, b1;
+	unsigned int mask;
+
+	nshift = S->length - P->length + 1;
+	first = _mm256_set1_epi8(P->ptr[0]);
+	last = _mm256_set1_epi8(P->ptr[P->length - 1]);
+	for (i = 0, s = S->ptr; i + 32 <= nshift; i += 32, s += 32) {
+		b0 = _mm256_loadu_si256((const __m256i *) s);
+		b1 = _mm256_loadu_si256((const __m256i *)
+					(s + P->length - 1));
+		mask = (unsigned int) _mm256_movemask_epi8(
+			_mm256_and_si256(_mm256_cmpeq_epi8(first, b0),
+					 _mm256_cmpeq_epi8(last, b1)));
+		REPORT_MATCHES_IN_MASK(mask, i, P, S, reporter)
+	}
+	return i;
+}
+
+#endif  /* HAVE_X86_SIMD_KERNELS */
+
+void _match_pattern_naive_exact(const Chars_holder *P, const Chars_holder *S,
+		MatchReporter *reporter)
+{
+	const char *p, *s;
+	int plen, slen, start, n2;
+
+	if (P->length <= 0)
+		error("empty pattern");
+	p = P->ptr;
+	plen = P->length;
+	s = S->ptr;
+	slen = S->length;
+	start = 1;
+#ifdef HAVE_X86_SIMD_KERNELS
+	if (plen <= slen) {
+		switch (simd_level()) {
+		    case SIMD_AVX2:
+			start += naive_exact_avx2(P, S, reporter);
+			break;
+		    case SIMD_SSE2:
+			start += naive_exact_sse2(P, S, reporter);
+			break;
+		}
+		s += start - 1;
+	}
+#endif
+	for (n2 = start - 1 + plen; n2 <= slen; start++, n2++, s++) {
+		if (memcmp(p, s, plen) == 0)
+			_MatchReporter_report_match(reporter, start, P->length);
+	}
+	return;
+}
+
+
+/****************************************************************************
+ * An implementation of the "naive" method for inexact matching.
+ *
+ * When 'fixedP' and 'fixedS' are TRUE (i.e. a letter in P matches a letter
+ * in S iff they are equal) and P has less than 256 letters, the SIMD kernels
+ * count the matching letters for 16 or 32 consecutive shifts at once (one
+ * byte counter per shift). They only process the shifts where P is
+ * entirely within the limits of S, and stop early when none of the shifts
+ * in the current block can have <= 'max_nmis' mismatches.
+ */
+
+#define MAX_SIMD_INEXACT_PLENGTH 255
+
+#ifdef HAVE_X86_SIMD_KERNELS
+
+#define REPORT_SHIFTS_IN_MASK(mask, i0, P, reporter) \
+{ \
+	while ((mask) != 0) { \
+		_MatchReporter_report_match((reporter), \
+				(i0) + __builtin_ctz(mask) + 1, (P)->length); \
+		(mask) &= (mask) - 1; \
+	} \
+}
+
+/* Checking for an early exit every 4 letters is a good compromise. */
+#define EARLY_EXIT_STEP 4
+
+__attribute__((target("sse2")))
+static int naive_inexact_sse2(const Chars_holder *P, const Chars_holder *S,
+		int max_nmis, int min_nmis, MatchReporter *reporter)
+{
+	int nshift, i, k;
+	const char *s;
+	__m128i min_nmatch, max_nmatch, nmatch, ok;
+	unsigned int mask;
+
+	nshift = S->length - P->length + 1;
+	min_nmatch = _mm_set1_epi8((char) (P->length - max_nmis));
+	max_nmatch = _mm_set1_epi8((char) (P->length - min_nmis));
+	for (i = 0, s = S->ptr; i + 16 <= nshift; i += 16, s += 16) {
+		nmatch = _mm_setzero_si128();
+		for (k = 0; k < P->length; k++) {
+			/* _mm_cmpeq_epi8() returns -1 for the matches */
+			nmatch = _mm_sub_epi8(nmatch, _mm_cmpeq_epi8(
+				_mm_set1_epi8(P->ptr[k]),
+				_mm_loadu_si128((const __m128i *) (s + k))));
+			if ((k + 1) % EARLY_EXIT_STEP == 0
+			 && k + 1 > max_nmis) {
+				/* any shift with <= max_nmis mismatches so
+				   far? */
+				ok = _mm_set1_epi8((char) (k + 1 - max_nmis));
+				ok = _mm_cmpeq_epi8(_mm_max_epu8(nmatch, ok),
+						    nmatch);
+				if (_mm_movemask_epi8(ok) == 0)
+					break;
+			}
+		}
+		if (k < P->length)
+			continue;
+		ok = _mm_and_si128(
+			_mm_cmpeq_epi8(_mm_max_epu8(nmatch, min_nmatch),
+				       nmatch),
+			_mm_cmpeq_epi8(_mm_min_epu8(nmatch, max_nmatch),
+				       nmatch));
+		mask = (unsigned int) _mm_movemask_epi8(ok);
+		REPORT_SHIFTS_IN_MASK(mask, i, P, reporter)
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+static int naive_inexact_avx2(const Chars_holder *P, const Chars_holder *S,
+		int max_nmis, int min_nmis, MatchReporter *reporter)
+{
+	int nshift, i, k;
+	const char *s;
+	__m256i min_nmatch, max_nmatch, nmatch, ok;
+	unsigned int mask;
+
+	nshift = S->length - P->length + 1;
+	min_nmatch = _mm256_set1_epi8((char) (P->length - max_nmis));
+	max_nmatch = _mm256_set1_epi8((char) (P->length - min_nmis));
+	for (i = 0, s = S->ptr; i + 32 <= nshift; i += 32, s += 32) {
+		nmatch = _mm256_setzero_si256();
+		for (k = 0; k < P->length; k++) {
+			/* _mm256_cmpeq_epi8() returns -1 for the matches */
+			nmatch = _mm256_sub_epi8(nmatch, _mm256_cmpeq_epi8(
+				_mm256_set1_epi8(P->ptr[k]),
+				_mm256_loadu_si256((const __m256i *) (s + k))));
+			if ((k + 1) % EARLY_EXIT_STEP == 0
+			 && k + 1 > max_nmis) {
+				/* any shift with <= max_nmis mismatches so
+				   far? */
+				ok = _mm256_set1_epi8(
+					(char) (k + 1 - max_nmis));
+				ok = _mm256_cmpeq_epi8(
+					_mm256_max_epu8(nmatch, ok), nmatch);
+				if (_mm256_movemask_epi8(ok) == 0)
+					break;
+			}
+		}
+		if (k < P->length)
+			continue;
+		ok = _mm256_and_si256(
+			_mm256_cmpeq_epi8(_mm256_max_epu8(nmatch, min_nmatch),
+					  nmatch),
+			_mm256_cmpeq_epi8(_mm256_min_epu8(nmatch, max_nmatch),
+					  nmatch));
+		mask = (unsigned int) _mm256_movemask_epi8(ok);
+		REPORT_SHIFTS_IN_MASK(mask, i, P, reporter)
+	}
+	return i;
+}
+
+#endif  /* HAVE_X86_SIMD_KERNELS */
+
+static void match_naive_inexact_shifts(const Chars_holder *P,
+		const Chars_holder *S, int from_Pshift, int to_Pshift,
+		int max_nmis, int min_nmis,
+		const BytewiseOpTable *bytewise_match_table,
+		MatchReporter *reporter)
+{
+	int Pshift, nmis;
+
+	for (Pshift = from_Pshift; Pshift <= to_Pshift; Pshift++) {
+		nmis = _nmismatch_at_Pshift(P, S, Pshift, max_nmis,
+					    bytewise_match_table);
+		if (nmis <= max_nmis && nmis >= min_nmis)
+			_MatchReporter_report_match(reporter,
+					Pshift + 1, P->length);
+	}
+	return;
+}
+
+void _match_pattern_naive_inexact(const Chars_holder *P,
+		const Chars_holder *S,
+		int max_nmis, int min_nmis, int fixedP, int fixedS,
+		MatchReporter *reporter)
+{
+	int min_Pshift, max_Pshift, Pshift;
+	const BytewiseOpTable *bytewise_match_table;
+
+	if (P->length <= 0)
+		error("empty pattern");
+	bytewise_match_table = _select_bytewise_match_table(fixedP, fixedS);
+	// Pshift is the position of pattern left-most char relative to the
+	// subject
+	min_Pshift = P->length <= max_nmis ? 1 - P->length : -max_nmis;
+	max_Pshift = S->length - P->length - min_Pshift;
+	Pshift = min_Pshift;
+#ifdef HAVE_X86_SIMD_KERNELS
+	if (fixedP && fixedS && max_nmis < P->length
+	 && P->length <= MAX_SIMD_INEXACT_PLENGTH
+	 && P->length <= S->length)
+	{
+		int nshift = 0;
+
+		match_naive_inexact_shifts(P, S, min_Pshift, -1,
+				max_nmis, min_nmis, bytewise_match_table,
+				reporter);
+		switch (simd_level()) {
+		    case SIMD_AVX2:
+			nshift = naive_inexact_avx2(P, S, max_nmis, min_nmis,
+						    reporter);
+			break;
+		    case SIMD_SSE2:
+			nshift = naive_inexact_sse2(P, S, max_nmis, min_nmis,
+						    reporter);
+			break;
+		}
+		Pshift = nshift;
+	}
+#endif
+	match_naive_inexact_shifts(P, S, Pshift, max_Pshift,
+			max_nmis, min_nmis, bytewise_match_table, reporter);
+	return;
+}
+
@@ -97,16 +97,29 @@ SEXP bits_per_long()
 }
 
 
-/****************************************************************************/
+/****************************************************************************
+ * Patterns longer than BITS_PER_LONG letters are supported by using
+ * 'nword' words per bitmask (the "multi-word" bitmasks). The bits of a
+ * multi-word bitmask are numbered from the right-most bit of its first word
+ * (bit 0) to the left-most bit of its last word (bit nword*BITS_PER_LONG-1)
+ * so the last position in the pattern is still mapped to bit 0.
+ */
+
+#define SHIFTOR_NWORD(Plength) (((Plength) + BITS_PER_LONG - 1) / BITS_PER_LONG)
 
+/*
+ * Stores the (multi-word) pmask for 'nncode' in
+ * pmaskmap[nncode * nword], ..., pmaskmap[nncode * nword + nword - 1].
+ */
 static void set_pmaskmap(
 		int is_fixed,
 		int pmaskmap_length,
+		int nword,
 		ShiftOrWord_t *pmaskmap,
 		const Chars_holder *P)
 {
-	ShiftOrWord_t pmask;
-	int nncode, i;
+	ShiftOrWord_t *pmask;
+	int nncode, i, b, k;
 
 	/* Why go to 255? Only pmaskmap[nncode] will be used,
 	where nncode is a numerical nucleotide code.
@@ -114,18 +127,19 @@ static void set_pmaskmap(
 	Not even all values <= 30 are used!
 	*/
 	for (nncode = 0; nncode < pmaskmap_length; nncode++) {
-		pmask = 0LU;
-		for (i = 0; i < P->length; i++) {
-			pmask <<= 1;
+		pmask = pmaskmap + nncode * nword;
+		for (k = 0; k < nword; k++)
+			pmask[k] = 0UL;
+		for (i = 0, b = P->length - 1; i < P->length; i++, b--) {
 			if (is_fixed) {
-				if (((unsigned char) P->ptr[i]) != nncode)
-					pmask |= 1UL;
+				if (((unsigned char) P->ptr[i]) == nncode)
+					continue;
 			} else {
-				if ((((unsigned char) P->ptr[i]) & nncode) == 0)
-					pmask |= 1UL;
+				if ((((unsigned char) P->ptr[i]) & nncode) != 0)
+					continue;
 			}
+			pmask[b / BITS_PER_LONG] |= 1UL << (b % BITS_PER_LONG);
 		}
-		pmaskmap[nncode] = pmask;
 	}
 	return;
 }
@@ -135,8 +149,8 @@ static void update_PMmasks(
 		ShiftOrWord_t *PMmask,
 		ShiftOrWord_t pmask)
 {
-	static ShiftOrWord_t PMmaskA, PMmaskB;
-	static int e;
+	ShiftOrWord_t PMmaskA, PMmaskB;
+	int e;
 
 	PMmaskA = PMmask[0] >> 1;
 	PMmask[0] = PMmaskA | pmask;
@@ -156,13 +170,12 @@ static int next_match(
 		int *Lpos,
 		int *Rpos,
 		const Chars_holder *S,
-		ShiftOrWord_t *pmaskmap,
+		const ShiftOrWord_t *pmaskmap,
 		int PMmask_length, /* PMmask_length = kerr+1 */
 		ShiftOrWord_t *PMmask)
 {
-	static ShiftOrWord_t pmask;
-	static int nncode;
-	static int e;
+	ShiftOrWord_t pmask;
+	int nncode, e;
 
 	while (*Lpos < S->length) {
 		if (*Rpos < S->length) {
@@ -183,17 +196,161 @@ static int next_match(
 	return -1;
 }
 
+/*
+ * Same as update_PMmasks() but on multi-word bitmasks. PMmask[e] is stored
+ * in PMmask[e * nword], ..., PMmask[e * nword + nword - 1].
+ * 'PMmaskA' is a buffer of length 'nword'.
+ */
+static void update_multiword_PMmasks(
+		int PMmask_length,
+		int nword,
+		ShiftOrWord_t *PMmask,
+		const ShiftOrWord_t *pmask,
+		ShiftOrWord_t *PMmaskA)
+{
+	ShiftOrWord_t *PMmask_e, PMmaskA_k, PMmaskB_k;
+	int e, k;
+
+	for (e = 0, PMmask_e = PMmask; e < PMmask_length; e++, PMmask_e += nword)
+	{
+		/* We walk the words from right to left (i.e. from bit 0 to
+		   bit nword*BITS_PER_LONG-1) so PMmask_e[k+1] has not been
+		   updated yet when we shift it into PMmask_e[k]. */
+		for (k = 0; k < nword; k++) {
+			PMmaskA_k = PMmask_e[k] >> 1;
+			if (k + 1 < nword)
+				PMmaskA_k |= PMmask_e[k + 1] <<
+					     (BITS_PER_LONG - 1);
+			if (e == 0) {
+				PMmask_e[k] = PMmaskA_k | pmask[k];
+			} else {
+				PMmaskB_k = PMmaskA[k];
+				PMmask_e[k] = (PMmaskA_k | pmask[k]) &
+					      PMmaskB_k & PMmask_e[k - nword];
+			}
+			PMmaskA[k] = PMmaskA_k;
+		}
+	}
+	return;
+}
+
+/*
+ * Same as next_match() but on multi-word bitmasks. 'oob_pmask' is the
+ * (multi-word) pmask used for the letters beyond the end of the subject.
+ */
+static int next_multiword_match(
+		int *Lpos,
+		int *Rpos,
+		const Chars_holder *S,
+		const ShiftOrWord_t *pmaskmap,
+		const ShiftOrWord_t *oob_pmask,
+		int PMmask_length, /* PMmask_length = kerr+1 */
+		int nword,
+		ShiftOrWord_t *PMmask,
+		ShiftOrWord_t *PMmaskA)
+{
+	const ShiftOrWord_t *pmask;
+	int nncode, e;
+
+	while (*Lpos < S->length) {
+		if (*Rpos < S->length) {
+			nncode = (unsigned char) S->ptr[*Rpos];
+			pmask = pmaskmap + nncode * nword;
+		} else {
+			pmask = oob_pmask;
+		}
+		update_multiword_PMmasks(PMmask_length, nword, PMmask, pmask,
+					 PMmaskA);
+		(*Lpos)++;
+		(*Rpos)++;
+		for (e = 0; e < PMmask_length; e++) {
+			if ((PMmask[e * nword] & 1UL) == 0UL) {
+				return e;
+			}
+		}
+	}
+	return -1;
+}
+
+/*
+ * Uses R_alloc() for its buffers so must NOT be called in a worker thread.
+ * The buffers are released before the function returns so calling it for
+ * many subjects doesn't accumulate memory.
+ */
+static void multiword_shiftor(const Chars_holder *P, const Chars_holder *S,
+		int PMmask_length, const ShiftOrWord_t *pmaskmap,
+		MatchReporter *reporter)
+{
+	const void *vmax;
+	ShiftOrWord_t *PMmask, *PMmaskA, *oob_pmask;
+	int nword, i, e, k, Lpos, Rpos, ret;
+
+	vmax = vmaxget();
+	nword = SHIFTOR_NWORD(P->length);
+	PMmask = (ShiftOrWord_t *) R_alloc((long) PMmask_length * nword,
+					   sizeof(ShiftOrWord_t));
+	PMmaskA = (ShiftOrWord_t *) R_alloc((long) nword,
+					    sizeof(ShiftOrWord_t));
+	oob_pmask = (ShiftOrWord_t *) R_alloc((long) nword,
+					      sizeof(ShiftOrWord_t));
+	for (k = 0; k < nword; k++) {
+		PMmask[k] = 0UL;
+		oob_pmask[k] = ~0UL;
+	}
+	for (i = 0; i < P->length; i++)
+		PMmask[i / BITS_PER_LONG] |= 1UL << (i % BITS_PER_LONG);
+	for (e = 1; e < PMmask_length; e++) {
+		for (k = 0; k < nword; k++) {
+			PMmask[e * nword + k] = PMmask[(e - 1) * nword + k] >> 1;
+			if (k + 1 < nword)
+				PMmask[e * nword + k] |=
+					PMmask[(e - 1) * nword + k + 1] <<
+					(BITS_PER_LONG - 1);
+		}
+	}
+	Lpos = 1 - P->length;
+	Rpos = 0;
+	while (1) {
+		ret = next_multiword_match(
+			&Lpos,
+			&Rpos,
+			S,
+			pmaskmap,
+			oob_pmask,
+			PMmask_length,
+			nword,
+			PMmask,
+			PMmaskA);
+		if (ret == -1) {
+			break;
+		}
+		_MatchReporter_report_match(reporter, Lpos, P->length);
+	}
+	vmaxset(vmax);
+	return;
+}
+
+/*
+ * Doesn't call any function of the R API (so can be used in a worker thread)
+ * as long as 'P' and 'PMmask_length' are valid and 'P' is not longer than
+ * BITS_PER_LONG letters.
+ */
 static void shiftor(const Chars_holder *P, const Chars_holder *S,
-		int PMmask_length, int is_fixed)
+		int PMmask_length, const ShiftOrWord_t *pmaskmap,
+		MatchReporter *reporter)
 {
-	ShiftOrWord_t *PMmask, pmaskmap[256];
+	ShiftOrWord_t PMmask[BITS_PER_LONG + 1];
 	int i, e, Lpos, Rpos, ret;
 
 	if (P->length <= 0)
 		error("empty pattern");
-	set_pmaskmap(is_fixed, 256, pmaskmap, P);
-	PMmask = (ShiftOrWord_t *)
-			R_alloc(PMmask_length, sizeof(ShiftOrWord_t));
+	if (PMmask_length > P->length + 1)
+		error("Biostrings internal error in shiftor(): "
+		      "PMmask_length > P->length + 1");
+	if (P->length > shiftor_maxbits) {
+		multiword_shiftor(P, S, PMmask_length, pmaskmap, reporter);
+		return;
+	}
 	PMmask[0] = 1UL;
 	for (i = 1; i < P->length; i++) {
 		PMmask[0] <<= 1;
@@ -215,19 +372,86 @@ static void shiftor(const Chars_holder *P, const Chars_holder *S,
 		if (ret == -1) {
 			break;
 		}
-		_report_match(Lpos, P->length);
+		_MatchReporter_report_match(reporter, Lpos, P->length);
 	}
-	/* No need to free PMmask, R does that for us */
 	return;
 }
 
+/*
+ * Returns 1 if _match_pattern_shiftor() won't raise an error for 'P',
+ * 'fixedP' and 'fixedS', and thus can be called in a worker thread.
+ * Patterns that need multi-word bitmasks are matched serially.
+ */
+int _shiftor_is_thread_safe(const Chars_holder *P, int fixedP, int fixedS)
+{
+	return P->length > 0 && P->length <= shiftor_maxbits &&
+	       fixedP == fixedS;
+}
+
 void _match_pattern_shiftor(const Chars_holder *P, const Chars_holder *S,
-		int max_nmis, int fixedP, int fixedS)
+		int max_nmis, int fixedP, int fixedS, MatchReporter *reporter)
+{
+	ShiftOrWord_t pmaskmap0[256], *pmaskmap;
+	const void *vmax;
+	int nword;
+
+	if (fixedP != fixedS)
+		error("fixedP != fixedS not supported by shift-or algo");
+	nword = SHIFTOR_NWORD(P->length);
+	if (nword <= 1) {
+		set_pmaskmap(fixedP, 256, 1, pmaskmap0, P);
+		shiftor(P, S, max_nmis + 1, pmaskmap0, reporter);
+		return;
+	}
+	vmax = vmaxget();
+	pmaskmap = (ShiftOrWord_t *) R_alloc(256L * nword,
+					     sizeof(ShiftOrWord_t));
+	set_pmaskmap(fixedP, 256, nword, pmaskmap, P);
+	shiftor(P, S, max_nmis + 1, pmaskmap, reporter);
+	vmaxset(vmax);
+	return;
+}
+
+
+/****************************************************************************
+ * Preprocessing a pattern once for all.
+ *
+ * _preprocess_pattern_shiftor() stores the pmaskmap of 'P' for fixed=TRUE
+ * followed by its pmaskmap for fixed=FALSE in 'pmaskmap' (must have room
+ * for 512 x _shiftor_nword(P->length) elts).
+ */
+
+int _shiftor_nword(int Plength)
+{
+	return SHIFTOR_NWORD(Plength);
+}
+
+void _preprocess_pattern_shiftor(const Chars_holder *P,
+		unsigned long *pmaskmap)
+{
+	int nword;
+
+	nword = SHIFTOR_NWORD(P->length);
+	set_pmaskmap(1, 256, nword, pmaskmap, P);
+	set_pmaskmap(0, 256, nword, pmaskmap + 256 * nword, P);
+	return;
+}
+
+/*
+ * Like _match_pattern_shiftor() but uses the pmaskmap precomputed by
+ * _preprocess_pattern_shiftor(). Can be used in a worker thread if
+ * _shiftor_is_thread_safe() returns 1 for 'ppattern->P'.
+ */
+void _match_PreprocessedPattern_shiftor(
+		const PreprocessedPattern_holder *ppattern,
+		const Chars_holder *S,
+		int max_nmis, int fixedP, int fixedS, MatchReporter *reporter)
 {
-	if (P->length > shiftor_maxbits)
-		error("pattern is too long");
 	if (fixedP != fixedS)
 		error("fixedP != fixedS not supported by shift-or algo");
-	shiftor(P, S, max_nmis + 1, fixedP);
+	shiftor(&(ppattern->P), S, max_nmis + 1,
+		ppattern->pmaskmap + (fixedP ? 0 : 256 *
+				      SHIFTOR_NWORD(ppattern->P.length)),
+		reporter);
 }
 
@@ -9,6 +9,8 @@
 #include "IRanges_interface.h"
 #include "S4Vectors_interface.h"
 
+#include <stdlib.h> /* for malloc() and free() */
+
 
 /****************************************************************************
  * Helper functions for all the *match_pdict() .Call entry points.
@@ -21,10 +23,17 @@ static MatchPDictBuf new_MatchPDictBuf_from_PDict3Parts(SEXP matches_as,
 		SEXP pptb, SEXP pdict_head, SEXP pdict_tail)
 {
 	int tb_length, tb_width;
-	const int *head_widths, *tail_widths;
+	const int *tb_widths, *head_widths, *tail_widths;
 
 	tb_length = _get_PreprocessedTB_length(pptb);
 	tb_width = _get_PreprocessedTB_width(pptb);
+	/* Only the Trusted Band of an ACtreeVW object can have a variable
+	   width (and then it has no head and no tail) */
+	if (strcmp(get_classname(pptb), "ACtreeVW") == 0)
+		tb_widths = INTEGER(_get_XStringSet_width(
+					_get_PreprocessedTB_tb(pptb)));
+	else
+		tb_widths = NULL;
 	if (pdict_head == R_NilValue)
 		head_widths = NULL;
 	else
@@ -34,7 +43,7 @@ static MatchPDictBuf new_MatchPDictBuf_from_PDict3Parts(SEXP matches_as,
 	else
 		tail_widths = INTEGER(_get_XStringSet_width(pdict_tail));
 	return _new_MatchPDictBuf(matches_as, tb_length, tb_width,
-				head_widths, tail_widths);
+				tb_widths, head_widths, tail_widths);
 }
 
 static void match_pdict(SEXP pptb, HeadTail *headtail, const Chars_holder *S,
@@ -66,6 +75,8 @@ static void match_pdict(SEXP pptb, HeadTail *headtail, const Chars_holder *S,
 		_match_Twobit(pptb, S, fixedS, tb_matches);
 	else if (strcmp(type, "ACtree2") == 0)
 		_match_tbACtree2(pptb, S, fixedS, tb_matches);
+	else if (strcmp(type, "ACtreeVW") == 0)
+		_match_ACtreeVW(pptb, S, fixedS, tb_matches);
 	else
 		error("%s: unsupported Trusted Band type in 'pdict'", type);
 	/* Call _match_pdict_all_flanks() even if 'headtail' is empty
@@ -77,6 +88,217 @@ static void match_pdict(SEXP pptb, HeadTail *headtail, const Chars_holder *S,
 }
 
 
+/****************************************************************************
+ * Helper functions for the vmatch_PDict3Parts_XStringSet() .Call entry point.
+ *
+ * When the subjects are fixed, we walk the Trusted Band along a batch of
+ * subjects at once with _match_tbACtree2_interleaved(), which interleaves
+ * the walks of several subjects so their memory accesses can overlap (see
+ * inst/benchmarks/dictionary_interleaving.R for comparing it with walking
+ * the subjects one after the other). The batch is split in 1 range of
+ * subjects per thread.
+ * Then the matches of each subject are fed back to the TBMatchBuf and the
+ * flanks are matched as usual (in the main thread) so the result is exactly
+ * the same as with match_pdict().
+ * Subjects longer than INTERLEAVE_MAX_SUBJECT_LENGTH are left out of the
+ * batch and walked by match_pdict() (which can walk them in parallel).
+ * The links of the tree are completed before the 1st batch that has a
+ * subject to walk, so nothing is done on the tree when all the subjects
+ * are left out.
+ * The batch (TBBatch) is a local of vmatch_PDict3Parts_XStringSet() that
+ * is passed down by pointer.
+ */
+
+#define INTERLEAVE_BATCH_SIZE 4096
+#define INTERLEAVE_MAX_SUBJECT_LENGTH 100000
+
+/* Walking less subjects than this is not worth starting a thread. */
+#define MIN_SUBJECTS_PER_CHUNK 256
+
+typedef struct tb_batch {
+	int is_on;
+	int is_prepared;  /* set by the 1st walk_TBBatch() that walks */
+	int offset;  /* index of the 1st subject in the batch */
+	int nS;
+	Chars_holder *S;  /* INTERLEAVE_BATCH_SIZE subjects */
+	int max_nchunk, nchunk;
+	TBBatchMatches *chunk_matches;  /* 1 buffer per chunk */
+	/* The matches of the k-th subject of the batch are at indices
+	 * breakpoints[k] to breakpoints[k+1] - 1 of P_ids and ends. */
+	int *breakpoints;
+	int *cursors;
+	IntAE *P_ids, *ends;
+} TBBatch;
+
+/*
+ * Only the buffers of 'chunk_matches' are malloc'ed. They are freed as
+ * soon as the matches of a batch have been used (i.e. before anything that
+ * can raise an error).
+ */
+static TBBatch new_TBBatch(SEXP pptb, SEXP fixed)
+{
+	TBBatch tb_batch;
+	int k;
+
+	tb_batch.is_on = strcmp(get_classname(pptb), "ACtree2") == 0 &&
+			 LOGICAL(fixed)[1];
+	tb_batch.is_prepared = 0;
+	tb_batch.offset = tb_batch.nS = 0;
+	tb_batch.max_nchunk = tb_batch.nchunk = 0;
+	if (!tb_batch.is_on)
+		return tb_batch;
+	tb_batch.S = (Chars_holder *) R_alloc(INTERLEAVE_BATCH_SIZE,
+					      sizeof(Chars_holder));
+	tb_batch.max_nchunk = _get_nthreads();
+	tb_batch.chunk_matches = (TBBatchMatches *)
+		R_alloc(tb_batch.max_nchunk, sizeof(TBBatchMatches));
+	for (k = 0; k < tb_batch.max_nchunk; k++)
+		_init_TBBatchMatches(tb_batch.chunk_matches + k);
+	tb_batch.breakpoints = (int *) R_alloc(INTERLEAVE_BATCH_SIZE + 1,
+					       sizeof(int));
+	tb_batch.cursors = (int *) R_alloc(INTERLEAVE_BATCH_SIZE,
+					   sizeof(int));
+	tb_batch.P_ids = new_IntAE(0, 0, 0);
+	tb_batch.ends = new_IntAE(0, 0, 0);
+	return tb_batch;
+}
+
+static void free_TBBatch_chunk_matches(TBBatch *tb_batch)
+{
+	int k;
+
+	for (k = 0; k < tb_batch->max_nchunk; k++)
+		_free_TBBatchMatches(tb_batch->chunk_matches + k);
+	return;
+}
+
+static void walk_TBBatch(TBBatch *tb_batch, SEXP pptb,
+		const XStringSet_holder *S, int S_length, int offset)
+{
+	int nS, k, nwalked, nchunk;
+
+	nS = S_length - offset;
+	if (nS > INTERLEAVE_BATCH_SIZE)
+		nS = INTERLEAVE_BATCH_SIZE;
+	nwalked = 0;
+	for (k = 0; k < nS; k++) {
+		tb_batch->S[k] = _get_elt_from_XStringSet_holder(S, offset + k);
+		if (tb_batch->S[k].length >= INTERLEAVE_MAX_SUBJECT_LENGTH)
+			tb_batch->S[k].length = 0;  /* left out */
+		else
+			nwalked++;
+	}
+	if (nwalked != 0 && !tb_batch->is_prepared) {
+		_prepare_tbACtree2_interleaved(pptb);
+		tb_batch->is_prepared = 1;
+	}
+	nchunk = nS / MIN_SUBJECTS_PER_CHUNK;
+	if (nchunk > tb_batch->max_nchunk)
+		nchunk = tb_batch->max_nchunk;
+	if (nchunk < 1)
+		nchunk = 1;
+	_match_tbACtree2_interleaved(pptb, tb_batch->S, nS,
+			tb_batch->chunk_matches, nchunk);
+	for (k = 0; k < nchunk; k++) {
+		if (tb_batch->chunk_matches[k].malloc_failed) {
+			free_TBBatch_chunk_matches(tb_batch);
+			error("walk_TBBatch(): memory allocation failed");
+		}
+	}
+	tb_batch->offset = offset;
+	tb_batch->nS = nS;
+	tb_batch->nchunk = nchunk;
+	return;
+}
+
+/*
+ * Group the matches of the batch by subject (the order of the matches of a
+ * given subject is preserved). The matches are first moved to R_alloc'ed
+ * memory and the chunk buffers are freed, because growing 'P_ids' and
+ * 'ends' can raise an error.
+ */
+static void group_TBBatch_matches(TBBatch *tb_batch)
+{
+	int nmatch, k, i, pos, *S_ids, *P_ids, *ends;
+	const TBBatchMatches *matches;
+	const void *vmax;
+
+	nmatch = 0;
+	for (k = 0; k < tb_batch->nchunk; k++)
+		nmatch += tb_batch->chunk_matches[k].nelt;
+	vmax = vmaxget();
+	S_ids = P_ids = ends = NULL;
+	if (nmatch != 0) {
+		S_ids = (int *) R_alloc(nmatch, sizeof(int));
+		P_ids = (int *) R_alloc(nmatch, sizeof(int));
+		ends = (int *) R_alloc(nmatch, sizeof(int));
+	}
+	for (k = 0, i = 0; k < tb_batch->nchunk; k++) {
+		matches = tb_batch->chunk_matches + k;
+		if (matches->nelt == 0)
+			continue;
+		memcpy(S_ids + i, matches->S_ids, sizeof(int) * matches->nelt);
+		memcpy(P_ids + i, matches->P_ids, sizeof(int) * matches->nelt);
+		memcpy(ends + i, matches->ends, sizeof(int) * matches->nelt);
+		i += matches->nelt;
+	}
+	free_TBBatch_chunk_matches(tb_batch);
+
+	memset(tb_batch->breakpoints, 0, sizeof(int) * (tb_batch->nS + 1));
+	for (i = 0; i < nmatch; i++)
+		tb_batch->breakpoints[S_ids[i] + 1]++;
+	for (k = 0; k < tb_batch->nS; k++) {
+		tb_batch->breakpoints[k + 1] += tb_batch->breakpoints[k];
+		tb_batch->cursors[k] = tb_batch->breakpoints[k];
+	}
+	if (nmatch > tb_batch->P_ids->_buflength) {
+		IntAE_extend(tb_batch->P_ids, nmatch);
+		IntAE_extend(tb_batch->ends, nmatch);
+	}
+	IntAE_set_nelt(tb_batch->P_ids, nmatch);
+	IntAE_set_nelt(tb_batch->ends, nmatch);
+	for (i = 0; i < nmatch; i++) {
+		pos = tb_batch->cursors[S_ids[i]]++;
+		tb_batch->P_ids->elts[pos] = P_ids[i];
+		tb_batch->ends->elts[pos] = ends[i];
+	}
+	vmaxset(vmax);
+	return;
+}
+
+/* Same as match_pdict() on the j-th subject */
+static void match_pdict_elt(TBBatch *tb_batch, SEXP pptb, HeadTail *headtail,
+		const XStringSet_holder *S, int S_length, int j,
+		SEXP max_mismatch, SEXP min_mismatch, SEXP fixed,
+		MatchPDictBuf *matchpdict_buf)
+{
+	Chars_holder S_elt;
+	int k, i;
+
+	S_elt = _get_elt_from_XStringSet_holder(S, j);
+	if (!tb_batch->is_on ||
+	    S_elt.length >= INTERLEAVE_MAX_SUBJECT_LENGTH) {
+		match_pdict(pptb, headtail, &S_elt,
+			    max_mismatch, min_mismatch, fixed,
+			    matchpdict_buf);
+		return;
+	}
+	k = j - tb_batch->offset;
+	if (k < 0 || k >= tb_batch->nS) {
+		walk_TBBatch(tb_batch, pptb, S, S_length, j);
+		group_TBBatch_matches(tb_batch);
+		k = 0;
+	}
+	for (i = tb_batch->breakpoints[k]; i < tb_batch->breakpoints[k + 1]; i++)
+		_TBMatchBuf_report_match(&(matchpdict_buf->tb_matches),
+					 tb_batch->P_ids->elts[i],
+					 tb_batch->ends->elts[i]);
+	_match_pdict_all_flanks(_get_PreprocessedTB_low2high(pptb), headtail,
+		&S_elt, INTEGER(max_mismatch)[0], INTEGER(min_mismatch)[0],
+		LOGICAL(fixed)[0], LOGICAL(fixed)[1], matchpdict_buf);
+	return;
+}
+
 
 /****************************************************************************
  * Helper functions for the vcount_*_XStringSet all() functions.
@@ -145,15 +367,29 @@ static void update_vcount_collapsed_ans(SEXP ans,
  *     - min_mismatch: min.mismatch (min nb of mismatches *outside* the TB);
  *     - fixed: logical vector of length 2;
  *     - matches_as: "MATCHES_AS_NULL", "MATCHES_AS_WHICH",
- *         "MATCHES_AS_COUNTS" or "MATCHES_AS_ENDS";
- *     - envir: NULL or environment to be populated with the matches.
+ *         "MATCHES_AS_COUNTS", "MATCHES_AS_ENDS" or "MATCHES_AS_COVERAGE";
+ *     - envir: NULL or environment to be populated with the matches;
+ *   o match_PDict3Parts_XString() only:
+ *     - coverage_weight: NULL or integer vector with 1 weight per pattern
+ *         (only used when 'matches_as' is "MATCHES_AS_COVERAGE").
  */
 
+static void set_coverage_weights(MatchPDictBuf *matchpdict_buf,
+		SEXP coverage_weight)
+{
+	if (coverage_weight == R_NilValue
+	 || matchpdict_buf->tb_matches.is_init == 0)
+		return;
+	_MatchBuf_set_coverage_weights(&(matchpdict_buf->matches),
+				       INTEGER(coverage_weight));
+	return;
+}
+
 /* --- .Call ENTRY POINT --- */
 SEXP match_PDict3Parts_XString(SEXP pptb, SEXP pdict_head, SEXP pdict_tail,
 		SEXP subject,
 		SEXP max_mismatch, SEXP min_mismatch, SEXP fixed,
-		SEXP matches_as, SEXP envir)
+		SEXP matches_as, SEXP envir, SEXP coverage_weight)
 {
 	HeadTail headtail;
 	Chars_holder S;
@@ -164,6 +400,7 @@ SEXP match_PDict3Parts_XString(SEXP pptb, SEXP pdict_head, SEXP pdict_tail,
 	S = hold_XRaw(subject);
 	matchpdict_buf = new_MatchPDictBuf_from_PDict3Parts(matches_as,
 				pptb, pdict_head, pdict_tail);
+	set_coverage_weights(&matchpdict_buf, coverage_weight);
 	match_pdict(pptb, &headtail,
 		&S, max_mismatch, min_mismatch, fixed,
 		&matchpdict_buf);
@@ -181,21 +418,22 @@ SEXP match_XStringSet_XString(SEXP pattern,
 	int P_length, i;
 	Chars_holder S, P_elt;
 	const char *algo, *ms_mode;
+	MatchReporter reporter;
 
 	P = _hold_XStringSet(pattern);
 	P_length = _get_length_from_XStringSet_holder(&P);
 	S = hold_XRaw(subject);
 	algo = CHAR(STRING_ELT(algorithm, 0));
 	ms_mode = CHAR(STRING_ELT(matches_as, 0));
-	_init_match_reporting(ms_mode, P_length);
+	reporter = _new_MatchReporter(ms_mode, P_length);
 	for (i = 0; i < P_length; i++) {
 		P_elt = _get_elt_from_XStringSet_holder(&P, i);
-		_set_active_PSpair(i);
+		_MatchReporter_set_active_PSpair(&reporter, i);
 		_match_pattern_XString(&P_elt, &S,
 			max_mismatch, min_mismatch, with_indels, fixed,
-			algo);
+			algo, &reporter);
 	}
-	return _MatchBuf_as_SEXP(_get_internal_match_buf(), envir);
+	return _MatchBuf_as_SEXP(&(reporter.match_buf), envir);
 }
 
 
@@ -217,15 +455,21 @@ SEXP match_XStringSet_XString(SEXP pattern,
  *     - min_mismatch: min.mismatch (min nb of mismatches *outside* the TB);
  *     - fixed: logical vector of length 2;
  *     - matches_as: "MATCHES_AS_NULL", "MATCHES_AS_WHICH",
- *         "MATCHES_AS_COUNTS" or "MATCHES_AS_ENDS";
- *     - envir: NULL or environment to be populated with the matches.
+ *         "MATCHES_AS_COUNTS", "MATCHES_AS_ENDS" or "MATCHES_AS_COVERAGE";
+ *     - envir: NULL or environment to be populated with the matches;
+ *   o match_PDict3Parts_XStringViews() only:
+ *     - coverage_weight: NULL or integer vector with 1 weight per pattern
+ *         (only used when 'matches_as' is "MATCHES_AS_COVERAGE").
+ * In "MATCHES_AS_COVERAGE" mode, the parts of the matches that are before
+ * the 1st position of the subject are dropped (like with coverage() on the
+ * matches).
  */
 
 /* --- .Call ENTRY POINT --- */
 SEXP match_PDict3Parts_XStringViews(SEXP pptb, SEXP pdict_head, SEXP pdict_tail,
 		SEXP subject, SEXP views_start, SEXP views_width,
 		SEXP max_mismatch, SEXP min_mismatch, SEXP fixed,
-		SEXP matches_as, SEXP envir)
+		SEXP matches_as, SEXP envir, SEXP coverage_weight)
 {
 	HeadTail headtail;
 	int tb_length;
@@ -240,6 +484,7 @@ SEXP match_PDict3Parts_XStringViews(SEXP pptb, SEXP pdict_head, SEXP pdict_tail,
 	S = hold_XRaw(subject);
 	matchpdict_buf = new_MatchPDictBuf_from_PDict3Parts(matches_as,
 				pptb, pdict_head, pdict_tail);
+	set_coverage_weights(&matchpdict_buf, coverage_weight);
 	global_match_buf = _new_MatchBuf(matchpdict_buf.matches.ms_code,
 				tb_length);
 	nviews = LENGTH(views_start);
@@ -254,6 +499,8 @@ SEXP match_PDict3Parts_XStringViews(SEXP pptb, SEXP pdict_head, SEXP pdict_tail,
 			error("'subject' has \"out of limits\" views");
 		S_view.ptr = S.ptr + view_offset;
 		S_view.length = *view_width;
+		_MatchBuf_set_coverage_shift(&(matchpdict_buf.matches),
+					     view_offset);
 		match_pdict(pptb, &headtail, &S_view,
 			    max_mismatch, min_mismatch, fixed,
 			    &matchpdict_buf);
@@ -274,22 +521,171 @@ SEXP match_XStringSet_XStringViews(SEXP pattern,
 	int P_length, i;
 	Chars_holder S, P_elt;
 	const char *algo, *ms_mode;
+	MatchReporter reporter;
 
 	P = _hold_XStringSet(pattern);
 	P_length = _get_length_from_XStringSet_holder(&P);
 	S = hold_XRaw(subject);
 	algo = CHAR(STRING_ELT(algorithm, 0));
 	ms_mode = CHAR(STRING_ELT(matches_as, 0));
-	_init_match_reporting(ms_mode, P_length);
+	reporter = _new_MatchReporter(ms_mode, P_length);
 	for (i = 0; i < P_length; i++) {
 		P_elt = _get_elt_from_XStringSet_holder(&P, i);
-		_set_active_PSpair(i);
+		_MatchReporter_set_active_PSpair(&reporter, i);
 		_match_pattern_XStringViews(&P_elt,
 			&S, views_start, views_width,
 			max_mismatch, min_mismatch, with_indels, fixed,
-			algo);
+			algo, &reporter);
 	}
-	return _MatchBuf_as_SEXP(_get_internal_match_buf(), envir);
+	return _MatchBuf_as_SEXP(&(reporter.match_buf), envir);
+}
+
+
+/****************************************************************************
+ * .Call entry points: stream_PDict3Parts_XStringViews()
+ *                     stream_XStringSet_XStringViews()
+ *
+ * Same as match_PDict3Parts_XStringViews() and
+ * match_XStringSet_XStringViews() except that 'matches_as' and 'envir' are
+ * replaced by:
+ *   o stream_PDict3Parts_XStringViews() only:
+ *     - low2high: NULL or list with 1 elt per pattern, the elt for a pattern
+ *         that is not a duplicate being NULL or the (1-based) indices of its
+ *         duplicates (those are not matched but their matches are the same
+ *         as the matches of the pattern);
+ *   o common arguments:
+ *     - sink, batch_size, seqname, names: see _new_MatchSink_from_SEXP().
+ * The matches are sent to the sink in batches. The match counts are
+ * returned (the duplicates get a count of 0).
+ * Note that with a PDict object, the matches of the Trusted Band are still
+ * stored for each view before the head and tail are checked.
+ */
+
+typedef struct dups_sink {
+	MatchSink *sink;
+	SEXP low2high;
+} DupsSink;
+
+/* MatchSink consumer that passes the matches to another MatchSink after
+   adding the matches of the duplicates. */
+static void add_matches_of_dups(void *sink_data, const int *PSpair_ids,
+		const int *starts, const int *widths, int nmatch)
+{
+	const DupsSink *dups_sink;
+	int i, j, nelt;
+	SEXP dups;
+
+	dups_sink = (const DupsSink *) sink_data;
+	for (i = 0; i < nmatch; i++) {
+		_MatchSink_report_match(dups_sink->sink,
+				PSpair_ids[i], starts[i], widths[i]);
+		dups = VECTOR_ELT(dups_sink->low2high, PSpair_ids[i]);
+		if (dups == R_NilValue)
+			continue;
+		nelt = LENGTH(dups);
+		for (j = 0; j < nelt; j++)
+			_MatchSink_report_match(dups_sink->sink,
+				INTEGER(dups)[j] - 1, starts[i], widths[i]);
+	}
+	return;
+}
+
+/* --- .Call ENTRY POINT --- */
+SEXP stream_PDict3Parts_XStringViews(SEXP pptb,
+		SEXP pdict_head, SEXP pdict_tail,
+		SEXP subject, SEXP views_start, SEXP views_width,
+		SEXP max_mismatch, SEXP min_mismatch, SEXP fixed,
+		SEXP low2high, SEXP sink, SEXP batch_size,
+		SEXP seqname, SEXP names)
+{
+	HeadTail headtail;
+	int tb_length;
+	Chars_holder S, S_view;
+	int nviews, v, *view_start, *view_width, view_offset;
+	MatchPDictBuf matchpdict_buf;
+	MatchBuf global_match_buf;
+	MatchSink match_sink, user_sink;
+	DupsSink dups_sink;
+	SEXP matches_as;
+
+	tb_length = _get_PreprocessedTB_length(pptb);
+	headtail = _new_HeadTail(pdict_head, pdict_tail, pptb,
+				max_mismatch, fixed, 1);
+	S = hold_XRaw(subject);
+	PROTECT(matches_as = mkString("MATCHES_AS_COUNTS"));
+	matchpdict_buf = new_MatchPDictBuf_from_PDict3Parts(matches_as,
+				pptb, pdict_head, pdict_tail);
+	global_match_buf = _new_MatchBuf(MATCHES_AS_COUNTS, tb_length);
+	user_sink = _new_MatchSink_from_SEXP(sink, batch_size,
+					     seqname, S.length, names);
+	if (low2high == R_NilValue) {
+		match_sink = user_sink;
+	} else {
+		dups_sink.sink = &user_sink;
+		dups_sink.low2high = low2high;
+		match_sink = _new_MatchSink(add_matches_of_dups,
+				(void *) &dups_sink, INTEGER(batch_size)[0]);
+	}
+	matchpdict_buf.matches.sink = &match_sink;
+	nviews = LENGTH(views_start);
+	for (v = 0,
+	     view_start = INTEGER(views_start),
+	     view_width = INTEGER(views_width);
+	     v < nviews;
+	     v++, view_start++, view_width++)
+	{
+		view_offset = *view_start - 1;
+		if (view_offset < 0 || view_offset + *view_width > S.length)
+			error("'subject' has \"out of limits\" views");
+		S_view.ptr = S.ptr + view_offset;
+		S_view.length = *view_width;
+		_MatchSink_set_match_shift(&match_sink, view_offset);
+		match_pdict(pptb, &headtail, &S_view,
+			    max_mismatch, min_mismatch, fixed,
+			    &matchpdict_buf);
+		_MatchPDictBuf_append_and_flush(&global_match_buf,
+			&matchpdict_buf, view_offset);
+	}
+	_MatchSink_flush(&match_sink);
+	if (low2high != R_NilValue)
+		_MatchSink_flush(&user_sink);
+	UNPROTECT(1);
+	return _MatchBuf_counts_asINTEGER(&global_match_buf);
+}
+
+/* --- .Call ENTRY POINT --- */
+SEXP stream_XStringSet_XStringViews(SEXP pattern,
+		SEXP subject, SEXP views_start, SEXP views_width,
+		SEXP max_mismatch, SEXP min_mismatch,
+		SEXP with_indels, SEXP fixed,
+		SEXP algorithm, SEXP sink, SEXP batch_size,
+		SEXP seqname, SEXP names)
+{
+	XStringSet_holder P;
+	int P_length, i;
+	Chars_holder S, P_elt;
+	const char *algo;
+	MatchReporter reporter;
+	MatchSink match_sink;
+
+	P = _hold_XStringSet(pattern);
+	P_length = _get_length_from_XStringSet_holder(&P);
+	S = hold_XRaw(subject);
+	algo = CHAR(STRING_ELT(algorithm, 0));
+	reporter = _new_MatchReporter("MATCHES_AS_COUNTS", P_length);
+	match_sink = _new_MatchSink_from_SEXP(sink, batch_size,
+					      seqname, S.length, names);
+	_MatchReporter_set_sink(&reporter, &match_sink);
+	for (i = 0; i < P_length; i++) {
+		P_elt = _get_elt_from_XStringSet_holder(&P, i);
+		_MatchReporter_set_active_PSpair(&reporter, i);
+		_match_pattern_XStringViews(&P_elt,
+			&S, views_start, views_width,
+			max_mismatch, min_mismatch, with_indels, fixed,
+			algo, &reporter);
+	}
+	_MatchSink_flush(&match_sink);
+	return _MatchBuf_counts_asINTEGER(&(reporter.match_buf));
 }
 
 
@@ -317,7 +713,8 @@ SEXP match_XStringSet_XStringViews(SEXP pattern,
  *     - envir: NULL or environment to be populated with the matches.
  */
 
-static SEXP vwhich_PDict3Parts_XStringSet(SEXP pptb, HeadTail *headtail,
+static SEXP vwhich_PDict3Parts_XStringSet(TBBatch *tb_batch,
+		SEXP pptb, HeadTail *headtail,
 		SEXP subject,
 		SEXP max_mismatch, SEXP min_mismatch, SEXP fixed,
 		MatchPDictBuf *matchpdict_buf)
@@ -325,16 +722,14 @@ static SEXP vwhich_PDict3Parts_XStringSet(SEXP pptb, HeadTail *headtail,
 	int S_length, j;
 	XStringSet_holder S;
 	SEXP ans, ans_elt;
-	Chars_holder S_elt;
 
 	S = _hold_XStringSet(subject);
 	S_length = _get_length_from_XStringSet_holder(&S);
 	PROTECT(ans = NEW_LIST(S_length));
 	for (j = 0; j < S_length; j++) {
-		S_elt = _get_elt_from_XStringSet_holder(&S, j);
-		match_pdict(pptb, headtail, &S_elt,
-			    max_mismatch, min_mismatch, fixed,
-			    matchpdict_buf);
+		match_pdict_elt(tb_batch, pptb, headtail, &S, S_length, j,
+				max_mismatch, min_mismatch, fixed,
+				matchpdict_buf);
 		PROTECT(ans_elt = _MatchBuf_which_asINTEGER(
 					&(matchpdict_buf->matches)));
 		SET_ELEMENT(ans, j, ans_elt);
@@ -356,6 +751,7 @@ static SEXP vwhich_XStringSet_XStringSet(SEXP pattern,
 	Chars_holder P_elt, S_elt;
 	const char *algo;
 	IntAEAE *ans_buf;
+	MatchReporter reporter;
 
 	P = _hold_XStringSet(pattern);
 	P_length = _get_length_from_XStringSet_holder(&P);
@@ -365,35 +761,243 @@ static SEXP vwhich_XStringSet_XStringSet(SEXP pattern,
 	ans_buf = new_IntAEAE(S_length, S_length);
 	for (j = 0; j < S_length; j++)
 		IntAE_set_nelt(ans_buf->elts[j], 0);
-	_init_match_reporting("MATCHES_AS_COUNTS", 1);
+	reporter = _new_MatchReporter("MATCHES_AS_COUNTS", 1);
 	for (i = 0; i < P_length; i++) {
 		P_elt = _get_elt_from_XStringSet_holder(&P, i);
 		for (j = 0; j < S_length; j++) {
 			S_elt = _get_elt_from_XStringSet_holder(&S, j);
 			_match_pattern_XString(&P_elt, &S_elt,
 				max_mismatch, min_mismatch, with_indels, fixed,
-				algo);
-			if (_get_match_count() != 0)
+				algo, &reporter);
+			if (_MatchReporter_get_match_count(&reporter) != 0)
 				IntAE_insert_at(ans_buf->elts[j],
 					IntAE_get_nelt(ans_buf->elts[j]),
 					i + 1);
-			_drop_reported_matches();
+			_MatchReporter_drop_reported_matches(&reporter);
 		}
 	}
 	return new_LIST_from_IntAEAE(ans_buf, 0);
 }
 
-static SEXP vcount_PDict3Parts_XStringSet(SEXP pptb, HeadTail *headtail,
+/* Adds the counts of the j-th subject to 'ans' */
+static void add_vcount_col(SEXP ans, const IntAE *count_buf, int j,
+		int collapse, SEXP weight)
+{
+	int tb_length, i;
+
+	/* 'IntAE_get_nelt(count_buf)' is 'tb_length' */
+	tb_length = IntAE_get_nelt(count_buf);
+	if (collapse == 0) {
+		memcpy(INTEGER(ans) + (size_t) j * tb_length, count_buf->elts,
+		       sizeof(int) * tb_length);
+		return;
+	}
+	for (i = 0; i < tb_length; i++)
+		update_vcount_collapsed_ans(ans, count_buf->elts[i], i, j,
+					    collapse, weight);
+	return;
+}
+
+/*
+ * When the PDict has no head and no tail, the counts of a subject are just
+ * the nb of matches of the Trusted Band (plus the counts of the duplicated
+ * patterns, which are copied from the pattern they are a duplicate of).
+ * Then the counts are computed from the TBBatchMatches buffers directly,
+ * in the worker threads: each thread writes to the columns of its own
+ * subjects (collapse=FALSE), or to its own row of 'sums' (collapse=1), or
+ * to the sums of its own subjects (collapse=2). 'weights' is 'weight' as
+ * doubles, with the weights of the duplicated patterns added to the weight
+ * of the pattern they are a duplicate of when collapse=2.
+ */
+typedef struct vcount_tb_ctx {
+	int tb_length;
+	int collapse;
+	int ndup;
+	const int *dup_ids, *dup_low_ids;
+	int *count_mat;
+	const double *weights;
+	double *sums;
+} VcountTBCtx;
+
+/* Must NOT call any function of the R API. */
+static void count_TBBatchMatches(const VcountTBCtx *ctx, int offset,
+		const TBBatchMatches *matches, int k)
+{
+	int j, d, *col;
+	size_t i;
+	double *acc;
+
+	switch (ctx->collapse) {
+	    case 0:
+		for (j = matches->S_from; j < matches->S_to; j++) {
+			col = ctx->count_mat +
+			      (size_t) (offset + j) * ctx->tb_length;
+			memset(col, 0, sizeof(int) * ctx->tb_length);
+		}
+		for (i = 0; i < matches->nelt; i++) {
+			col = ctx->count_mat +
+			      (size_t) (offset + matches->S_ids[i]) *
+			      ctx->tb_length;
+			col[matches->P_ids[i]]++;
+		}
+		for (j = matches->S_from; j < matches->S_to; j++) {
+			col = ctx->count_mat +
+			      (size_t) (offset + j) * ctx->tb_length;
+			for (d = 0; d < ctx->ndup; d++)
+				col[ctx->dup_ids[d]] = col[ctx->dup_low_ids[d]];
+		}
+		break;
+	    case 1:
+		acc = ctx->sums + (size_t) k * ctx->tb_length;
+		for (i = 0; i < matches->nelt; i++)
+			acc[matches->P_ids[i]] +=
+				ctx->weights[offset +
+					     matches->S_ids[i]];
+		break;
+	    case 2:
+		for (j = matches->S_from; j < matches->S_to; j++)
+			ctx->sums[j] = 0.0;
+		for (i = 0; i < matches->nelt; i++)
+			ctx->sums[matches->S_ids[i]] +=
+				ctx->weights[matches->P_ids[i]];
+		break;
+	}
+	return;
+}
+
+static void add_to_vcount_collapsed_ans(SEXP ans, int i, double x)
+{
+	if (IS_INTEGER(ans))
+		INTEGER(ans)[i] += (int) x;
+	else
+		REAL(ans)[i] += x;
+	return;
+}
+
+static void init_VcountTBCtx(VcountTBCtx *ctx, const TBBatch *tb_batch,
+		SEXP pptb, SEXP ans, int collapse, SEXP weight)
+{
+	int tb_length, weight_length, ndup, i, n, d, *dup_ids, *dup_low_ids;
+	SEXP low2high, dups;
+	double *weights;
+	size_t sums_length, k;
+
+	tb_length = _get_PreprocessedTB_length(pptb);
+	low2high = _get_PreprocessedTB_low2high(pptb);
+	ndup = 0;
+	for (i = 0; i < tb_length; i++) {
+		dups = VECTOR_ELT(low2high, i);
+		if (dups != R_NilValue)
+			ndup += LENGTH(dups);
+	}
+	dup_ids = (int *) R_alloc(ndup, sizeof(int));
+	dup_low_ids = (int *) R_alloc(ndup, sizeof(int));
+	for (i = d = 0; i < tb_length; i++) {
+		dups = VECTOR_ELT(low2high, i);
+		if (dups == R_NilValue)
+			continue;
+		for (n = 0; n < LENGTH(dups); n++, d++) {
+			dup_ids[d] = INTEGER(dups)[n] - 1;
+			dup_low_ids[d] = i;
+		}
+	}
+	ctx->tb_length = tb_length;
+	ctx->collapse = collapse;
+	ctx->ndup = ndup;
+	ctx->dup_ids = dup_ids;
+	ctx->dup_low_ids = dup_low_ids;
+	ctx->count_mat = collapse == 0 ? INTEGER(ans) : NULL;
+	ctx->weights = NULL;
+	ctx->sums = NULL;
+	if (collapse == 0)
+		return;
+	weight_length = LENGTH(weight);
+	weights = (double *) R_alloc(weight_length, sizeof(double));
+	for (i = 0; i < weight_length; i++)
+		weights[i] = IS_INTEGER(weight) ? (double) INTEGER(weight)[i]
+						: REAL(weight)[i];
+	if (collapse == 1) {
+		/* 1 row of 'tb_length' sums per chunk */
+		sums_length = (size_t) tb_batch->max_nchunk * tb_length;
+		ctx->sums = (double *) R_alloc(sums_length, sizeof(double));
+		for (k = 0; k < sums_length; k++)
+			ctx->sums[k] = 0.0;
+	} else {
+		for (d = 0; d < ndup; d++)
+			weights[dup_low_ids[d]] += weights[dup_ids[d]];
+		ctx->sums = (double *) R_alloc(INTERLEAVE_BATCH_SIZE,
+					       sizeof(double));
+	}
+	ctx->weights = weights;
+	return;
+}
+
+static void vcount_tb_only(TBBatch *tb_batch, SEXP pptb, HeadTail *headtail,
+		const XStringSet_holder *S, int S_length,
+		SEXP max_mismatch, SEXP min_mismatch, SEXP fixed,
+		SEXP ans, int collapse, SEXP weight,
+		MatchPDictBuf *matchpdict_buf)
+{
+	VcountTBCtx ctx;
+	int offset, nchunk, k, i, d;
+	Chars_holder S_elt;
+
+	init_VcountTBCtx(&ctx, tb_batch, pptb, ans, collapse, weight);
+	for (offset = 0; offset < S_length; offset += tb_batch->nS) {
+		walk_TBBatch(tb_batch, pptb, S, S_length, offset);
+		nchunk = tb_batch->nchunk;
+#ifdef _OPENMP
+		#pragma omp parallel for num_threads(nchunk) schedule(static, 1)
+#endif
+		for (k = 0; k < nchunk; k++)
+			count_TBBatchMatches(&ctx, offset,
+					     tb_batch->chunk_matches + k, k);
+		free_TBBatch_chunk_matches(tb_batch);
+		if (collapse == 2) {
+			for (k = 0; k < tb_batch->nS; k++)
+				add_to_vcount_collapsed_ans(ans, offset + k,
+							    ctx.sums[k]);
+		}
+		/* The subjects left out of the batch */
+		for (k = 0; k < tb_batch->nS; k++) {
+			S_elt = _get_elt_from_XStringSet_holder(S, offset + k);
+			if (S_elt.length < INTERLEAVE_MAX_SUBJECT_LENGTH)
+				continue;
+			match_pdict(pptb, headtail, &S_elt,
+				    max_mismatch, min_mismatch, fixed,
+				    matchpdict_buf);
+			add_vcount_col(ans, matchpdict_buf->matches.match_counts,
+				       offset + k, collapse, weight);
+			_MatchPDictBuf_flush(matchpdict_buf);
+		}
+	}
+	if (collapse != 1)
+		return;
+	for (k = 0; k < tb_batch->max_nchunk; k++)
+		for (i = 0; i < ctx.tb_length; i++)
+			add_to_vcount_collapsed_ans(ans, i,
+				ctx.sums[(size_t) k * ctx.tb_length + i]);
+	for (d = 0; d < ctx.ndup; d++) {
+		if (IS_INTEGER(ans))
+			INTEGER(ans)[ctx.dup_ids[d]] =
+				INTEGER(ans)[ctx.dup_low_ids[d]];
+		else
+			REAL(ans)[ctx.dup_ids[d]] =
+				REAL(ans)[ctx.dup_low_ids[d]];
+	}
+	return;
+}
+
+static SEXP vcount_PDict3Parts_XStringSet(TBBatch *tb_batch,
+		SEXP pptb, HeadTail *headtail,
 		SEXP subject,
 		SEXP max_mismatch, SEXP min_mismatch, SEXP fixed,
 		SEXP collapse, SEXP weight,
 		MatchPDictBuf *matchpdict_buf)
 {
-	int tb_length, S_length, collapse0, i, j, match_count, *ans_col;
+	int tb_length, S_length, collapse0, j;
 	XStringSet_holder S;
 	SEXP ans;
-	Chars_holder S_elt;
-	const IntAE *count_buf;
 
 	tb_length = _get_PreprocessedTB_length(pptb);
 	S = _hold_XStringSet(subject);
@@ -401,31 +1005,25 @@ static SEXP vcount_PDict3Parts_XStringSet(SEXP pptb, HeadTail *headtail,
 	collapse0 = INTEGER(collapse)[0];
 	if (collapse0 == 0) {
 		PROTECT(ans = allocMatrix(INTSXP, tb_length, S_length));
-		ans_col = INTEGER(ans);
 	} else {
 		PROTECT(ans = init_vcount_collapsed_ans(tb_length, S_length,
 					collapse0, weight));
 	}
-	for (j = 0; j < S_length; j++) {
-		S_elt = _get_elt_from_XStringSet_holder(&S, j);
-		match_pdict(pptb, headtail, &S_elt,
-			max_mismatch, min_mismatch, fixed,
-			matchpdict_buf);
-		count_buf = matchpdict_buf->matches.match_counts;
-		/* 'IntAE_get_nelt(count_buf)' is 'tb_length' */
-		if (collapse0 == 0) {
-			memcpy(ans_col, count_buf->elts,
-				sizeof(int) * tb_length);
-			ans_col += tb_length;
-		} else {
-			for (i = 0; i < tb_length; i++) {
-				match_count = count_buf->elts[i];
-				update_vcount_collapsed_ans(ans,
-					match_count, i, j,
-					collapse0, weight);
-			}
+	if (tb_batch->is_on && headtail->max_HTwidth == 0
+	 && INTEGER(min_mismatch)[0] == 0) {
+		vcount_tb_only(tb_batch, pptb, headtail, &S, S_length,
+			       max_mismatch, min_mismatch, fixed,
+			       ans, collapse0, weight,
+			       matchpdict_buf);
+	} else {
+		for (j = 0; j < S_length; j++) {
+			match_pdict_elt(tb_batch, pptb, headtail, &S, S_length, j,
+					max_mismatch, min_mismatch, fixed,
+					matchpdict_buf);
+			add_vcount_col(ans, matchpdict_buf->matches.match_counts,
+				       j, collapse0, weight);
+			_MatchPDictBuf_flush(matchpdict_buf);
 		}
-		_MatchPDictBuf_flush(matchpdict_buf);
 	}
 	UNPROTECT(1);
 	return ans;
@@ -442,6 +1040,7 @@ static SEXP vcount_XStringSet_XStringSet(SEXP pattern,
 	const char *algo;
 	SEXP ans;
 	Chars_holder P_elt, S_elt;
+	MatchReporter reporter;
 
 	P = _hold_XStringSet(pattern);
 	P_length = _get_length_from_XStringSet_holder(&P);
@@ -454,7 +1053,7 @@ static SEXP vcount_XStringSet_XStringSet(SEXP pattern,
 	else
 		PROTECT(ans = init_vcount_collapsed_ans(P_length, S_length,
 					collapse0, weight));
-	_init_match_reporting("MATCHES_AS_COUNTS", 1);
+	reporter = _new_MatchReporter("MATCHES_AS_COUNTS", 1);
 	for (i = 0; i < P_length; i++) {
 		P_elt = _get_elt_from_XStringSet_holder(&P, i);
 		if (collapse0 == 0)
@@ -463,8 +1062,8 @@ static SEXP vcount_XStringSet_XStringSet(SEXP pattern,
 			S_elt = _get_elt_from_XStringSet_holder(&S, j);
 			_match_pattern_XString(&P_elt, &S_elt,
 				max_mismatch, min_mismatch, with_indels, fixed,
-				algo);
-			match_count = _get_match_count();
+				algo, &reporter);
+			match_count = _MatchReporter_get_match_count(&reporter);
 			if (collapse0 == 0) {
 				*ans_elt = match_count;
 				ans_elt += P_length;
@@ -473,7 +1072,7 @@ static SEXP vcount_XStringSet_XStringSet(SEXP pattern,
 					match_count, i, j,
 					collapse0, weight);
 			}
-			_drop_reported_matches();
+			_MatchReporter_drop_reported_matches(&reporter);
 		}
 	}
 	UNPROTECT(1);
@@ -489,6 +1088,7 @@ SEXP vmatch_PDict3Parts_XStringSet(SEXP pptb, SEXP pdict_head, SEXP pdict_tail,
 {
 	HeadTail headtail;
 	MatchPDictBuf matchpdict_buf;
+	TBBatch tb_batch;
 
 	headtail = _new_HeadTail(pdict_head, pdict_tail, pptb,
 				max_mismatch, fixed, 1);
@@ -500,12 +1100,16 @@ SEXP vmatch_PDict3Parts_XStringSet(SEXP pptb, SEXP pdict_head, SEXP pdict_tail,
 		      "'matches_as=\"%s\"' yet, sorry",
 		      CHAR(STRING_ELT(matches_as, 0)));
 	    case MATCHES_AS_WHICH:
-		return vwhich_PDict3Parts_XStringSet(pptb, &headtail,
+		tb_batch = new_TBBatch(pptb, fixed);
+		return vwhich_PDict3Parts_XStringSet(&tb_batch,
+				pptb, &headtail,
 				subject,
 				max_mismatch, min_mismatch, fixed,
 				&matchpdict_buf);
 	    case MATCHES_AS_COUNTS:
-		return vcount_PDict3Parts_XStringSet(pptb, &headtail,
+		tb_batch = new_TBBatch(pptb, fixed);
+		return vcount_PDict3Parts_XStringSet(&tb_batch,
+				pptb, &headtail,
 				subject,
 				max_mismatch, min_mismatch, fixed,
 				collapse, weight,
@@ -7,8 +7,13 @@
 #include "Biostrings.h"
 #include "IRanges_interface.h"
 
-#include <stdlib.h> /* for div() */
+#include <stdlib.h> /* for div(), malloc(), realloc() and free() */
 #include <limits.h> /* for UINT_MAX */
+#include <string.h> /* for memset(), memcpy() and strcmp() */
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 
 /*
@@ -394,6 +399,19 @@ static unsigned int new_eid(ACnodeextBuf *buf)
 /* result of NODE_P_ID() is undefined on a non-leaf node */
 #define NODE_P_ID(node) ((node)->attribs & MAX_P_ID)
 
+/*
+ * A "frozen" tree is a dense DFA over the 4 bases that is computed from the
+ * tree once all the failure links are known (see freeze_ACtree() below).
+ * The states are the nodes of the tree renumbered in BFS order so the leaf
+ * nodes (which are all at depth TREE_DEPTH) are the last states. The
+ * transitions from state s are in trans[4 * s], ..., trans[4 * s + 3].
+ */
+typedef struct frozen_actree {
+	const unsigned int *trans;  /* NULL if the tree is not frozen */
+	const int *leaf_P_ids;  /* 1 per leaf state */
+	unsigned int first_leaf;  /* state id of the 1st leaf */
+} FrozenACtree;
+
 /*
  * Always set 'max_nodeextbuf_nelt' to 0U (no max) and 'dont_extend_nodes' to
  * 0 during preprocessing.
@@ -405,6 +423,7 @@ typedef struct actree {
 	ByteTrTable char2linktag;
 	unsigned int max_nodeextbuf_nelt;  /* 0U means "no max" */
 	int dont_extend_nodes;  /* always at 0 during preprocessing */
+	FrozenACtree frozen;
 } ACtree;
 
 #define GET_NODEEXT(tree, eid) get_nodeext_from_buf(&((tree)->nodeextbuf), eid)
@@ -595,6 +614,7 @@ static ACtree new_ACtree(int tb_length, int tb_width, SEXP base_codes,
 	_init_byte2offset_with_INTEGER(&(tree.char2linktag), base_codes, 1);
 	tree.max_nodeextbuf_nelt = 0U;
 	tree.dont_extend_nodes = 0;
+	tree.frozen.trans = NULL;
 	NEW_NODE(&tree, 0);  /* create the root node */
 	return tree;
 }
@@ -616,6 +636,31 @@ static unsigned int a_nice_max_nodeextbuf_nelt(int nnodes)
 	return n;
 }
 
+/*
+ * 'frozen_bab' is the IntegerBAB where the frozen tree is stored: block 0
+ * contains the transitions and block 1 the P_ids of the leaf states. It's
+ * empty if the tree is not frozen. R_NilValue (old serialized ACtree2
+ * object) is also accepted.
+ */
+static FrozenACtree get_FrozenACtree(SEXP frozen_bab)
+{
+	FrozenACtree frozen;
+	SEXP blocks, trans, leaf_P_ids;
+
+	frozen.trans = NULL;
+	if (frozen_bab == R_NilValue || *_get_BAB_nblock_ptr(frozen_bab) < 2)
+		return frozen;
+	blocks = _get_BAB_blocks(frozen_bab);
+	trans = VECTOR_ELT(blocks, 0);
+	leaf_P_ids = VECTOR_ELT(blocks, 1);
+	frozen.trans = (const unsigned int *) INTEGER(trans);
+	frozen.leaf_P_ids = INTEGER(leaf_P_ids);
+	frozen.first_leaf = (unsigned int) (LENGTH(trans) /
+					    MAX_CHILDREN_PER_NODE) -
+			    (unsigned int) LENGTH(leaf_P_ids);
+	return frozen;
+}
+
 static ACtree pptb_asACtree(SEXP pptb)
 {
 	ACtree tree;
@@ -651,6 +696,7 @@ static ACtree pptb_asACtree(SEXP pptb)
 	tree.max_nodeextbuf_nelt = max_nelt;
 	nelt = get_ACnodeextBuf_nelt(&(tree.nodeextbuf));
 	tree.dont_extend_nodes = max_nelt != 0U && nelt >= max_nelt;
+	tree.frozen = get_FrozenACtree(_get_ACtree2_frozen_ptr(pptb));
 	return tree;
 }
 
@@ -704,6 +750,36 @@ SEXP ACtree2_print_nodes(SEXP pptb)
 	return R_NilValue;
 }
 
+/* --- .Call ENTRY POINT ---
+ * Returns an integer matrix with 1 row per node and 5 columns: the P_id of
+ * the node (NA if it's not a leaf) followed by its links for each of the 4
+ * linktags (NA if not set). For testing only.
+ */
+SEXP ACtree2_nodes(SEXP pptb)
+{
+	ACtree tree;
+	unsigned int nnodes, nid, link;
+	ACnode *node;
+	int linktag, *ans_p;
+	SEXP ans;
+
+	tree = pptb_asACtree(pptb);
+	nnodes = TREE_SIZE(&tree);
+	PROTECT(ans = allocMatrix(INTSXP, nnodes, MAX_CHILDREN_PER_NODE + 1));
+	ans_p = INTEGER(ans);
+	for (nid = 0U; nid < nnodes; nid++) {
+		node = GET_NODE(&tree, nid);
+		ans_p[nid] = IS_LEAFNODE(node) ? NODE_P_ID(node) : NA_INTEGER;
+		for (linktag = 0; linktag < MAX_CHILDREN_PER_NODE; linktag++) {
+			link = GET_NODE_LINK(&tree, node, linktag);
+			ans_p[nid + (size_t) nnodes * (linktag + 1)] =
+				link == NOT_AN_ID ? NA_INTEGER : (int) link;
+		}
+	}
+	UNPROTECT(1);
+	return ans;
+}
+
 /* --- .Call ENTRY POINT --- */
 SEXP ACtree2_summary(SEXP pptb)
 {
@@ -738,6 +814,7 @@ SEXP ACtree2_summary(SEXP pptb)
 	min_nn = count_min_needed_nnodes(nleaves, TREE_DEPTH(&tree));
 	Rprintf("| - max_needed_nnodes(nleaves, TREE_DEPTH) = %u\n", max_nn);
 	Rprintf("| - min_needed_nnodes(nleaves, TREE_DEPTH) = %u\n", min_nn);
+	Rprintf("| Frozen: %s\n", tree.frozen.trans != NULL ? "yes" : "no");
 	return R_NilValue;
 }
 
@@ -747,6 +824,359 @@ SEXP ACtree2_summary(SEXP pptb)
  *                             G. PREPROCESSING                             *
  ****************************************************************************/
 
+/*
+ * The Trusted Band is preprocessed in bulk:
+ *   1. The patterns are 2-bit encoded (4 letters per byte, 1st letter in
+ *      the high bits) so that comparing 2 encoded patterns byte by byte
+ *      compares them letter by letter.
+ *   2. The encoded patterns are radix-sorted (LSD, stable so patterns with
+ *      the same sequence stay in original order).
+ *   3. The longest common prefix (LCP) between consecutive patterns in
+ *      sorted order is computed.
+ *   4. For each pattern P, the LCP between P and the patterns located
+ *      before P in the Trusted Band is derived from 3. This is the depth of
+ *      the node where add_pattern() (the one-at-a-time insertion, see
+ *      below) would have started creating new nodes for P. When it's the
+ *      width of the Trusted Band, P is a duplicate.
+ *   5. The nodes are created in the order in which they would have been
+ *      created by inserting the patterns one at a time. So the resulting
+ *      tree is the same, node for node (and node extension for node
+ *      extension), but the tree is never walked from the root.
+ * Encoding, sorting and computing the LCPs are done in parallel when
+ * Biostrings is using more than 1 thread.
+ * The tree can still be built with add_pattern() by calling
+ * .Call("set_ACtree2_builder", "incremental"). This is only for testing
+ * (the 2 builders must give the same tree, node for node).
+ */
+
+#define BULK_MIN_NPATTERN_PER_CHUNK 65536
+
+typedef struct bulk_tb {
+	int npattern;  /* nb of patterns to preprocess */
+	int width;
+	int nbyte;  /* nb of bytes per encoded pattern */
+	int *P_offset;  /* offsets of the patterns in the Trusted Band */
+	unsigned char *codes;  /* npattern * nbyte bytes */
+	int nchunk;
+} BulkTB;
+
+#define GET_CODE(btb, i) ((btb)->codes + (size_t) (i) * (btb)->nbyte)
+#define CODE_LINKTAG(code, depth) \
+	(((code)[(depth) >> 2] >> (6 - 2 * ((depth) & 3))) & 3)
+
+static int chunk_from(const BulkTB *btb, int k)
+{
+	int chunk_length, from;
+
+	chunk_length = btb->npattern / btb->nchunk + 1;
+	from = k * chunk_length;
+	return from < btb->npattern ? from : btb->npattern;
+}
+
+/* Returns the index of the 1st pattern with a non base letter or -1. */
+static int encode_patterns(const BulkTB *btb, const ACtree *tree,
+		const XStringSet_holder *tb_holder)
+{
+	int *first_bad, k, bad;
+
+	first_bad = (int *) R_alloc(btb->nchunk, sizeof(int));
+#ifdef _OPENMP
+	#pragma omp parallel for num_threads(btb->nchunk) schedule(static, 1)
+#endif
+	for (k = 0; k < btb->nchunk; k++) {
+		int to, i, depth, linktag;
+		Chars_holder P;
+		unsigned char *code;
+
+		first_bad[k] = -1;
+		to = chunk_from(btb, k + 1);
+		for (i = chunk_from(btb, k); i < to; i++) {
+			P = _get_elt_from_XStringSet_holder(tb_holder,
+							    btb->P_offset[i]);
+			code = GET_CODE(btb, i);
+			memset(code, 0, btb->nbyte);
+			for (depth = 0; depth < btb->width; depth++) {
+				linktag = CHAR2LINKTAG(tree, P.ptr[depth]);
+				if (linktag == NA_INTEGER)
+					break;
+				code[depth >> 2] |=
+					linktag << (6 - 2 * (depth & 3));
+			}
+			if (depth < btb->width) {
+				first_bad[k] = i;
+				break;
+			}
+		}
+	}
+	bad = -1;
+	for (k = 0; k < btb->nchunk && bad == -1; k++)
+		bad = first_bad[k];
+	return bad;
+}
+
+/*
+ * Stable counting sort of 'in' (pattern indices) on byte 'b' of the encoded
+ * patterns. Returns 0 (and leaves 'out' untouched) if all the patterns have
+ * the same byte 'b'.
+ */
+static int radix_sort_pass(const BulkTB *btb, int b,
+		const int *in, int *out, int *counts)
+{
+	int k, d, pos, count;
+
+#ifdef _OPENMP
+	#pragma omp parallel for num_threads(btb->nchunk) schedule(static, 1)
+#endif
+	for (k = 0; k < btb->nchunk; k++) {
+		int *chunk_counts, to, r;
+
+		chunk_counts = counts + 256 * k;
+		memset(chunk_counts, 0, 256 * sizeof(int));
+		to = chunk_from(btb, k + 1);
+		for (r = chunk_from(btb, k); r < to; r++)
+			chunk_counts[GET_CODE(btb, in[r])[b]]++;
+	}
+	pos = 0;
+	for (d = 0; d < 256; d++) {
+		for (k = 0; k < btb->nchunk; k++) {
+			count = counts[256 * k + d];
+			if (count == btb->npattern)
+				return 0;
+			counts[256 * k + d] = pos;
+			pos += count;
+		}
+	}
+#ifdef _OPENMP
+	#pragma omp parallel for num_threads(btb->nchunk) schedule(static, 1)
+#endif
+	for (k = 0; k < btb->nchunk; k++) {
+		int *chunk_counts, to, r;
+
+		chunk_counts = counts + 256 * k;
+		to = chunk_from(btb, k + 1);
+		for (r = chunk_from(btb, k); r < to; r++)
+			out[chunk_counts[GET_CODE(btb, in[r])[b]]++] = in[r];
+	}
+	return 1;
+}
+
+/* Returns the sorted pattern indices (in 'order' or 'buf'). */
+static int *sort_patterns(const BulkTB *btb, int *order, int *buf)
+{
+	int *counts, i, b, *tmp;
+
+	counts = (int *) R_alloc(256 * btb->nchunk, sizeof(int));
+	for (i = 0; i < btb->npattern; i++)
+		order[i] = i;
+	for (b = btb->nbyte - 1; b >= 0; b--) {
+		if (!radix_sort_pass(btb, b, order, buf, counts))
+			continue;
+		tmp = order;
+		order = buf;
+		buf = tmp;
+	}
+	return order;
+}
+
+static int code_lcp(const BulkTB *btb,
+		const unsigned char *code1, const unsigned char *code2)
+{
+	int b, lcp;
+	unsigned char x;
+
+	for (b = 0; b < btb->nbyte; b++) {
+		x = code1[b] ^ code2[b];
+		if (x == 0)
+			continue;
+		for (lcp = 4 * b; (x & 0xC0) == 0; lcp++)
+			x <<= 2;
+		return lcp;
+	}
+	return btb->width;
+}
+
+/* lcp[r] is the LCP between the patterns at ranks r-1 and r (lcp[0] is 0) */
+static void compute_adjacent_lcps(const BulkTB *btb, const int *order,
+		int *lcp)
+{
+	int k;
+
+	lcp[0] = 0;
+#ifdef _OPENMP
+	#pragma omp parallel for num_threads(btb->nchunk) schedule(static, 1)
+#endif
+	for (k = 0; k < btb->nchunk; k++) {
+		int to, r;
+
+		to = chunk_from(btb, k + 1);
+		for (r = chunk_from(btb, k); r < to; r++) {
+			if (r == 0)
+				continue;
+			lcp[r] = code_lcp(btb, GET_CODE(btb, order[r - 1]),
+					       GET_CODE(btb, order[r]));
+		}
+	}
+	return;
+}
+
+/*
+ * The LCP between pattern i and the patterns before it is the LCP between
+ * i and the closest pattern (in sorted order) with a lower index, either on
+ * the left or on the right. The closest ones are found with a stack.
+ * 'stack' and 'gap' are used as scratch buffers.
+ */
+static void compute_max_lcps(const BulkTB *btb, const int *order,
+		const int *lcp, int *max_lcp, int *stack, int *gap)
+{
+	int n, top, cur, r, i;
+
+	n = btb->npattern;
+	/* left pass: 'cur' is the min of lcp[stack[top]+1..r] */
+	for (top = -1, cur = btb->width, r = 0; r < n; r++) {
+		i = order[r];
+		if (r > 0 && lcp[r] < cur)
+			cur = lcp[r];
+		for ( ; top >= 0 && order[stack[top]] > i; top--) {
+			if (top > 0 && gap[top - 1] < cur)
+				cur = gap[top - 1];
+		}
+		max_lcp[i] = top >= 0 ? cur : 0;
+		if (top >= 0)
+			gap[top] = cur;
+		stack[++top] = r;
+		cur = btb->width;
+	}
+	/* right pass: 'cur' is the min of lcp[r+1..stack[top]] */
+	for (top = -1, cur = btb->width, r = n - 1; r >= 0; r--) {
+		i = order[r];
+		if (r < n - 1 && lcp[r + 1] < cur)
+			cur = lcp[r + 1];
+		for ( ; top >= 0 && order[stack[top]] > i; top--) {
+			if (top > 0 && gap[top - 1] < cur)
+				cur = gap[top - 1];
+		}
+		if (top >= 0 && cur > max_lcp[i])
+			max_lcp[i] = cur;
+		if (top >= 0)
+			gap[top] = cur;
+		stack[++top] = r;
+		cur = btb->width;
+	}
+	return;
+}
+
+/*
+ * For each pattern i, finds the pattern that creates the node at depth
+ * max_lcp[i] on the path of pattern i (-1 for the root node). This is the
+ * only pattern in the group of patterns sharing this prefix (a group is a
+ * range of ranks) that doesn't share it with a pattern before it. The
+ * groups are walked in sorted order and the patterns waiting for the
+ * creator of their group are kept in linked lists ('pending_next').
+ */
+static void find_creators(const BulkTB *btb, const int *order,
+		const int *lcp, const int *max_lcp,
+		int *creator, int *pending_next)
+{
+	int *creator_at, *pending_head, d, r, i, m, p;
+
+	creator_at = (int *) R_alloc(btb->width + 1, sizeof(int));
+	pending_head = (int *) R_alloc(btb->width + 1, sizeof(int));
+	for (d = 0; d <= btb->width; d++)
+		creator_at[d] = pending_head[d] = -1;
+	for (r = 0; r < btb->npattern; r++) {
+		i = order[r];
+		/* close the groups that don't contain pattern i */
+		for (d = lcp[r] + 1; d <= btb->width; d++)
+			creator_at[d] = -1;
+		m = max_lcp[i];
+		for (d = m + 1; d <= btb->width; d++) {
+			creator_at[d] = i;
+			for (p = pending_head[d]; p != -1; p = pending_next[p])
+				creator[p] = i;
+			pending_head[d] = -1;
+		}
+		if (m == 0) {
+			creator[i] = -1;
+		} else if (creator_at[m] != -1) {
+			creator[i] = creator_at[m];
+		} else {
+			pending_next[i] = pending_head[m];
+			pending_head[m] = i;
+		}
+	}
+	return;
+}
+
+static void emit_nodes(ACtree *tree, const BulkTB *btb,
+		const int *max_lcp, const int *creator, unsigned int *first_nid)
+{
+	int i, m, k, depth;
+	const unsigned char *code;
+	unsigned int nid1, nid2;
+	ACnode *node1;
+
+	for (i = 0; i < btb->npattern; i++) {
+		m = max_lcp[i];
+		k = creator[i];
+		if (m == btb->width) {
+			_report_ppdup(btb->P_offset[i], btb->P_offset[k] + 1);
+			continue;
+		}
+		nid1 = m == 0 ? 0U : first_nid[k] + (m - max_lcp[k] - 1);
+		code = GET_CODE(btb, i);
+		for (depth = m; depth < btb->width; depth++) {
+			if (depth < btb->width - 1)
+				nid2 = NEW_NODE(tree, depth + 1);
+			else
+				nid2 = NEW_LEAFNODE(tree, btb->P_offset[i] + 1);
+			if (depth == m) {
+				first_nid[i] = nid2;
+				node1 = GET_NODE(tree, nid1);
+			}
+			SET_NODE_LINK(tree, node1, CODE_LINKTAG(code, depth), nid2);
+			node1 = GET_NODE(tree, nid2);
+		}
+	}
+	return;
+}
+
+static void add_patterns(ACtree *tree, BulkTB *btb,
+		const XStringSet_holder *tb_holder, int bad_length_offset)
+{
+	int n, bad, *order, *buf1, *buf2, *max_lcp, *buf3, *buf4;
+
+	n = btb->npattern;
+	btb->nbyte = (btb->width + 3) / 4;
+	btb->codes = (unsigned char *) R_alloc((size_t) n * btb->nbyte,
+					       sizeof(unsigned char));
+	btb->nchunk = _get_nthreads();
+	if (btb->nchunk > n / BULK_MIN_NPATTERN_PER_CHUNK + 1)
+		btb->nchunk = n / BULK_MIN_NPATTERN_PER_CHUNK + 1;
+	bad = encode_patterns(btb, tree, tb_holder);
+	if (bad != -1)
+		error("non base DNA letter found in Trusted Band "
+		      "for pattern %d", btb->P_offset[bad] + 1);
+	if (bad_length_offset != -1)
+		error("element %d in Trusted Band has a different "
+		      "length than first element", bad_length_offset + 1);
+	buf1 = (int *) R_alloc(n, sizeof(int));
+	buf2 = (int *) R_alloc(n, sizeof(int));
+	max_lcp = (int *) R_alloc(n, sizeof(int));
+	buf3 = (int *) R_alloc(n, sizeof(int));
+	buf4 = (int *) R_alloc(n, sizeof(int));
+	order = sort_patterns(btb, buf1, buf2);
+	/* reuse the buffer that is not holding 'order' for the LCPs */
+	if (order == buf1)
+		buf1 = buf2;
+	compute_adjacent_lcps(btb, order, buf1);
+	compute_max_lcps(btb, order, buf1, max_lcp, buf3, buf4);
+	find_creators(btb, order, buf1, max_lcp, buf3, buf4);
+	/* the LCPs are not needed anymore so their buffer is reused to store
+	   the id of the 1st node created by each pattern */
+	emit_nodes(tree, btb, max_lcp, buf3, (unsigned int *) buf1);
+	return;
+}
+
 static void add_pattern(ACtree *tree, const Chars_holder *P, int P_offset)
 {
 	int P_id, depth, dmax, linktag;
@@ -780,6 +1210,27 @@ static void add_pattern(ACtree *tree, const Chars_holder *P, int P_offset)
 	return;
 }
 
+static int bulk_build = 1;
+
+/* --- .Call ENTRY POINT ---
+ * 'builder' is "bulk" (the default) or "incremental". Returns the previous
+ * setting. */
+SEXP set_ACtree2_builder(SEXP builder)
+{
+	const char *builder0;
+	int prev_bulk_build;
+
+	prev_bulk_build = bulk_build;
+	builder0 = CHAR(STRING_ELT(builder, 0));
+	if (strcmp(builder0, "bulk") == 0)
+		bulk_build = 1;
+	else if (strcmp(builder0, "incremental") == 0)
+		bulk_build = 0;
+	else
+		error("invalid ACtree2 builder \"%s\"", builder0);
+	return mkString(prev_bulk_build ? "bulk" : "incremental");
+}
+
 /* --- .Call ENTRY POINT ---
  * Arguments:
  *   tb:         the Trusted Band extracted from the input dictionary as a
@@ -793,9 +1244,10 @@ SEXP ACtree2_build(SEXP tb, SEXP pp_exclude, SEXP base_codes,
 		SEXP nodebuf_ptr, SEXP nodeextbuf_ptr)
 {
 	ACtree tree;
-	int tb_length, tb_width, P_offset;
+	int tb_length, tb_width, P_offset, bad_length_offset, i;
 	XStringSet_holder tb_holder;
 	Chars_holder P;
+	BulkTB btb;
 	SEXP ans, ans_names, ans_elt;
 
 	tb_length = _get_XStringSet_length(tb);
@@ -803,7 +1255,10 @@ SEXP ACtree2_build(SEXP tb, SEXP pp_exclude, SEXP base_codes,
 		error("Trusted Band is empty");
 	_init_ppdups_buf(tb_length);
 	tb_width = -1;
+	bad_length_offset = -1;
 	tb_holder = _hold_XStringSet(tb);
+	btb.npattern = 0;
+	btb.P_offset = (int *) R_alloc(tb_length, sizeof(int));
 	for (P_offset = 0; P_offset < tb_length; P_offset++) {
 		/* skip duplicated patterns */
 		if (pp_exclude != R_NilValue
@@ -818,10 +1273,25 @@ SEXP ACtree2_build(SEXP tb, SEXP pp_exclude, SEXP base_codes,
 			tree = new_ACtree(tb_length, tb_width, base_codes,
 					nodebuf_ptr, nodeextbuf_ptr);
 		} else if (P.length != tb_width) {
-			error("element %d in Trusted Band has a different "
-			      "length than first element", P_offset + 1);
+			/* reported after the patterns before it have been
+			   checked for non base letters */
+			bad_length_offset = P_offset;
+			break;
 		}
-		add_pattern(&tree, &P, P_offset);
+		btb.P_offset[btb.npattern++] = P_offset;
+	}
+	if (tb_width != -1 && bulk_build) {
+		btb.width = tb_width;
+		add_patterns(&tree, &btb, &tb_holder, bad_length_offset);
+	} else if (tb_width != -1) {
+		for (i = 0; i < btb.npattern; i++) {
+			P = _get_elt_from_XStringSet_holder(&tb_holder,
+							    btb.P_offset[i]);
+			add_pattern(&tree, &P, btb.P_offset[i]);
+		}
+		if (bad_length_offset != -1)
+			error("element %d in Trusted Band has a different "
+			      "length than first element", bad_length_offset + 1);
 	}
 
 	PROTECT(ans = NEW_LIST(2));
@@ -911,6 +1381,28 @@ static unsigned int compute_flink(ACtree *tree,
 	return nid;
 }
 
+/*
+ * Read-only version of transition(). Can only be used on a tree where all
+ * the nodes already have a failure link (see compute_all_flinks() below).
+ * Because it never sets a failure link or a shortcut link, it doesn't
+ * modify the tree so it's safe to call it on the same tree from several
+ * threads at the same time.
+ */
+static unsigned int frozen_transition(ACtree *tree,
+		ACnode *node, int linktag)
+{
+	unsigned int link;
+
+	if (linktag == NA_INTEGER)
+		return 0U;
+	while ((link = GET_NODE_LINK(tree, node, linktag)) == NOT_AN_ID) {
+		if (IS_ROOTNODE(tree, node))
+			return 0U;
+		node = GET_NODE(tree, GET_NODE_FLINK(tree, node));
+	}
+	return link;
+}
+
 static int has_all_flinks(ACtree *tree)
 {
 	unsigned int nnodes, nid, flink;
@@ -991,12 +1483,205 @@ SEXP ACtree2_compute_all_flinks(SEXP pptb)
 	return R_NilValue;
 }
 
+/*
+ * Sets the shortcut links that transition() sets on the fly, i.e. the 4
+ * links of each node, so frozen_transition() (which doesn't set them)
+ * takes 1 step per letter. Nodes that can't be extended anymore (see
+ * extend_ACnode()) keep following their failure link.
+ * The tree must have all its failure links.
+ */
+static void compute_all_shortcuts(ACtree *tree)
+{
+	unsigned int nnodes, nid;
+	int linktag;
+
+	nnodes = TREE_SIZE(tree);
+	for (nid = 0U; nid < nnodes; nid++)
+		for (linktag = 0; linktag < MAX_CHILDREN_PER_NODE; linktag++)
+			transition(tree, GET_NODE(tree, nid), NULL, linktag);
+	return;
+}
+
+/*
+ * Computes all the failure links and shortcut links of a tree that is not
+ * frozen so it can be walked with frozen_transition() (e.g. from several
+ * threads) in 1 step per letter. After that, the tree doesn't change
+ * anymore. This is recorded in the "frozen_ptr" buffer of 'pptb' (in its
+ * nb of elements in the last block, which is not used while the buffer is
+ * empty) so the next calls don't sweep the tree again. Must be called in
+ * the main thread.
+ */
+static void complete_all_links(ACtree *tree, SEXP pptb)
+{
+	SEXP frozen_bab, tb;
+	XStringSet_holder tb_holder;
+	int *links_are_complete;
+
+	if (tree->frozen.trans != NULL)
+		return;
+	frozen_bab = _get_ACtree2_frozen_ptr(pptb);
+	/* an old serialized ACtree2 object has no "frozen_ptr" slot */
+	links_are_complete = frozen_bab == R_NilValue ? NULL :
+			     _get_BAB_lastblock_nelt_ptr(frozen_bab);
+	if (links_are_complete != NULL && *links_are_complete)
+		return;
+	if (!has_all_flinks(tree)) {
+		tb = _get_PreprocessedTB_tb(pptb);
+		tb_holder = _hold_XStringSet(tb);
+		compute_all_flinks(tree, &tb_holder);
+	}
+	compute_all_shortcuts(tree);
+	if (links_are_complete != NULL)
+		*links_are_complete = 1;
+	return;
+}
+
+/*
+ * Freezing the tree.
+ * All the nodes must have a failure link. The nodes are renumbered in BFS
+ * order (the children of a node are the nodes it links to that are 1 level
+ * deeper, the other links are shortcuts to shallower nodes) and the 4
+ * transitions of each node are computed with frozen_transition(). The
+ * result is stored in 'frozen_bab' (see get_FrozenACtree() above).
+ * With the frozen tree, walking along the subject takes 1 table lookup per
+ * letter instead of following the links of the ACnode/ACnodeext structs.
+ */
+static void freeze_ACtree(ACtree *tree, SEXP frozen_bab)
+{
+	unsigned int nnodes, *queue, *new_sid, qlen, q, nid, link,
+		     *trans, nleaves;
+	int depth, linktag, *leaf_P_ids;
+	ACnode *node;
+	SEXP block;
+
+	nnodes = TREE_SIZE(tree);
+	if (nnodes > INT_MAX / MAX_CHILDREN_PER_NODE)
+		error("too many nodes (%u) to freeze this ACtree2 object",
+		      nnodes);
+	queue = (unsigned int *) malloc(sizeof(unsigned int) * nnodes);
+	new_sid = (unsigned int *) malloc(sizeof(unsigned int) * nnodes);
+	if (queue == NULL || new_sid == NULL) {
+		free(queue);
+		free(new_sid);
+		error("freeze_ACtree(): memory allocation failed");
+	}
+	queue[0] = 0U;
+	qlen = 1U;
+	nleaves = 0U;
+	for (q = 0U; q < qlen; q++) {
+		nid = queue[q];
+		new_sid[nid] = q;
+		node = GET_NODE(tree, nid);
+		if (IS_LEAFNODE(node)) {
+			nleaves++;
+			continue;
+		}
+		depth = NODE_DEPTH(tree, node);
+		for (linktag = 0; linktag < MAX_CHILDREN_PER_NODE; linktag++) {
+			link = GET_NODE_LINK(tree, node, linktag);
+			if (link != NOT_AN_ID && qlen < nnodes
+			 && NODE_DEPTH(tree, GET_NODE(tree, link)) == depth + 1)
+				queue[qlen++] = link;
+		}
+	}
+	if (qlen != nnodes) {
+		free(queue);
+		free(new_sid);
+		error("Biostrings internal error in freeze_ACtree(): "
+		      "qlen != nnodes");
+	}
+	block = _IntegerBAB_addblock(frozen_bab,
+				     nnodes * MAX_CHILDREN_PER_NODE);
+	trans = (unsigned int *) INTEGER(block);
+	block = _IntegerBAB_addblock(frozen_bab, nleaves);
+	leaf_P_ids = INTEGER(block);
+	for (q = 0U; q < nnodes; q++) {
+		node = GET_NODE(tree, queue[q]);
+		for (linktag = 0; linktag < MAX_CHILDREN_PER_NODE; linktag++)
+			*(trans++) = new_sid[frozen_transition(tree,
+							node, linktag)];
+		if (q >= nnodes - nleaves)
+			*(leaf_P_ids++) = NODE_P_ID(node);
+	}
+	free(queue);
+	free(new_sid);
+	return;
+}
+
+/* --- .Call ENTRY POINT --- */
+SEXP ACtree2_is_frozen(SEXP pptb)
+{
+	ACtree tree;
+
+	tree = pptb_asACtree(pptb);
+	return ScalarLogical(tree.frozen.trans != NULL);
+}
+
+/* --- .Call ENTRY POINT --- */
+SEXP ACtree2_freeze(SEXP pptb)
+{
+	ACtree tree;
+	SEXP frozen_bab, tb;
+	XStringSet_holder tb_holder;
+
+	frozen_bab = _get_ACtree2_frozen_ptr(pptb);
+	if (frozen_bab == R_NilValue)
+		error("this ACtree2 object cannot be frozen (it was created "
+		      "with an old version of Biostrings), please call PDict() "
+		      "again to recreate it");
+	tree = pptb_asACtree(pptb);
+	if (tree.frozen.trans != NULL)
+		return R_NilValue;
+	/* drop what's left of a previous attempt that failed */
+	*_get_BAB_nblock_ptr(frozen_bab) = 0;
+	if (!has_all_flinks(&tree)) {
+		tb = _get_PreprocessedTB_tb(pptb);
+		tb_holder = _hold_XStringSet(tb);
+		compute_all_flinks(&tree, &tb_holder);
+	}
+	freeze_ACtree(&tree, frozen_bab);
+	return R_NilValue;
+}
+
 
 
 /****************************************************************************
  *                             I. MATCH FINDING                             *
  ****************************************************************************/
 
+/*
+ * Walking along the subject with a frozen tree. 'sid' is a state id (see
+ * freeze_ACtree() above). A letter that is not a base brings us back to the
+ * root state.
+ */
+#define FROZEN_TRANSITION(frozen, sid, linktag) \
+	((linktag) == NA_INTEGER ? 0U : \
+	 (frozen)->trans[(size_t) (sid) * MAX_CHILDREN_PER_NODE + (linktag)])
+#define IS_LEAF_STATE(frozen, sid) ((sid) >= (frozen)->first_leaf)
+#define LEAF_STATE_P_ID(frozen, sid) \
+	((frozen)->leaf_P_ids[(sid) - (frozen)->first_leaf])
+
+/* Does report matches */
+static void walk_frozen_tb_subject(ACtree *tree, const Chars_holder *S,
+		TBMatchBuf *tb_matches)
+{
+	const FrozenACtree *frozen;
+	int n, linktag;
+	const char *c;
+	unsigned int sid;
+
+	frozen = &(tree->frozen);
+	sid = 0U;
+	for (n = 1, c = S->ptr; n <= S->length; n++, c++) {
+		linktag = CHAR2LINKTAG(tree, *c);
+		sid = FROZEN_TRANSITION(frozen, sid, linktag);
+		if (IS_LEAF_STATE(frozen, sid))
+			_TBMatchBuf_report_match(tb_matches,
+					LEAF_STATE_P_ID(frozen, sid) - 1, n);
+	}
+	return;
+}
+
 /* Does report matches */
 static void walk_tb_subject(ACtree *tree, const Chars_holder *S,
 		TBMatchBuf *tb_matches)
@@ -1006,6 +1691,10 @@ static void walk_tb_subject(ACtree *tree, const Chars_holder *S,
 	const char *node_path;
 	unsigned int nid;
 
+	if (tree->frozen.trans != NULL) {
+		walk_frozen_tb_subject(tree, S, tb_matches);
+		return;
+	}
 	node = GET_NODE(tree, 0U);
 	node_path = S->ptr;
 	for (n = 1; n <= S->length; n++) {
@@ -1020,99 +1709,283 @@ static void walk_tb_subject(ACtree *tree, const Chars_holder *S,
 	return;
 }
 
-/* 1st helper function for walk_tb_nonfixed_subject() */
-#define	NODE_SUBSET_MAXSIZE	5000000 /* 5 million node pointers */
-static ACnode *node_subset[NODE_SUBSET_MAXSIZE];
-static int node_subset_size = 0;
+/*
+ * Multi-threaded version of walk_tb_subject(). The tree must be "frozen"
+ * i.e. all its nodes must already have a failure link.
+ * The subject is split in 1 chunk per thread. Each chunk is walked from the
+ * root node, starting 'tree depth - 1' letters before the first end position
+ * that it's responsible for, so no match is lost or reported twice. The
+ * matches found in each chunk are stored in a malloc-based buffer (the
+ * TBMatchBuf cannot be used from the worker threads) and then reported in
+ * chunk order by the main thread. This guarantees that the matches end up in
+ * 'tb_matches' in the exact same order as with walk_tb_subject().
+ * Because reporting a match can raise an error, the matches are moved to
+ * R_alloc'ed memory and the malloc-based buffers are freed before the first
+ * match is reported.
+ */
 
-static void split_and_move_pointers(ACtree *tree, unsigned char c)
-{
-	int node_subset_size0, i, is_first, j, linktag;
-	ACnode *node0, *node1, *node2;
-	unsigned char base;
-	unsigned int nid;
+/* Walking a chunk shorter than this is not worth starting a thread. */
+#define MIN_CHUNK_LENGTH 100000
 
-	node0 = GET_NODE(tree, 0U);
-	node_subset_size0 = node_subset_size;
-	for (i = 0; i < node_subset_size0; i++) {
-		node1 = node_subset[i];
-		is_first = 1;
-		for (j = 0, base = 1; j < 4; j++, base *= 2) {
-			if ((c & base) == 0)
-				continue;
-			linktag = CHAR2LINKTAG(tree, base);
-			nid = transition(tree, node1, NULL, linktag);
-			//Rprintf("%d --[%d]--> %d\n", node1 - node0, base, nid);
-			node2 = GET_NODE(tree, nid);
-			if (is_first) {
-				node_subset[i] = node2;
-				is_first = 0;
-			} else {
-				if (node_subset_size >= NODE_SUBSET_MAXSIZE) {
-					node_subset_size = 0;
-					error("too many IUPAC ambiguity "
-					      "letters in 'subject'");
-				}
-				node_subset[node_subset_size++] = node2;
-			}
+typedef struct chunk_matches {
+	int *P_offsets;
+	int *ends;
+	int nelt;
+	int buflength;
+	int malloc_failed;
+} ChunkMatches;
+
+static void add_to_ChunkMatches(ChunkMatches *chunk_matches,
+		int P_offset, int end)
+{
+	int new_buflength, *new_P_offsets, *new_ends;
+
+	if (chunk_matches->nelt == chunk_matches->buflength) {
+		new_buflength = chunk_matches->buflength == 0 ?
+				1024 : 2 * chunk_matches->buflength;
+		new_P_offsets = (int *) realloc(chunk_matches->P_offsets,
+					sizeof(int) * new_buflength);
+		if (new_P_offsets != NULL)
+			chunk_matches->P_offsets = new_P_offsets;
+		new_ends = (int *) realloc(chunk_matches->ends,
+					sizeof(int) * new_buflength);
+		if (new_ends != NULL)
+			chunk_matches->ends = new_ends;
+		if (new_P_offsets == NULL || new_ends == NULL) {
+			chunk_matches->malloc_failed = 1;
+			return;
 		}
+		chunk_matches->buflength = new_buflength;
 	}
+	chunk_matches->P_offsets[chunk_matches->nelt] = P_offset;
+	chunk_matches->ends[chunk_matches->nelt] = end;
+	chunk_matches->nelt++;
 	return;
 }
 
-/* 2nd helper function for walk_tb_nonfixed_subject() */
-static int compar_node_pointers_for_sort(const void *p1, const void *p2)
+/* Does NOT report matches. Must NOT call any function of the R API. */
+static void walk_frozen_tb_subject_chunk(const FrozenACtree *frozen,
+		const ByteTrTable *char2linktag, const Chars_holder *S,
+		int n, int from, int to, ChunkMatches *chunk_matches)
 {
-	return *((const ACnode * const *) p1) - *((const ACnode * const *) p2);
+	int linktag;
+	const char *c;
+	unsigned int sid;
+
+	sid = 0U;
+	for (c = S->ptr + n - 1; n <= to; n++, c++) {
+		linktag = char2linktag->byte2code[(unsigned char) *c];
+		sid = FROZEN_TRANSITION(frozen, sid, linktag);
+		if (n >= from && IS_LEAF_STATE(frozen, sid)) {
+			add_to_ChunkMatches(chunk_matches,
+					LEAF_STATE_P_ID(frozen, sid) - 1, n);
+			if (chunk_matches->malloc_failed)
+				return;
+		}
+	}
+	return;
 }
-static void sort_node_pointer_array(ACnode **x, int nelt)
+
+/* Does NOT report matches. Must NOT call any function of the R API. */
+static void walk_tb_subject_chunk(ACtree *tree, const Chars_holder *S,
+		int from, int to, ChunkMatches *chunk_matches)
 {
-	qsort(x, nelt, sizeof(ACnode *), compar_node_pointers_for_sort);
+	ACnode *node;
+	int n, linktag;
+	const char *c;
+	unsigned int nid;
+
+	n = from - TREE_DEPTH(tree) + 1;
+	if (n < 1)
+		n = 1;
+	if (tree->frozen.trans != NULL) {
+		walk_frozen_tb_subject_chunk(&(tree->frozen),
+				&(tree->char2linktag), S, n, from, to,
+				chunk_matches);
+		return;
+	}
+	node = GET_NODE(tree, 0U);
+	for (c = S->ptr + n - 1; n <= to; n++, c++) {
+		linktag = CHAR2LINKTAG(tree, *c);
+		nid = frozen_transition(tree, node, linktag);
+		node = GET_NODE(tree, nid);
+		if (n >= from && IS_LEAFNODE(node)) {
+			add_to_ChunkMatches(chunk_matches,
+					NODE_P_ID(node) - 1, n);
+			if (chunk_matches->malloc_failed)
+				return;
+		}
+	}
 	return;
 }
-static void merge_pointers(ACtree *tree, int n)
-{
-	int i1, i2;
-	ACnode *node0, *node1, *node2;
 
-	node0 = GET_NODE(tree, 0U);
-/*
-	Rprintf("n=%d nodes before merging: ", n);
-	for (i1 = 0; i1 < node_subset_size; i1++) {
-		node1 = node_subset[i1];
-		Rprintf(" %d", node1 - node0);
+/* Does report matches */
+static void walk_tb_subject_in_parallel(ACtree *tree, const Chars_holder *S,
+		TBMatchBuf *tb_matches, int nchunk)
+{
+	ChunkMatches *chunk_matches;
+	int chunk_length, k, malloc_failed, nmatch, i;
+	int *P_offsets, *ends;
+
+	chunk_matches = (ChunkMatches *) calloc(nchunk, sizeof(ChunkMatches));
+	if (chunk_matches == NULL)
+		error("walk_tb_subject_in_parallel(): memory allocation failed");
+	chunk_length = S->length / nchunk + 1;
+#ifdef _OPENMP
+	#pragma omp parallel for num_threads(nchunk) schedule(static, 1)
+#endif
+	for (k = 0; k < nchunk; k++) {
+		int from, to;
+
+		from = k * chunk_length + 1;
+		to = from + chunk_length - 1;
+		if (to > S->length)
+			to = S->length;
+		walk_tb_subject_chunk(tree, S, from, to, chunk_matches + k);
 	}
-	Rprintf("\n");
-*/
-	sort_node_pointer_array(node_subset, node_subset_size);
-	i1 = 0;
-	node1 = node_subset[i1];
-	for (i2 = 1; i2 < node_subset_size; i2++) {
-		node2 = node_subset[i2];
-		if (node2 == node1)
-			continue;
-		i1++;
-		node1 = node_subset[i1] = node2;
+	malloc_failed = 0;
+	nmatch = 0;
+	for (k = 0; k < nchunk; k++) {
+		if (chunk_matches[k].malloc_failed)
+			malloc_failed = 1;
+		nmatch += chunk_matches[k].nelt;
 	}
-	node_subset_size = i1 + 1;
-/*
-	Rprintf("n=%d nodes after merging: ", n);
-	for (i1 = 0; i1 < node_subset_size; i1++) {
-		node1 = node_subset[i1];
-		Rprintf(" %d", node1 - node0);
+	P_offsets = ends = NULL;
+	if (!malloc_failed && nmatch != 0) {
+		P_offsets = (int *) R_alloc((long) nmatch, sizeof(int));
+		ends = (int *) R_alloc((long) nmatch, sizeof(int));
+		for (k = 0, i = 0; k < nchunk; k++) {
+			memcpy(P_offsets + i, chunk_matches[k].P_offsets,
+			       sizeof(int) * chunk_matches[k].nelt);
+			memcpy(ends + i, chunk_matches[k].ends,
+			       sizeof(int) * chunk_matches[k].nelt);
+			i += chunk_matches[k].nelt;
+		}
 	}
-	Rprintf("\n");
-*/
+	for (k = 0; k < nchunk; k++) {
+		free(chunk_matches[k].P_offsets);
+		free(chunk_matches[k].ends);
+	}
+	free(chunk_matches);
+	if (malloc_failed)
+		error("walk_tb_subject_in_parallel(): memory allocation failed");
+	for (i = 0; i < nmatch; i++)
+		_TBMatchBuf_report_match(tb_matches, P_offsets[i], ends[i]);
 	return;
 }
 
-static void report_matches(TBMatchBuf *tb_matches, int n)
+/*
+ * walk_tb_nonfixed_subject() walks the tree along a subject that can
+ * contain IUPAC ambiguity letters. After each letter, the "frontier" is the
+ * set of states (node ids, or state ids if the tree is frozen) that are
+ * reached by at least 1 of the sequences of bases that the letters read so
+ * far can represent. The frontier is stored in 2 growable arrays (the
+ * current and the next frontier) and a bitset with 1 bit per state is used
+ * to not add the same state twice to the next frontier. Only the bits that
+ * were set are cleared after each letter. So each letter is processed in
+ * time proportional to the size of the frontier (no sorting or merging)
+ * and the frontier can never have more states than the tree.
+ * The transitions are made with frozen_transition() on a tree where all the
+ * links have been set (see complete_all_links()) so they take 1 step each.
+ * The Frontier is allocated the 1st time a subject is walked and is then
+ * reused for the next subjects of the same call (it's stored in the
+ * TBMatchBuf). No global state is used so several calls can run at the
+ * same time.
+ */
+
+typedef struct frontier {
+	IntAE *sids, *next_sids;
+	BitWord *is_next;  /* 1 bit per state */
+} Frontier;
+
+static Frontier *get_Frontier(TBMatchBuf *tb_matches, unsigned int nstate)
 {
-	int i;
+	Frontier *frontier;
+	size_t nword;
+
+	if (tb_matches->frontier != NULL)
+		return tb_matches->frontier;
+	frontier = (Frontier *) R_alloc(1, sizeof(Frontier));
+	frontier->sids = new_IntAE(1024, 0, 0);
+	frontier->next_sids = new_IntAE(1024, 0, 0);
+	nword = (nstate + NBIT_PER_BITWORD - 1) / NBIT_PER_BITWORD;
+	frontier->is_next = (BitWord *) R_alloc((long) nword, sizeof(BitWord));
+	memset(frontier->is_next, 0, nword * sizeof(BitWord));
+	tb_matches->frontier = frontier;
+	return frontier;
+}
+
+static void reset_Frontier(Frontier *frontier)
+{
+	frontier->sids->elts[0] = 0;
+	IntAE_set_nelt(frontier->sids, 1);
+	return;
+}
+
+static void add_to_next_Frontier(Frontier *frontier, unsigned int sid)
+{
+	BitWord *bitword, mask;
+	IntAE *next_sids;
+	int nelt;
+
+	bitword = frontier->is_next + sid / NBIT_PER_BITWORD;
+	mask = 1UL << (sid % NBIT_PER_BITWORD);
+	if (*bitword & mask)
+		return;
+	*bitword |= mask;
+	next_sids = frontier->next_sids;
+	nelt = IntAE_get_nelt(next_sids);
+	if (nelt == next_sids->_buflength)
+		IntAE_extend(next_sids, 2 * nelt);
+	next_sids->elts[nelt] = (int) sid;
+	IntAE_set_nelt(next_sids, nelt + 1);
+	return;
+}
+
+/* Makes the next frontier the current one and clears the bitset. */
+static void swap_Frontier(Frontier *frontier)
+{
+	IntAE *tmp;
+	int nelt, i;
+
+	nelt = IntAE_get_nelt(frontier->next_sids);
+	for (i = 0; i < nelt; i++)
+		frontier->is_next[(unsigned int) frontier->next_sids->elts[i] /
+				  NBIT_PER_BITWORD] = 0UL;
+	tmp = frontier->sids;
+	frontier->sids = frontier->next_sids;
+	frontier->next_sids = tmp;
+	IntAE_set_nelt(frontier->next_sids, 0);
+	return;
+}
+
+static unsigned int nonfixed_transition(ACtree *tree, unsigned int sid,
+		int linktag)
+{
+	if (tree->frozen.trans != NULL)
+		return FROZEN_TRANSITION(&(tree->frozen), sid, linktag);
+	return frozen_transition(tree, GET_NODE(tree, sid), linktag);
+}
+
+static void report_frontier_matches(ACtree *tree, const Frontier *frontier,
+		TBMatchBuf *tb_matches, int n)
+{
+	const FrozenACtree *frozen;
+	int size, i;
+	unsigned int sid;
 	ACnode *node;
 
-	for (i = 0; i < node_subset_size; i++) {
-		node = node_subset[i];
+	frozen = &(tree->frozen);
+	size = IntAE_get_nelt(frontier->sids);
+	for (i = 0; i < size; i++) {
+		sid = (unsigned int) frontier->sids->elts[i];
+		if (frozen->trans != NULL) {
+			if (IS_LEAF_STATE(frozen, sid))
+				_TBMatchBuf_report_match(tb_matches,
+					LEAF_STATE_P_ID(frozen, sid) - 1, n);
+			continue;
+		}
+		node = GET_NODE(tree, sid);
 		if (IS_LEAFNODE(node))
 			_TBMatchBuf_report_match(tb_matches,
 					NODE_P_ID(node) - 1, n);
@@ -1124,35 +1997,35 @@ static void report_matches(TBMatchBuf *tb_matches, int n)
 static void walk_tb_nonfixed_subject(ACtree *tree, const Chars_holder *S,
 		TBMatchBuf *tb_matches)
 {
-	int max_size, n;
+	Frontier *frontier;
+	int n, size, i, j, linktag;
 	const unsigned char *c;
+	unsigned char base;
 
-	if (node_subset_size != 0)
-		error("Biostrings internal error in "
-		      "walk_tb_nonfixed_subject(): node_subset_size != 0... "
-		      "PLEASE REPORT THIS! THANKS.\n");
-	node_subset_size = max_size = 1;
-	node_subset[0] = GET_NODE(tree, 0U);
+	frontier = get_Frontier(tb_matches, TREE_SIZE(tree));
+	reset_Frontier(frontier);
 	for (n = 1, c = (unsigned char *) S->ptr; n <= S->length; n++, c++) {
 		if (*c >= 16) {
 			/* '*c' is not an IUPAC (base or extended) code */
-			node_subset[0] = GET_NODE(tree, 0U);
-			node_subset_size = 1;
+			reset_Frontier(frontier);
 			continue;
 		}
-		split_and_move_pointers(tree, *c);
-		merge_pointers(tree, n);
-/*
-		if (node_subset_size > max_size) {
-			max_size = node_subset_size;
-			Rprintf("walk_tb_nonfixed_subject(): "
-				"n=%d max_size=%d\n",
-				n, max_size);
+		size = IntAE_get_nelt(frontier->sids);
+		for (i = 0; i < size; i++) {
+			for (j = 0, base = 1; j < 4; j++, base *= 2) {
+				if ((*c & base) == 0)
+					continue;
+				linktag = CHAR2LINKTAG(tree, base);
+				add_to_next_Frontier(frontier,
+					nonfixed_transition(tree,
+						(unsigned int)
+						frontier->sids->elts[i],
+						linktag));
+			}
 		}
-*/
-		report_matches(tb_matches, n);
+		swap_Frontier(frontier);
+		report_frontier_matches(tree, frontier, tb_matches, n);
 	}
-	node_subset_size = 0;
 	return;
 }
 
@@ -1161,20 +2034,23 @@ void _match_tbACtree2(SEXP pptb, const Chars_holder *S, int fixedS,
 		TBMatchBuf *tb_matches)
 {
 	ACtree tree;
-	SEXP tb;
-	XStringSet_holder tb_holder;
+	int nchunk;
 
 	tree = pptb_asACtree(pptb);
-	if (fixedS) {
+	nchunk = _get_nthreads();
+	if (nchunk > S->length / MIN_CHUNK_LENGTH)
+		nchunk = S->length / MIN_CHUNK_LENGTH;
+	if (fixedS && nchunk <= 1) {
 		walk_tb_subject(&tree, S, tb_matches);
 		return;
 	}
-	if (!has_all_flinks(&tree)) {
-		tb = _get_PreprocessedTB_tb(pptb);
-		tb_holder = _hold_XStringSet(tb);
-		//Rprintf("computing all flinks... ");
-		compute_all_flinks(&tree, &tb_holder);
-		//Rprintf("OK\n");
+	/* Both walk_tb_subject_in_parallel() and walk_tb_nonfixed_subject()
+	 * use frozen_transition() so they need all the links (a frozen tree
+	 * has them all) */
+	complete_all_links(&tree, pptb);
+	if (fixedS) {
+		walk_tb_subject_in_parallel(&tree, S, tb_matches, nchunk);
+		return;
 	}
 	walk_tb_nonfixed_subject(&tree, S, tb_matches);
 	return;
@@ -1195,9 +2071,27 @@ static void walk_pdict_subject(ACtree *tree,
 {
 	ACnode *node;
 	int n, linktag;
-	unsigned int nid;
+	unsigned int nid, sid;
 	const char *node_path;
-
+	const FrozenACtree *frozen;
+
+	frozen = &(tree->frozen);
+	if (frozen->trans != NULL) {
+		sid = 0U;
+		for (n = 1, node_path = S->ptr; n <= S->length;
+		     n++, node_path++)
+		{
+			linktag = CHAR2LINKTAG(tree, *node_path);
+			sid = FROZEN_TRANSITION(frozen, sid, linktag);
+			if (IS_LEAF_STATE(frozen, sid))
+				_match_pdict_flanks_at(
+					LEAF_STATE_P_ID(frozen, sid) - 1,
+					low2high, headtail, S, n,
+					max_nmis, min_nmis, fixedP, fixedS,
+					matchpdict_buf);
+		}
+		return;
+	}
 	node = GET_NODE(tree, 0U);
 	node_path = S->ptr;
 	for (n = 1; n <= S->length; n++) {
@@ -1248,3 +2142,199 @@ void _match_pdictACtree2(SEXP pptb, HeadTail *headtail,
 	return;
 }
 
+
+
+/****************************************************************************
+ *                      K. INTERLEAVED MATCH FINDING                        *
+ ****************************************************************************/
+
+/*
+ * Walking several subjects in lockstep. When the tree is much bigger than
+ * the CPU cache (typical with a big dictionary), each step of the walk is a
+ * cache miss and walking short subjects one after the other leaves the CPU
+ * waiting for memory most of the time. Here we keep up to INTERLEAVE_WIDTH
+ * subjects "in flight": each of them takes a step in turn and the state (or
+ * node) it will need at its next step is prefetched, so the memory accesses
+ * of all the subjects in flight overlap. A subject that is done is replaced
+ * with the next one.
+ * The matches are stored in a TBBatchMatches buffer (see
+ * _TBBatchMatches_add()). The matches of a given subject are stored in the
+ * order walk_tb_subject() would report them.
+ */
+
+#define INTERLEAVE_WIDTH 16
+
+#if defined(__GNUC__)
+#define PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define PREFETCH(addr)
+#endif
+
+typedef struct walk_lane {
+	int j;  /* subject index */
+	const char *c;  /* next letter */
+	int n;  /* nb of letters walked so far */
+	unsigned int sid;  /* state id (frozen tree) or node id */
+	int node_seen;  /* walk_tb_subjects() only */
+} WalkLane;
+
+static int start_lanes(WalkLane *lanes, int nlane,
+		const Chars_holder *S, int S_to, int *next_j)
+{
+	while (nlane < INTERLEAVE_WIDTH && *next_j < S_to) {
+		if (S[*next_j].length != 0) {
+			lanes[nlane].j = *next_j;
+			lanes[nlane].c = S[*next_j].ptr;
+			lanes[nlane].n = 0;
+			lanes[nlane].sid = 0U;
+			lanes[nlane].node_seen = 0;
+			nlane++;
+		}
+		(*next_j)++;
+	}
+	return nlane;
+}
+
+/* Returns the new nb of lanes */
+static int retire_done_lanes(WalkLane *lanes, int nlane,
+		const Chars_holder *S, int S_to, int *next_j)
+{
+	int k;
+
+	for (k = 0; k < nlane; ) {
+		if (lanes[k].n < S[lanes[k].j].length) {
+			k++;
+			continue;
+		}
+		lanes[k] = lanes[--nlane];
+	}
+	return start_lanes(lanes, nlane, S, S_to, next_j);
+}
+
+/* Must NOT call any function of the R API. */
+static void walk_frozen_tb_subjects(ACtree *tree, const Chars_holder *S,
+		TBBatchMatches *matches)
+{
+	const FrozenACtree *frozen;
+	WalkLane lanes[INTERLEAVE_WIDTH], *lane;
+	int nlane, next_j, k, linktag;
+	unsigned int sid;
+
+	frozen = &(tree->frozen);
+	next_j = matches->S_from;
+	nlane = start_lanes(lanes, 0, S, matches->S_to, &next_j);
+	while (nlane != 0) {
+		for (k = 0, lane = lanes; k < nlane; k++, lane++) {
+			linktag = CHAR2LINKTAG(tree, *(lane->c++));
+			sid = FROZEN_TRANSITION(frozen, lane->sid, linktag);
+			lane->n++;
+			if (IS_LEAF_STATE(frozen, sid))
+				_TBBatchMatches_add(matches, lane->j,
+					LEAF_STATE_P_ID(frozen, sid) - 1,
+					lane->n);
+			PREFETCH(frozen->trans +
+				 (size_t) sid * MAX_CHILDREN_PER_NODE);
+			lane->sid = sid;
+		}
+		nlane = retire_done_lanes(lanes, nlane,
+					  S, matches->S_to, &next_j);
+	}
+	return;
+}
+
+/*
+ * Unlike with the frozen tree, a step touches 2 cache lines: the node
+ * (whether it's a leaf) and its extension (its links). So each step of a
+ * lane takes 2 rounds: the 1st one checks the node that was prefetched at
+ * the previous round and prefetches its extension, the 2nd one follows the
+ * link and prefetches the next node. The last node of a subject is checked
+ * right away.
+ * The tree must have all its failure links.
+ * Must NOT call any function of the R API.
+ */
+static void walk_tb_subjects(ACtree *tree, const Chars_holder *S,
+		TBBatchMatches *matches)
+{
+	WalkLane lanes[INTERLEAVE_WIDTH], *lane;
+	int nlane, next_j, k, linktag;
+	ACnode *node;
+
+	next_j = matches->S_from;
+	nlane = start_lanes(lanes, 0, S, matches->S_to, &next_j);
+	while (nlane != 0) {
+		for (k = 0, lane = lanes; k < nlane; k++, lane++) {
+			node = GET_NODE(tree, lane->sid);
+			if (!lane->node_seen) {
+				if (lane->n != 0 && IS_LEAFNODE(node))
+					_TBBatchMatches_add(matches, lane->j,
+						NODE_P_ID(node) - 1, lane->n);
+				if (IS_EXTENDEDNODE(node))
+					PREFETCH(GET_NODEEXT(tree,
+							node->nid_or_eid));
+				lane->node_seen = 1;
+				continue;
+			}
+			linktag = CHAR2LINKTAG(tree, *(lane->c++));
+			lane->sid = frozen_transition(tree, node, linktag);
+			lane->n++;
+			lane->node_seen = 0;
+			node = GET_NODE(tree, lane->sid);
+			if (lane->n < S[lane->j].length) {
+				PREFETCH(node);
+			} else if (IS_LEAFNODE(node)) {
+				_TBBatchMatches_add(matches, lane->j,
+					NODE_P_ID(node) - 1, lane->n);
+			}
+		}
+		nlane = retire_done_lanes(lanes, nlane,
+					  S, matches->S_to, &next_j);
+	}
+	return;
+}
+
+/*
+ * Entry points for the INTERLEAVED MATCH FINDING section.
+ * _prepare_tbACtree2_interleaved() must be called (in the main thread)
+ * before the 1st call to _match_tbACtree2_interleaved(). It completes the
+ * links of a tree that is not frozen (see complete_all_links()), which is
+ * a no-op once they have been completed.
+ */
+void _prepare_tbACtree2_interleaved(SEXP pptb)
+{
+	ACtree tree;
+
+	tree = pptb_asACtree(pptb);
+	complete_all_links(&tree, pptb);
+	return;
+}
+
+/*
+ * Only for fixed subjects. The 'nS' subjects are split in 'nchunk' ranges
+ * of consecutive subjects and the k-th range is walked (in its own thread
+ * if 'nchunk' > 1) into 'matches[k]'. The previous content of the
+ * 'matches[k]' buffers is dropped. The caller must check their
+ * 'malloc_failed' field.
+ */
+void _match_tbACtree2_interleaved(SEXP pptb, const Chars_holder *S, int nS,
+		TBBatchMatches *matches, int nchunk)
+{
+	ACtree tree;
+	int k;
+
+	tree = pptb_asACtree(pptb);
+	for (k = 0; k < nchunk; k++) {
+		matches[k].S_from = (int) ((long long) nS * k / nchunk);
+		matches[k].S_to = (int) ((long long) nS * (k + 1) / nchunk);
+		matches[k].nelt = 0;
+	}
+#ifdef _OPENMP
+	#pragma omp parallel for num_threads(nchunk) schedule(static, 1)
+#endif
+	for (k = 0; k < nchunk; k++) {
+		if (tree.frozen.trans != NULL)
+			walk_frozen_tb_subjects(&tree, S, matches + k);
+		else
+			walk_tb_subjects(&tree, S, matches + k);
+	}
+	return;
+}
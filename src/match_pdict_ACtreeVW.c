@@ -0,0 +1,311 @@
+/****************************************************************************
+ *                         The ACtreeVW algorithm                           *
+ *                    for variable width DNA dictionaries                   *
+ *                                                                          *
+ * Unlike the ACtree2 algorithm, which requires a Trusted Band of constant  *
+ * width (all the leaves of the tree are at the same depth), this is a      *
+ * general Aho-Corasick automaton that accepts patterns of mixed lengths.   *
+ * A pattern can end on an internal node of the tree and the output links   *
+ * are used to report the patterns that are suffixes of the current prefix *
+ * (e.g. a short adapter that is nested in a longer one).                   *
+ ****************************************************************************/
+#include "Biostrings.h"
+#include "XVector_interface.h"
+#include "IRanges_interface.h"
+#include "S4Vectors_interface.h"
+
+#include <string.h>  /* for memcpy() */
+
+
+/*
+ * The automaton is a dense DFA over the 4 bases that is stored in a single
+ * XInteger object with INTS_PER_STATE ints per state. For state s:
+ *   - states[INTS_PER_STATE * s + linktag] (linktag = 0..3) is the state
+ *     reached from s after reading the base with this linktag;
+ *   - states[INTS_PER_STATE * s + P_ID_COL] is the 1-based position in the
+ *     Trusted Band of the pattern that ends at s (NA if none);
+ *   - states[INTS_PER_STATE * s + OLINK_COL] is the output link of s i.e.
+ *     the deepest state strictly below s on its chain of failure links
+ *     where a pattern ends (0 if none).
+ * State 0 is the root. It's never the end of a pattern (empty patterns are
+ * not allowed) so 0 can be used to terminate the chains of output links.
+ * The states are numbered in BFS order so the shallow states, which are
+ * the most visited when walking a subject, are next to each other in
+ * memory.
+ */
+#define MAX_CHILDREN_PER_STATE 4
+#define P_ID_COL MAX_CHILDREN_PER_STATE
+#define OLINK_COL (P_ID_COL + 1)
+#define INTS_PER_STATE (OLINK_COL + 1)
+#define NO_STATE -1
+
+#define STATE_ROW(states, s) ((states) + (size_t) (s) * INTS_PER_STATE)
+
+
+
+/****************************************************************************
+ *                                                                          *
+ *                             A. PREPROCESSING                             *
+ *                                                                          *
+ ****************************************************************************/
+
+static int new_state(IntAE *states)
+{
+	/* not static: NA_INTEGER is not a constant expression */
+	const int row0[INTS_PER_STATE] = {
+		NO_STATE, NO_STATE, NO_STATE, NO_STATE, NA_INTEGER, 0
+	};
+	int nstate;
+
+	nstate = IntAE_get_nelt(states) / INTS_PER_STATE;
+	IntAE_append(states, row0, INTS_PER_STATE);
+	return nstate;
+}
+
+/* Returns -1 if 'pattern' contains a non-base letter. */
+static int add_pattern(IntAE *states, const ByteTrTable *char2linktag,
+		const Chars_holder *pattern, int poffset)
+{
+	int s, i, linktag, child, *row;
+
+	s = 0;
+	for (i = 0; i < pattern->length; i++) {
+		linktag = char2linktag->byte2code[(unsigned char)
+						  pattern->ptr[i]];
+		if (linktag == NA_INTEGER)
+			return -1;
+		child = STATE_ROW(states->elts, s)[linktag];
+		if (child == NO_STATE) {
+			/* new_state() can move 'states->elts' */
+			child = new_state(states);
+			STATE_ROW(states->elts, s)[linktag] = child;
+		}
+		s = child;
+	}
+	row = STATE_ROW(states->elts, s);
+	if (row[P_ID_COL] == NA_INTEGER)
+		row[P_ID_COL] = poffset + 1;
+	else
+		_report_ppdup(poffset, row[P_ID_COL]);
+	return 0;
+}
+
+/*
+ * Visits the states of the tree in BFS order to compute their failure links
+ * and output links, and replaces the missing transitions with the
+ * transitions of the failure link (which is above so is already complete).
+ * Returns the non-root states in BFS order.
+ */
+static const int *complete_automaton(int *states, int nstate)
+{
+	int *flinks, *queue, qhead, qtail, r, s, f, linktag, *row, *frow;
+
+	flinks = (int *) R_alloc((long) nstate, sizeof(int));
+	queue = (int *) R_alloc((long) nstate, sizeof(int));
+	qhead = qtail = 0;
+	row = STATE_ROW(states, 0);
+	for (linktag = 0; linktag < MAX_CHILDREN_PER_STATE; linktag++) {
+		s = row[linktag];
+		if (s == NO_STATE) {
+			row[linktag] = 0;
+			continue;
+		}
+		flinks[s] = 0;
+		queue[qtail++] = s;
+	}
+	while (qhead < qtail) {
+		r = queue[qhead++];
+		row = STATE_ROW(states, r);
+		frow = STATE_ROW(states, flinks[r]);
+		for (linktag = 0; linktag < MAX_CHILDREN_PER_STATE; linktag++) {
+			s = row[linktag];
+			if (s == NO_STATE) {
+				row[linktag] = frow[linktag];
+				continue;
+			}
+			f = flinks[s] = frow[linktag];
+			STATE_ROW(states, s)[OLINK_COL] =
+				STATE_ROW(states, f)[P_ID_COL] != NA_INTEGER ?
+				f : STATE_ROW(states, f)[OLINK_COL];
+			queue[qtail++] = s;
+		}
+	}
+	return queue;
+}
+
+/*
+ * Renumbers the states of the complete automaton so state 'bfs_order[i]'
+ * becomes state i + 1 (the root stays state 0).
+ */
+static void renumber_states(int *states, int nstate, const int *bfs_order)
+{
+	int *new_ids, *old_states, s, linktag, *row;
+
+	new_ids = (int *) R_alloc((long) nstate, sizeof(int));
+	new_ids[0] = 0;
+	for (s = 1; s < nstate; s++)
+		new_ids[bfs_order[s - 1]] = s;
+	old_states = (int *) R_alloc((long) nstate * INTS_PER_STATE,
+				     sizeof(int));
+	memcpy(old_states, states,
+	       (size_t) nstate * INTS_PER_STATE * sizeof(int));
+	for (s = 0; s < nstate; s++) {
+		row = STATE_ROW(states, new_ids[s]);
+		memcpy(row, STATE_ROW(old_states, s),
+		       INTS_PER_STATE * sizeof(int));
+		for (linktag = 0; linktag < MAX_CHILDREN_PER_STATE; linktag++)
+			row[linktag] = new_ids[row[linktag]];
+		row[OLINK_COL] = new_ids[row[OLINK_COL]];
+	}
+	return;
+}
+
+
+/****************************************************************************
+ * Turning our local data structures into an R list (SEXP)
+ * -------------------------------------------------------
+ */
+
+/*
+ * ACtreeVW_asLIST() returns an R list with the following elements:
+ *   - states: XInteger object;
+ *   - high2low: an integer vector containing the mapping between duplicated and
+ *         primary reads.
+ */
+
+static SEXP ACtreeVW_asLIST(const IntAE *states)
+{
+	SEXP ans, ans_names, ans_elt, tag;
+
+	PROTECT(ans = NEW_LIST(2));
+
+	/* set the names */
+	PROTECT(ans_names = NEW_CHARACTER(2));
+	SET_STRING_ELT(ans_names, 0, mkChar("states"));
+	SET_STRING_ELT(ans_names, 1, mkChar("high2low"));
+	SET_NAMES(ans, ans_names);
+	UNPROTECT(1);
+
+	/* set the "states" element */
+	PROTECT(tag = new_INTEGER_from_IntAE(states));
+	PROTECT(ans_elt = new_XInteger_from_tag("XInteger", tag));
+	SET_ELEMENT(ans, 0, ans_elt);
+	UNPROTECT(2);
+
+	/* set the "high2low" element */
+	PROTECT(ans_elt = _get_ppdups_buf_asINTEGER());
+	SET_ELEMENT(ans, 1, ans_elt);
+	UNPROTECT(1);
+
+	UNPROTECT(1);
+	return ans;
+}
+
+
+/****************************************************************************
+ * .Call entry point for preprocessing
+ * -----------------------------------
+ *
+ * Arguments:
+ *   tb:         the Trusted Band extracted from the original dictionary as a
+ *               DNAStringSet object (can have a variable width);
+ *   pp_exclude: NULL or an integer vector of the same length as 'tb' where
+ *               non-NA values indicate the elements to exclude from
+ *               preprocessing;
+ *   base_codes: the internal codes for A, C, G and T.
+ *
+ * See ACtreeVW_asLIST() for a description of the returned SEXP.
+ */
+
+SEXP ACtreeVW_build(SEXP tb, SEXP pp_exclude, SEXP base_codes)
+{
+	int tb_length, poffset;
+	XStringSet_holder tb_holder;
+	Chars_holder pattern;
+	ByteTrTable char2linktag;
+	IntAE *states;
+	int nstate;
+	const int *bfs_order;
+
+	if (LENGTH(base_codes) != MAX_CHILDREN_PER_STATE)
+		error("Biostrings internal error in ACtreeVW_build(): "
+		      "LENGTH(base_codes) != MAX_CHILDREN_PER_STATE");
+	_init_byte2offset_with_INTEGER(&char2linktag, base_codes, 1);
+	tb_length = _get_XStringSet_length(tb);
+	_init_ppdups_buf(tb_length);
+	tb_holder = _hold_XStringSet(tb);
+	states = new_IntAE(0, 0, 0);
+	new_state(states);  /* create the root */
+	for (poffset = 0; poffset < tb_length; poffset++) {
+		/* Skip duplicated patterns */
+		if (pp_exclude != R_NilValue
+		 && INTEGER(pp_exclude)[poffset] != NA_INTEGER)
+			continue;
+		pattern = _get_elt_from_XStringSet_holder(&tb_holder, poffset);
+		if (pattern.length == 0)
+			error("empty trusted region for pattern %d",
+			      poffset + 1);
+		if (add_pattern(states, &char2linktag, &pattern, poffset) != 0)
+			error("non-base DNA letter found in Trusted Band "
+			      "for pattern %d", poffset + 1);
+	}
+	nstate = IntAE_get_nelt(states) / INTS_PER_STATE;
+	bfs_order = complete_automaton(states->elts, nstate);
+	renumber_states(states->elts, nstate, bfs_order);
+	return ACtreeVW_asLIST(states);
+}
+
+
+
+/****************************************************************************
+ *                                                                          *
+ *                             B. MATCH FINDING                             *
+ *                                                                          *
+ ****************************************************************************/
+
+static void walk_subject(const int *states, const ByteTrTable *char2linktag,
+		const Chars_holder *S, TBMatchBuf *tb_matches)
+{
+	int n, s, linktag, P_id;
+	const int *row;
+	const char *c;
+
+	s = 0;
+	for (n = 1, c = S->ptr; n <= S->length; n++, c++) {
+		linktag = char2linktag->byte2code[(unsigned char) *c];
+		if (linktag == NA_INTEGER) {
+			s = 0;
+			continue;
+		}
+		s = STATE_ROW(states, s)[linktag];
+		row = STATE_ROW(states, s);
+		P_id = row[P_ID_COL];
+		if (P_id != NA_INTEGER)
+			_TBMatchBuf_report_match(tb_matches, P_id - 1, n);
+		/* report the patterns that are suffixes of the current one */
+		while (row[OLINK_COL] != 0) {
+			row = STATE_ROW(states, row[OLINK_COL]);
+			_TBMatchBuf_report_match(tb_matches,
+						 row[P_ID_COL] - 1, n);
+		}
+	}
+	return;
+}
+
+void _match_ACtreeVW(SEXP pptb, const Chars_holder *S, int fixedS,
+		TBMatchBuf *tb_matches)
+{
+	const int *states;
+	ByteTrTable char2linktag;
+
+	if (!fixedS)
+		error("cannot treat IUPAC extended letters in the subject "
+		      "as ambiguities when 'pdict' is a PDict object of "
+		      "the \"ACtreeVW\" type");
+	states = INTEGER(_get_ACtreeVW_states_tag(pptb));
+	_init_byte2offset_with_INTEGER(&char2linktag,
+			_get_PreprocessedTB_base_codes(pptb), 1);
+	walk_subject(states, &char2linktag, S, tb_matches);
+	return;
+}
+
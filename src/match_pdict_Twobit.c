@@ -11,6 +11,173 @@
 #include "XVector_interface.h"
 #include "IRanges_interface.h"
 
+#include <stdint.h>  /* for uint64_t */
+
+/*
+ * Dictionaries of width <= TWOBIT_MAX_DENSE_WIDTH use a dense sign2pos
+ * lookup table of 4^width ints. Wider dictionaries (up to TWOBIT_MAX_WIDTH)
+ * use an open-addressing hash table with Robin Hood insertion, keyed by the
+ * 64-bit 2-bit-per-letter signature, so the memory used is proportional to
+ * the number of patterns. The hash table is stored in the same integer
+ * vector as the dense table would be, with 3 ints per bucket: the low and
+ * high 32 bits of the signature and the 1-based position of the pattern in
+ * the Trusted Band (NA for an empty bucket). Because 4^width is never a
+ * multiple of 3, the length of the vector tells which kind of table it is
+ * (older versions of Biostrings produced dense tables for widths 13 and 14).
+ */
+#define TWOBIT_MAX_DENSE_WIDTH 12
+#define TWOBIT_MAX_WIDTH 32
+#define BUCKET_NINT 3
+#define MIN_HASH_NBIT 4
+#define MAX_HASH_NBIT 29
+
+
+/****************************************************************************
+ * 64-bit signatures and the hashed sign2pos table
+ * -----------------------------------------------
+ *
+ * TwobitEncodingBuffer only supports widths <= 15 so we use our own encoder
+ * for the hashed table.
+ */
+
+typedef struct twobit64_encoder {
+	ByteTrTable eightbit2twobit;
+	int width;
+	uint64_t mask;
+	int nb_valid_prev_char;
+	uint64_t current_signature;
+} Twobit64Encoder;
+
+static void init_Twobit64Encoder(Twobit64Encoder *enc, SEXP base_codes,
+		int width)
+{
+	if (LENGTH(base_codes) != 4)
+		error("Biostrings internal error in init_Twobit64Encoder(): "
+		      "'base_codes' must be of length 4");
+	_init_byte2offset_with_INTEGER(&(enc->eightbit2twobit), base_codes, 1);
+	enc->width = width;
+	enc->mask = width >= 32 ? ~((uint64_t) 0) :
+				  (((uint64_t) 1) << (2 * width)) - 1;
+	enc->nb_valid_prev_char = 0;
+	enc->current_signature = 0;
+	return;
+}
+
+/* Returns 1 if the last 'enc->width' letters are all bases, 0 otherwise. */
+static inline int shift_Twobit64Encoder(Twobit64Encoder *enc, char c)
+{
+	int code;
+
+	code = enc->eightbit2twobit.byte2code[(unsigned char) c];
+	if (code == NA_INTEGER) {
+		enc->nb_valid_prev_char = 0;
+		return 0;
+	}
+	enc->current_signature = ((enc->current_signature << 2) |
+				  (uint64_t) code) & enc->mask;
+	if (enc->nb_valid_prev_char < enc->width) {
+		enc->nb_valid_prev_char++;
+		if (enc->nb_valid_prev_char < enc->width)
+			return 0;
+	}
+	return 1;
+}
+
+static int is_hashed_sign2pos(int tb_width, R_xlen_t sign2pos_len)
+{
+	return tb_width > TWOBIT_MAX_DENSE_WIDTH
+	    && sign2pos_len % BUCKET_NINT == 0;
+}
+
+/* Fibonacci hashing: the top 'nbit' bits of the signature times 2^64/phi. */
+static inline unsigned int home_bucket(uint64_t sign, int nbit)
+{
+	return (unsigned int)
+		((sign * (uint64_t) 0x9E3779B97F4A7C15ULL) >> (64 - nbit));
+}
+
+static inline uint64_t get_bucket_sign(const int *bucket)
+{
+	return (uint64_t) (unsigned int) bucket[0] |
+	       ((uint64_t) (unsigned int) bucket[1] << 32);
+}
+
+static inline void set_bucket(int *bucket, uint64_t sign, int pos)
+{
+	bucket[0] = (int) (unsigned int) (sign & 0xFFFFFFFFU);
+	bucket[1] = (int) (unsigned int) (sign >> 32);
+	bucket[2] = pos;
+	return;
+}
+
+static int get_hash_nbit(R_xlen_t sign2pos_len)
+{
+	R_xlen_t nbucket;
+	int nbit;
+
+	nbucket = sign2pos_len / BUCKET_NINT;
+	nbit = 0;
+	while (((R_xlen_t) 1 << nbit) < nbucket)
+		nbit++;
+	return nbit;
+}
+
+/*
+ * Returns NA_INTEGER if 'sign' was inserted, or the position already stored
+ * for it if it's a duplicate. The table is never more than half full so
+ * there is always an empty bucket.
+ */
+static int insert_hashed_sign(int *buckets, int nbit, uint64_t sign, int pos)
+{
+	unsigned int mask, i, dist, b_dist;
+	uint64_t b_sign;
+	int *bucket, b_pos;
+
+	mask = (1U << nbit) - 1U;
+	i = home_bucket(sign, nbit);
+	for (dist = 0; ; dist++, i = (i + 1U) & mask) {
+		bucket = buckets + (size_t) i * BUCKET_NINT;
+		if (bucket[2] == NA_INTEGER) {
+			set_bucket(bucket, sign, pos);
+			return NA_INTEGER;
+		}
+		b_sign = get_bucket_sign(bucket);
+		if (b_sign == sign)
+			return bucket[2];
+		b_dist = (i - home_bucket(b_sign, nbit)) & mask;
+		if (b_dist < dist) {
+			/* Robin Hood: the richer resident moves on */
+			b_pos = bucket[2];
+			set_bucket(bucket, sign, pos);
+			sign = b_sign;
+			pos = b_pos;
+			dist = b_dist;
+		}
+	}
+}
+
+static inline int lookup_hashed_sign(const int *buckets, int nbit,
+		uint64_t sign)
+{
+	unsigned int mask, i, dist;
+	uint64_t b_sign;
+	const int *bucket;
+
+	mask = (1U << nbit) - 1U;
+	i = home_bucket(sign, nbit);
+	for (dist = 0; ; dist++, i = (i + 1U) & mask) {
+		bucket = buckets + (size_t) i * BUCKET_NINT;
+		if (bucket[2] == NA_INTEGER)
+			return NA_INTEGER;
+		b_sign = get_bucket_sign(bucket);
+		if (b_sign == sign)
+			return bucket[2];
+		/* 'sign' would have displaced this resident */
+		if (((i - home_bucket(b_sign, nbit)) & mask) < dist)
+			return NA_INTEGER;
+	}
+}
+
 
 /****************************************************************************
  *                                                                          *
@@ -45,6 +212,42 @@ static int pp_pattern(SEXP twobit_sign2pos, TwobitEncodingBuffer *teb,
 	return 0;
 }
 
+static int pp_hashed_pattern(SEXP twobit_sign2pos, int nbit,
+		Twobit64Encoder *enc, const Chars_holder *pattern, int poffset)
+{
+	int i, is_valid, pos0;
+
+	enc->nb_valid_prev_char = 0;
+	is_valid = 0;
+	for (i = 0; i < pattern->length; i++)
+		is_valid = shift_Twobit64Encoder(enc, pattern->ptr[i]);
+	if (!is_valid)
+		return -1;
+	pos0 = insert_hashed_sign(INTEGER(twobit_sign2pos), nbit,
+				  enc->current_signature, poffset + 1);
+	if (pos0 != NA_INTEGER)
+		_report_ppdup(poffset, pos0);
+	return 0;
+}
+
+static SEXP alloc_hashed_sign2pos(int npatterns, int *nbit)
+{
+	SEXP twobit_sign2pos;
+	size_t nbucket;
+
+	/* Keep the load factor <= 0.5 */
+	*nbit = MIN_HASH_NBIT;
+	while (((size_t) 1 << *nbit) < 2 * (size_t) npatterns)
+		(*nbit)++;
+	if (*nbit > MAX_HASH_NBIT)
+		error("too many patterns for 'type=\"Twobit\"'");
+	nbucket = (size_t) 1 << *nbit;
+	PROTECT(twobit_sign2pos = NEW_INTEGER(nbucket * BUCKET_NINT));
+	init_twobit_sign2pos(twobit_sign2pos, NA_INTEGER);
+	UNPROTECT(1);
+	return twobit_sign2pos;
+}
+
 
 /****************************************************************************
  * Turning our local data structures into an R list (SEXP)
@@ -103,10 +306,11 @@ static SEXP Twobit_asLIST(SEXP twobit_sign2pos)
 
 SEXP build_Twobit(SEXP tb, SEXP pp_exclude, SEXP base_codes)
 {
-	int tb_length, tb_width, poffset, twobit_len;
+	int tb_length, tb_width, poffset, twobit_len, is_hashed, nbit, ret;
 	XStringSet_holder tb_holder;
 	Chars_holder pattern;
 	TwobitEncodingBuffer teb;
+	Twobit64Encoder enc;
 	SEXP ans, twobit_sign2pos;
 
 	tb_length = _get_XStringSet_length(tb);
@@ -124,18 +328,35 @@ SEXP build_Twobit(SEXP tb, SEXP pp_exclude, SEXP base_codes)
 			      poffset + 1);
 		if (tb_width == -1) {
 			tb_width = pattern.length;
-			if (tb_width > 14)
+			if (tb_width > TWOBIT_MAX_WIDTH)
 				error("the width of the Trusted Band must "
-				      "be <= 14 when 'type=\"Twobit\"'");
-			teb = _new_TwobitEncodingBuffer(base_codes, tb_width, 0);
-			twobit_len = 1 << (tb_width * 2); // 4^tb_width
-			PROTECT(twobit_sign2pos = NEW_INTEGER(twobit_len));
-			init_twobit_sign2pos(twobit_sign2pos, NA_INTEGER);
+				      "be <= %d when 'type=\"Twobit\"'",
+				      TWOBIT_MAX_WIDTH);
+			is_hashed = tb_width > TWOBIT_MAX_DENSE_WIDTH;
+			if (is_hashed) {
+				init_Twobit64Encoder(&enc, base_codes,
+						     tb_width);
+				PROTECT(twobit_sign2pos =
+					alloc_hashed_sign2pos(tb_length,
+							      &nbit));
+			} else {
+				teb = _new_TwobitEncodingBuffer(base_codes,
+							tb_width, 0);
+				twobit_len = 1 << (tb_width * 2); // 4^tb_width
+				PROTECT(twobit_sign2pos =
+					NEW_INTEGER(twobit_len));
+				init_twobit_sign2pos(twobit_sign2pos,
+						     NA_INTEGER);
+			}
 		} else if (pattern.length != tb_width) {
 			error("all the trusted regions must have "
 			      "the same length");
 		}
-		if (pp_pattern(twobit_sign2pos, &teb, &pattern, poffset) != 0) {
+		ret = is_hashed ?
+		      pp_hashed_pattern(twobit_sign2pos, nbit, &enc,
+					&pattern, poffset) :
+		      pp_pattern(twobit_sign2pos, &teb, &pattern, poffset);
+		if (ret != 0) {
 			UNPROTECT(1);
 			error("non-base DNA letter found in Trusted Band "
 			      "for pattern %d", poffset + 1);
@@ -174,22 +395,53 @@ void walk_subject(const int *twobit_sign2pos, TwobitEncodingBuffer *teb,
 	return;
 }
 
+static void walk_subject_hashed(const int *buckets, int nbit,
+		Twobit64Encoder *enc, const Chars_holder *S,
+		TBMatchBuf *tb_matches)
+{
+	int n, P_id;
+	const char *s;
+
+	enc->nb_valid_prev_char = 0;
+	for (n = 1, s = S->ptr; n <= S->length; n++, s++) {
+		if (!shift_Twobit64Encoder(enc, *s))
+			continue;
+		P_id = lookup_hashed_sign(buckets, nbit,
+					  enc->current_signature);
+		if (P_id == NA_INTEGER)
+			continue;
+		_TBMatchBuf_report_match(tb_matches, P_id - 1, n);
+	}
+	return;
+}
+
 void _match_Twobit(SEXP pptb, const Chars_holder *S, int fixedS,
 		TBMatchBuf *tb_matches)
 {
 	int tb_width;
 	const int *twobit_sign2pos;
-	SEXP base_codes;
+	R_xlen_t sign2pos_len;
+	SEXP base_codes, sign2pos_tag;
 	TwobitEncodingBuffer teb;
+	Twobit64Encoder enc;
 
 	tb_width = _get_PreprocessedTB_width(pptb);
-	twobit_sign2pos = INTEGER(_get_Twobit_sign2pos_tag(pptb));
+	sign2pos_tag = _get_Twobit_sign2pos_tag(pptb);
+	twobit_sign2pos = INTEGER(sign2pos_tag);
+	sign2pos_len = XLENGTH(sign2pos_tag);
 	base_codes = _get_PreprocessedTB_base_codes(pptb);
-	teb = _new_TwobitEncodingBuffer(base_codes, tb_width, 0);
 	if (!fixedS)
 		error("cannot treat IUPAC extended letters in the subject "
 		      "as ambiguities when 'pdict' is a PDict object of "
 		      "the \"Twobit\" type");
+	if (is_hashed_sign2pos(tb_width, sign2pos_len)) {
+		init_Twobit64Encoder(&enc, base_codes, tb_width);
+		walk_subject_hashed(twobit_sign2pos,
+				    get_hash_nbit(sign2pos_len),
+				    &enc, S, tb_matches);
+		return;
+	}
+	teb = _new_TwobitEncodingBuffer(base_codes, tb_width, 0);
 	walk_subject(twobit_sign2pos, &teb, S, tb_matches);
 	return;
 }
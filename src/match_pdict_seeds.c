@@ -0,0 +1,317 @@
+/****************************************************************************
+ *             Inexact matching of a DNA dictionary using seeds             *
+ *                                                                          *
+ * For an MTB_PDict object, the first min(width(dict0)) letters of each     *
+ * pattern are split in max.mismatch + 1 disjoint Trusted Bands. By the     *
+ * pigeonhole principle, a match with at most max.mismatch mismatches has   *
+ * at least 1 Trusted Band that matches exactly. So instead of walking 1    *
+ * tree per Trusted Band (and matching the heads and tails of each of them),*
+ * we index all the Trusted Bands (the "seeds") in a single ACtreeVW        *
+ * automaton, walk the subject once, and verify each candidate (pattern,    *
+ * start) once against the entire pattern.                                  *
+ ****************************************************************************/
+#include "Biostrings.h"
+#include "XVector_interface.h"
+#include "IRanges_interface.h"
+#include "S4Vectors_interface.h"
+
+#include <stdint.h>  /* for uint64_t */
+#include <string.h>  /* for memcpy() and memcmp() */
+
+
+/****************************************************************************
+ * Bit-parallel mismatch counting
+ * ------------------------------
+ *
+ * The letters of a DNA sequence are encoded as bit masks (1 bit per base)
+ * so we compare 8 letters at a time with the 64-bit word operations that
+ * correspond to the 4 bytewise match tables (see lowlevel_matching.c).
+ */
+
+#define LOW7_BITS ((uint64_t) 0x7F7F7F7F7F7F7F7FULL)
+#define HIGH1_BIT ((uint64_t) 0x8080808080808080ULL)
+#define LOW1_BIT ((uint64_t) 0x0101010101010101ULL)
+
+/* Nb of non-zero bytes in 'x'. */
+static inline int count_nonzero_bytes(uint64_t x)
+{
+	x = (((x & LOW7_BITS) + LOW7_BITS) | x) & HIGH1_BIT;
+	/* now 1 bit per non-zero byte: add them up in the top byte */
+	return (int) ((((x >> 7) & LOW1_BIT) * LOW1_BIT) >> 56);
+}
+
+/* Nb of mismatching letters in 8 letters of the pattern ('p') and
+   8 letters of the subject ('s'). */
+static inline int nmismatch_in_word(uint64_t p, uint64_t s,
+		int fixedP, int fixedS)
+{
+	if (fixedP)
+		return count_nonzero_bytes(fixedS ? p ^ s : p & ~s);
+	if (fixedS)
+		return count_nonzero_bytes(~p & s);
+	return 8 - count_nonzero_bytes(p & s);
+}
+
+/*
+ * Like _nmismatch_at_Pshift() (the letters of 'P' that fall outside 'S' are
+ * mismatches) but compares 8 letters at a time. Stops counting when the
+ * number of mismatches exceeds 'max_nmis'.
+ */
+static int nmismatch_at_Pshift(const Chars_holder *P, const Chars_holder *S,
+		int Pshift, int max_nmis, int fixedP, int fixedS,
+		const BytewiseOpTable *bytewise_match_table)
+{
+	int i1, i2, i, nmis;
+	const char *p, *s;
+	uint64_t pw, sw;
+
+	/* 'P' letters i1 to i2 - 1 are within 'S' */
+	i1 = Pshift < 0 ? -Pshift : 0;
+	i2 = S->length - Pshift;
+	if (i2 > P->length)
+		i2 = P->length;
+	if (i2 < i1)
+		i2 = i1;
+	nmis = i1 + (P->length - i2);
+	if (nmis > max_nmis)
+		return nmis;
+	p = P->ptr;
+	s = S->ptr + Pshift;
+	for (i = i1; i + 8 <= i2; i += 8) {
+		memcpy(&pw, p + i, sizeof(uint64_t));
+		memcpy(&sw, s + i, sizeof(uint64_t));
+		nmis += nmismatch_in_word(pw, sw, fixedP, fixedS);
+		if (nmis > max_nmis)
+			return nmis;
+	}
+	for ( ; i < i2; i++) {
+		if (bytewise_match_table->xy2val[(unsigned char) p[i]]
+						[(unsigned char) s[i]])
+			continue;
+		if (nmis++ >= max_nmis)
+			break;
+	}
+	return nmis;
+}
+
+
+/****************************************************************************
+ * Candidate verification
+ * ----------------------
+ */
+
+typedef struct seeds_ctx {
+	SEXP seeds_pptb;
+	SEXP low2high;
+	XStringSet_holder dict;
+	int npattern;
+	int nband;
+	const int *seed_offsets;  /* band k is at seed_offsets[k] to
+				     seed_offsets[k+1] - 1 (0-based) */
+	int max_nmis, min_nmis, fixedP;
+	const BytewiseOpTable *bytewise_match_table;
+} SeedsCtx;
+
+/*
+ * A match has at least 1 band that matches exactly but can have several of
+ * them. To verify each candidate (pattern, start) only once, we only verify
+ * the candidate found by its 1st exact band.
+ */
+static int has_lower_exact_band(const SeedsCtx *ctx, const Chars_holder *P,
+		const Chars_holder *S, int Pshift, int band)
+{
+	int k, from, to;
+
+	for (k = 0; k < band; k++) {
+		from = Pshift + ctx->seed_offsets[k];
+		to = Pshift + ctx->seed_offsets[k + 1];
+		if (from < 0 || to > S->length)
+			continue;
+		if (memcmp(P->ptr + ctx->seed_offsets[k], S->ptr + from,
+			   to - from) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+static void verify_candidates(const SeedsCtx *ctx, int seed_id,
+		const Chars_holder *S, const IntAE *seed_ends,
+		MatchBuf *matches)
+{
+	int band, P_id, nend, j, Pshift, nmis;
+	Chars_holder P;
+
+	band = seed_id / ctx->npattern;
+	P_id = seed_id % ctx->npattern;
+	P = _get_elt_from_XStringSet_holder(&(ctx->dict), P_id);
+	nend = IntAE_get_nelt(seed_ends);
+	for (j = 0; j < nend; j++) {
+		/* 0-based position of the pattern in 'S' */
+		Pshift = seed_ends->elts[j] - ctx->seed_offsets[band + 1];
+		if (has_lower_exact_band(ctx, &P, S, Pshift, band))
+			continue;
+		nmis = nmismatch_at_Pshift(&P, S, Pshift, ctx->max_nmis,
+				ctx->fixedP, 1, ctx->bytewise_match_table);
+		if (nmis <= ctx->max_nmis && nmis >= ctx->min_nmis)
+			_MatchBuf_report_match(matches, P_id, Pshift + 1,
+					       P.length);
+	}
+	return;
+}
+
+/* The ends of the matches of each pattern are reported in ascending order
+   (like with the other types of PDict objects). */
+static void sort_match_starts(MatchBuf *matches)
+{
+	int nelt, i, P_id;
+
+	if (matches->match_starts == NULL)
+		return;
+	nelt = IntAE_get_nelt(matches->PSlink_ids);
+	for (i = 0; i < nelt; i++) {
+		P_id = matches->PSlink_ids->elts[i];
+		/* all the matches of a pattern have the same width */
+		IntAE_qsort(matches->match_starts->elts[P_id], 0, 0);
+	}
+	return;
+}
+
+static void match_seeds(const SeedsCtx *ctx, const Chars_holder *S,
+		TBMatchBuf *seed_matches, MatchBuf *matches)
+{
+	int nelt, i, low, nhigh, h;
+	const IntAE *seed_ends;
+	SEXP highs;
+
+	_match_ACtreeVW(ctx->seeds_pptb, S, 1, seed_matches);
+	nelt = IntAE_get_nelt(seed_matches->PSlink_ids);
+	for (i = 0; i < nelt; i++) {
+		low = seed_matches->PSlink_ids->elts[i];
+		seed_ends = seed_matches->match_ends->elts[low];
+		verify_candidates(ctx, low, S, seed_ends, matches);
+		/* the same seed can belong to several (pattern, band) */
+		highs = VECTOR_ELT(ctx->low2high, low);
+		if (highs == R_NilValue)
+			continue;
+		nhigh = LENGTH(highs);
+		for (h = 0; h < nhigh; h++)
+			verify_candidates(ctx, INTEGER(highs)[h] - 1,
+					  S, seed_ends, matches);
+	}
+	_TBMatchBuf_flush(seed_matches);
+	return;
+}
+
+static SeedsCtx new_SeedsCtx(SEXP seeds_pptb, SEXP dict0, SEXP seed_offsets,
+		SEXP max_mismatch, SEXP min_mismatch, SEXP fixed)
+{
+	SeedsCtx ctx;
+
+	if (!LOGICAL(fixed)[1])
+		error("Biostrings internal error in new_SeedsCtx(): "
+		      "the subject must be fixed");
+	ctx.seeds_pptb = seeds_pptb;
+	ctx.low2high = _get_PreprocessedTB_low2high(seeds_pptb);
+	ctx.dict = _hold_XStringSet(dict0);
+	ctx.npattern = _get_length_from_XStringSet_holder(&(ctx.dict));
+	ctx.nband = LENGTH(seed_offsets) - 1;
+	ctx.seed_offsets = INTEGER(seed_offsets);
+	if (_get_PreprocessedTB_length(seeds_pptb) !=
+	    ctx.npattern * ctx.nband)
+		error("Biostrings internal error in new_SeedsCtx(): "
+		      "the seeds don't match the dictionary");
+	ctx.max_nmis = INTEGER(max_mismatch)[0];
+	ctx.min_nmis = INTEGER(min_mismatch)[0];
+	ctx.fixedP = LOGICAL(fixed)[0];
+	ctx.bytewise_match_table = _select_bytewise_match_table(ctx.fixedP, 1);
+	return ctx;
+}
+
+
+/****************************************************************************
+ * .Call entry points: match_seeds_XString()
+ *                     match_seeds_XStringViews()
+ *
+ * Arguments:
+ *   - seeds_pptb: the ACtreeVW object where the Trusted Bands of all the
+ *       patterns are stored (the k-th band of the i-th pattern is the
+ *       seed at position (k - 1) * length(dict0) + i);
+ *   - dict0: the original dictionary (DNAStringSet);
+ *   - seed_offsets: integer vector of length nb of bands + 1 (the k-th band
+ *       of a pattern is at positions seed_offsets[k] + 1 to
+ *       seed_offsets[k + 1]);
+ *   - subject: reference sequence (XString);
+ *   - views_start, views_width: views defined on the subject
+ *       (match_seeds_XStringViews() only);
+ *   - max_mismatch, min_mismatch: max.mismatch, min.mismatch (nb of
+ *       mismatches along the entire pattern);
+ *   - fixed: logical vector of length 2 (the subject must be fixed);
+ *   - matches_as: "MATCHES_AS_WHICH", "MATCHES_AS_COUNTS" or
+ *       "MATCHES_AS_ENDS";
+ *   - envir: NULL or environment to be populated with the matches.
+ */
+
+/* --- .Call ENTRY POINT --- */
+SEXP match_seeds_XString(SEXP seeds_pptb, SEXP dict0, SEXP seed_offsets,
+		SEXP subject,
+		SEXP max_mismatch, SEXP min_mismatch, SEXP fixed,
+		SEXP matches_as, SEXP envir)
+{
+	SeedsCtx ctx;
+	Chars_holder S;
+	TBMatchBuf seed_matches;
+	MatchBuf matches;
+
+	ctx = new_SeedsCtx(seeds_pptb, dict0, seed_offsets,
+			   max_mismatch, min_mismatch, fixed);
+	S = hold_XRaw(subject);
+	seed_matches = _new_TBMatchBuf(_get_PreprocessedTB_length(seeds_pptb),
+				       0, NULL, NULL, NULL);
+	matches = _new_MatchBuf(
+			_get_match_storing_code(CHAR(STRING_ELT(matches_as, 0))),
+			ctx.npattern);
+	match_seeds(&ctx, &S, &seed_matches, &matches);
+	sort_match_starts(&matches);
+	return _MatchBuf_as_SEXP(&matches, envir);
+}
+
+/* --- .Call ENTRY POINT --- */
+SEXP match_seeds_XStringViews(SEXP seeds_pptb, SEXP dict0, SEXP seed_offsets,
+		SEXP subject, SEXP views_start, SEXP views_width,
+		SEXP max_mismatch, SEXP min_mismatch, SEXP fixed,
+		SEXP matches_as, SEXP envir)
+{
+	SeedsCtx ctx;
+	Chars_holder S, S_view;
+	int ms_code, nviews, v, *view_start, *view_width, view_offset;
+	TBMatchBuf seed_matches;
+	MatchBuf matches, global_matches;
+
+	ctx = new_SeedsCtx(seeds_pptb, dict0, seed_offsets,
+			   max_mismatch, min_mismatch, fixed);
+	S = hold_XRaw(subject);
+	seed_matches = _new_TBMatchBuf(_get_PreprocessedTB_length(seeds_pptb),
+				       0, NULL, NULL, NULL);
+	ms_code = _get_match_storing_code(CHAR(STRING_ELT(matches_as, 0)));
+	matches = _new_MatchBuf(ms_code, ctx.npattern);
+	global_matches = _new_MatchBuf(ms_code, ctx.npattern);
+	nviews = LENGTH(views_start);
+	for (v = 0,
+	     view_start = INTEGER(views_start),
+	     view_width = INTEGER(views_width);
+	     v < nviews;
+	     v++, view_start++, view_width++)
+	{
+		view_offset = *view_start - 1;
+		if (view_offset < 0 || view_offset + *view_width > S.length)
+			error("'subject' has \"out of limits\" views");
+		S_view.ptr = S.ptr + view_offset;
+		S_view.length = *view_width;
+		match_seeds(&ctx, &S_view, &seed_matches, &matches);
+		_MatchBuf_append_and_flush(&global_matches, &matches,
+					   view_offset);
+	}
+	sort_match_starts(&global_matches);
+	return _MatchBuf_as_SEXP(&global_matches, envir);
+}
+
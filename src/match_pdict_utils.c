@@ -8,8 +8,9 @@
 #include "S4Vectors_interface.h"
 #include <S.h> /* for Salloc() */
 
+#include <stdlib.h> /* for realloc() and free() */
+#include <string.h> /* for strcmp() */
 #include <limits.h> /* for ULONG_MAX */
-#include <time.h> /* for clock() and CLOCKS_PER_SEC */
 
 
 /****************************************************************************
@@ -20,16 +21,19 @@
  */
 
 TBMatchBuf _new_TBMatchBuf(int tb_length, int tb_width,
+		const int *tb_widths,
 		const int *head_widths, const int *tail_widths)
 {
 	static TBMatchBuf buf;
 
 	buf.is_init = 1;
 	buf.tb_width = tb_width;
+	buf.tb_widths = tb_widths;
 	buf.head_widths = head_widths;
 	buf.tail_widths = tail_widths;
 	buf.PSlink_ids = new_IntAE(0, 0, 0);
 	buf.match_ends = new_IntAEAE(tb_length, tb_length);
+	buf.frontier = NULL;
 	return buf;
 }
 
@@ -64,7 +68,65 @@ void _TBMatchBuf_flush(TBMatchBuf *buf)
 	return;
 }
 
+void _init_TBBatchMatches(TBBatchMatches *matches)
+{
+	matches->S_from = matches->S_to = 0;
+	matches->S_ids = matches->P_ids = matches->ends = NULL;
+	matches->nelt = matches->buflength = 0;
+	matches->malloc_failed = 0;
+	return;
+}
+
+void _free_TBBatchMatches(TBBatchMatches *matches)
+{
+	free(matches->S_ids);
+	free(matches->P_ids);
+	free(matches->ends);
+	_init_TBBatchMatches(matches);
+	return;
+}
+
+static int *realloc_ints(int *x, size_t new_buflength, int *malloc_failed)
+{
+	int *new_x;
+
+	new_x = (int *) realloc(x, sizeof(int) * new_buflength);
+	if (new_x == NULL) {
+		*malloc_failed = 1;
+		return x;
+	}
+	return new_x;
+}
+
+/* Must NOT call any function of the R API. */
+void _TBBatchMatches_add(TBBatchMatches *matches, int S_id, int P_id, int end)
+{
+	size_t new_buflength;
+
+	if (matches->malloc_failed)
+		return;
+	if (matches->nelt == matches->buflength) {
+		new_buflength = matches->buflength == 0 ?
+				1024 : 2 * matches->buflength;
+		matches->S_ids = realloc_ints(matches->S_ids, new_buflength,
+					      &(matches->malloc_failed));
+		matches->P_ids = realloc_ints(matches->P_ids, new_buflength,
+					      &(matches->malloc_failed));
+		matches->ends = realloc_ints(matches->ends, new_buflength,
+					     &(matches->malloc_failed));
+		if (matches->malloc_failed)
+			return;
+		matches->buflength = new_buflength;
+	}
+	matches->S_ids[matches->nelt] = S_id;
+	matches->P_ids[matches->nelt] = P_id;
+	matches->ends[matches->nelt] = end;
+	matches->nelt++;
+	return;
+}
+
 MatchPDictBuf _new_MatchPDictBuf(SEXP matches_as, int tb_length, int tb_width,
+		const int *tb_widths,
 		const int *head_widths, const int *tail_widths)
 {
 	const char *ms_mode;
@@ -75,9 +137,10 @@ MatchPDictBuf _new_MatchPDictBuf(SEXP matches_as, int tb_length, int tb_width,
 	ms_code = _get_match_storing_code(ms_mode);
 	if (ms_code == MATCHES_AS_NULL) {
 		buf.tb_matches.is_init = 0;
+		buf.tb_matches.frontier = NULL;
 	} else {
 		buf.tb_matches = _new_TBMatchBuf(tb_length, tb_width,
-					head_widths, tail_widths);
+					tb_widths, head_widths, tail_widths);
 		buf.matches = _new_MatchBuf(ms_code, tb_length);
 	}
 	return buf;
@@ -85,17 +148,13 @@ MatchPDictBuf _new_MatchPDictBuf(SEXP matches_as, int tb_length, int tb_width,
 
 void _MatchPDictBuf_report_match(MatchPDictBuf *buf, int PSpair_id, int tb_end)
 {
-	IntAE *PSlink_ids, *count_buf, *start_buf, *width_buf;
 	int start, width;
 
 	if (buf->tb_matches.is_init == 0)
 		return;
-	PSlink_ids = buf->matches.PSlink_ids;
-	count_buf = buf->matches.match_counts;
-	if (count_buf->elts[PSpair_id]++ == 0)
-		IntAE_insert_at(PSlink_ids,
-			IntAE_get_nelt(PSlink_ids), PSpair_id);
-	width = buf->tb_matches.tb_width;
+	width = buf->tb_matches.tb_widths != NULL ?
+		buf->tb_matches.tb_widths[PSpair_id] :
+		buf->tb_matches.tb_width;
 	start = tb_end - width + 1;
 	if (buf->tb_matches.head_widths != NULL) {
 		start -= buf->tb_matches.head_widths[PSpair_id];
@@ -103,14 +162,7 @@ void _MatchPDictBuf_report_match(MatchPDictBuf *buf, int PSpair_id, int tb_end)
 	}
 	if (buf->tb_matches.tail_widths != NULL)
 		width += buf->tb_matches.tail_widths[PSpair_id];
-	if (buf->matches.match_starts != NULL) {
-		start_buf = buf->matches.match_starts->elts[PSpair_id];
-		IntAE_insert_at(start_buf, IntAE_get_nelt(start_buf), start);
-	}
-	if (buf->matches.match_widths != NULL) {
-		width_buf = buf->matches.match_widths->elts[PSpair_id];
-		IntAE_insert_at(width_buf, IntAE_get_nelt(width_buf), width);
-	}
+	_MatchBuf_report_match(&(buf->matches), PSpair_id, start, width);
 	return;
 }
 
@@ -314,6 +366,9 @@ static void match_headtail_by_key(HeadTail *headtail,
 
 #define MAX_REMAINING_KEYS 24  // >= 0 and < NBIT_PER_BITWORD
 #define TMPMATCH_BMBUF_MAXNCOL 200
+/* Max value of max_Hwidth + max_Twidth for which the head and tail get
+   preprocessed (see the criteria in _new_HeadTail()) */
+#define PPHEADTAIL_MAX_HTWIDTH (10 + 4 * 4)
 
 static PPHeadTail new_PPHeadTail(SEXP base_codes, int bmbuf_nrow,
 		int max_Hwidth, int max_Twidth, int max_nmis)
@@ -526,16 +581,25 @@ static void preprocess_tail(const RoSeqs *tail, const IntAE *grouped_keys,
 	return;
 }
 
+/*
+ * The columns of the head and tail BitMatrix buffers that correspond to the
+ * letters of 'S' around 'tb_end' are collected first (a column of ones
+ * for a letter that is not a base i.e. a mismatch for all the patterns)
+ * and then added to the nmis counters in a single pass (see
+ * _BitMatrix_grow1rows_ncols()).
+ */
 static BitCol match_ppheadtail_for_loc(HeadTail *headtail, int tb_width,
 		const Chars_holder *S, int tb_end, int max_nmis, int min_nmis)
 {
 	BitMatrix *nmis_bmbuf;
 	const BitMatrix *head_bmbuf, *tail_bmbuf;
-	int j1, j2, offset;
+	int j1, j2, offset, ncol;
 	char s;
-	BitCol bitcol, max_nmis_bitcol, min_nmis_bitcol;
+	const BitWord *cols[PPHEADTAIL_MAX_HTWIDTH];
+	BitCol max_nmis_bitcol, min_nmis_bitcol;
 
 	nmis_bmbuf = &(headtail->ppheadtail.nmis_bmbuf);
+	ncol = 0;
 	// Match the heads
 	head_bmbuf = headtail->ppheadtail.head_bmbuf;
 	for (j1 = 0, j2 = tb_end - tb_width - 1;
@@ -548,11 +612,11 @@ static BitCol match_ppheadtail_for_loc(HeadTail *headtail, int tb_width,
 		s = S->ptr[j2];
 		offset = headtail->ppheadtail.byte2offset.byte2code[(unsigned char) s];
 		if (offset == NA_INTEGER) {
-			_BitMatrix_Rrot1(nmis_bmbuf);
+			cols[ncol++] = NULL;
 			continue;
 		}
-		bitcol = _BitMatrix_get_col(head_bmbuf + offset, j1);
-		_BitMatrix_grow1rows(nmis_bmbuf, &bitcol);
+		cols[ncol++] = _BitMatrix_get_col(head_bmbuf + offset,
+						  j1).bitword0;
 	}
 	// Match the tails
 	tail_bmbuf = headtail->ppheadtail.tail_bmbuf;
@@ -566,12 +630,13 @@ static BitCol match_ppheadtail_for_loc(HeadTail *headtail, int tb_width,
 		s = S->ptr[j2];
 		offset = headtail->ppheadtail.byte2offset.byte2code[(unsigned char) s];
 		if (offset == NA_INTEGER) {
-			_BitMatrix_Rrot1(nmis_bmbuf);
+			cols[ncol++] = NULL;
 			continue;
 		}
-		bitcol = _BitMatrix_get_col(tail_bmbuf + offset, j1);
-		_BitMatrix_grow1rows(nmis_bmbuf, &bitcol);
+		cols[ncol++] = _BitMatrix_get_col(tail_bmbuf + offset,
+						  j1).bitword0;
 	}
+	_BitMatrix_grow1rows_ncols(nmis_bmbuf, cols, ncol);
 	max_nmis_bitcol = _BitMatrix_get_col(nmis_bmbuf, max_nmis);
 	if (min_nmis >= 1) {
 		min_nmis_bitcol = _BitMatrix_get_col(nmis_bmbuf, min_nmis - 1);
@@ -580,24 +645,39 @@ static BitCol match_ppheadtail_for_loc(HeadTail *headtail, int tb_width,
 	return max_nmis_bitcol;
 }
 
+/* Index of the lowest bit set in non-zero 'x'. */
+static inline int lowest_bit(BitWord x)
+{
+#if defined(__GNUC__)
+	return __builtin_ctzl(x);
+#else
+	int i;
+
+	for (i = 0; !(x & 1UL); i++)
+		x >>= 1;
+	return i;
+#endif
+}
+
 static void report_matches_for_loc(const BitCol *bitcol, HeadTail *headtail,
 		int tb_end, MatchPDictBuf *matchpdict_buf)
 {
-	// Note that using _BitCol_get_bit() for this would be easier but is
-	// also twice slower!
-	BitWord *bitword;
-	int i, i2;
-
-	bitword = bitcol->bitword0;
-	for (i = i2 = 0; i < bitcol->nbit; i++, i2++) {
-		if (i2 >= NBIT_PER_BITWORD) {
-			i2 = 0;
-			bitword++;
-		}
-		if (!(*bitword & 1UL)) {
-			//_MatchPDictBuf_report_match(matchpdict_buf,
-			//	headtail->grouped_keys.elts[i], tb_end);
-			int key, start, width;
+	// Only the 0 bits (i.e. the matches) are visited so the words with
+	// no match (the vast majority) are skipped at once.
+	const BitWord *bitword;
+	BitWord matches;
+	int i1, i, key, start, width;
+
+	for (i1 = 0, bitword = bitcol->bitword0;
+	     i1 * (int) NBIT_PER_BITWORD < bitcol->nbit;
+	     i1++, bitword++)
+	{
+		for (matches = ~(*bitword); matches != 0UL;
+		     matches &= matches - 1UL)
+		{
+			i = i1 * NBIT_PER_BITWORD + lowest_bit(matches);
+			if (i >= bitcol->nbit)
+				break;
 			key = headtail->grouped_keys->elts[i];
 			width = headtail->head.elts[key].length
 			      + matchpdict_buf->tb_matches.tb_width
@@ -605,7 +685,6 @@ static void report_matches_for_loc(const BitCol *bitcol, HeadTail *headtail,
 			start = tb_end + headtail->tail.elts[key].length - width + 1;
 			_MatchPDictBuf_report_match2(matchpdict_buf, key, start, width);
 		}
-		*bitword >>= 1;
 	}
 	return;
 }
@@ -743,36 +822,49 @@ static void match_ppheadtail(HeadTail *headtail,
 }
 
 /*
-static void BENCHMARK_match_ppheadtail(HeadTail *headtail,
-		const Chars_holder *S, const IntAE *tb_end_buf,
-		int max_nmis, int min_nmis,
-		const BytewiseOpTable *bytewise_match_table,
-		MatchPDictBuf *matchpdict_buf)
-{
-	clock_t time0;
-	double dt1, dt2;
-	int i;
+ * The engine used by _match_pdict_all_flanks() for matching the heads and
+ * tails can be forced with .Call("set_headtail_engine", engine) where
+ * 'engine' is one of:
+ *   - "auto": the BitMatrix engine is used when the head and tail could be
+ *     preprocessed and the Trusted Band has at least 15 matches (the
+ *     default);
+ *   - "bruteforce": the brute force engine is always used;
+ *   - "bitmatrix": the BitMatrix engine is used whenever the head and tail
+ *     could be preprocessed;
+ *   - "bitmatrix-scalar": same as "bitmatrix" but without the SIMD kernels.
+ * This is only for benchmarking and testing (see
+ * inst/benchmarks/headtail_matching.R).
+ */
 
-	time0 = clock();
-	for (i = 0; i < 100; i++) {
-		match_ppheadtail0(headtail,
-			S, tb_end_buf, max_nmis, min_nmis,
-			bytewise_match_table,
-			matchpdict_buf);
-	}
-	dt1 = (double) (clock() - time0) / CLOCKS_PER_SEC;
-	time0 = clock();
-	for (i = 0; i < 100; i++) {
-		match_headtail_by_key(headtail,
-			S, tb_end_buf,
-			max_nmis, min_nmis, bytewise_match_table,
-			matchpdict_buf);
-	}
-	dt2 = (double) (clock() - time0) / CLOCKS_PER_SEC;
-	Rprintf("%.3f\t%.3f\n", dt1, dt2);
-	return;
+#define HEADTAIL_ENGINE_AUTO 0
+#define HEADTAIL_ENGINE_BRUTEFORCE 1
+#define HEADTAIL_ENGINE_BITMATRIX 2
+#define HEADTAIL_ENGINE_BITMATRIX_SCALAR 3
+
+static const char *headtail_engines[] = {
+	"auto", "bruteforce", "bitmatrix", "bitmatrix-scalar"
+};
+
+static int headtail_engine = HEADTAIL_ENGINE_AUTO;
+
+/* --- .Call ENTRY POINT ---
+ * Returns the previous setting. */
+SEXP set_headtail_engine(SEXP engine)
+{
+	const char *engine0;
+	int prev_engine, i;
+
+	prev_engine = headtail_engine;
+	engine0 = CHAR(STRING_ELT(engine, 0));
+	for (i = 0; i < 4; i++)
+		if (strcmp(engine0, headtail_engines[i]) == 0)
+			break;
+	if (i == 4)
+		error("invalid head/tail engine \"%s\"", engine0);
+	headtail_engine = i;
+	_BitMatrix_use_simd(i != HEADTAIL_ENGINE_BITMATRIX_SCALAR);
+	return mkString(headtail_engines[prev_engine]);
 }
-*/
 
 
 /*****************************************************************************
@@ -832,7 +924,9 @@ void _match_pdict_all_flanks(SEXP low2high,
 		total_NFC += NFC;
 */
 		if (headtail->ppheadtail.is_init
-		 && IntAE_get_nelt(tb_end_buf) >= 15) {
+		 && headtail_engine != HEADTAIL_ENGINE_BRUTEFORCE
+		 && (headtail_engine != HEADTAIL_ENGINE_AUTO
+		  || IntAE_get_nelt(tb_end_buf) >= 15)) {
 			// Use the BitMatrix horse-power
 /*
 			Rprintf("_match_pdict_all_flanks(): "
@@ -847,65 +941,12 @@ void _match_pdict_all_flanks(SEXP low2high,
 			match_ppheadtail(headtail, S, tb_end_buf,
 				max_nmis, min_nmis, bytewise_match_table,
 				matchpdict_buf);
-/*
-			BENCHMARK_match_ppheadtail(headtail, S, tb_end_buf,
-				max_nmis, min_nmis, bytewise_match_table,
-				matchpdict_buf);
-*/
 		} else {
 			// Use brute force
 			match_headtail_by_key(headtail, S, tb_end_buf,
 				max_nmis, min_nmis, bytewise_match_table,
 				matchpdict_buf);
 		}
-
-/*
-BENCHMARK
-=========
-Uncomment below (and comment out the use of brute force above), reinstall
-and use with the following code:
-
-library(BSgenome.Dmelanogaster.UCSC.dm3)
-chr3R <- unmasked(Dmelanogaster$chr3R)
-chr3R_50000 <- subseq(chr3R, end=50000)
-
-library(drosophila2probe)
-dict0 <- DNAStringSet(drosophila2probe$sequence, end=12)
-pdict6 <- PDict(dict0, tb.start=4, tb.end=9)
-
-mi6 <- matchPDict(pdict6, chr3R_50000, max.mismatch=1)
-sum(elementNROWS(mi6))  # 17896
-
-		if (headtail->ppheadtail.is_init
-		 && IntAE_get_nelt(tb_end_buf) >= 40) {
-			clock_t time0;
-			double dt1, dt2;
-			int j;
-
-			time0 = clock();
-			for (j = 0; j < 5000; j++)
-				match_ppheadtail(headtail, S, tb_end_buf,
-					max_nmis, min_nmis,
-					bytewise_match_table,
-					matchpdict_buf);
-			dt1 = (double) (clock() - time0) / CLOCKS_PER_SEC;
-			time0 = clock();
-			for (j = 0; j < 5000; j++)
-				match_headtail_by_key(headtail, S, tb_end_buf,
-					max_nmis, min_nmis,
-					bytewise_match_table,
-					matchpdict_buf);
-			dt2 = (double) (clock() - time0) / CLOCKS_PER_SEC;
-			if (dt1 > dt2) {
-				Rprintf("_match_pdict_all_flanks(): "
-					"IntAE_get_nelt(headtail->grouped_keys)=%d "
-					"tb_end_buf->nelt=%d\n",
-					IntAE_get_nelt(headtail->grouped_keys),
-					IntAE_get_nelt(tb_end_buf));
-				Rprintf("  --> dt1=%.3f dt2=%.3f\n", dt1, dt2);
-			}
-		}
-*/
 	}
 	//Rprintf("_match_pdict_all_flanks(): "
 	//	"total_NFC=%lu subtotal_NFC=%lu ratio=%.2f\n",
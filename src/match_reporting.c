@@ -6,6 +6,10 @@
 #include "IRanges_interface.h"
 #include "S4Vectors_interface.h"
 
+#include <stdlib.h>  /* for realloc() and free() */
+#include <stdio.h>  /* for fopen(), fprintf() and fclose() */
+#include <string.h>  /* for memcpy() */
+
 
 int _get_match_storing_code(const char *ms_mode)
 {
@@ -38,18 +42,20 @@ int _get_match_storing_code(const char *ms_mode)
 MatchBuf _new_MatchBuf(int ms_code, int nPSpair)
 {
 	int count_only;
-	static MatchBuf match_buf;
+	MatchBuf match_buf;
 
 	if (ms_code != MATCHES_AS_NULL
 	 && ms_code != MATCHES_AS_WHICH
 	 && ms_code != MATCHES_AS_COUNTS
 	 && ms_code != MATCHES_AS_STARTS
 	 && ms_code != MATCHES_AS_ENDS
-	 && ms_code != MATCHES_AS_RANGES)
+	 && ms_code != MATCHES_AS_RANGES
+	 && ms_code != MATCHES_AS_COVERAGE)
 		error("Biostrings internal error in _new_MatchBuf(): ",
 		      "%d: unsupported match storing code", ms_code);
 	count_only = ms_code == MATCHES_AS_WHICH ||
-		     ms_code == MATCHES_AS_COUNTS;
+		     ms_code == MATCHES_AS_COUNTS ||
+		     ms_code == MATCHES_AS_COVERAGE;
 	match_buf.ms_code = ms_code;
 	match_buf.PSlink_ids = new_IntAE(0, 0, 0);
 	match_buf.match_counts = new_IntAE(nPSpair, nPSpair, 0);
@@ -61,9 +67,106 @@ MatchBuf _new_MatchBuf(int ms_code, int nPSpair)
 		match_buf.match_starts = new_IntAEAE(nPSpair, nPSpair);
 		match_buf.match_widths = new_IntAEAE(nPSpair, nPSpair);
 	}
+	if (ms_code == MATCHES_AS_COVERAGE)
+		match_buf.coverage = new_IntAE(0, 0, 0);
+	else
+		match_buf.coverage = NULL;
+	match_buf.coverage_first = 1;
+	match_buf.coverage_shift = 0;
+	match_buf.coverage_weights = NULL;
+	match_buf.sink = NULL;
 	return match_buf;
 }
 
+/*
+ * 'weights' must have 1 elt per PSpair and stay valid as long as
+ * 'match_buf' is in use. Only used in MATCHES_AS_COVERAGE mode.
+ */
+void _MatchBuf_set_coverage_weights(MatchBuf *match_buf, const int *weights)
+{
+	match_buf->coverage_weights = weights;
+	return;
+}
+
+/*
+ * Only used in MATCHES_AS_COVERAGE mode. 'view_offset' must be the offset
+ * of the view where the matches reported to 'match_buf' are found (their
+ * starts are relative to the view).
+ */
+void _MatchBuf_set_coverage_shift(MatchBuf *match_buf, int view_offset)
+{
+	match_buf->coverage_shift = view_offset;
+	return;
+}
+
+/* Makes sure 'coverage->elts' has room for 'nelt' elts. */
+static void reserve_coverage(IntAE *coverage, size_t nelt)
+{
+	size_t new_buflength;
+
+	if (nelt <= coverage->_buflength)
+		return;
+	new_buflength = increase_buflength(coverage->_buflength);
+	if (new_buflength < nelt)
+		new_buflength = nelt;
+	IntAE_extend(coverage, new_buflength);
+	return;
+}
+
+/*
+ * Makes sure the difference array has an elt for each position from 'from'
+ * to 'to'. The new elts are set to 0. Returns the index of the elt for
+ * 'from'.
+ */
+static int extend_coverage(MatchBuf *match_buf, int from, int to)
+{
+	IntAE *coverage;
+	size_t nelt, n;
+
+	coverage = match_buf->coverage;
+	nelt = IntAE_get_nelt(coverage);
+	if (nelt == 0) {
+		match_buf->coverage_first = from;
+	} else if (from < match_buf->coverage_first) {
+		n = match_buf->coverage_first - from;
+		reserve_coverage(coverage, nelt + n);
+		memmove(coverage->elts + n, coverage->elts, sizeof(int) * nelt);
+		memset(coverage->elts, 0, sizeof(int) * n);
+		nelt += n;
+		IntAE_set_nelt(coverage, nelt);
+		match_buf->coverage_first = from;
+	}
+	n = to - match_buf->coverage_first + 1;
+	if (n > nelt) {
+		reserve_coverage(coverage, n);
+		memset(coverage->elts + nelt, 0, sizeof(int) * (n - nelt));
+		IntAE_set_nelt(coverage, n);
+	}
+	return from - match_buf->coverage_first;
+}
+
+/* The part of the match that is before the 1st position of the subject is
+   dropped. */
+static void add_match_to_coverage(MatchBuf *match_buf,
+		int PSpair_id, int start, int width)
+{
+	int end, weight, i;
+	IntAE *coverage;
+
+	end = start + width - 1;
+	if (start + match_buf->coverage_shift < 1)
+		start = 1 - match_buf->coverage_shift;
+	if (end < start)
+		return;
+	weight = match_buf->coverage_weights == NULL ?
+			1 : match_buf->coverage_weights[PSpair_id];
+	coverage = match_buf->coverage;
+	i = extend_coverage(match_buf, start, end + 1);
+	coverage->elts[i] += weight;
+	coverage->elts[i + end + 1 - start] -= weight;
+	return;
+}
+
 void _MatchBuf_report_match(MatchBuf *match_buf,
 		int PSpair_id, int start, int width)
 {
@@ -74,6 +177,11 @@ void _MatchBuf_report_match(MatchBuf *match_buf,
 	if (count_buf->elts[PSpair_id]++ == 0)
 		IntAE_insert_at(PSlink_ids,
 			IntAE_get_nelt(PSlink_ids), PSpair_id);
+	if (match_buf->sink != NULL) {
+		_MatchSink_report_match(match_buf->sink,
+					PSpair_id, start, width);
+		return;
+	}
 	if (match_buf->match_starts != NULL) {
 		start_buf = match_buf->match_starts->elts[PSpair_id];
 		IntAE_insert_at(start_buf, IntAE_get_nelt(start_buf), start);
@@ -82,6 +190,8 @@ void _MatchBuf_report_match(MatchBuf *match_buf,
 		width_buf = match_buf->match_widths->elts[PSpair_id];
 		IntAE_insert_at(width_buf, IntAE_get_nelt(width_buf), width);
 	}
+	if (match_buf->coverage != NULL)
+		add_match_to_coverage(match_buf, PSpair_id, start, width);
 	return;
 }
 
@@ -99,6 +209,8 @@ void _MatchBuf_flush(MatchBuf *match_buf)
 			IntAE_set_nelt(match_buf->match_widths->elts[PSlink_id], 0);
 	}
 	IntAE_set_nelt(match_buf->PSlink_ids, 0);
+	if (match_buf->coverage != NULL)
+		IntAE_set_nelt(match_buf->coverage, 0);
 	return;
 }
 
@@ -107,6 +219,8 @@ void _MatchBuf_append_and_flush(MatchBuf *match_buf1,
 {
 	int nelt, i, PSlink_id;
 	IntAE *start_buf1, *start_buf2, *width_buf1, *width_buf2;
+	IntAE *coverage1, *coverage2;
+	int i1;
 
 	if (match_buf1->ms_code == MATCHES_AS_NULL
 	 || match_buf2->ms_code == MATCHES_AS_NULL)
@@ -143,6 +257,20 @@ void _MatchBuf_append_and_flush(MatchBuf *match_buf1,
 				width_buf2->elts, IntAE_get_nelt(width_buf2));
 		}
 	}
+	if (match_buf1->coverage != NULL) {
+		/* The weights were already applied to 'match_buf2'. */
+		coverage1 = match_buf1->coverage;
+		coverage2 = match_buf2->coverage;
+		nelt = IntAE_get_nelt(coverage2);
+		if (nelt != 0) {
+			i1 = extend_coverage(match_buf1,
+				match_buf2->coverage_first + view_offset,
+				match_buf2->coverage_first + view_offset +
+					nelt - 1);
+			for (i = 0; i < nelt; i++)
+				coverage1->elts[i1 + i] += coverage2->elts[i];
+		}
+	}
 	_MatchBuf_flush(match_buf2);
 	return;
 }
@@ -211,6 +339,59 @@ static SEXP _MatchBuf_ends_toEnvir(const MatchBuf *match_buf, SEXP env)
 	return IntAEAE_toEnvir(match_buf->match_starts, env, 1);
 }
 
+/*
+ * Returns the runs of the coverage as the 2 components (values and lengths)
+ * of an ordinary list. The last run is the last run of non-zero coverage
+ * (the caller is expected to pad the coverage with zeros up to the length
+ * of the subject).
+ */
+SEXP _MatchBuf_coverage_asLIST(const MatchBuf *match_buf)
+{
+	const IntAE *coverage;
+	int nelt, nzero, nrun, i, cov, prev_cov, *values, *lengths;
+	SEXP ans, ans_values, ans_lengths;
+
+	if (match_buf->coverage == NULL)
+		error("Biostrings internal error: _MatchBuf_coverage_asLIST() "
+		      "was called in the wrong context");
+	coverage = match_buf->coverage;
+	/* The last elt of the difference array brings the coverage back to 0
+	   so we can ignore it. */
+	nelt = IntAE_get_nelt(coverage) - 1;
+	/* The positions before 'coverage_first' have a coverage of 0. */
+	nzero = nelt > 0 ? match_buf->coverage_first - 1 : 0;
+	nrun = nzero > 0 ? 1 : 0;
+	for (i = 0, cov = 0; i < nelt; i++) {
+		prev_cov = cov;
+		cov += coverage->elts[i];
+		if ((i == 0 && nzero == 0) || cov != prev_cov)
+			nrun++;
+	}
+	PROTECT(ans_values = NEW_INTEGER(nrun));
+	PROTECT(ans_lengths = NEW_INTEGER(nrun));
+	values = INTEGER(ans_values) - 1;
+	lengths = INTEGER(ans_lengths) - 1;
+	if (nzero > 0) {
+		*(++values) = 0;
+		*(++lengths) = nzero;
+	}
+	for (i = 0, cov = 0; i < nelt; i++) {
+		prev_cov = cov;
+		cov += coverage->elts[i];
+		if ((i == 0 && nzero == 0) || cov != prev_cov) {
+			*(++values) = cov;
+			*(++lengths) = 1;
+		} else {
+			(*lengths)++;
+		}
+	}
+	PROTECT(ans = NEW_LIST(2));
+	SET_VECTOR_ELT(ans, 0, ans_values);
+	SET_VECTOR_ELT(ans, 1, ans_lengths);
+	UNPROTECT(3);
+	return ans;
+}
+
 /*
  * Returns the result of _MatchBuf_starts_asLIST(match_buf) and
  * _MatchBuf_widths_asLIST(match_buf) as the 2 components of an ordinary list.
@@ -248,6 +429,8 @@ SEXP _MatchBuf_as_SEXP(const MatchBuf *match_buf, SEXP env)
 		return _MatchBuf_ends_asLIST(match_buf);
 	    case MATCHES_AS_RANGES:
 		return _MatchBuf_as_Ranges(match_buf);
+	    case MATCHES_AS_COVERAGE:
+		return _MatchBuf_coverage_asLIST(match_buf);
 	}
 	error("Biostrings internal error in _MatchBuf_as_SEXP(): "
 	      "unknown 'match_buf->ms_code' value %d", match_buf->ms_code);
@@ -256,82 +439,486 @@ SEXP _MatchBuf_as_SEXP(const MatchBuf *match_buf, SEXP env)
 
 
 /****************************************************************************
- * Internal match buffer instance with a simple API.
+ * MatchReporter manipulation.
  */
 
-static MatchBuf internal_match_buf;
-int active_PSpair_id;
-static int match_shift;
-
-void _init_match_reporting(const char *ms_mode, int nPSpair)
+MatchReporter _new_MatchReporter(const char *ms_mode, int nPSpair)
 {
-	int ms_code;
+	MatchReporter reporter;
+
+	reporter.match_buf = _new_MatchBuf(_get_match_storing_code(ms_mode),
+					   nPSpair);
+	reporter.active_PSpair_id = 0;
+	reporter.match_shift = 0;
+	reporter.deferred_matches = NULL;
+	return reporter;
+}
 
-	ms_code = _get_match_storing_code(ms_mode);
-	internal_match_buf = _new_MatchBuf(ms_code, nPSpair);
-	active_PSpair_id = 0;
-	match_shift = 0;
+void _MatchReporter_set_active_PSpair(MatchReporter *reporter, int PSpair_id)
+{
+	reporter->active_PSpair_id = PSpair_id;
 	return;
 }
 
-void _set_active_PSpair(int PSpair_id)
+void _MatchReporter_set_match_shift(MatchReporter *reporter, int shift)
 {
-	active_PSpair_id = PSpair_id;
+	reporter->match_shift = shift;
 	return;
 }
 
-void _set_match_shift(int shift)
+/*
+ * The matches reported to 'reporter' after this call are counted and sent
+ * to 'sink' (they are not stored in 'reporter'). 'reporter' should be
+ * created with the "MATCHES_AS_COUNTS" mode. Don't forget to call
+ * _MatchSink_flush() on 'sink' once the matchers are done.
+ */
+void _MatchReporter_set_sink(MatchReporter *reporter, MatchSink *sink)
 {
-	match_shift = shift;
+	reporter->match_buf.sink = sink;
+	return;
 }
 
-void _report_match(int start, int width)
+static void defer_match(DeferredMatches *deferred_matches,
+		int PSpair_id, int start, int width);
+
+void _MatchReporter_report_match(MatchReporter *reporter,
+		int start, int width)
 {
-	start += match_shift;
-	_MatchBuf_report_match(&internal_match_buf,
-			active_PSpair_id, start, width);
+	if (reporter->deferred_matches != NULL) {
+		defer_match(reporter->deferred_matches,
+			    reporter->active_PSpair_id,
+			    start + reporter->match_shift, width);
+		return;
+	}
+	_MatchBuf_report_match(&(reporter->match_buf),
+			reporter->active_PSpair_id,
+			start + reporter->match_shift, width);
 	return;
 }
 
 /* Drops reported matches for all PSpairs! */
-void _drop_reported_matches()
+void _MatchReporter_drop_reported_matches(MatchReporter *reporter)
 {
-	_MatchBuf_flush(&internal_match_buf);
+	_MatchBuf_flush(&(reporter->match_buf));
 	return;
 }
 
-int _get_match_count()
+int _MatchReporter_get_match_count(const MatchReporter *reporter)
 {
-	return internal_match_buf.match_counts->elts[active_PSpair_id];
+	return reporter->match_buf.match_counts->elts[
+					reporter->active_PSpair_id];
 }
 
-SEXP _reported_matches_asSEXP()
+/* Returns the matches reported for the active PSpair only. */
+SEXP _MatchReporter_reported_matches_asSEXP(const MatchReporter *reporter)
 {
+	const MatchBuf *match_buf;
+	int PSpair_id;
 	SEXP start, width, ans;
 
-	switch (internal_match_buf.ms_code) {
+	match_buf = &(reporter->match_buf);
+	PSpair_id = reporter->active_PSpair_id;
+	switch (match_buf->ms_code) {
 	    case MATCHES_AS_NULL:
 		return R_NilValue;
 	    case MATCHES_AS_COUNTS:
 	    case MATCHES_AS_WHICH:
-		return ScalarInteger(_get_match_count());
+		return ScalarInteger(_MatchReporter_get_match_count(reporter));
 	    case MATCHES_AS_RANGES:
 		PROTECT(start = new_INTEGER_from_IntAE(
-		  internal_match_buf.match_starts->elts[active_PSpair_id]));
+				match_buf->match_starts->elts[PSpair_id]));
 		PROTECT(width = new_INTEGER_from_IntAE(
-		  internal_match_buf.match_widths->elts[active_PSpair_id]));
+				match_buf->match_widths->elts[PSpair_id]));
 		PROTECT(ans = new_IRanges("IRanges", start, width, R_NilValue));
 		UNPROTECT(3);
 		return ans;
+	    case MATCHES_AS_COVERAGE:
+		/* The coverage is not split by PSpair. */
+		return _MatchBuf_coverage_asLIST(match_buf);
 	}
-	error("Biostrings internal error in _reported_matches_asSEXP(): "
-	      "invalid 'internal_match_buf.ms_code' value %d",
-	      internal_match_buf.ms_code);
+	error("Biostrings internal error in "
+	      "_MatchReporter_reported_matches_asSEXP(): "
+	      "invalid 'match_buf->ms_code' value %d", match_buf->ms_code);
 	return R_NilValue;
 }
 
-MatchBuf *_get_internal_match_buf()
+
+/****************************************************************************
+ * Deferred match reporting.
+ *
+ * A regular MatchReporter cannot be used in a worker thread because its
+ * MatchBuf is made of IntAE buffers. A worker thread must use a "deferring"
+ * MatchReporter instead. The matches reported to it are stored in a
+ * malloc-based DeferredMatches buffer without calling any function of the
+ * R API. Once the worker threads are done, the main thread replays the
+ * deferred matches into a regular MatchReporter.
+ * Only _MatchReporter_set_active_PSpair(), _MatchReporter_set_match_shift()
+ * and _MatchReporter_report_match() can be called on a deferring
+ * MatchReporter.
+ */
+
+void _init_DeferredMatches(DeferredMatches *deferred_matches, int ms_code)
+{
+	deferred_matches->ms_code = ms_code;
+	deferred_matches->PSpair_ids = NULL;
+	deferred_matches->starts = NULL;
+	deferred_matches->widths = NULL;
+	deferred_matches->nelt = deferred_matches->buflength = 0;
+	deferred_matches->malloc_failed = 0;
+	return;
+}
+
+void _free_DeferredMatches(DeferredMatches *deferred_matches)
+{
+	free(deferred_matches->PSpair_ids);
+	free(deferred_matches->starts);
+	free(deferred_matches->widths);
+	_init_DeferredMatches(deferred_matches, deferred_matches->ms_code);
+	return;
+}
+
+static int *realloc_ints(int *x, size_t new_buflength, int *malloc_failed)
+{
+	int *new_x;
+
+	new_x = (int *) realloc(x, sizeof(int) * new_buflength);
+	if (new_x == NULL) {
+		*malloc_failed = 1;
+		return x;
+	}
+	return new_x;
+}
+
+/* Must NOT call any function of the R API. */
+static void defer_match(DeferredMatches *deferred_matches,
+		int PSpair_id, int start, int width)
+{
+	size_t new_buflength;
+	int with_ranges;
+
+	if (deferred_matches->ms_code == MATCHES_AS_NULL
+	 || deferred_matches->malloc_failed)
+		return;
+	with_ranges = deferred_matches->ms_code != MATCHES_AS_WHICH &&
+		      deferred_matches->ms_code != MATCHES_AS_COUNTS;
+	if (deferred_matches->nelt == deferred_matches->buflength) {
+		new_buflength = deferred_matches->buflength == 0 ?
+				1024 : 2 * deferred_matches->buflength;
+		deferred_matches->PSpair_ids = realloc_ints(
+				deferred_matches->PSpair_ids, new_buflength,
+				&(deferred_matches->malloc_failed));
+		if (with_ranges) {
+			deferred_matches->starts = realloc_ints(
+				deferred_matches->starts, new_buflength,
+				&(deferred_matches->malloc_failed));
+			deferred_matches->widths = realloc_ints(
+				deferred_matches->widths, new_buflength,
+				&(deferred_matches->malloc_failed));
+		}
+		if (deferred_matches->malloc_failed)
+			return;
+		deferred_matches->buflength = new_buflength;
+	}
+	deferred_matches->PSpair_ids[deferred_matches->nelt] = PSpair_id;
+	if (with_ranges) {
+		deferred_matches->starts[deferred_matches->nelt] = start;
+		deferred_matches->widths[deferred_matches->nelt] = width;
+	}
+	deferred_matches->nelt++;
+	return;
+}
+
+MatchReporter _new_deferring_MatchReporter(DeferredMatches *deferred_matches)
+{
+	MatchReporter reporter;
+
+	reporter.match_buf.ms_code = deferred_matches->ms_code;
+	reporter.match_buf.PSlink_ids = NULL;
+	reporter.match_buf.match_counts = NULL;
+	reporter.match_buf.match_starts = NULL;
+	reporter.match_buf.match_widths = NULL;
+	reporter.match_buf.coverage = NULL;
+	reporter.match_buf.coverage_weights = NULL;
+	reporter.match_buf.sink = NULL;
+	reporter.active_PSpair_id = 0;
+	reporter.match_shift = 0;
+	reporter.deferred_matches = deferred_matches;
+	return reporter;
+}
+
+static void free_DeferredMatches_array(DeferredMatches *deferred_matches,
+		int n)
+{
+	int k;
+
+	for (k = 0; k < n; k++)
+		_free_DeferredMatches(deferred_matches + k);
+	return;
+}
+
+/*
+ * Reports the matches deferred to the 'n' buffers in 'deferred_matches' to
+ * 'reporter' (must be a regular MatchReporter), buffer after buffer and in
+ * the order they were deferred, and frees the buffers. Reporting a match
+ * can raise an error, so the matches are first moved to R_alloc'ed memory
+ * and the malloc-based buffers are freed before the first match is
+ * reported. Note that the shift was already added to the starts so the
+ * current shift of 'reporter' is ignored.
+ */
+void _MatchReporter_report_DeferredMatches(MatchReporter *reporter,
+		DeferredMatches *deferred_matches, int n)
+{
+	size_t nmatch, i;
+	int k, with_ranges, *PSpair_ids, *starts, *widths;
+	const DeferredMatches *dm;
+
+	nmatch = 0;
+	with_ranges = 0;
+	for (k = 0; k < n; k++) {
+		dm = deferred_matches + k;
+		if (dm->malloc_failed) {
+			free_DeferredMatches_array(deferred_matches, n);
+			error("failed to allocate memory for the deferred "
+			      "matches");
+		}
+		nmatch += dm->nelt;
+		with_ranges = with_ranges || dm->starts != NULL;
+	}
+	PSpair_ids = starts = widths = NULL;
+	if (nmatch != 0) {
+		PSpair_ids = (int *) R_alloc(nmatch, sizeof(int));
+		if (with_ranges) {
+			starts = (int *) R_alloc(nmatch, sizeof(int));
+			widths = (int *) R_alloc(nmatch, sizeof(int));
+		}
+	}
+	for (k = 0, i = 0; k < n; k++) {
+		dm = deferred_matches + k;
+		if (dm->nelt == 0)
+			continue;
+		memcpy(PSpair_ids + i, dm->PSpair_ids, sizeof(int) * dm->nelt);
+		if (with_ranges) {
+			memcpy(starts + i, dm->starts, sizeof(int) * dm->nelt);
+			memcpy(widths + i, dm->widths, sizeof(int) * dm->nelt);
+		}
+		i += dm->nelt;
+	}
+	free_DeferredMatches_array(deferred_matches, n);
+	for (i = 0; i < nmatch; i++)
+		_MatchBuf_report_match(&(reporter->match_buf), PSpair_ids[i],
+				       with_ranges ? starts[i] : 0,
+				       with_ranges ? widths[i] : 0);
+	return;
+}
+
+
+/****************************************************************************
+ * Streaming match sinks.
+ *
+ * A MatchSink is attached to a MatchBuf (or MatchReporter) when the number
+ * of matches can be too big for them to be stored. The matches are put in
+ * a fixed-size batch that is passed to a consumer function every time it's
+ * full. The batch buffers are allocated with R_alloc() so a MatchSink can
+ * only be used during a .Call and NOT in a worker thread (but the matches
+ * deferred by a worker thread can be replayed into a MatchReporter with a
+ * sink).
+ */
+
+MatchSink _new_MatchSink(MatchSinkFUN FUN, void *sink_data, int batch_size)
+{
+	MatchSink sink;
+
+	if (batch_size == NA_INTEGER || batch_size <= 0)
+		error("the batch size must be a single positive integer");
+	sink.FUN = FUN;
+	sink.sink_data = sink_data;
+	sink.batch_size = batch_size;
+	sink.PSpair_ids = (int *) R_alloc((long) batch_size, sizeof(int));
+	sink.starts = (int *) R_alloc((long) batch_size, sizeof(int));
+	sink.widths = (int *) R_alloc((long) batch_size, sizeof(int));
+	sink.nmatch = 0;
+	sink.match_shift = 0;
+	return sink;
+}
+
+void _MatchSink_set_match_shift(MatchSink *sink, int shift)
+{
+	sink->match_shift = shift;
+	return;
+}
+
+void _MatchSink_report_match(MatchSink *sink,
+		int PSpair_id, int start, int width)
+{
+	if (sink->nmatch == sink->batch_size)
+		_MatchSink_flush(sink);
+	sink->PSpair_ids[sink->nmatch] = PSpair_id;
+	sink->starts[sink->nmatch] = start + sink->match_shift;
+	sink->widths[sink->nmatch] = width;
+	sink->nmatch++;
+	return;
+}
+
+/* Passes the current batch (if not empty) to the consumer. */
+void _MatchSink_flush(MatchSink *sink)
+{
+	int nmatch;
+
+	nmatch = sink->nmatch;
+	if (nmatch == 0)
+		return;
+	/* Reset the batch first: the consumer can raise an error. */
+	sink->nmatch = 0;
+	sink->FUN(sink->sink_data,
+		  sink->PSpair_ids, sink->starts, sink->widths, nmatch);
+	return;
+}
+
+/* Consumer that calls an R function on each batch. The function is called
+   with 3 integer vectors: the 1-based PSpair ids, the starts and the widths
+   of the matches. */
+static void call_R_function(void *sink_data, const int *PSpair_ids,
+		const int *starts, const int *widths, int nmatch)
 {
-	return &internal_match_buf;
+	SEXP ids, start, width, call;
+	int i;
+
+	PROTECT(ids = NEW_INTEGER(nmatch));
+	for (i = 0; i < nmatch; i++)
+		INTEGER(ids)[i] = PSpair_ids[i] + 1;
+	PROTECT(start = NEW_INTEGER(nmatch));
+	memcpy(INTEGER(start), starts, sizeof(int) * nmatch);
+	PROTECT(width = NEW_INTEGER(nmatch));
+	memcpy(INTEGER(width), widths, sizeof(int) * nmatch);
+	PROTECT(call = lang4((SEXP) sink_data, ids, start, width));
+	eval(call, R_GlobalEnv);
+	UNPROTECT(4);
+	return;
 }
 
+typedef struct bed_file {
+	const char *path;
+	const char *seqname;
+	int seqlength;
+	SEXP names;  /* NULL or character vector with 1 name per PSpair */
+} BEDFile;
+
+/* Consumer that appends each batch to a BED file (1 line per match, the
+   name is the name of the PSpair or its 1-based id). The file is opened
+   and closed for each batch so it's always closed if an error occurs
+   during the search. A BED interval must be within the sequence so the
+   parts of a match that are before its 1st position or after its last
+   position are dropped (and so is the match if nothing is left). */
+static void append_to_BED_file(void *sink_data, const int *PSpair_ids,
+		const int *starts, const int *widths, int nmatch)
+{
+	const BEDFile *bed_file;
+	FILE *file;
+	int i, start0, end;
+	SEXP name;
+
+	bed_file = (const BEDFile *) sink_data;
+	file = fopen(bed_file->path, "a");
+	if (file == NULL)
+		error("cannot open file '%s'", bed_file->path);
+	for (i = 0; i < nmatch; i++) {
+		start0 = starts[i] - 1;
+		end = starts[i] + widths[i] - 1;
+		if (start0 < 0)
+			start0 = 0;
+		if (end > bed_file->seqlength)
+			end = bed_file->seqlength;
+		if (end <= start0)
+			continue;
+		fprintf(file, "%s\t%d\t%d\t", bed_file->seqname, start0, end);
+		if (bed_file->names != R_NilValue
+		 && (name = STRING_ELT(bed_file->names, PSpair_ids[i]))
+		    != NA_STRING)
+			fprintf(file, "%s\n", CHAR(name));
+		else
+			fprintf(file, "%d\n", PSpair_ids[i] + 1);
+	}
+	if (fclose(file) != 0)
+		error("failed to write to file '%s'", bed_file->path);
+	return;
+}
+
+/*
+ * 'sink' must be an R function or the path to a BED file (single string)
+ * and 'batch_size' a single integer. 'seqname' (single string), 'seqlength'
+ * (the length of the subject) and 'names' (NULL or character vector) are
+ * only used for a BED file.
+ */
+MatchSink _new_MatchSink_from_SEXP(SEXP sink, SEXP batch_size,
+		SEXP seqname, int seqlength, SEXP names)
+{
+	BEDFile *bed_file;
+
+	if (isFunction(sink))
+		return _new_MatchSink(call_R_function, (void *) sink,
+				      INTEGER(batch_size)[0]);
+	bed_file = (BEDFile *) R_alloc(1, sizeof(BEDFile));
+	bed_file->path = CHAR(STRING_ELT(sink, 0));
+	bed_file->seqname = CHAR(STRING_ELT(seqname, 0));
+	bed_file->seqlength = seqlength;
+	bed_file->names = names;
+	return _new_MatchSink(append_to_BED_file, (void *) bed_file,
+			      INTEGER(batch_size)[0]);
+}
+
+
+/****************************************************************************
+ * Internal MatchReporter instance with a simple API.
+ *
+ * Kept for backward compatibility with the C code (in Biostrings or in other
+ * packages) that doesn't pass a MatchReporter around. Because it's a global
+ * instance, only one matcher at a time can use this API.
+ */
+
+static MatchReporter internal_reporter;
+
+void _init_match_reporting(const char *ms_mode, int nPSpair)
+{
+	internal_reporter = _new_MatchReporter(ms_mode, nPSpair);
+	return;
+}
+
+void _set_active_PSpair(int PSpair_id)
+{
+	_MatchReporter_set_active_PSpair(&internal_reporter, PSpair_id);
+	return;
+}
+
+void _set_match_shift(int shift)
+{
+	_MatchReporter_set_match_shift(&internal_reporter, shift);
+	return;
+}
+
+void _report_match(int start, int width)
+{
+	_MatchReporter_report_match(&internal_reporter, start, width);
+	return;
+}
+
+/* Drops reported matches for all PSpairs! */
+void _drop_reported_matches()
+{
+	_MatchReporter_drop_reported_matches(&internal_reporter);
+	return;
+}
+
+int _get_match_count()
+{
+	return _MatchReporter_get_match_count(&internal_reporter);
+}
+
+SEXP _reported_matches_asSEXP()
+{
+	return _MatchReporter_reported_matches_asSEXP(&internal_reporter);
+}
+
+MatchReporter *_get_internal_match_reporter()
+{
+	return &internal_reporter;
+}
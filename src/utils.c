@@ -1,5 +1,9 @@
 #include "Biostrings.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 
 void _init_ByteTrTable_with_lkup(ByteTrTable *byte_tr_table, SEXP lkup)
 {
@@ -174,3 +178,88 @@ int _get_twobit_signature_at(TwobitEncodingBuffer *teb, const Chars_holder *seq,
 	return twobit_sign;
 }
 
+
+
+/****************************************************************************
+ * Number of threads used by the multi-threaded matching code.
+ *
+ * This is a package-wide setting (1 by default) that is controlled at the
+ * R level with setBiostringsThreads(). Note that _get_nthreads() always
+ * returns 1 if Biostrings was compiled without OpenMP support.
+ */
+
+static int nthreads = 1;
+
+int _get_nthreads()
+{
+#ifdef _OPENMP
+	return nthreads;
+#else
+	return 1;
+#endif
+}
+
+/* --- .Call ENTRY POINT --- */
+SEXP get_nthreads()
+{
+	return ScalarInteger(_get_nthreads());
+}
+
+/* --- .Call ENTRY POINT ---
+ * Returns the previous setting.
+ */
+SEXP set_nthreads(SEXP n)
+{
+	int prev_nthreads, n0;
+
+	prev_nthreads = _get_nthreads();
+	n0 = INTEGER(n)[0];
+	if (n0 == NA_INTEGER || n0 < 1)
+		error("the number of threads must be a single integer >= 1");
+#ifdef _OPENMP
+	if (n0 > omp_get_num_procs())
+		n0 = omp_get_num_procs();
+#endif
+	nthreads = n0;
+	return ScalarInteger(prev_nthreads);
+}
+
+
+
+/****************************************************************************
+ * Memory limit for the traceback matrices of pairwiseAlignment().
+ *
+ * This is a package-wide setting (in bytes, 1 GiB by default) that is
+ * controlled at the R level with setTracebackMemoryLimit(). The alignments
+ * whose traceback matrices would need more memory than that are traced
+ * back in linear space.
+ */
+
+static double traceback_memory_limit = 1073741824.0;
+
+double _get_traceback_memory_limit()
+{
+	return traceback_memory_limit;
+}
+
+/* --- .Call ENTRY POINT --- */
+SEXP get_traceback_memory_limit()
+{
+	return ScalarReal(traceback_memory_limit);
+}
+
+/* --- .Call ENTRY POINT ---
+ * Returns the previous setting.
+ */
+SEXP set_traceback_memory_limit(SEXP limit)
+{
+	double prev_limit, limit0;
+
+	prev_limit = traceback_memory_limit;
+	limit0 = REAL(limit)[0];
+	if (ISNAN(limit0) || limit0 < 0)
+		error("the traceback memory limit must be "
+		      "a single non-negative number");
+	traceback_memory_limit = limit0;
+	return ScalarReal(prev_limit);
+}